@@ -0,0 +1,564 @@
+// フリートゲートウェイ：複数の制御ボードを1つのAPIにまとめる
+//
+// インベントリ（inventory.h）に書いたボードをそれぞれ専用スレッドで定期的にポーリングし、
+// 状態をメモリ上にキャッシュする。/api/status はキャッシュだけから返すので、ボードの台数や
+// 応答の遅さに関係なくすぐ返る。電源操作はホスト名からボードとチャンネルを引いて転送し、
+// 一括操作はボードごとに並列で送る（ボードへの同時接続数は connections= で制限）。
+// ボードへの転送はボードごとのスレッド（connections= 本）で行い、HTTPのI/Oスレッドは応答を保留して
+// すぐ次の接続へ戻る（HttpResponse::deferred）。遅いボードが待たせるのはそのボードへの操作だけになる。
+//
+// ビルド（リポジトリのルートで）：
+//   g++ -std=c++17 -O2 -I./shared -I./simulator -o fleet_gateway gateway/fleet_gateway.cpp -lpthread
+//
+// 例：
+//   ./fleet_gateway --inventory gateway/fleet.example.conf --port 8090
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "json_writer.h"
+#include "router.h"
+#include "http_server.h"
+#include "http_client.h"
+#include "inventory.h"
+#include "json_scan.h"
+
+namespace {
+
+uint64_t nowMs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ボードへの操作を実行するスレッド群。スレッド数を接続プールと同じにして、
+// 実行中の操作が接続の空きを待たないようにする
+class BoardExecutor {
+public:
+    void start(int threads) {
+        for (int i = 0; i < threads; i++) std::thread([this] { run(); }).detach();
+    }
+
+    void post(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push_back(std::move(job));
+        }
+        cv_.notify_one();
+    }
+
+private:
+    void run() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return !jobs_.empty(); });
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> jobs_;
+};
+
+// ボード1台分：接続プールと、ポーリングで得た状態のキャッシュ
+struct Board {
+    BoardConfig config;
+    std::unique_ptr<HttpClientPool> pool;
+    BoardExecutor executor;  // 電源操作の転送（ポーリングは pollBoard のスレッド）
+
+    std::mutex mutex;  // 以下を保護する
+    bool online = false;
+    uint64_t updatedMs = 0;  // 最後に状態を取得できた時刻（0なら未取得）
+    std::string error;
+    std::vector<std::string> names;  // /api/info の pcNames（チャンネル数もこれで決まる）
+    std::vector<bool> states;
+    std::vector<bool> sensed;
+    uint64_t polls = 0;
+    uint64_t failures = 0;
+};
+
+// ホスト名 → ボードとチャンネル
+struct HostEntry {
+    std::string name;
+    int board;
+    int channel;
+};
+
+Inventory inventory;
+std::vector<std::unique_ptr<Board>> boards;
+int pollIntervalMs = 1000;
+
+// ホスト名の表（ボードからチャンネル名を取得するたびに作り直す）
+std::mutex directoryMutex;
+std::vector<HostEntry> directory;  // ボード順・チャンネル順
+std::unordered_map<std::string, size_t> directoryIndex;
+
+// 表を作り直す。名前の決め方：
+//   1. インベントリの host 行
+//   2. ボードが返す名前（フリート全体で一意で、host 行の名前と重ならない場合）
+//   3. それ以外は "ボード名:チャンネル"
+// "ボード名:チャンネル" はどのチャンネルにも常に使える（resolveHost）。
+void rebuildDirectory() {
+    std::vector<std::vector<std::string>> reported(boards.size());
+    for (size_t b = 0; b < boards.size(); b++) {
+        std::lock_guard<std::mutex> lock(boards[b]->mutex);
+        reported[b] = boards[b]->names;
+    }
+    std::map<std::pair<int, int>, std::string> assigned;
+    std::unordered_map<std::string, int> uses;
+    for (const HostConfig& host : inventory.hosts) {
+        assigned[{inventory.findBoard(host.board), host.channel}] = host.name;
+        uses[host.name] += 2;  // 報告された名前とは共有させない
+    }
+    for (size_t b = 0; b < reported.size(); b++) {
+        for (const std::string& name : reported[b]) uses[name]++;
+    }
+
+    std::vector<HostEntry> entries;
+    for (size_t b = 0; b < boards.size(); b++) {
+        int channels = (int)reported[b].size();
+        for (const auto& a : assigned) {
+            if (a.first.first == (int)b) channels = std::max(channels, a.first.second + 1);
+        }
+        for (int ch = 0; ch < channels; ch++) {
+            HostEntry entry;
+            entry.board = (int)b;
+            entry.channel = ch;
+            auto a = assigned.find({(int)b, ch});
+            if (a != assigned.end()) {
+                entry.name = a->second;
+            } else if (ch < (int)reported[b].size() && inventoryNameValid(reported[b][ch]) &&
+                       uses[reported[b][ch]] == 1) {
+                entry.name = reported[b][ch];
+            } else {
+                entry.name = boards[b]->config.name + ":" + std::to_string(ch);
+            }
+            entries.push_back(entry);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(directoryMutex);
+    directory.swap(entries);
+    directoryIndex.clear();
+    for (size_t i = 0; i < directory.size(); i++) directoryIndex[directory[i].name] = i;
+}
+
+// ホスト名（または "ボード名:チャンネル"）を引く
+bool resolveHost(const std::string& name, HostEntry& entry) {
+    {
+        std::lock_guard<std::mutex> lock(directoryMutex);
+        auto it = directoryIndex.find(name);
+        if (it != directoryIndex.end()) {
+            entry = directory[it->second];
+            return true;
+        }
+    }
+    size_t colon = name.rfind(':');
+    if (colon == std::string::npos) return false;
+    int b = inventory.findBoard(name.substr(0, colon));
+    char* end = nullptr;
+    long ch = strtol(name.c_str() + colon + 1, &end, 10);
+    if (b < 0 || colon + 1 == name.size() || *end != '\0' || ch < 0 || ch > INT16_MAX) return false;
+    // チャンネル数が分かっていればその範囲だけ（まだ分からなければボードに判定させる）
+    {
+        std::lock_guard<std::mutex> lock(boards[b]->mutex);
+        if (!boards[b]->names.empty() && ch >= (long)boards[b]->names.size()) return false;
+    }
+    entry.name = name;
+    entry.board = b;
+    entry.channel = (int)ch;
+    return true;
+}
+
+// ボードのポーリング（ボードごとのスレッド）
+void pollBoard(size_t index) {
+    Board& board = *boards[index];
+    for (;;) {
+        uint64_t started = nowMs();
+        HttpClientResponse response;
+        std::string error;
+        bool needNames;
+        {
+            std::lock_guard<std::mutex> lock(board.mutex);
+            needNames = board.names.empty();
+        }
+        // チャンネル数と名前は最初に1回だけ取る（ボードの設定は実行中に変わらない）
+        if (needNames) {
+            std::vector<std::string> names;
+            if (!board.pool->request("GET", "/api/info", response, error)) {
+                // error はそのまま
+            } else if (response.status != 200 || !jsonStringArray(response.body, "pcNames", names) || names.empty()) {
+                error = "unexpected /api/info response (HTTP " + std::to_string(response.status) + ")";
+            } else {
+                {
+                    std::lock_guard<std::mutex> lock(board.mutex);
+                    board.names = names;
+                }
+                rebuildDirectory();
+                std::cout << "[INFO] " << board.config.name << ": " << names.size() << " channels" << std::endl;
+            }
+        }
+
+        std::vector<uint64_t> stateBits, sensedBits;
+        bool ok = error.empty();
+        if (ok && !board.pool->request("GET", "/api/status", response, error)) {
+            ok = false;
+        } else if (ok && (response.status != 200 || !jsonNumberArray(response.body, "stateBits", stateBits) ||
+                          !jsonNumberArray(response.body, "sensedBits", sensedBits))) {
+            error = "unexpected /api/status response (HTTP " + std::to_string(response.status) + ")";
+            ok = false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(board.mutex);
+            board.polls++;
+            if (ok) {
+                if (!board.online) std::cout << "[INFO] " << board.config.name << " is online" << std::endl;
+                size_t n = board.names.size();
+                board.states.assign(n, false);
+                board.sensed.assign(n, false);
+                for (size_t ch = 0; ch < n; ch++) {
+                    size_t word = ch / 32;
+                    uint64_t bit = 1ULL << (ch % 32);
+                    board.states[ch] = word < stateBits.size() && (stateBits[word] & bit);
+                    board.sensed[ch] = word < sensedBits.size() && (sensedBits[word] & bit);
+                }
+                board.online = true;
+                board.updatedMs = nowMs();
+                board.error.clear();
+            } else {
+                if (board.online || board.polls == 1) {
+                    std::cout << "[WARN] " << board.config.name << " (" << board.config.host << ":"
+                              << board.config.port << "): " << error << std::endl;
+                }
+                board.online = false;
+                board.failures++;
+                board.error = error;
+            }
+        }
+
+        uint64_t elapsed = nowMs() - started;
+        if (elapsed < (uint64_t)pollIntervalMs) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(pollIntervalMs - elapsed));
+        }
+    }
+}
+
+HttpResponse createHttpResponse(int statusCode, const std::string& body) {
+    HttpResponse response;
+    response.status = statusCode;
+    response.contentType = "application/json";
+    response.body = body;
+    return response;
+}
+
+HttpResponse createJsonResponse(int statusCode, const JsonWriter& json) {
+    if (!json.ok()) return createHttpResponse(500, "{\"error\":\"Response too large\"}");
+    return createHttpResponse(statusCode, std::string(json.c_str(), json.length()));
+}
+
+// ボードの応答本文を埋め込む（JSONでなければ null）
+void writeBoardBody(JsonWriter& json, const std::string& body) {
+    if (!body.empty() && body[0] == '{') {
+        json.raw(body.c_str());
+    } else {
+        json.raw("null");
+    }
+}
+
+// 全ボード・全ホストの状態（キャッシュから返す）
+HttpResponse handleStatus(const HttpRequest&, const RouteParams&) {
+    std::vector<HostEntry> entries;
+    {
+        std::lock_guard<std::mutex> lock(directoryMutex);
+        entries = directory;
+    }
+    std::vector<char> buf(1024 + boards.size() * 256 + entries.size() * 160);
+    JsonWriter json(buf.data(), buf.size());
+    uint64_t now = nowMs();
+    json.beginObject().key("boards").beginArray();
+    for (const auto& board : boards) {
+        std::lock_guard<std::mutex> lock(board->mutex);
+        json.beginObject()
+            .field("name", board->config.name.c_str())
+            .field("address", board->config.host.c_str(), (":" + board->config.port).c_str())
+            .field("online", board->online)
+            .field("channels", (uint32_t)board->names.size())
+            .field("polls", board->polls)
+            .field("failures", board->failures);
+        if (board->updatedMs != 0) json.field("ageMs", now - board->updatedMs);
+        if (!board->error.empty()) json.field("error", board->error.c_str());
+        json.endObject();
+    }
+    json.endArray().key("hosts").beginArray();
+    for (const HostEntry& entry : entries) {
+        Board& board = *boards[entry.board];
+        std::lock_guard<std::mutex> lock(board.mutex);
+        bool known = entry.channel < (int)board.states.size();
+        // ポーリング3回分以上古い値は stale とする（値自体は最後に取得したもの）
+        bool stale = !known || now - board.updatedMs > (uint64_t)pollIntervalMs * 3;
+        json.beginObject()
+            .field("name", entry.name.c_str())
+            .field("board", board.config.name.c_str())
+            .field("channel", entry.channel);
+        if (known) {
+            json.field("state", (bool)board.states[entry.channel]).field("sensed", (bool)board.sensed[entry.channel]);
+        }
+        json.field("stale", stale).endObject();
+    }
+    json.endArray().endObject();
+    return createJsonResponse(200, json);
+}
+
+// 1台のPCへの操作をボードへ送る（ボードのスレッドで実行する。ボードのステータスコードをそのまま返す）
+HttpResponse sendCommand(const HostEntry& entry, const std::string& target) {
+    Board& board = *boards[entry.board];
+    HttpClientResponse response;
+    std::string error;
+    bool ok = board.pool->request("POST", target, response, error);
+
+    std::vector<char> buf(512 + response.body.size());
+    JsonWriter json(buf.data(), buf.size());
+    json.beginObject()
+        .field("host", entry.name.c_str())
+        .field("board", board.config.name.c_str())
+        .field("channel", entry.channel);
+    if (!ok) {
+        json.field("success", false).field("error", error.c_str()).endObject();
+        return createJsonResponse(502, json);
+    }
+    json.field("success", response.status >= 200 && response.status < 300)
+        .field("status", response.status)
+        .key("result");
+    writeBoardBody(json, response.body);
+    json.endObject();
+    return createJsonResponse(response.status, json);
+}
+
+// 1台のPCへの操作をボードへ転送する（送信はボードのスレッドで行い、応答は保留する）
+HttpResponse forwardCommand(const HttpRequest& request, const RouteParams& params, const char* boardPath) {
+    std::string name(request.path.substr((size_t)params[0], params.lengths[0]));
+    HostEntry entry;
+    if (!resolveHost(name, entry)) {
+        return createHttpResponse(404, "{\"success\":false,\"message\":\"Unknown host\"}");
+    }
+    std::string target = std::string(boardPath) + std::to_string(entry.channel);
+    HttpResponse deferred;
+    deferred.deferred = [entry, target](HttpReply reply) {
+        boards[entry.board]->executor.post([entry, target, reply] {
+            reply(sendCommand(entry, target));
+        });
+    };
+    return deferred;
+}
+
+HttpResponse handlePower(const HttpRequest& request, const RouteParams& params) {
+    return forwardCommand(request, params, "/api/power/");
+}
+
+HttpResponse handleLongPress(const HttpRequest& request, const RouteParams& params) {
+    return forwardCommand(request, params, "/api/longpress/");
+}
+
+// 一括操作のボード1台分
+struct BatchResult {
+    int board;
+    std::vector<HostEntry> hosts;
+    bool ok = false;
+    HttpClientResponse response;
+    std::string error;
+};
+
+// ボードへ /api/power/batch を送る（ボードのスレッドで実行する）
+void sendBatch(BatchResult& result, int requestedMax) {
+    Board& board = *boards[result.board];
+    int maxConcurrent = board.config.maxConcurrent;
+    if (requestedMax > 0 && (maxConcurrent <= 0 || requestedMax < maxConcurrent)) maxConcurrent = requestedMax;
+    std::string target = "/api/power/batch?channels=";
+    for (size_t i = 0; i < result.hosts.size(); i++) {
+        if (i > 0) target += ',';
+        target += std::to_string(result.hosts[i].channel);
+    }
+    if (maxConcurrent > 0) target += "&max=" + std::to_string(maxConcurrent);
+    result.ok = board.pool->request("POST", target, result.response, result.error);
+}
+
+HttpResponse batchResponse(const std::vector<BatchResult>& results) {
+    size_t bodies = 0;
+    for (const BatchResult& result : results) bodies += result.response.body.size() + result.hosts.size() * 64;
+    std::vector<char> buf(512 + bodies + results.size() * 256);
+    JsonWriter json(buf.data(), buf.size());
+    int succeeded = 0;
+    json.beginObject().key("boards").beginArray();
+    for (const BatchResult& result : results) {
+        bool success = result.ok && result.response.status >= 200 && result.response.status < 300;
+        if (success) succeeded++;
+        json.beginObject().field("board", boards[result.board]->config.name.c_str()).key("hosts").beginArray();
+        for (const HostEntry& entry : result.hosts) json.value(entry.name.c_str());
+        json.endArray().field("success", success);
+        if (!result.ok) {
+            json.field("error", result.error.c_str());
+        } else {
+            json.field("status", result.response.status).key("result");
+            writeBoardBody(json, result.response.body);
+        }
+        json.endObject();
+    }
+    json.endArray().endObject();
+    // 全ボード成功なら202、全滅なら502、一部だけなら207
+    int status = succeeded == (int)results.size() ? 202 : succeeded == 0 ? 502 : 207;
+    return createJsonResponse(status, json);
+}
+
+// 複数PCの一括操作（?hosts=a,b,c[&max=N]）
+// ボードごとにまとめて /api/power/batch を各ボードのスレッドから並列に送る。max はボードごとの
+// 同時押し台数の上限で、インベントリの max= より緩くはできない
+HttpResponse handlePowerBatch(const HttpRequest& request, const RouteParams&) {
+    std::string list;
+    if (!request.param("hosts", list) || list.empty()) {
+        return createHttpResponse(400, "{\"success\":false,\"message\":\"hosts is required\"}");
+    }
+    int requestedMax = 0;
+    std::string value;
+    if (request.param("max", value)) requestedMax = atoi(value.c_str());
+
+    // ボードごとのチャンネル（不明なホストがあれば何も押さない）
+    std::map<int, std::vector<HostEntry>> byBoard;
+    for (size_t pos = 0; pos <= list.size();) {
+        size_t comma = list.find(',', pos);
+        if (comma == std::string::npos) comma = list.size();
+        std::string name = list.substr(pos, comma - pos);
+        pos = comma + 1;
+        if (name.empty()) continue;
+        HostEntry entry;
+        if (!resolveHost(name, entry)) {
+            std::string body = "{\"success\":false,\"message\":\"Unknown host\",\"host\":\"";
+            for (char c : name) {
+                if (c != '"' && c != '\\' && (unsigned char)c >= 0x20) body += c;
+            }
+            return createHttpResponse(404, body + "\"}");
+        }
+        byBoard[entry.board].push_back(entry);
+    }
+
+    // ボードごとの結果。各ボードのスレッドが自分の分を埋め、最後に終わったスレッドが応答を返す
+    struct Batch {
+        std::vector<BatchResult> results;
+        std::atomic<size_t> remaining{0};
+    };
+    std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+    for (auto& group : byBoard) {
+        BatchResult result;
+        result.board = group.first;
+        result.hosts = group.second;
+        batch->results.push_back(result);
+    }
+    batch->remaining = batch->results.size();
+
+    HttpResponse deferred;
+    deferred.deferred = [batch, requestedMax](HttpReply reply) {
+        for (size_t i = 0; i < batch->results.size(); i++) {
+            boards[batch->results[i].board]->executor.post([batch, i, requestedMax, reply] {
+                sendBatch(batch->results[i], requestedMax);
+                if (--batch->remaining == 0) reply(batchResponse(batch->results));
+            });
+        }
+    };
+    return deferred;
+}
+
+typedef HttpResponse (*GatewayRouteHandler)(const HttpRequest& request, const RouteParams& params);
+
+constexpr RouteEntry<GatewayRouteHandler> API_ROUTES[] = {
+    {HttpMethod::Get,  "/api/status",        Route::Status,     handleStatus},
+    {HttpMethod::Post, "/api/power/batch",   Route::PowerBatch, handlePowerBatch},
+    {HttpMethod::Post, "/api/power/{s}",     Route::Power,      handlePower},
+    {HttpMethod::Post, "/api/longpress/{s}", Route::LongPress,  handleLongPress},
+};
+static_assert(routeTableValid(API_ROUTES), "API_ROUTES has a malformed pattern");
+
+HttpResponse handleRequest(const HttpRequest& request) {
+    RouteParams params;
+    const RouteEntry<GatewayRouteHandler>* route =
+        matchRoute(API_ROUTES, parseHttpMethod(request.method.data(), request.method.size()), request.path.data(), request.path.size(), params);
+    if (!route) return createHttpResponse(404, "{\"error\":\"Not found\"}");
+    return route->handler(request, params);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const char* inventoryPath = nullptr;
+    int port = 8090;
+    int workers = 4;
+    int timeoutMs = 2000;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--inventory" && i + 1 < argc) {
+            inventoryPath = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (arg == "--workers" && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (arg == "--poll-ms" && i + 1 < argc) {
+            pollIntervalMs = std::max(50, atoi(argv[++i]));
+        } else if (arg == "--timeout-ms" && i + 1 < argc) {
+            timeoutMs = std::max(100, atoi(argv[++i]));
+        } else {
+            inventoryPath = nullptr;
+            break;
+        }
+    }
+    if (!inventoryPath) {
+        std::cerr << "Usage: " << argv[0]
+                  << " --inventory PATH [--port N] [--workers N] [--poll-ms N] [--timeout-ms N]" << std::endl;
+        return 1;
+    }
+    std::string error;
+    if (!loadInventory(inventoryPath, inventory, error)) {
+        std::cerr << "Invalid inventory: " << error << std::endl;
+        return 1;
+    }
+
+    for (const BoardConfig& config : inventory.boards) {
+        std::unique_ptr<Board> board(new Board());
+        board->config = config;
+        board->pool.reset(new HttpClientPool(config.host, config.port, config.connections, timeoutMs));
+        boards.push_back(std::move(board));
+    }
+    rebuildDirectory();
+
+    HttpServer server(handleRequest);
+    if (!server.listen((uint16_t)port, 128)) {
+        std::cerr << "Error binding socket: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    for (size_t i = 0; i < boards.size(); i++) {
+        boards[i]->executor.start(boards[i]->config.connections);
+        std::thread(pollBoard, i).detach();
+    }
+    std::cout << "[INFO] Fleet gateway on port " << port << ": " << boards.size() << " boards, "
+              << inventory.hosts.size() << " named hosts, polling every " << pollIntervalMs << "ms" << std::endl;
+    server.run(workers);
+    return 0;
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cctype>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+// ボードへのHTTP/1.1クライアント（ブロッキング、キープアライブ）
+//
+// 1つの HttpClient は1本の接続を持ち、1度に1要求だけ送る。再利用した接続が応答の前に閉じられていたら
+// （ボード側のキープアライブ切れ）、張り直して1回だけ再送する。タイムアウトでは再送しない（二重に押さないため）。
+
+struct HttpClientResponse {
+    int status = 0;
+    std::string body;
+};
+
+class HttpClient {
+public:
+    HttpClient(const std::string& host, const std::string& port, int timeoutMs)
+        : host_(host), port_(port), timeoutMs_(timeoutMs) {}
+
+    ~HttpClient() { disconnect(); }
+
+    HttpClient(const HttpClient&) = delete;
+    HttpClient& operator=(const HttpClient&) = delete;
+
+    // 失敗したら false と error
+    bool request(const char* method, const std::string& target, HttpClientResponse& response, std::string& error) {
+        bool reused = fd_ >= 0;
+        stale_ = false;
+        if (attempt(method, target, response, error)) return true;
+        disconnect();
+        if (!reused || !stale_) return false;
+        if (attempt(method, target, response, error)) return true;
+        disconnect();
+        return false;
+    }
+
+private:
+    bool attempt(const char* method, const std::string& target, HttpClientResponse& response, std::string& error) {
+        deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs_);
+        if (fd_ < 0 && !connectTo(error)) return false;
+
+        std::string out = std::string(method) + " " + target + " HTTP/1.1\r\nHost: " + host_ + "\r\n";
+        if (strcmp(method, "GET") != 0) out += "Content-Length: 0\r\n";
+        out += "\r\n";
+        size_t off = 0;
+        while (off < out.size()) {
+            if (!waitFor(POLLOUT, error)) return false;
+            ssize_t n = send(fd_, out.data() + off, out.size() - off, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EINTR) continue;
+                stale_ = errno == EPIPE || errno == ECONNRESET;
+                error = strerror(errno);
+                return false;
+            }
+            off += (size_t)n;
+        }
+        return readResponse(response, error);
+    }
+
+    bool connectTo(std::string& error) {
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addr = nullptr;
+        int rc = getaddrinfo(host_.c_str(), port_.c_str(), &hints, &addr);
+        if (rc != 0) {
+            error = gai_strerror(rc);
+            return false;
+        }
+        fd_ = socket(addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd_ < 0) {
+            error = strerror(errno);
+            freeaddrinfo(addr);
+            return false;
+        }
+        int one = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        rc = connect(fd_, addr->ai_addr, addr->ai_addrlen);
+        freeaddrinfo(addr);
+        if (rc < 0 && errno != EINPROGRESS) {
+            error = strerror(errno);
+            return false;
+        }
+        if (!waitFor(POLLOUT, error)) return false;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            error = strerror(err);
+            return false;
+        }
+        return true;
+    }
+
+    bool waitFor(short events, std::string& error) {
+        for (;;) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline_ - std::chrono::steady_clock::now());
+            if (left.count() <= 0) {
+                error = "timeout";
+                return false;
+            }
+            struct pollfd p = {fd_, events, 0};
+            int rc = poll(&p, 1, (int)left.count());
+            if (rc > 0) return true;
+            if (rc < 0 && errno != EINTR) {
+                error = strerror(errno);
+                return false;
+            }
+        }
+    }
+
+    // ヘッダーと本文（Content-Length または chunked）を読む
+    bool readResponse(HttpClientResponse& response, std::string& error) {
+        std::string in;
+        size_t headerEnd = std::string::npos;
+        while ((headerEnd = in.find("\r\n\r\n")) == std::string::npos) {
+            if (!readMore(in, error)) return false;
+        }
+        if (in.compare(0, 5, "HTTP/") != 0 || in.size() < 12) {
+            error = "malformed response";
+            return false;
+        }
+        response.status = atoi(in.c_str() + 9);
+        std::string headers = in.substr(0, headerEnd + 2);
+        for (char& c : headers) c = (char)tolower((unsigned char)c);
+        bool close = headers.find("\r\nconnection: close\r\n") != std::string::npos;
+        size_t bodyStart = headerEnd + 4;
+
+        size_t cl = headers.find("\r\ncontent-length:");
+        if (cl != std::string::npos) {
+            size_t length = strtoul(headers.c_str() + cl + 17, nullptr, 10);
+            while (in.size() < bodyStart + length) {
+                if (!readMore(in, error)) return false;
+            }
+            response.body = in.substr(bodyStart, length);
+        } else if (headers.find("\r\ntransfer-encoding: chunked\r\n") != std::string::npos) {
+            response.body.clear();
+            size_t pos = bodyStart;
+            for (;;) {
+                size_t eol;
+                while ((eol = in.find("\r\n", pos)) == std::string::npos) {
+                    if (!readMore(in, error)) return false;
+                }
+                size_t size = strtoul(in.c_str() + pos, nullptr, 16);
+                while (in.size() < eol + 2 + size + 2) {
+                    if (!readMore(in, error)) return false;
+                }
+                if (size == 0) break;
+                response.body.append(in, eol + 2, size);
+                pos = eol + 2 + size + 2;
+            }
+        } else if (response.status == 204 || response.status == 304) {
+            response.body.clear();
+        } else {
+            // 長さの指定がなければ切断まで読む
+            while (readMore(in, error)) {
+            }
+            response.body = in.substr(bodyStart);
+            close = true;
+        }
+        if (close) disconnect();
+        return true;
+    }
+
+    bool readMore(std::string& in, std::string& error) {
+        char buf[4096];
+        for (;;) {
+            if (!waitFor(POLLIN, error)) return false;
+            ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+            if (n > 0) {
+                in.append(buf, (size_t)n);
+                return true;
+            }
+            if (n == 0) {
+                stale_ = in.empty();
+                error = "connection closed";
+                return false;
+            }
+            if (errno != EAGAIN && errno != EINTR) {
+                stale_ = in.empty() && errno == ECONNRESET;
+                error = strerror(errno);
+                return false;
+            }
+        }
+    }
+
+    void disconnect() {
+        if (fd_ >= 0) close(fd_);
+        fd_ = -1;
+    }
+
+    std::string host_;
+    std::string port_;
+    int timeoutMs_;
+    int fd_ = -1;
+    bool stale_ = false;  // 応答を1バイトも受け取る前に閉じられた
+    std::chrono::steady_clock::time_point deadline_;
+};
+
+// 1台のボードへの接続プール（同時に送る要求を size 本までに抑える。ESP32は同時接続数が少ない）
+class HttpClientPool {
+public:
+    HttpClientPool(const std::string& host, const std::string& port, int size, int timeoutMs) {
+        for (int i = 0; i < size; i++) {
+            clients_.emplace_back(new HttpClient(host, port, timeoutMs));
+            idle_.push_back(clients_.back().get());
+        }
+    }
+
+    bool request(const char* method, const std::string& target, HttpClientResponse& response, std::string& error) {
+        HttpClient* client;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            available_.wait(lock, [this] { return !idle_.empty(); });
+            client = idle_.back();
+            idle_.pop_back();
+        }
+        bool ok = client->request(method, target, response, error);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            idle_.push_back(client);
+        }
+        available_.notify_one();
+        return ok;
+    }
+
+private:
+    std::vector<std::unique_ptr<HttpClient>> clients_;
+    std::vector<HttpClient*> idle_;
+    std::mutex mutex_;
+    std::condition_variable available_;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// フリートゲートウェイのインベントリ（どのボードがどこにあり、どのPCがどのボードのどのチャンネルか）
+//
+// 1行1項目のテキスト。'#' 以降はコメント。
+//   board <ボード名> <ホスト>:<ポート> [max=<同時に押す台数>] [connections=<同時接続数>]
+//   host  <ホスト名> <ボード名> <チャンネル>
+//
+// max は一括操作でそのボードが同時に押す台数の上限（ボードの /api/power/batch の max に渡す、0なら
+// ボードの設定に従う）。connections はゲートウェイからそのボードへ同時に送る要求の上限（既定2）。
+// host 行のないチャンネルは、ボードが /api/info で返す名前（config.h の PC_NAMES）で呼べる。
+
+struct BoardConfig {
+    std::string name;
+    std::string host;
+    std::string port;
+    int maxConcurrent = 0;
+    int connections = 2;
+};
+
+struct HostConfig {
+    std::string name;
+    std::string board;
+    int channel = -1;
+};
+
+struct Inventory {
+    std::vector<BoardConfig> boards;
+    std::vector<HostConfig> hosts;
+
+    int findBoard(const std::string& name) const {
+        for (size_t i = 0; i < boards.size(); i++) {
+            if (boards[i].name == name) return (int)i;
+        }
+        return -1;
+    }
+};
+
+// ホスト名・ボード名に使える文字（URLのパスにそのまま書ける範囲。':' は "ボード:チャンネル" の区切り）
+inline bool inventoryNameValid(const std::string& name) {
+    if (name.empty()) return false;
+    for (char c : name) {
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' ||
+                  c == '_' || c == '.';
+        if (!ok) return false;
+    }
+    return true;
+}
+
+// 失敗したら false と error（"ファイル:行: 理由"）
+inline bool loadInventory(const char* path, Inventory& inventory, std::string& error) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        error = std::string(path) + ": " + strerror(errno);
+        return false;
+    }
+    char line[512];
+    int lineNo = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        lineNo++;
+        char* hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        std::vector<std::string> words;
+        for (char* tok = strtok(line, " \t\r\n"); tok; tok = strtok(nullptr, " \t\r\n")) words.push_back(tok);
+        if (words.empty()) continue;
+
+        std::string where = std::string(path) + ":" + std::to_string(lineNo) + ": ";
+        if (words[0] == "board" && words.size() >= 3) {
+            BoardConfig board;
+            board.name = words[1];
+            size_t colon = words[2].rfind(':');
+            if (!inventoryNameValid(board.name) || colon == std::string::npos || colon == 0) {
+                error = where + "expected 'board <name> <host>:<port>'";
+                ok = false;
+                break;
+            }
+            board.host = words[2].substr(0, colon);
+            board.port = words[2].substr(colon + 1);
+            for (size_t i = 3; i < words.size() && ok; i++) {
+                if (words[i].compare(0, 4, "max=") == 0) {
+                    board.maxConcurrent = atoi(words[i].c_str() + 4);
+                } else if (words[i].compare(0, 12, "connections=") == 0) {
+                    board.connections = atoi(words[i].c_str() + 12);
+                } else {
+                    error = where + "unknown option '" + words[i] + "'";
+                    ok = false;
+                }
+            }
+            if (!ok) break;
+            if (board.connections < 1 || board.maxConcurrent < 0) {
+                error = where + "connections must be >= 1 and max >= 0";
+                ok = false;
+            } else if (inventory.findBoard(board.name) >= 0) {
+                error = where + "duplicate board '" + board.name + "'";
+                ok = false;
+            } else {
+                inventory.boards.push_back(board);
+            }
+        } else if (words[0] == "host" && words.size() == 4) {
+            HostConfig host;
+            host.name = words[1];
+            host.board = words[2];
+            char* end = nullptr;
+            host.channel = (int)strtol(words[3].c_str(), &end, 10);
+            if (!inventoryNameValid(host.name) || *end != '\0' || host.channel < 0) {
+                error = where + "expected 'host <name> <board> <channel>'";
+                ok = false;
+            } else if (inventory.findBoard(host.board) < 0) {
+                error = where + "unknown board '" + host.board + "' (declare boards first)";
+                ok = false;
+            } else {
+                for (const HostConfig& other : inventory.hosts) {
+                    if (other.name == host.name || (other.board == host.board && other.channel == host.channel)) {
+                        error = where + "duplicate host '" + host.name + "' or channel";
+                        ok = false;
+                    }
+                }
+                if (ok) inventory.hosts.push_back(host);
+            }
+        } else {
+            error = where + "expected 'board ...' or 'host ...'";
+            ok = false;
+        }
+    }
+    fclose(file);
+    if (ok && inventory.boards.empty()) {
+        error = std::string(path) + ": no boards";
+        ok = false;
+    }
+    return ok;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// ボードの応答（/api/info, /api/status）から必要な配列だけを取り出す
+// 汎用のJSONパーサではない。ボードの JsonWriter が出す形（"key":[...] で、値は数値か文字列）だけを扱う。
+
+// "key":[ の直後の位置（なければ npos）
+inline size_t jsonFindArray(const std::string& json, const char* key) {
+    std::string needle = std::string("\"") + key + "\":[";
+    size_t pos = json.find(needle);
+    return pos == std::string::npos ? pos : pos + needle.size();
+}
+
+// 非負整数の配列（"stateBits":[1,0] など）
+inline bool jsonNumberArray(const std::string& json, const char* key, std::vector<uint64_t>& out) {
+    size_t pos = jsonFindArray(json, key);
+    if (pos == std::string::npos) return false;
+    out.clear();
+    while (pos < json.size() && json[pos] != ']') {
+        char* end = nullptr;
+        uint64_t value = strtoull(json.c_str() + pos, &end, 10);
+        if (end == json.c_str() + pos) return false;
+        out.push_back(value);
+        pos = (size_t)(end - json.c_str());
+        if (pos < json.size() && json[pos] == ',') pos++;
+    }
+    return pos < json.size();
+}
+
+// 文字列の配列（"pcNames":["a","b"] など）。\\uXXXX はASCIIの範囲だけ戻す
+inline bool jsonStringArray(const std::string& json, const char* key, std::vector<std::string>& out) {
+    size_t pos = jsonFindArray(json, key);
+    if (pos == std::string::npos) return false;
+    out.clear();
+    while (pos < json.size() && json[pos] == '"') {
+        std::string value;
+        pos++;
+        while (pos < json.size() && json[pos] != '"') {
+            char c = json[pos++];
+            if (c != '\\' || pos >= json.size()) {
+                value += c;
+                continue;
+            }
+            char e = json[pos++];
+            switch (e) {
+                case 'n': value += '\n'; break;
+                case 't': value += '\t'; break;
+                case 'r': value += '\r'; break;
+                case 'b': value += '\b'; break;
+                case 'f': value += '\f'; break;
+                case 'u': {
+                    unsigned long code = strtoul(json.substr(pos, 4).c_str(), nullptr, 16);
+                    value += code < 0x80 ? (char)code : '?';
+                    pos += 4;
+                    break;
+                }
+                default: value += e; break;  // \" \\ \/
+            }
+        }
+        if (pos >= json.size()) return false;
+        out.push_back(value);
+        pos++;
+        if (pos < json.size() && json[pos] == ',') pos++;
+    }
+    return pos < json.size() && json[pos] == ']';
+}
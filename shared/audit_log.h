@@ -0,0 +1,388 @@
+#pragma once
+
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json_writer.h"
+#include "power_commands.h"
+#include "pulse_engine.h"
+
+// 電源操作の監査ログ（実機・シミュレータ共通）
+//
+// 32バイト固定長のレコードをリングとして1つのファイルに書く。レコードの位置は seq % Records で決まり、
+// 一周したら古いものから上書きする。書き込みは4KBのセクタ単位で、セクタが埋まったときと
+// 未書き込みのレコードができてから flushIntervalMs 経ったときだけ行う（押下ごとにフラッシュを書かない）。
+// 起動時は全レコードを読み、CRCが合う最大の seq から続きを書く。
+//
+// 記録は任意のタスクから MpscRing に積み、1つのタスク（実機は loop()）が append() と flushIfDue() を呼ぶ。
+// 読み出し（/api/audit）は別タスクから readBatch() で行う。
+
+enum class AuditEvent : uint8_t {
+    Press,       // 通常押しの要求
+    LongPress,   // 長押しの要求
+    Batch,       // 一括押しの要求（arg はチャンネルマスクの maskWord 番目の32ビット、空でないワードごとに1件）
+    PulseStart,  // パルス開始
+    PulseEnd     // パルス終了
+};
+
+enum class AuditResult : uint8_t {
+    Queued,
+    Coalesced,
+    Full,
+    Invalid,
+    Started,
+    Busy,
+    Completed,
+    Skipped, // WoL のクールダウン中、または電源LED入力で既にON
+    IoError  // ピンに書けず押せなかった（PulseStart）
+};
+
+enum class AuditSource : uint8_t {
+    Internal,  // ワーカーやタイマー（パルスの開始・終了）
+    Http,
+    Wol,       // Wake-on-LAN マジックパケット
+    Udp,       // 認証付きUDP制御プロトコル
+    Plan,      // 電源投入プラン（/api/plan）
+    Schedule,  // 予約運転（/api/schedules）
+    Reconcile  // 目標状態に合わせる押下（/api/state）
+};
+
+// ファイル上の形式（リトルエンディアン、実機とシミュレータで同じ）
+struct AuditRecord {
+    uint32_t seq;       // 1から始まる通し番号（0は空き）
+    uint32_t unixTime;  // 時刻（未同期なら0）
+    uint32_t uptimeMs;  // 起動からの時間
+    uint32_t client;    // 要求元のIPv4アドレス（a<<24|b<<16|c<<8|d、内部なら0）
+    uint32_t arg;       // パルス幅（ミリ秒）または一括押しのチャンネルマスク（maskWord * 32 から32チャンネル分）
+    uint16_t boot;      // 起動回数
+    int8_t channel;     // 一括押しは -1
+    AuditEvent event;
+    AuditResult result;
+    AuditSource source;
+    PulseKind kind;
+    uint8_t maskWord;   // 一括押しのマスクのワード番号（それ以外は0。以前の形式では常に0）
+    uint32_t crc;       // crc より前の28バイトのCRC-32
+};
+static_assert(sizeof(AuditRecord) == 32, "AuditRecord must be 32 bytes");
+
+// CRC-32（IEEE 802.3）。4ビットずつ表引きする
+inline uint32_t auditCrc32(const void* data, size_t len) {
+    static const uint32_t TABLE[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        crc = (crc >> 4) ^ TABLE[crc & 0x0F];
+        crc = (crc >> 4) ^ TABLE[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+inline bool auditRecordValid(const AuditRecord& record) {
+    return record.seq != 0 && record.crc == auditCrc32(&record, offsetof(AuditRecord, crc));
+}
+
+// seq, boot, crc は append() が埋める
+inline AuditRecord makeAuditRecord(AuditEvent event, AuditResult result, AuditSource source, int channel,
+                                   PulseKind kind, uint32_t client, uint32_t arg, uint32_t uptimeMs,
+                                   uint32_t unixTime, uint8_t maskWord = 0) {
+    AuditRecord record;
+    memset(&record, 0, sizeof(record));
+    record.unixTime = unixTime;
+    record.uptimeMs = uptimeMs;
+    record.client = client;
+    record.arg = arg;
+    record.channel = (int8_t)(channel >= -1 && channel <= 127 ? channel : -1);
+    record.event = event;
+    record.result = result;
+    record.source = source;
+    record.kind = kind;
+    record.maskWord = maskWord;
+    return record;
+}
+
+inline AuditResult auditResultOf(CommandResult result) {
+    switch (result) {
+        case CommandResult::Queued:    return AuditResult::Queued;
+        case CommandResult::Coalesced: return AuditResult::Coalesced;
+        case CommandResult::Full:      return AuditResult::Full;
+        default:                       return AuditResult::Invalid;
+    }
+}
+
+inline const char* auditEventName(AuditEvent event) {
+    switch (event) {
+        case AuditEvent::Press:      return "press";
+        case AuditEvent::LongPress:  return "longpress";
+        case AuditEvent::Batch:      return "batch";
+        case AuditEvent::PulseStart: return "pulse_start";
+        case AuditEvent::PulseEnd:   return "pulse_end";
+    }
+    return "unknown";
+}
+
+inline const char* auditResultName(AuditResult result) {
+    switch (result) {
+        case AuditResult::Queued:    return "queued";
+        case AuditResult::Coalesced: return "coalesced";
+        case AuditResult::Full:      return "full";
+        case AuditResult::Invalid:   return "invalid";
+        case AuditResult::Started:   return "started";
+        case AuditResult::Busy:      return "busy";
+        case AuditResult::Completed: return "completed";
+        case AuditResult::Skipped:   return "skipped";
+        case AuditResult::IoError:   return "io_error";
+    }
+    return "unknown";
+}
+
+inline const char* auditSourceName(AuditSource source) {
+    switch (source) {
+        case AuditSource::Internal:  return "internal";
+        case AuditSource::Http:      return "http";
+        case AuditSource::Wol:       return "wol";
+        case AuditSource::Udp:       return "udp";
+        case AuditSource::Plan:      return "plan";
+        case AuditSource::Schedule:  return "schedule";
+        case AuditSource::Reconcile: return "reconcile";
+    }
+    return "unknown";
+}
+
+// {"seq":12,"boot":3,"uptimeMs":81234,"time":0,"event":"press","ch":2,"kind":"short",
+//  "result":"queued","source":"http","client":"192.168.1.20","arg":1500}
+// 一括押しは "maskBase":32 を足す（arg のビット k がチャンネル maskBase + k）
+inline void writeAuditRecord(JsonWriter& json, const AuditRecord& record) {
+    char client[16];
+    snprintf(client, sizeof(client), "%u.%u.%u.%u", (unsigned)(record.client >> 24) & 0xFF,
+             (unsigned)(record.client >> 16) & 0xFF, (unsigned)(record.client >> 8) & 0xFF,
+             (unsigned)record.client & 0xFF);
+    json.beginObject()
+        .field("seq", record.seq)
+        .field("boot", record.boot)
+        .field("uptimeMs", record.uptimeMs)
+        .field("time", record.unixTime)
+        .field("event", auditEventName(record.event))
+        .field("ch", record.channel)
+        .field("kind", record.kind == PulseKind::Long ? "long" : "short")
+        .field("result", auditResultName(record.result))
+        .field("source", auditSourceName(record.source))
+        .field("client", client)
+        .field("arg", record.arg);
+    if (record.event == AuditEvent::Batch) json.field("maskBase", (uint32_t)record.maskWord * 32);
+    json.endObject();
+}
+
+// Storage は次を持つ（実機は LittleFS のファイル、シミュレータは mmap したファイル）
+//   bool read(size_t offset, void* data, size_t len);
+//   bool write(size_t offset, const void* data, size_t len);  // offset と len はセクタ境界
+//   void sync();
+template <typename Storage, size_t Records>
+class AuditLog {
+public:
+    static constexpr size_t SECTOR_BYTES = 4096;
+    static constexpr size_t SECTOR_RECORDS = SECTOR_BYTES / sizeof(AuditRecord);
+    static constexpr size_t FILE_BYTES = Records * sizeof(AuditRecord);
+    static_assert(Records >= 2 * SECTOR_RECORDS && Records % SECTOR_RECORDS == 0,
+                  "Records must be a multiple of the sector size (at least two sectors)");
+
+    AuditLog(Storage& storage, uint32_t flushIntervalMs)
+        : storage_(storage), flushIntervalMs_(flushIntervalMs) {}
+
+    // ファイル全体を走査して続きの seq と起動回数を決める
+    void begin() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint32_t last = 0;
+        uint16_t boot = 0;
+        for (size_t sector = 0; sector < Records / SECTOR_RECORDS; sector++) {
+            if (!storage_.read(sector * SECTOR_BYTES, sector_, SECTOR_BYTES)) continue;
+            for (size_t i = 0; i < SECTOR_RECORDS; i++) {
+                const AuditRecord& r = sector_[i];
+                if (!auditRecordValid(r) || r.seq % Records != sector * SECTOR_RECORDS + i) continue;
+                if (r.seq > last) {
+                    last = r.seq;
+                    boot = r.boot;
+                }
+            }
+        }
+        next_ = last + 1;
+        boot_ = (uint16_t)(boot + 1);
+        loadSector(next_);
+    }
+
+    void append(AuditRecord record) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t slot = next_ % Records;
+        if (slot / SECTOR_RECORDS != sectorIndex_) loadSector(next_);
+        record.seq = next_++;
+        record.boot = boot_;
+        record.crc = auditCrc32(&record, offsetof(AuditRecord, crc));
+        sector_[slot % SECTOR_RECORDS] = record;
+        dirty_ = true;
+        // セクタの最後のレコードならすぐ書く
+        if (slot % SECTOR_RECORDS == SECTOR_RECORDS - 1) writeSector();
+    }
+
+    // append() の後に呼ぶ。未書き込みのレコードを最初に見てから flushIntervalMs 経っていれば書く
+    void flushIfDue(uint32_t nowMs) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!dirty_) return;
+        if (!dirtySeen_) {
+            dirtySeen_ = true;
+            dirtySince_ = nowMs;
+        }
+        if (nowMs - dirtySince_ >= flushIntervalMs_) writeSector();
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (dirty_) writeSector();
+    }
+
+    // 残っている最古の seq と次に書く seq（[firstSeq, nextSeq) が読める範囲）
+    uint32_t firstSeq() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return firstSeqLocked();
+    }
+
+    uint32_t nextSeq() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return next_;
+    }
+
+    uint16_t boot() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return boot_;
+    }
+
+    // seq 以降のレコードを最大 max 件 out に読む。壊れたレコードは飛ばす
+    // 戻り値は読んだ件数。seq は次に読む番号に進む
+    size_t readBatch(uint32_t& seq, uint32_t end, AuditRecord* out, size_t max) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint32_t first = firstSeqLocked();
+        if (seq < first) seq = first;
+        if (end > next_) end = next_;
+        size_t count = 0;
+        while (seq < end && count < max) {
+            size_t slot = seq % Records;
+            AuditRecord record;
+            if (slot / SECTOR_RECORDS == sectorIndex_) {
+                record = sector_[slot % SECTOR_RECORDS];
+            } else if (!storage_.read(slot * sizeof(AuditRecord), &record, sizeof(record))) {
+                record.seq = 0;
+            }
+            if (record.seq == seq && auditRecordValid(record)) out[count++] = record;
+            seq++;
+        }
+        return count;
+    }
+
+private:
+    uint32_t firstSeqLocked() const { return next_ > Records ? next_ - (uint32_t)Records : 1; }
+
+    // seq を含むセクタをバッファに読む（まだ上書きしていない古いレコードも読めるようにしておく）
+    void loadSector(uint32_t seq) {
+        sectorIndex_ = (seq % Records) / SECTOR_RECORDS;
+        if (!storage_.read(sectorIndex_ * SECTOR_BYTES, sector_, SECTOR_BYTES)) {
+            memset(sector_, 0, sizeof(sector_));
+        }
+        dirty_ = false;
+        dirtySeen_ = false;
+    }
+
+    void writeSector() {
+        storage_.write(sectorIndex_ * SECTOR_BYTES, sector_, SECTOR_BYTES);
+        storage_.sync();
+        dirty_ = false;
+        dirtySeen_ = false;
+    }
+
+    Storage& storage_;
+    const uint32_t flushIntervalMs_;
+    mutable std::mutex mutex_;
+    AuditRecord sector_[SECTOR_RECORDS];
+    size_t sectorIndex_ = 0;
+    bool dirty_ = false;
+    bool dirtySeen_ = false;
+    uint32_t dirtySince_ = 0;
+    uint32_t next_ = 1;
+    uint16_t boot_ = 1;
+};
+
+// /api/audit の本文を少しずつ書き出す（ログ全体をRAMに載せない）
+// {"boot":3,"first":1,"next":42,"records":[{...},{...}]}
+// next は続きを読むときの since に使う
+template <typename Log>
+class AuditRenderer {
+public:
+    AuditRenderer(const Log& log, uint32_t since, uint32_t limit) : log_(log) {
+        uint32_t first = log.firstSeq();
+        uint32_t next = log.nextSeq();
+        seq_ = since < first ? first : since;
+        end_ = next;
+        if (limit > 0 && seq_ < end_ && end_ - seq_ > limit) end_ = seq_ + limit;
+        if (seq_ > end_) seq_ = end_;
+        lineLen_ = (size_t)snprintf(line_, sizeof(line_), "{\"boot\":%u,\"first\":%lu,\"next\":%lu,\"records\":[",
+                                    (unsigned)log.boot(), (unsigned long)first, (unsigned long)end_);
+    }
+
+    size_t render(char* buf, size_t cap) {
+        size_t written = 0;
+        while (written < cap) {
+            if (lineOff_ == lineLen_) {
+                if (!nextLine()) break;
+            }
+            size_t n = lineLen_ - lineOff_;
+            if (n > cap - written) n = cap - written;
+            memcpy(buf + written, line_ + lineOff_, n);
+            lineOff_ += n;
+            written += n;
+        }
+        return written;
+    }
+
+private:
+    static constexpr size_t BATCH = 8;
+
+    bool nextLine() {
+        lineOff_ = 0;
+        lineLen_ = 0;
+        if (done_) return false;
+        while (batchPos_ == batchLen_) {
+            if (seq_ >= end_) {
+                memcpy(line_, "]}", 2);
+                lineLen_ = 2;
+                done_ = true;
+                return true;
+            }
+            // 壊れたレコードは readBatch() が飛ばすので、0件のバッチもありうる
+            batchPos_ = 0;
+            batchLen_ = log_.readBatch(seq_, end_, batch_, BATCH);
+        }
+        size_t offset = 0;
+        if (!firstRecord_) line_[offset++] = ',';
+        firstRecord_ = false;
+        JsonWriter json(line_ + offset, sizeof(line_) - offset);
+        writeAuditRecord(json, batch_[batchPos_++]);
+        lineLen_ = offset + json.length();
+        return true;
+    }
+
+    const Log& log_;
+    uint32_t seq_;
+    uint32_t end_;
+    AuditRecord batch_[BATCH];
+    size_t batchPos_ = 0;
+    size_t batchLen_ = 0;
+    bool firstRecord_ = true;
+    bool done_ = false;
+    char line_[256];
+    size_t lineOff_ = 0;
+    size_t lineLen_ = 0;
+};
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+
+// チャンネルの集合（非アトミック、値として受け渡す）
+// 一括操作の対象チャンネルやウェーブの指定に使う。
+template <int N>
+struct ChannelMask {
+    static constexpr int WORDS = (N + 31) / 32;
+
+    uint32_t words[WORDS] = {};
+
+    bool test(int channel) const {
+        if (channel < 0 || channel >= N) return false;
+        return (words[channel >> 5] >> (channel & 31)) & 1u;
+    }
+
+    void set(int channel, bool on = true) {
+        if (channel < 0 || channel >= N) return;
+        if (on) {
+            words[channel >> 5] |= 1u << (channel & 31);
+        } else {
+            words[channel >> 5] &= ~(1u << (channel & 31));
+        }
+    }
+
+    bool any() const {
+        for (int i = 0; i < WORDS; i++) {
+            if (words[i]) return true;
+        }
+        return false;
+    }
+
+    int count() const {
+        int n = 0;
+        for (int i = 0; i < WORDS; i++) n += __builtin_popcount(words[i]);
+        return n;
+    }
+
+    // 最小のチャンネル番号（空なら -1）
+    int first() const {
+        for (int i = 0; i < WORDS; i++) {
+            if (words[i]) return i * 32 + __builtin_ctz(words[i]);
+        }
+        return -1;
+    }
+
+    // 小さい順に最大 limit 個を取り出す（limit <= 0 なら全部）
+    ChannelMask take(int limit) {
+        ChannelMask taken;
+        int n = 0;
+        for (int ch = first(); ch >= 0 && (limit <= 0 || n < limit); ch = first()) {
+            taken.set(ch);
+            set(ch, false);
+            n++;
+        }
+        return taken;
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (int i = 0; i < WORDS; i++) {
+            uint32_t w = words[i];
+            while (w) {
+                int bit = __builtin_ctz(w);
+                fn(i * 32 + bit);
+                w &= w - 1;
+            }
+        }
+    }
+};
+
+// "0,1,5" 形式のチャンネル一覧を解釈する（範囲外や不正な文字があれば false）
+template <int N>
+inline bool parseChannelList(const char* text, ChannelMask<N>& mask) {
+    if (text == nullptr || *text == '\0') return false;
+    const char* p = text;
+    while (*p) {
+        if (*p < '0' || *p > '9') return false;
+        char* end;
+        long ch = strtol(p, &end, 10);
+        if (ch < 0 || ch >= N) return false;
+        mask.set((int)ch);
+        p = end;
+        if (*p == ',') {
+            p++;
+            if (*p == '\0') return false;
+        } else if (*p != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// "0x7ffff" または10進のビットマスク（チャンネル0が最下位ビット、64チャンネルまで）
+template <int N>
+inline bool parseChannelBitmask(const char* text, ChannelMask<N>& mask) {
+    if (text == nullptr || *text == '\0') return false;
+    char* end;
+    unsigned long long bits = strtoull(text, &end, 0);
+    if (*end != '\0') return false;
+    for (int ch = 0; ch < 64; ch++) {
+        if (!((bits >> ch) & 1ULL)) continue;
+        if (ch >= N) return false;
+        mask.set(ch);
+    }
+    return true;
+}
+
+// チャンネルごとの1ビット状態を32ビットワードに詰めて保持する（各ワードはアトミック）
+// 複数タスク（AsyncTCP、esp_timer、サンプラ）から同時に読み書きできる。
+template <int N>
+class ChannelBitset {
+public:
+    static constexpr int WORDS = (N + 31) / 32;
+
+    ChannelBitset() {
+        for (int i = 0; i < WORDS; i++) words_[i].store(0, std::memory_order_relaxed);
+    }
+
+    bool test(int channel) const {
+        if (channel < 0 || channel >= N) return false;
+        return (words_[channel >> 5].load(std::memory_order_acquire) >> (channel & 31)) & 1u;
+    }
+
+    void set(int channel, bool on) {
+        if (channel < 0 || channel >= N) return;
+        uint32_t bit = 1u << (channel & 31);
+        if (on) {
+            words_[channel >> 5].fetch_or(bit, std::memory_order_acq_rel);
+        } else {
+            words_[channel >> 5].fetch_and(~bit, std::memory_order_acq_rel);
+        }
+    }
+
+    // 反転して新しい値を返す
+    bool flip(int channel) {
+        if (channel < 0 || channel >= N) return false;
+        uint32_t bit = 1u << (channel & 31);
+        uint32_t old = words_[channel >> 5].fetch_xor(bit, std::memory_order_acq_rel);
+        return !(old & bit);
+    }
+
+    uint32_t word(int index) const {
+        return words_[index].load(std::memory_order_acquire);
+    }
+
+    ChannelMask<N> mask() const {
+        ChannelMask<N> channels;
+        for (int i = 0; i < WORDS; i++) channels.words[i] = word(i);
+        return channels;
+    }
+
+    // 立っているビットを取り出して0にする（ワードごとにアトミック）
+    ChannelMask<N> take() {
+        ChannelMask<N> channels;
+        for (int i = 0; i < WORDS; i++) channels.words[i] = words_[i].exchange(0, std::memory_order_acq_rel);
+        return channels;
+    }
+
+    void set(const ChannelMask<N>& channels, bool on) {
+        for (int i = 0; i < WORDS; i++) {
+            if (!channels.words[i]) continue;
+            if (on) {
+                words_[i].fetch_or(channels.words[i], std::memory_order_acq_rel);
+            } else {
+                words_[i].fetch_and(~channels.words[i], std::memory_order_acq_rel);
+            }
+        }
+    }
+
+    bool any() const {
+        for (int i = 0; i < WORDS; i++) {
+            if (word(i)) return true;
+        }
+        return false;
+    }
+
+    static constexpr int size() { return N; }
+
+private:
+    std::atomic<uint32_t> words_[WORDS];
+};
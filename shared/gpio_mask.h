@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "channel_bitset.h"
+
+// ESP32のGPIO出力レジスタのビットマスク
+//   low : GPIO0〜31  → GPIO.out_w1ts / GPIO.out_w1tc
+//   high: GPIO32〜39 → GPIO.out1_w1ts / GPIO.out1_w1tc
+struct GpioBankMask {
+    uint32_t low = 0;
+    uint32_t high = 0;
+};
+
+// チャンネル番号→ピンのマスク表（PHOTOCOUPLER_PINS からコンパイル時に作る）
+template <int N>
+struct ChannelPinMasks {
+    GpioBankMask pins[N];
+
+    // 指定チャンネル群をまとめて書くためのマスク
+    GpioBankMask combine(const ChannelMask<N>& channels) const {
+        GpioBankMask mask;
+        channels.forEach([&](int channel) {
+            mask.low |= pins[channel].low;
+            mask.high |= pins[channel].high;
+        });
+        return mask;
+    }
+};
+
+template <int N>
+constexpr ChannelPinMasks<N> buildChannelPinMasks(const int (&pins)[N]) {
+    ChannelPinMasks<N> table{};
+    for (int i = 0; i < N; i++) {
+        if (pins[i] >= 0 && pins[i] < 32) {
+            table.pins[i].low = 1u << pins[i];
+        } else if (pins[i] >= 32 && pins[i] < 40) {
+            table.pins[i].high = 1u << (pins[i] - 32);
+        }
+    }
+    return table;
+}
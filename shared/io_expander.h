@@ -0,0 +1,293 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "channel_bitset.h"
+#include "gpio_mask.h"
+
+// チャンネルの出力先（本体のGPIOとI2CのI/Oエキスパンダ、実機・シミュレータ共通）
+//
+// ESP32で出力に使えるGPIOは20本ほどなので、それを超えるチャンネルは MCP23017 / PCF8575（各16ピン）に置く。
+// config.h の PHOTOCOUPLER_PINS に、本体のGPIOは番号を、エキスパンダのピンは expanderPin(エキスパンダ, ピン) を書く。
+//
+// ChannelDriver はチャンネルの集合を受け取り、本体のGPIOはバンクごとに1回の w1ts / w1tc で、
+// エキスパンダは変化したものだけ1回ずつのポート書き込みで変える（同じエキスパンダのチャンネルは1回にまとまる）。
+// 各エキスパンダの出力ラッチの写しを持つので、バスから読み戻さずに書き込む値が決まる（read-modify-write しない）。
+// 400kHz で1回の書き込みは 100µs 足らずなので、64チャンネルを一度に離してもエキスパンダ4個なら1ms未満で済む。
+// バスに書くのはコマンドワーカーだけにする。パルスのタイマーは writeNative() で本体のGPIOだけを離してワーカーを起こし、
+// エキスパンダはワーカーが離す。離す書き込みが失敗したら、IO_EXPANDER_RETRY_MS 後に成功するまでやり直す。
+//
+//   MCP23017: ピン 0〜7 が GPA0〜7、8〜15 が GPB0〜7。HIGHで押す（本体のGPIOと同じ）。
+//             起動時に OLAT を0にしてから使うピンだけを出力にする（IODIR）。使わないピンは入力のまま。
+//             書き込みは変わったポート（A / B）だけ
+//   PCF8575 : ピン 0〜7 が P00〜P07、8〜15 が P10〜P17。準双方向で電流を引き込めるだけなので LOW で押す
+//             （フォトカプラのLEDのアノードを抵抗経由で3.3Vへ、カソードをピンへ）。使わないピンはHIGH（入力）
+//
+// Hw に委譲する：
+//   void gpioWrite(const GpioBankMask& mask, bool level);               // 本体のGPIOの w1ts / w1tc
+//   bool i2cWrite(uint8_t address, const uint8_t* data, size_t len);   // 1トランザクション（START〜STOP）、ACKなら true
+//   void lockBus(); void unlockBus();                                   // ラッチの写しとバスを直列化する
+
+enum class IoExpanderType : uint8_t {
+    None,  // 使わない（IO_EXPANDERS を空にできないときの埋め草）
+    Mcp23017,
+    Pcf8575
+};
+
+inline const char* ioExpanderTypeName(IoExpanderType type) {
+    switch (type) {
+        case IoExpanderType::Mcp23017: return "mcp23017";
+        case IoExpanderType::Pcf8575:  return "pcf8575";
+        default:                       return "none";
+    }
+}
+
+struct IoExpander {
+    IoExpanderType type;
+    uint8_t address;  // 7ビットのI2Cアドレス（どちらも 0x20〜0x27）
+};
+
+// 離す書き込みが失敗したときにやり直すまでの間隔
+constexpr uint32_t IO_EXPANDER_RETRY_MS = 100;
+
+constexpr int IO_EXPANDER_PIN_BASE = 100;
+constexpr int IO_EXPANDER_PORT_PINS = 16;
+
+// PHOTOCOUPLER_PINS に書くエキスパンダのピン（expander は IO_EXPANDERS の添字、pin は 0〜15）
+constexpr int expanderPin(int expander, int pin) {
+    return IO_EXPANDER_PIN_BASE + expander * IO_EXPANDER_PORT_PINS + pin;
+}
+constexpr bool isExpanderPin(int pin) { return pin >= IO_EXPANDER_PIN_BASE; }
+constexpr int expanderOfPin(int pin) { return (pin - IO_EXPANDER_PIN_BASE) / IO_EXPANDER_PORT_PINS; }
+constexpr int expanderBitOfPin(int pin) { return (pin - IO_EXPANDER_PIN_BASE) % IO_EXPANDER_PORT_PINS; }
+
+// ログ用の表記（"GPIO 32" / "EXP0.3"）
+inline void formatOutputPin(char* buf, size_t size, int pin) {
+    if (isExpanderPin(pin)) {
+        snprintf(buf, size, "EXP%d.%d", expanderOfPin(pin), expanderBitOfPin(pin));
+    } else {
+        snprintf(buf, size, "GPIO %d", pin);
+    }
+}
+
+// 出力先の表の検証（static_assert 用）：
+//   本体のGPIOは出力できるピン（0〜33）で、I2C のピンと重ならない。エキスパンダのピンは設定されたエキスパンダを指す。
+//   同じピンを2つのチャンネルに使わない。エキスパンダのアドレスは 0x20〜0x27 で重ならない
+template <int N, int E>
+constexpr bool channelOutputsValid(const int (&pins)[N], const IoExpander (&expanders)[E], int sdaPin, int sclPin) {
+    bool usesExpanders = false;
+    for (int i = 0; i < N; i++) {
+        int pin = pins[i];
+        if (isExpanderPin(pin)) {
+            int expander = expanderOfPin(pin);
+            if (expander >= E || expanders[expander].type == IoExpanderType::None) return false;
+            usesExpanders = true;
+        } else if (pin < 0 || pin > 33) {
+            return false;
+        }
+        for (int j = 0; j < i; j++) {
+            if (pins[j] == pin) return false;
+        }
+    }
+    for (int i = 0; i < E; i++) {
+        if (expanders[i].type == IoExpanderType::None) continue;
+        if (expanders[i].address < 0x20 || expanders[i].address > 0x27) return false;
+        for (int j = 0; j < i; j++) {
+            if (expanders[j].type != IoExpanderType::None && expanders[j].address == expanders[i].address) return false;
+        }
+    }
+    if (usesExpanders) {
+        if (sdaPin < 0 || sclPin < 0 || sdaPin == sclPin) return false;
+        for (int i = 0; i < N; i++) {
+            if (pins[i] == sdaPin || pins[i] == sclPin) return false;
+        }
+    }
+    return true;
+}
+
+// チャンネル → 出力先の表（コンパイル時に作る）
+template <int N, int E>
+struct ChannelOutputMap {
+    ChannelPinMasks<N> native;  // 本体のGPIOのビット（エキスパンダのチャンネルは0）
+    int8_t expander[N];         // -1 なら本体のGPIO
+    uint16_t bit[N];            // エキスパンダのポートのビット
+    uint16_t used[E];           // エキスパンダごとに使っているピン
+
+    bool usesExpanders() const {
+        for (int i = 0; i < E; i++) {
+            if (used[i]) return true;
+        }
+        return false;
+    }
+};
+
+template <int N, int E>
+constexpr ChannelOutputMap<N, E> buildChannelOutputMap(const int (&pins)[N], const IoExpander (&)[E]) {
+    ChannelOutputMap<N, E> map{};
+    map.native = buildChannelPinMasks(pins);
+    for (int i = 0; i < N; i++) {
+        map.expander[i] = -1;
+        if (!isExpanderPin(pins[i])) continue;
+        int expander = expanderOfPin(pins[i]);
+        map.expander[i] = (int8_t)expander;
+        map.bit[i] = (uint16_t)(1u << expanderBitOfPin(pins[i]));
+        map.used[expander] |= map.bit[i];
+    }
+    return map;
+}
+
+// MCP23017 のレジスタ（IOCON.BANK=0、起動時の既定）。連続して書くとアドレスが進む
+constexpr uint8_t MCP23017_IODIRA = 0x00;
+constexpr uint8_t MCP23017_OLATA = 0x14;
+constexpr uint8_t MCP23017_OLATB = 0x15;
+
+template <int N, int E, typename Hw>
+class ChannelDriver {
+public:
+    static constexpr int WRITE_ATTEMPTS = 3;
+
+    ChannelDriver(Hw& hw, const ChannelOutputMap<N, E>& map, const IoExpander (&expanders)[E])
+        : hw_(hw), map_(map), expanders_(expanders) {}
+
+    // 使うエキスパンダを全チャンネル離した状態で出力にする。応答しないエキスパンダがあれば false
+    // （そのエキスパンダは次の書き込みのときに設定し直す）
+    bool begin() {
+        bool ok = true;
+        hw_.lockBus();
+        for (int i = 0; i < E; i++) {
+            if (!map_.used[i]) continue;
+            latch_[i] = 0;
+            if (!configure(i)) ok = false;
+        }
+        hw_.unlockBus();
+        return ok;
+    }
+
+    // channels をまとめて level（true で押す）にする。エキスパンダへの書き込みが失敗すれば false
+    // （押すときはエキスパンダを先に書き、失敗したら本体のGPIOは押さない）
+    bool write(const ChannelMask<N>& channels, bool level) {
+        GpioBankMask native = map_.native.combine(channels);
+        bool hasNative = native.low || native.high;
+        if (hasNative && !level) hw_.gpioWrite(native, level);
+        bool ok = writeExpanders(channels, level);
+        if (hasNative && level && ok) hw_.gpioWrite(native, level);
+        return ok;
+    }
+
+    bool write(int channel, bool level) {
+        ChannelMask<N> channels;
+        channels.set(channel);
+        return write(channels, level);
+    }
+
+    // channels のうち本体のGPIOだけを変える。バスを使わずすぐ戻るので、タイマーのコールバックから呼べる
+    // （エキスパンダのチャンネルは write() で変える）
+    void writeNative(const ChannelMask<N>& channels, bool level) {
+        GpioBankMask native = map_.native.combine(channels);
+        if (native.low || native.high) hw_.gpioWrite(native, level);
+    }
+
+    // channels のうち、最後の書き込みが失敗したエキスパンダにあるもの（出力が写しと違うかもしれない）
+    ChannelMask<N> failed(const ChannelMask<N>& channels) const {
+        ChannelMask<N> result;
+        channels.forEach([&](int channel) {
+            if (map_.expander[channel] >= 0 && dirty_[map_.expander[channel]]) result.set(channel);
+        });
+        return result;
+    }
+
+    // 押しているピン（論理値、1で押している）
+    uint16_t latch(int expander) const { return latch_[expander]; }
+    uint32_t transactions() const { return transactions_; }
+    uint32_t busErrors() const { return busErrors_; }
+    uint32_t skippedWrites() const { return skipped_; }
+
+private:
+    bool writeExpanders(const ChannelMask<N>& channels, bool level) {
+        uint16_t bits[E] = {};
+        bool touched = false;
+        channels.forEach([&](int channel) {
+            if (map_.expander[channel] < 0) return;
+            bits[map_.expander[channel]] |= map_.bit[channel];
+            touched = true;
+        });
+        if (!touched) return true;
+
+        bool ok = true;
+        hw_.lockBus();
+        for (int i = 0; i < E; i++) {
+            if (!bits[i]) continue;
+            uint16_t next = level ? (uint16_t)(latch_[i] | bits[i]) : (uint16_t)(latch_[i] & ~bits[i]);
+            if (next == latch_[i] && !dirty_[i]) {
+                skipped_++;
+                continue;
+            }
+            if (!update(i, next)) ok = false;
+        }
+        hw_.unlockBus();
+        return ok;
+    }
+
+    // 写しと比べて変わったバイトだけを書く（MCP23017）。前の書き込みが失敗していれば設定からやり直す
+    bool update(int i, uint16_t next) {
+        uint16_t changed = (uint16_t)(next ^ latch_[i]);
+        latch_[i] = next;
+        if (dirty_[i]) return configure(i);
+        bool ok;
+        if (expanders_[i].type == IoExpanderType::Mcp23017 && !(changed & 0xFF00)) {
+            uint8_t data[] = {MCP23017_OLATA, (uint8_t)next};
+            ok = send(i, data, sizeof(data));
+        } else if (expanders_[i].type == IoExpanderType::Mcp23017 && !(changed & 0x00FF)) {
+            uint8_t data[] = {MCP23017_OLATB, (uint8_t)(next >> 8)};
+            ok = send(i, data, sizeof(data));
+        } else {
+            ok = writePort(i, next);
+        }
+        dirty_[i] = !ok;
+        return ok;
+    }
+
+    // 写しのとおりに出力し、MCP23017 は使うピンだけを出力にする（OLAT を先に書くので出力にした瞬間に押さない）
+    bool configure(int i) {
+        bool ok = writePort(i, latch_[i]);
+        if (ok && expanders_[i].type == IoExpanderType::Mcp23017) {
+            uint16_t inputs = (uint16_t)~map_.used[i];
+            uint8_t iodir[] = {MCP23017_IODIRA, (uint8_t)inputs, (uint8_t)(inputs >> 8)};
+            ok = send(i, iodir, sizeof(iodir));
+        }
+        dirty_[i] = !ok;
+        return ok;
+    }
+
+    // ポート全体（16ピン）を書く。PCF8575 は押すピンをLOW、それ以外（使わないピンを含む）をHIGHにする
+    bool writePort(int i, uint16_t pressed) {
+        if (expanders_[i].type == IoExpanderType::Mcp23017) {
+            uint8_t data[] = {MCP23017_OLATA, (uint8_t)pressed, (uint8_t)(pressed >> 8)};
+            return send(i, data, sizeof(data));
+        }
+        uint16_t level = (uint16_t)~pressed;
+        uint8_t data[] = {(uint8_t)level, (uint8_t)(level >> 8)};
+        return send(i, data, sizeof(data));
+    }
+
+    // NACK なら数回までやり直す（離す書き込みが失われるとボタンが押されたままになる）
+    bool send(int i, const uint8_t* data, size_t len) {
+        for (int attempt = 0; attempt < WRITE_ATTEMPTS; attempt++) {
+            transactions_++;
+            if (hw_.i2cWrite(expanders_[i].address, data, len)) return true;
+            busErrors_++;
+        }
+        return false;
+    }
+
+    Hw& hw_;
+    const ChannelOutputMap<N, E>& map_;
+    const IoExpander (&expanders_)[E];
+    uint16_t latch_[E] = {};
+    bool dirty_[E] = {};
+    uint32_t transactions_ = 0;
+    uint32_t busErrors_ = 0;
+    uint32_t skipped_ = 0;
+};
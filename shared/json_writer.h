@@ -0,0 +1,212 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+// 呼び出し側が用意した固定長バッファにJSONを書き込むライタ（ヒープ確保なし）
+//
+//   char buf[256];
+//   JsonWriter json(buf, sizeof(buf));
+//   json.beginObject().field("success", true).field("pcIndex", 3).endObject();
+//   if (json.ok()) send(json.c_str(), json.length());
+//
+// カンマは自動で挿入し、文字列はエスケープする。容量を超えた場合は以降の書き込みを
+// 捨てて ok() が false になる（バッファは常にNUL終端される）。
+class JsonWriter {
+public:
+    static const int MAX_DEPTH = 16;
+
+    JsonWriter(char* buffer, size_t capacity)
+        : buf_(buffer), cap_(capacity), len_(0), depth_(0), overflow_(capacity == 0),
+          afterKey_(false), hasItem_(0) {
+        if (cap_ > 0) buf_[0] = '\0';
+    }
+
+    JsonWriter& beginObject() { return open('{'); }
+    JsonWriter& endObject() { return close('}'); }
+    JsonWriter& beginArray() { return open('['); }
+    JsonWriter& endArray() { return close(']'); }
+
+    JsonWriter& key(const char* name) {
+        separator();
+        writeString(name);
+        put(':');
+        afterKey_ = true;
+        return *this;
+    }
+
+    JsonWriter& value(const char* str) {
+        separator();
+        if (str == nullptr) {
+            write("null", 4);
+        } else {
+            writeString(str);
+        }
+        return *this;
+    }
+
+    // 2つの文字列を連結した1つのJSON文字列を書く（"<PC名> power button ..." 等）
+    JsonWriter& value(const char* first, const char* second) {
+        separator();
+        put('"');
+        writeEscaped(first);
+        writeEscaped(second);
+        put('"');
+        return *this;
+    }
+
+    JsonWriter& value(bool b) {
+        separator();
+        if (b) {
+            write("true", 4);
+        } else {
+            write("false", 5);
+        }
+        return *this;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value,
+                            JsonWriter&>::type
+    value(T number) {
+        separator();
+        if (std::is_signed<T>::value) {
+            writeSigned((int64_t)number);
+        } else {
+            writeUnsigned((uint64_t)number);
+        }
+        return *this;
+    }
+
+    // 事前に組み立て済みのJSON断片をそのまま書き込む
+    JsonWriter& raw(const char* fragment) {
+        separator();
+        write(fragment, strlen(fragment));
+        return *this;
+    }
+
+    template <typename T>
+    JsonWriter& field(const char* name, T v) {
+        key(name);
+        return value(v);
+    }
+
+    JsonWriter& field(const char* name, const char* first, const char* second) {
+        key(name);
+        return value(first, second);
+    }
+
+    const char* c_str() const { return buf_; }
+    size_t length() const { return len_; }
+    bool ok() const { return !overflow_ && depth_ == 0; }
+
+private:
+    JsonWriter& open(char bracket) {
+        separator();
+        put(bracket);
+        if (depth_ < MAX_DEPTH) {
+            depth_++;
+            hasItem_ &= ~(1u << depth_);
+        } else {
+            overflow_ = true;
+        }
+        return *this;
+    }
+
+    JsonWriter& close(char bracket) {
+        put(bracket);
+        if (depth_ > 0) depth_--;
+        return *this;
+    }
+
+    // 同じ階層の2つ目以降の要素の前にカンマを入れる
+    void separator() {
+        if (afterKey_) {
+            afterKey_ = false;
+            return;
+        }
+        uint32_t bit = 1u << depth_;
+        if (hasItem_ & bit) put(',');
+        hasItem_ |= bit;
+    }
+
+    void writeString(const char* str) {
+        put('"');
+        writeEscaped(str);
+        put('"');
+    }
+
+    void writeEscaped(const char* str) {
+        static const char HEX[] = "0123456789abcdef";
+        for (const unsigned char* p = (const unsigned char*)str; *p; p++) {
+            unsigned char c = *p;
+            switch (c) {
+                case '"':  write("\\\"", 2); break;
+                case '\\': write("\\\\", 2); break;
+                case '\n': write("\\n", 2); break;
+                case '\r': write("\\r", 2); break;
+                case '\t': write("\\t", 2); break;
+                case '\b': write("\\b", 2); break;
+                case '\f': write("\\f", 2); break;
+                default:
+                    if (c < 0x20) {
+                        char esc[6] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0x0f]};
+                        write(esc, 6);
+                    } else {
+                        put((char)c);  // UTF-8はそのまま
+                    }
+            }
+        }
+    }
+
+    void writeSigned(int64_t number) {
+        if (number < 0) {
+            put('-');
+            // INT64_MINでも溢れないよう符号なしで反転する
+            writeUnsigned(~(uint64_t)number + 1);
+        } else {
+            writeUnsigned((uint64_t)number);
+        }
+    }
+
+    void writeUnsigned(uint64_t number) {
+        char digits[20];
+        int n = 0;
+        do {
+            digits[n++] = (char)('0' + number % 10);
+            number /= 10;
+        } while (number != 0);
+        while (n > 0) put(digits[--n]);
+    }
+
+    void put(char c) {
+        if (overflow_) return;
+        if (len_ + 1 >= cap_) {
+            overflow_ = true;
+            return;
+        }
+        buf_[len_++] = c;
+        buf_[len_] = '\0';
+    }
+
+    void write(const char* data, size_t n) {
+        if (overflow_) return;
+        if (len_ + n >= cap_) {
+            overflow_ = true;
+            return;
+        }
+        memcpy(buf_ + len_, data, n);
+        len_ += n;
+        buf_[len_] = '\0';
+    }
+
+    char* buf_;
+    size_t cap_;
+    size_t len_;
+    int depth_;
+    bool overflow_;
+    bool afterKey_;
+    uint32_t hasItem_;  // 階層ごとの「既に要素がある」フラグ
+};
@@ -0,0 +1,380 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pulse_engine.h"
+
+// /api/metrics（Prometheusテキスト形式）の計測値（実機・シミュレータ共通）
+//
+// ハンドラ側はアトミックな加算だけを行う（確保なし）。文字列化はスクレイプ時に
+// MetricsRenderer が固定長バッファへ1チャンクずつ書き出す。
+
+// 計測対象のルート（ラベル route の値）
+enum class Route : uint8_t {
+    Index,
+    Info,
+    Status,
+    Events,
+    Power,
+    PowerBatch,
+    LongPress,
+    Metrics,
+    Audit,
+    Plan,
+    Trace,
+    Schedule,
+    State,
+    Other,     // シミュレータ専用のルートなど
+    NotFound,
+    Count
+};
+
+inline const char* routeLabel(Route route) {
+    switch (route) {
+        case Route::Index:      return "index";
+        case Route::Info:       return "info";
+        case Route::Status:     return "status";
+        case Route::Events:     return "events";
+        case Route::Power:      return "power";
+        case Route::PowerBatch: return "power_batch";
+        case Route::LongPress:  return "longpress";
+        case Route::Metrics:    return "metrics";
+        case Route::Audit:      return "audit";
+        case Route::Plan:       return "plan";
+        case Route::Trace:      return "trace";
+        case Route::Schedule:   return "schedule";
+        case Route::State:      return "state";
+        case Route::Other:      return "other";
+        case Route::NotFound:   return "not_found";
+        default:                return "unknown";
+    }
+}
+
+// ハンドラの処理時間のヒストグラム境界（マイクロ秒）。最後に +Inf が付く
+static constexpr uint32_t LATENCY_BUCKETS_US[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000};
+static constexpr const char* LATENCY_BUCKET_LABELS[] = {"0.0001", "0.00025", "0.0005", "0.001", "0.0025",
+                                                        "0.005", "0.01", "0.025", "0.1"};
+static constexpr int LATENCY_BUCKET_COUNT = sizeof(LATENCY_BUCKETS_US) / sizeof(LATENCY_BUCKETS_US[0]);
+
+// ルートごとの要求数と処理時間
+class HttpMetrics {
+public:
+    static constexpr int ROUTES = (int)Route::Count;
+
+    HttpMetrics() {
+        for (int r = 0; r < ROUTES; r++) {
+            for (int b = 0; b <= LATENCY_BUCKET_COUNT; b++) buckets_[r][b].store(0, std::memory_order_relaxed);
+            count_[r].store(0, std::memory_order_relaxed);
+            sumUs_[r].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void observe(Route route, uint32_t elapsedUs) {
+        int r = (int)route;
+        int b = 0;
+        while (b < LATENCY_BUCKET_COUNT && elapsedUs > LATENCY_BUCKETS_US[b]) b++;
+        buckets_[r][b].fetch_add(1, std::memory_order_relaxed);
+        sumUs_[r].fetch_add(elapsedUs, std::memory_order_relaxed);
+        count_[r].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint32_t count(int route) const { return count_[route].load(std::memory_order_relaxed); }
+    uint64_t sumUs(int route) const { return sumUs_[route].load(std::memory_order_relaxed); }
+    // 境界 bucket 以下の累積数（bucket == LATENCY_BUCKET_COUNT は +Inf）
+    uint32_t cumulative(int route, int bucket) const {
+        uint32_t n = 0;
+        for (int b = 0; b <= bucket; b++) n += buckets_[route][b].load(std::memory_order_relaxed);
+        return n;
+    }
+
+private:
+    std::atomic<uint32_t> buckets_[ROUTES][LATENCY_BUCKET_COUNT + 1];
+    std::atomic<uint32_t> count_[ROUTES];
+    std::atomic<uint64_t> sumUs_[ROUTES];
+};
+
+// ハンドラの先頭で作り、抜けるときに処理時間を記録する
+// Clock::nowUs() は単調増加のマイクロ秒（実機は esp_timer_get_time()）
+template <typename Clock>
+class RouteTimer {
+public:
+    RouteTimer(HttpMetrics& metrics, Route route)
+        : metrics_(metrics), route_(route), start_(Clock::nowUs()) {}
+    ~RouteTimer() { metrics_.observe(route_, (uint32_t)(Clock::nowUs() - start_)); }
+
+    // ハンドラ内でルートが決まる場合（シミュレータの振り分けなど）
+    void setRoute(Route route) { route_ = route; }
+
+private:
+    HttpMetrics& metrics_;
+    Route route_;
+    uint64_t start_;
+};
+
+// チャンネルごとのパルス回数とピンをHIGHにしていた累計時間
+template <int N>
+class PulseMetrics {
+public:
+    PulseMetrics() {
+        for (int i = 0; i < N; i++) {
+            shortCount_[i].store(0, std::memory_order_relaxed);
+            longCount_[i].store(0, std::memory_order_relaxed);
+            assertedUs_[i].store(0, std::memory_order_relaxed);
+            startUs_[i] = 0;
+        }
+    }
+
+    // Platform::onPulseStart / onPulseComplete から呼ぶ
+    void started(int channel, PulseKind kind, uint64_t nowUs) {
+        if (channel < 0 || channel >= N) return;
+        startUs_[channel] = nowUs;
+        (kind == PulseKind::Long ? longCount_ : shortCount_)[channel].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void completed(int channel, uint64_t nowUs) {
+        if (channel < 0 || channel >= N) return;
+        assertedUs_[channel].fetch_add(nowUs - startUs_[channel], std::memory_order_relaxed);
+    }
+
+    uint32_t count(int channel, PulseKind kind) const {
+        return (kind == PulseKind::Long ? longCount_ : shortCount_)[channel].load(std::memory_order_relaxed);
+    }
+    uint64_t assertedUs(int channel) const { return assertedUs_[channel].load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint32_t> shortCount_[N];
+    std::atomic<uint32_t> longCount_[N];
+    std::atomic<uint64_t> assertedUs_[N];
+    uint64_t startUs_[N];  // パルス状態機械が同じチャンネルの開始と完了を直列化する
+};
+
+// スクレイプ時に取得する値
+struct SystemGauges {
+    uint32_t heapFree = 0;
+    uint32_t heapLargestBlock = 0;  // 断片化の目安
+    uint32_t heapMinFree = 0;
+    int32_t wifiRssi = 0;
+    uint32_t wifiReconnects = 0;
+    uint32_t wifiBootToReadyMs = 0;    // 起動からWiFiがつながるまで（まだなら0）
+    uint32_t wifiLastReconnectMs = 0;  // 直近の切断からつながるまで（切れたことがなければ0）
+    uint32_t commandQueueDepth = 0;
+    uint32_t eventQueueDepth = 0;
+    uint32_t stuckOutputs = 0;    // 離せずにやり直しているチャンネル（エキスパンダのNACKなど）
+    uint32_t releaseRetries = 0;  // 離す書き込みに失敗してやり直した回数
+    uint32_t uptimeSeconds = 0;
+};
+
+// Prometheusテキスト形式の書き出し
+//
+// render() を呼ぶたびに、前回の続きからバッファが埋まるまで書き、書いたバイト数を返す。
+// 0 を返したら終わり。ESPAsyncWebServer のチャンク応答のコールバックからそのまま呼べる。
+template <int N>
+class MetricsRenderer {
+public:
+    MetricsRenderer(const HttpMetrics& http, const PulseMetrics<N>& pulses, const SystemGauges& gauges,
+                    const char* const* channelNames)
+        : http_(http), pulses_(pulses), gauges_(gauges), names_(channelNames) {}
+
+    size_t render(char* buf, size_t cap) {
+        size_t written = 0;
+        while (written < cap) {
+            if (lineOff_ == lineLen_) {
+                if (!nextLine()) break;
+            }
+            size_t n = lineLen_ - lineOff_;
+            if (n > cap - written) n = cap - written;
+            memcpy(buf + written, line_ + lineOff_, n);
+            lineOff_ += n;
+            written += n;
+        }
+        return written;
+    }
+
+private:
+    enum Family {
+        Requests,
+        Duration,
+        Pulses,
+        Asserted,
+        HeapFree,
+        HeapLargest,
+        HeapMin,
+        Rssi,
+        Reconnects,
+        WifiBootReady,
+        WifiReconnectTime,
+        CommandQueue,
+        EventQueue,
+        StuckOutputs,
+        ReleaseRetries,
+        Uptime,
+        Done
+    };
+
+    static constexpr int HISTOGRAM_LINES = LATENCY_BUCKET_COUNT + 3;  // バケット + +Inf + _sum + _count
+
+    // 各メトリクスは HELP, TYPE の2行に続いてサンプル行を出す
+    bool nextLine() {
+        lineOff_ = 0;
+        lineLen_ = 0;
+        while (family_ != Done) {
+            if (item_ < 2) {
+                writeHeader(item_ == 0);
+                item_++;
+                return true;
+            }
+            if (writeSample(item_ - 2)) {
+                item_++;
+                return true;
+            }
+            family_ = (Family)(family_ + 1);
+            item_ = 0;
+        }
+        return false;
+    }
+
+    void writeHeader(bool help) {
+        const char* name;
+        const char* type;
+        const char* text;
+        switch (family_) {
+            case Requests:     name = "wol_http_requests_total"; type = "counter"; text = "HTTP requests handled, by route"; break;
+            case Duration:     name = "wol_http_request_duration_seconds"; type = "histogram"; text = "Time spent in the request handler"; break;
+            case Pulses:       name = "wol_pulses_total"; type = "counter"; text = "Power button pulses started, by channel and kind"; break;
+            case Asserted:     name = "wol_pulse_asserted_seconds_total"; type = "counter"; text = "Total time the photocoupler output was held high"; break;
+            case HeapFree:     name = "wol_heap_free_bytes"; type = "gauge"; text = "Free heap"; break;
+            case HeapLargest:  name = "wol_heap_largest_free_block_bytes"; type = "gauge"; text = "Largest allocatable heap block"; break;
+            case HeapMin:      name = "wol_heap_min_free_bytes"; type = "gauge"; text = "Lowest free heap since boot"; break;
+            case Rssi:         name = "wol_wifi_rssi_dbm"; type = "gauge"; text = "WiFi signal strength"; break;
+            case Reconnects:   name = "wol_wifi_reconnects_total"; type = "counter"; text = "WiFi reconnections after the first connect"; break;
+            case WifiBootReady: name = "wol_wifi_boot_to_ready_seconds"; type = "gauge"; text = "Time from boot until WiFi was connected"; break;
+            case WifiReconnectTime: name = "wol_wifi_last_reconnect_seconds"; type = "gauge"; text = "Time the last WiFi outage took to recover"; break;
+            case CommandQueue: name = "wol_command_queue_depth"; type = "gauge"; text = "Power commands waiting for the worker"; break;
+            case EventQueue:   name = "wol_event_queue_depth"; type = "gauge"; text = "Power events waiting to be sent to SSE clients"; break;
+            case StuckOutputs: name = "wol_output_stuck_channels"; type = "gauge"; text = "Channels whose button could not be released yet (retrying)"; break;
+            case ReleaseRetries: name = "wol_output_release_retries_total"; type = "counter"; text = "Button releases that failed on the I/O expander and were retried"; break;
+            default:           name = "wol_uptime_seconds"; type = "gauge"; text = "Seconds since boot"; break;
+        }
+        if (help) {
+            format("# HELP %s %s\n", name, text);
+        } else {
+            format("# TYPE %s %s\n", name, type);
+        }
+    }
+
+    // i 番目のサンプル行を書く。なければ false
+    bool writeSample(int i) {
+        switch (family_) {
+            case Requests:
+                if (i >= HttpMetrics::ROUTES) return false;
+                format("wol_http_requests_total{route=\"%s\"} %lu\n", routeLabel((Route)i),
+                       (unsigned long)http_.count(i));
+                return true;
+            case Duration: {
+                if (i >= HttpMetrics::ROUTES * HISTOGRAM_LINES) return false;
+                int route = i / HISTOGRAM_LINES;
+                int k = i % HISTOGRAM_LINES;
+                const char* label = routeLabel((Route)route);
+                if (k < LATENCY_BUCKET_COUNT) {
+                    format("wol_http_request_duration_seconds_bucket{route=\"%s\",le=\"%s\"} %lu\n", label,
+                           LATENCY_BUCKET_LABELS[k], (unsigned long)http_.cumulative(route, k));
+                } else if (k == LATENCY_BUCKET_COUNT) {
+                    format("wol_http_request_duration_seconds_bucket{route=\"%s\",le=\"+Inf\"} %lu\n", label,
+                           (unsigned long)http_.cumulative(route, LATENCY_BUCKET_COUNT));
+                } else if (k == LATENCY_BUCKET_COUNT + 1) {
+                    uint64_t us = http_.sumUs(route);
+                    format("wol_http_request_duration_seconds_sum{route=\"%s\"} %llu.%06llu\n", label,
+                           (unsigned long long)(us / 1000000), (unsigned long long)(us % 1000000));
+                } else {
+                    format("wol_http_request_duration_seconds_count{route=\"%s\"} %lu\n", label,
+                           (unsigned long)http_.count(route));
+                }
+                return true;
+            }
+            case Pulses: {
+                if (i >= N * 2) return false;
+                int channel = i / 2;
+                PulseKind kind = (i & 1) ? PulseKind::Long : PulseKind::Short;
+                char name[48];
+                escapeLabel(names_[channel], name, sizeof(name));
+                format("wol_pulses_total{channel=\"%d\",name=\"%s\",kind=\"%s\"} %lu\n", channel, name,
+                       kind == PulseKind::Long ? "long" : "short", (unsigned long)pulses_.count(channel, kind));
+                return true;
+            }
+            case Asserted: {
+                if (i >= N) return false;
+                char name[48];
+                escapeLabel(names_[i], name, sizeof(name));
+                uint64_t us = pulses_.assertedUs(i);
+                format("wol_pulse_asserted_seconds_total{channel=\"%d\",name=\"%s\"} %llu.%06llu\n", i, name,
+                       (unsigned long long)(us / 1000000), (unsigned long long)(us % 1000000));
+                return true;
+            }
+            default:
+                if (i >= 1) return false;
+                writeGauge();
+                return true;
+        }
+    }
+
+    void writeGauge() {
+        switch (family_) {
+            case HeapFree:     format("wol_heap_free_bytes %lu\n", (unsigned long)gauges_.heapFree); break;
+            case HeapLargest:  format("wol_heap_largest_free_block_bytes %lu\n", (unsigned long)gauges_.heapLargestBlock); break;
+            case HeapMin:      format("wol_heap_min_free_bytes %lu\n", (unsigned long)gauges_.heapMinFree); break;
+            case Rssi:         format("wol_wifi_rssi_dbm %ld\n", (long)gauges_.wifiRssi); break;
+            case Reconnects:   format("wol_wifi_reconnects_total %lu\n", (unsigned long)gauges_.wifiReconnects); break;
+            case WifiBootReady: writeSeconds("wol_wifi_boot_to_ready_seconds", gauges_.wifiBootToReadyMs); break;
+            case WifiReconnectTime: writeSeconds("wol_wifi_last_reconnect_seconds", gauges_.wifiLastReconnectMs); break;
+            case CommandQueue: format("wol_command_queue_depth %lu\n", (unsigned long)gauges_.commandQueueDepth); break;
+            case EventQueue:   format("wol_event_queue_depth %lu\n", (unsigned long)gauges_.eventQueueDepth); break;
+            case StuckOutputs: format("wol_output_stuck_channels %lu\n", (unsigned long)gauges_.stuckOutputs); break;
+            case ReleaseRetries: format("wol_output_release_retries_total %lu\n", (unsigned long)gauges_.releaseRetries); break;
+            default:           format("wol_uptime_seconds %lu\n", (unsigned long)gauges_.uptimeSeconds); break;
+        }
+    }
+
+    void writeSeconds(const char* name, uint32_t ms) {
+        format("%s %lu.%03lu\n", name, (unsigned long)(ms / 1000), (unsigned long)(ms % 1000));
+    }
+
+    void format(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(line_, sizeof(line_), fmt, args);
+        va_end(args);
+        lineLen_ = n < 0 ? 0 : ((size_t)n < sizeof(line_) ? (size_t)n : sizeof(line_) - 1);
+    }
+
+    // ラベル値のエスケープ（\ " 改行）
+    static void escapeLabel(const char* in, char* out, size_t cap) {
+        size_t o = 0;
+        for (; *in && o + 2 < cap; in++) {
+            if (*in == '\\' || *in == '"') {
+                out[o++] = '\\';
+                out[o++] = *in;
+            } else if (*in == '\n') {
+                out[o++] = '\\';
+                out[o++] = 'n';
+            } else {
+                out[o++] = *in;
+            }
+        }
+        out[o] = '\0';
+    }
+
+    const HttpMetrics& http_;
+    const PulseMetrics<N>& pulses_;
+    SystemGauges gauges_;
+    const char* const* names_;
+    Family family_ = Requests;
+    int item_ = 0;
+    char line_[192];
+    size_t lineLen_ = 0;
+    size_t lineOff_ = 0;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// 固定長のロックフリーリングバッファ（複数生産者・単一消費者）
+//
+// 各スロットが持つシーケンス番号で生産者同士の競合を解決する（Vyukov方式）。
+// 容量は2のべき乗。満杯なら tryPush() は false を返し、呼び出し側で捨てるか503等にする。
+// AsyncTCPタスクやesp_timerタスクから投入し、別タスクで取り出す用途を想定している。
+template <typename T, size_t Capacity>
+class MpscRing {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "Capacity must be a power of two");
+
+public:
+    MpscRing() : head_(0), tail_(0) {
+        for (size_t i = 0; i < Capacity; i++) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool tryPush(const T& item) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots_[pos & (Capacity - 1)];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = item;
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // 満杯
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 消費者は1つだけ
+    bool tryPop(T& item) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Slot& slot = slots_[pos & (Capacity - 1)];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+        if ((intptr_t)seq - (intptr_t)(pos + 1) < 0) return false;  // 空
+        item = slot.value;
+        slot.seq.store(pos + Capacity, std::memory_order_release);
+        tail_.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // おおよその要素数（メトリクス用）
+    size_t size() const {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        return head >= tail ? head - tail : 0;
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    Slot slots_[Capacity];
+    std::atomic<size_t> head_;
+    std::atomic<size_t> tail_;
+};
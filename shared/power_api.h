@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "channel_bitset.h"
+#include "json_writer.h"
+#include "power_commands.h"
+#include "pulse_engine.h"
+
+// 電源操作APIの応答本文（実機・シミュレータ共通）
+
+template <int N>
+inline void writeChannelList(JsonWriter& json, const ChannelMask<N>& channels) {
+    json.beginArray();
+    channels.forEach([&](int channel) { json.value(channel); });
+    json.endArray();
+}
+
+// POST /api/power/batch の受付応答（202）
+// {"success":true,"status":"queued","queued":[0,1,2],"coalesced":[5],"maxConcurrent":2,"duration":1500,"queueDepth":1}
+// 押すのはワーカーで、そのとき実行中のチャンネルはパルスが終わってから押す
+template <int N>
+inline void writeBatchAccepted(JsonWriter& json, const BatchSubmitResult<N>& result, int maxConcurrent,
+                               uint32_t durationMs, size_t queueDepth) {
+    json.beginObject()
+        .field("success", true)
+        .field("status", "queued");
+    json.key("queued");
+    writeChannelList(json, result.queued);
+    json.key("coalesced");
+    writeChannelList(json, result.coalesced);
+    json.field("maxConcurrent", maxConcurrent > 0 ? maxConcurrent : 0)
+        .field("duration", durationMs)
+        .field("queueDepth", queueDepth)
+        .endObject();
+}
+
+// POST /api/power/{i} と /api/longpress/{i} の受付応答（202）
+// {"success":true,"status":"queued","coalesced":false,"message":"...","pcIndex":0,"duration":1500,"queueDepth":1}
+inline void writeCommandAccepted(JsonWriter& json, CommandResult result, int channel, const char* name,
+                                 const char* action, uint32_t durationMs, size_t queueDepth) {
+    json.beginObject()
+        .field("success", true)
+        .field("status", "queued")
+        .field("coalesced", result == CommandResult::Coalesced)
+        .field("message", name, action)
+        .field("pcIndex", channel)
+        .field("duration", durationMs)
+        .field("queueDepth", queueDepth)
+        .endObject();
+}
+
+// GET /api/status（と /api/events の status イベント）の本文の大きさ
+// チャンネルごとの最長は states / sensed の "false,"、desired の "\"off\","、convergence の "\"observing\","、
+// stuck / pressFailed の "999,"、stateBits / sensedBits の "4294967295,"（32チャンネルで1つ）
+constexpr size_t STATUS_JSON_BYTES_PER_CHANNEL = 40;
+constexpr size_t STATUS_JSON_FIXED_BYTES = 160;  // キーと括弧
+static_assert(2 * (sizeof("false,") - 1) + (sizeof("\"off\",") - 1) + (sizeof("\"observing\",") - 1) +
+                  2 * (sizeof("999,") - 1) + (2 * (sizeof("4294967295,") - 1) + 31) / 32 <=
+                  STATUS_JSON_BYTES_PER_CHANNEL,
+              "STATUS_JSON_BYTES_PER_CHANNEL is smaller than the longest channel entry");
+
+template <int N>
+constexpr size_t statusJsonCapacity() {
+    static_assert(N <= 1000, "channel numbers in stuck / pressFailed are budgeted at 3 digits");
+    return STATUS_JSON_FIXED_BYTES + (size_t)N * STATUS_JSON_BYTES_PER_CHANNEL;
+}
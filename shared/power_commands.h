@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "channel_bitset.h"
+#include "mpsc_ring.h"
+#include "pulse_engine.h"
+
+// 電源ボタン操作の要求（HTTPハンドラ → コマンドワーカー）
+// channel が -1 なら一括押しで、channels を maxConcurrent 台ずつのウェーブで通常押しする
+template <int N>
+struct PowerCommand {
+    int16_t channel;
+    PulseKind kind;
+    int16_t maxConcurrent;
+    ChannelMask<N> channels;
+};
+
+// 要求の受付結果
+enum class CommandResult : uint8_t {
+    Queued,         // キューに入れた（ワーカーが順に実行する）
+    Coalesced,      // 同じチャンネル・同じ種類の要求が未実行のまま残っているのでまとめた
+    Full,           // キューが満杯（呼び出し側は503を返す）
+    InvalidChannel  // 範囲外のチャンネル
+};
+
+// 一括押しの受付結果
+template <int N>
+struct BatchSubmitResult {
+    CommandResult result = CommandResult::InvalidChannel;  // Queued（1台でも積んだ） / Coalesced（全部まとめた） / Full
+    ChannelMask<N> queued;                                 // 積んだチャンネル
+    ChannelMask<N> coalesced;                              // 未実行の通常押しにまとめたチャンネル
+};
+
+// 常駐コマンドワーカー用の要求キュー（実機・シミュレータ共通）
+//
+// submit() は複数タスクから呼べる（ロックフリーのリングに積むだけ）。
+// drain() はワーカーだけが呼ぶ。取り出した要求はチャンネルごとの待ち行列に移し、
+// そのチャンネルのパルスが終わるまで次を始めない（同じピンでパルスが重ならない）。
+// 開始前の要求と同じ種類の要求は積まずにまとめるので、チャンネルごとの待ちは最大2件。
+// 一括押しも1件の要求としてリングに積み、チャンネルごとには通常押しと同じくまとめ・順番待ちをする。
+// 取り出した時点で待ちのないチャンネルだけを startBatch() でまとめて押し、残りは通常押しとして順番を待つ。
+template <int N, size_t Capacity>
+class PowerCommandQueue {
+public:
+    PowerCommandQueue() {
+        for (int i = 0; i < N; i++) pending_[i].store(0, std::memory_order_relaxed);
+    }
+
+    CommandResult submit(int channel, PulseKind kind) {
+        if (channel < 0 || channel >= N) return CommandResult::InvalidChannel;
+        uint8_t bit = kindBit(kind);
+        if (pending_[channel].fetch_or(bit, std::memory_order_acq_rel) & bit) {
+            return CommandResult::Coalesced;
+        }
+        PowerCommand<N> command;
+        command.channel = (int16_t)channel;
+        command.kind = kind;
+        command.maxConcurrent = 0;
+        if (!ring_.tryPush(command)) {
+            pending_[channel].fetch_and((uint8_t)~bit, std::memory_order_acq_rel);
+            return CommandResult::Full;
+        }
+        return CommandResult::Queued;
+    }
+
+    // channels を同時に通常押しする（maxConcurrent <= 0 なら上限なし）
+    BatchSubmitResult<N> submitBatch(const ChannelMask<N>& channels, int maxConcurrent) {
+        BatchSubmitResult<N> result;
+        uint8_t bit = kindBit(PulseKind::Short);
+        channels.forEach([&](int channel) {
+            if (pending_[channel].fetch_or(bit, std::memory_order_acq_rel) & bit) {
+                result.coalesced.set(channel);
+            } else {
+                result.queued.set(channel);
+            }
+        });
+        if (!result.queued.any()) {
+            result.result = result.coalesced.any() ? CommandResult::Coalesced : CommandResult::InvalidChannel;
+            return result;
+        }
+        PowerCommand<N> command;
+        command.channel = -1;
+        command.kind = PulseKind::Short;
+        command.maxConcurrent = (int16_t)(maxConcurrent > 0 ? maxConcurrent : 0);
+        command.channels = result.queued;
+        if (!ring_.tryPush(command)) {
+            result.queued.forEach([&](int channel) {
+                pending_[channel].fetch_and((uint8_t)~bit, std::memory_order_acq_rel);
+            });
+            result.result = CommandResult::Full;
+            return result;
+        }
+        result.result = CommandResult::Queued;
+        return result;
+    }
+
+    // 溜まった要求を実行する（ワーカーから呼ぶ）
+    // start(channel, kind) は PulseResult を返す。Busy なら待ち行列に残し、次の drain() で再試行する
+    // startBatch(channels, maxConcurrent) は PulseBatchResult<N> を返す。busy のチャンネルは通常押しとして待たせる
+    template <typename StartFn, typename BatchFn>
+    void drain(StartFn start, BatchFn startBatch) {
+        PowerCommand<N> command;
+        while (ring_.tryPop(command)) {
+            if (command.channel < 0) {
+                // 先に待っている要求があるチャンネルは、その後に通常押しとして並べる
+                ChannelMask<N> ready;
+                command.channels.forEach([&](int channel) {
+                    if (waiting_[channel].count == 0) {
+                        ready.set(channel);
+                    } else {
+                        enqueue(channel, PulseKind::Short);
+                    }
+                });
+                if (!ready.any()) continue;
+                PulseBatchResult<N> result = startBatch(ready, (int)command.maxConcurrent);
+                uint8_t bit = kindBit(PulseKind::Short);
+                ready.forEach([&](int channel) {
+                    if (result.busy.test(channel)) {
+                        enqueue(channel, PulseKind::Short);
+                    } else {
+                        pending_[channel].fetch_and((uint8_t)~bit, std::memory_order_acq_rel);
+                    }
+                });
+                continue;
+            }
+            enqueue(command.channel, command.kind);
+        }
+
+        ChannelMask<N> channels = waitingChannels_;
+        channels.forEach([&](int channel) {
+            Waiting& w = waiting_[channel];
+            PulseKind kind = w.kinds[0];
+            if (start(channel, kind) == PulseResult::Busy) return;
+            // 開始したらまとめ対象から外す（以降の同じ要求は次のパルスとして積む）
+            pending_[channel].fetch_and((uint8_t)~kindBit(kind), std::memory_order_acq_rel);
+            w.kinds[0] = w.kinds[1];
+            w.count--;
+            waitingCount_.fetch_sub(1, std::memory_order_relaxed);
+            if (w.count == 0) waitingChannels_.set(channel, false);
+        });
+    }
+
+    // 未実行の要求数（リング内 + チャンネル待ち）
+    size_t depth() const {
+        return ring_.size() + (size_t)waitingCount_.load(std::memory_order_relaxed);
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    struct Waiting {
+        PulseKind kinds[2];
+        uint8_t count = 0;
+    };
+
+    static uint8_t kindBit(PulseKind kind) { return kind == PulseKind::Long ? 2 : 1; }
+
+    void enqueue(int channel, PulseKind kind) {
+        Waiting& w = waiting_[channel];
+        w.kinds[w.count++] = kind;
+        waitingChannels_.set(channel);
+        waitingCount_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    MpscRing<PowerCommand<N>, Capacity> ring_;
+    std::atomic<uint8_t> pending_[N];
+    // 以下はワーカーだけが触る
+    Waiting waiting_[N];
+    ChannelMask<N> waitingChannels_;
+    std::atomic<int> waitingCount_{0};
+};
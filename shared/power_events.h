@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "json_writer.h"
+#include "pulse_engine.h"
+
+// /api/events で配信する電源イベント（実機・シミュレータ共通）
+enum class PowerEventType : uint8_t {
+    PulseStart,  // パルス開始（ピンHIGH）
+    PulseEnd,    // パルス終了（ピンLOW）。on は終了後の状態
+    State,       // 電源LED入力で検出した状態変化
+    PulseFailed  // ピンに書けず押せなかった。on は変わらない状態
+};
+
+struct PowerEvent {
+    uint32_t seq;
+    int16_t channel;
+    PowerEventType type;
+    PulseKind kind;
+    bool on;
+};
+
+// SSEのイベントIDとして使う通し番号
+inline uint32_t nextPowerEventSeq() {
+    static std::atomic<uint32_t> seq(0);
+    return seq.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+inline PowerEvent makePowerEvent(int channel, PowerEventType type, PulseKind kind, bool on) {
+    PowerEvent event;
+    event.seq = nextPowerEventSeq();
+    event.channel = (int16_t)channel;
+    event.type = type;
+    event.kind = kind;
+    event.on = on;
+    return event;
+}
+
+inline const char* powerEventTypeName(PowerEventType type) {
+    switch (type) {
+        case PowerEventType::PulseStart:  return "pulse_start";
+        case PowerEventType::PulseEnd:    return "pulse_end";
+        case PowerEventType::State:       return "state";
+        case PowerEventType::PulseFailed: return "pulse_failed";
+    }
+    return "unknown";
+}
+
+// イベント本文（SSEのdata部）: {"seq":1,"ch":3,"type":"pulse_end","kind":"short","on":true}
+// 状態検出イベントには kind を付けない
+inline void writePowerEvent(JsonWriter& json, const PowerEvent& event) {
+    json.beginObject()
+        .field("seq", event.seq)
+        .field("ch", event.channel)
+        .field("type", powerEventTypeName(event.type));
+    if (event.type != PowerEventType::State) {
+        json.field("kind", event.kind == PulseKind::Long ? "long" : "short");
+    }
+    json.field("on", event.on).endObject();
+}
+
+// SSEの1イベント分を組み立てる（ESPAsyncWebServerのAsyncEventSourceを使わない側で使用）
+// 容量不足の場合は0を返す
+inline size_t formatSseEvent(char* buf, size_t capacity, const char* eventName,
+                             uint32_t id, const char* data) {
+    int n = snprintf(buf, capacity, "id: %u\nevent: %s\ndata: %s\n\n", (unsigned)id, eventName, data);
+    if (n < 0 || (size_t)n >= capacity) return 0;
+    return (size_t)n;
+}
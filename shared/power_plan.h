@@ -0,0 +1,513 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "json_writer.h"
+#include "power_commands.h"
+
+// 電源投入プラン（実機・シミュレータ共通、POST /api/plan/{name}）
+//
+// プランはチャンネルを押すステップのDAG。各ステップは先行ステップ（最大 PLAN_MAX_DEPS）が準備完了してから
+// 辺ごとの遅延だけ待って押す。押してから準備完了までを「起動中」とし、同時に起動中のステップを maxConcurrent
+// までに抑える（PDUの突入電流対策）。押せるステップが複数あれば、そこから最後のステップまでの最長経路
+// （遅延 + パルス幅の和）が長いものから押す（全体の立ち上げ時間を短くするため）。
+//
+// 準備完了の判定（PlanStep::ready）：
+//   nullptr / ""  : パルスが終わった時点
+//   "sense"       : 電源LED入力がON（入力のないチャンネルでは開始できない）
+//   "<host>:<port>" : TCP接続できた（PLAN_PROBE_INTERVAL_MS ごとに試す）
+// 電源LED入力でONと分かっている、または押す前にTCP接続できたステップは押さずに準備完了にする（押すと切れる）。
+//
+// PlanRunner はスレッドセーフではないので呼び出し側で直列化する。TCP接続はブロックするので、
+// dueProbes() で対象を取り出し、ロックの外で接続を試して probeResult() で返す。
+// Platform: CommandResult press(int channel);   // 電源ボタンを押す（キューに積む）
+//           int powerState(int channel);         // 電源LED入力 1:ON 0:OFF -1:入力なし
+
+static constexpr int PLAN_MAX_DEPS = 4;
+static constexpr int PLAN_MAX_STEPS = 64;
+static constexpr uint32_t PLAN_PROBE_INTERVAL_MS = 2000;
+// 1回の poll で取り出す確認の数（残りは次の poll で取り出す。実機では probes をタスクのスタックに置く）
+static constexpr int PLAN_MAX_PROBES_PER_POLL = 4;
+
+struct PlanDep {
+    int channel = -1;      // 先行ステップのチャンネル（-1 は未使用）
+    uint32_t delayMs = 0;  // 先行ステップの準備完了から押すまで
+};
+
+struct PlanStep {
+    int channel;
+    const char* ready;
+    PlanDep after[PLAN_MAX_DEPS];
+};
+
+struct PowerPlan {
+    const char* name;
+    const PlanStep* steps;
+    int stepCount;
+    int maxConcurrent;        // 同時に起動中のステップ数の上限（0なら上限なし）
+    uint32_t readyTimeoutMs;  // 押してから準備完了までの上限。超えたら失敗
+};
+
+// POWER_PLANS を空にできないときの埋め草（名前のないプランは一覧に出さず、開始もできない）
+constexpr PowerPlan NO_POWER_PLAN = {nullptr, nullptr, 0, 0, 0};
+
+template <size_t S>
+constexpr PowerPlan powerPlan(const char* name, const PlanStep (&steps)[S], int maxConcurrent,
+                              uint32_t readyTimeoutMs) {
+    return PowerPlan{name, steps, (int)S, maxConcurrent, readyTimeoutMs};
+}
+
+// ---- コンパイル時の検証（static_assert(powerPlansValid(POWER_PLANS, NUM_PHOTOCOUPLERS))） ----
+
+constexpr bool planNameChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_' ||
+           c == '.';
+}
+
+constexpr bool planNameEqual(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+// "sense" / "<host>:<port>" のポート部分。不正なら0
+constexpr uint32_t planReadyPort(const char* ready) {
+    const char* colon = nullptr;
+    for (const char* p = ready; *p; p++) {
+        if (*p == ':') colon = p;
+    }
+    if (!colon || colon == ready || colon[1] == '\0') return 0;
+    uint32_t port = 0;
+    for (const char* p = colon + 1; *p; p++) {
+        if (*p < '0' || *p > '9' || port > 65535) return 0;
+        port = port * 10 + (uint32_t)(*p - '0');
+    }
+    return port <= 65535 ? port : 0;
+}
+
+constexpr bool planReadyValid(const char* ready) {
+    return ready == nullptr || ready[0] == '\0' || planNameEqual(ready, "sense") || planReadyPort(ready) != 0;
+}
+
+constexpr int planStepOf(const PowerPlan& plan, int channel) {
+    for (int i = 0; i < plan.stepCount; i++) {
+        if (plan.steps[i].channel == channel) return i;
+    }
+    return -1;
+}
+
+constexpr bool powerPlanValid(const PowerPlan& plan, int channels) {
+    if (!plan.name) return plan.stepCount == 0;
+    if (!plan.name[0] || plan.stepCount < 1 || plan.stepCount > PLAN_MAX_STEPS ||
+        plan.maxConcurrent < 0) {
+        return false;
+    }
+    for (const char* p = plan.name; *p; p++) {
+        if (!planNameChar(*p)) return false;
+    }
+    int pending[PLAN_MAX_STEPS] = {};  // 未処理の先行ステップ数
+    for (int i = 0; i < plan.stepCount; i++) {
+        const PlanStep& step = plan.steps[i];
+        if (step.channel < 0 || step.channel >= channels || planStepOf(plan, step.channel) != i) return false;
+        if (!planReadyValid(step.ready)) return false;
+        for (int d = 0; d < PLAN_MAX_DEPS; d++) {
+            int dep = step.after[d].channel;
+            if (dep == -1) continue;
+            if (dep == step.channel || planStepOf(plan, dep) < 0) return false;
+            for (int e = 0; e < d; e++) {
+                if (step.after[e].channel == dep) return false;
+            }
+            pending[i]++;
+        }
+    }
+    // 先行のないステップから順に消していき、全部消せなければ循環がある
+    bool done[PLAN_MAX_STEPS] = {};
+    for (int removed = 0; removed < plan.stepCount; removed++) {
+        int next = -1;
+        for (int i = 0; i < plan.stepCount && next < 0; i++) {
+            if (!done[i] && pending[i] == 0) next = i;
+        }
+        if (next < 0) return false;
+        done[next] = true;
+        for (int i = 0; i < plan.stepCount; i++) {
+            for (int d = 0; d < PLAN_MAX_DEPS; d++) {
+                if (plan.steps[i].after[d].channel == plan.steps[next].channel) pending[i]--;
+            }
+        }
+    }
+    return true;
+}
+
+template <size_t P>
+constexpr bool powerPlansValid(const PowerPlan (&plans)[P], int channels) {
+    for (size_t i = 0; i < P; i++) {
+        if (!powerPlanValid(plans[i], channels)) return false;
+        for (size_t j = 0; j < i; j++) {
+            if (plans[i].name && plans[j].name && planNameEqual(plans[i].name, plans[j].name)) return false;
+        }
+    }
+    return true;
+}
+
+// name（長さ len）のプラン。なければ nullptr
+template <size_t P>
+const PowerPlan* findPowerPlan(const PowerPlan (&plans)[P], const char* name, size_t len) {
+    for (size_t i = 0; i < P; i++) {
+        if (!plans[i].name) continue;
+        if (strlen(plans[i].name) == len && memcmp(plans[i].name, name, len) == 0) return &plans[i];
+    }
+    return nullptr;
+}
+
+// ---- 実行 ----
+
+enum class PlanState : uint8_t { Idle, Running, Succeeded, Failed, Cancelled };
+
+inline const char* planStateName(PlanState state) {
+    switch (state) {
+        case PlanState::Idle:      return "idle";
+        case PlanState::Running:   return "running";
+        case PlanState::Succeeded: return "succeeded";
+        case PlanState::Failed:    return "failed";
+        case PlanState::Cancelled: return "cancelled";
+    }
+    return "unknown";
+}
+
+enum class PlanStepState : uint8_t {
+    Pending,   // 先行ステップか遅延を待っている
+    Checking,  // 押す前に、既に起動していないかTCPで確かめている
+    Waiting,   // 押せるが同時起動数の空きを待っている
+    Started,   // 押した。準備完了を待っている
+    Ready,
+    Failed,    // 準備完了しなかった、または押せなかった
+    Skipped    // 先行ステップの失敗か中止で押さなかった
+};
+
+inline const char* planStepStateName(PlanStepState state) {
+    switch (state) {
+        case PlanStepState::Pending:  return "pending";
+        case PlanStepState::Checking: return "checking";
+        case PlanStepState::Waiting:  return "waiting";
+        case PlanStepState::Started:  return "started";
+        case PlanStepState::Ready:    return "ready";
+        case PlanStepState::Failed:   return "failed";
+        case PlanStepState::Skipped:  return "skipped";
+    }
+    return "unknown";
+}
+
+enum class PlanStartResult : uint8_t {
+    Started,
+    Busy,    // 別のプランを実行中
+    NoSense  // "sense" のステップのチャンネルに電源LED入力がない（badChannel）
+};
+
+// TCPで確かめる対象（host は NUL 終端）
+struct PlanProbe {
+    uint32_t run;  // start() ごとに変わる（前の実行の結果を捨てるため）
+    int step;
+    char host[64];
+    uint16_t port;
+};
+
+template <int N, typename Platform>
+class PlanRunner {
+public:
+    PlanRunner(Platform& platform, uint32_t pulseMs) : platform_(platform), pulseMs_(pulseMs) {}
+
+    PlanStartResult start(const PowerPlan& plan, uint32_t nowMs, int& badChannel) {
+        if (state_ == PlanState::Running) return PlanStartResult::Busy;
+        for (int i = 0; i < plan.stepCount; i++) {
+            if (checkOf(plan.steps[i]) == Check::Sense && platform_.powerState(plan.steps[i].channel) < 0) {
+                badChannel = plan.steps[i].channel;
+                return PlanStartResult::NoSense;
+            }
+        }
+        plan_ = &plan;
+        runId_++;
+        nextProbeStep_ = 0;
+        state_ = PlanState::Running;
+        startMs_ = nowMs;
+        endMs_ = 0;
+        for (int i = 0; i < plan.stepCount; i++) steps_[i] = StepRun();
+        computePriorities();
+        poll(nowMs);
+        return PlanStartResult::Started;
+    }
+
+    // まだ押していないステップを押さずに終える（押したステップは started のまま残る）
+    bool cancel(uint32_t nowMs) {
+        if (state_ != PlanState::Running) return false;
+        for (int i = 0; i < plan_->stepCount; i++) {
+            if (!terminal(steps_[i].state) && !steps_[i].pressed) steps_[i].state = PlanStepState::Skipped;
+        }
+        finish(PlanState::Cancelled, nowMs);
+        return true;
+    }
+
+    void poll(uint32_t nowMs) {
+        if (state_ != PlanState::Running) return;
+        const int count = plan_->stepCount;
+        bool progressed = true;
+        while (progressed) {
+            progressed = false;
+            for (int i = 0; i < count; i++) {
+                StepRun& run = steps_[i];
+                const PlanStep& step = plan_->steps[i];
+                if (run.state == PlanStepState::Started) {
+                    progressed |= pollStarted(i, nowMs);
+                } else if (run.state == PlanStepState::Pending) {
+                    int blocked = depsState(i, nowMs);
+                    if (blocked < 0) {
+                        run.state = PlanStepState::Skipped;
+                        progressed = true;
+                    } else if (blocked == 0) {
+                        if (platform_.powerState(step.channel) == 1) {
+                            markReady(i, nowMs, true);
+                        } else {
+                            run.state = checkOf(step) == Check::Tcp && platform_.powerState(step.channel) < 0
+                                            ? PlanStepState::Checking
+                                            : PlanStepState::Waiting;
+                        }
+                        progressed = true;
+                    }
+                }
+            }
+            progressed |= pressWaiting(nowMs);
+        }
+
+        bool allDone = true;
+        bool anyFailed = false;
+        for (int i = 0; i < count; i++) {
+            allDone &= terminal(steps_[i].state);
+            anyFailed |= steps_[i].state != PlanStepState::Ready;
+        }
+        if (allDone) finish(anyFailed ? PlanState::Failed : PlanState::Succeeded, nowMs);
+    }
+
+    // TCPで確かめる時期が来たステップを out に書き、数を返す（結果は probeResult() で返す）
+    // cap 個で打ち切ったときは次の呼び出しを続きのステップから探す（先頭のステップばかり確かめない）
+    int dueProbes(uint32_t nowMs, PlanProbe* out, int cap) {
+        if (state_ != PlanState::Running) return 0;
+        int n = 0;
+        int count = plan_->stepCount;
+        for (int k = 0; k < count && n < cap; k++) {
+            int i = (nextProbeStep_ + k) % count;
+            StepRun& run = steps_[i];
+            bool due = run.state == PlanStepState::Checking ||
+                       (run.state == PlanStepState::Started && checkOf(plan_->steps[i]) == Check::Tcp &&
+                        (int32_t)(nowMs - run.nextProbeMs) >= 0);
+            if (!due || run.probing) continue;
+            run.probing = true;
+            run.nextProbeMs = nowMs + PLAN_PROBE_INTERVAL_MS;
+            const char* ready = plan_->steps[i].ready;
+            size_t hostLen = strrchr(ready, ':') - ready;
+            if (hostLen >= sizeof(out[n].host)) hostLen = sizeof(out[n].host) - 1;
+            out[n].run = runId_;
+            out[n].step = i;
+            memcpy(out[n].host, ready, hostLen);
+            out[n].host[hostLen] = '\0';
+            out[n].port = (uint16_t)planReadyPort(ready);
+            n++;
+            nextProbeStep_ = (i + 1) % count;
+        }
+        return n;
+    }
+
+    void probeResult(const PlanProbe& probe, bool reachable, uint32_t nowMs) {
+        if (state_ != PlanState::Running || probe.run != runId_) return;
+        int step = probe.step;
+        StepRun& run = steps_[step];
+        run.probing = false;
+        if (run.state == PlanStepState::Checking) {
+            if (reachable) {
+                markReady(step, nowMs, true);
+            } else {
+                run.state = PlanStepState::Waiting;
+            }
+        } else if (run.state == PlanStepState::Started && reachable) {
+            markReady(step, nowMs, false);
+        }
+        poll(nowMs);
+    }
+
+    PlanState state() const { return state_; }
+    bool running() const { return state_ == PlanState::Running; }
+    const PowerPlan* plan() const { return plan_; }
+
+    // {"plan":"cluster","state":"running","elapsedMs":41200,"maxConcurrent":2,"starting":2,
+    //  "steps":[{"channel":0,"name":"proxmox001","state":"ready","check":"sense","pressedMs":0,"readyMs":38000,
+    //            "alreadyOn":false},...]}
+    // 時刻は開始からのミリ秒（まだなら null）
+    void writeJson(JsonWriter& json, uint32_t nowMs, const char* const* names) const {
+        json.beginObject();
+        if (!plan_) {
+            json.field("state", planStateName(state_)).endObject();
+            return;
+        }
+        int starting = 0;
+        for (int i = 0; i < plan_->stepCount; i++) starting += steps_[i].state == PlanStepState::Started;
+        json.field("plan", plan_->name)
+            .field("state", planStateName(state_))
+            .field("elapsedMs", (state_ == PlanState::Running ? nowMs : endMs_) - startMs_)
+            .field("maxConcurrent", plan_->maxConcurrent)
+            .field("starting", starting)
+            .key("steps").beginArray();
+        for (int i = 0; i < plan_->stepCount; i++) {
+            const PlanStep& step = plan_->steps[i];
+            const StepRun& run = steps_[i];
+            json.beginObject()
+                .field("channel", step.channel)
+                .field("name", names[step.channel])
+                .field("state", planStepStateName(run.state))
+                .field("check", step.ready && step.ready[0] ? step.ready : "pulse");
+            writeTime(json, "pressedMs", run.pressed, run.pressedMs - startMs_);
+            writeTime(json, "readyMs", run.state == PlanStepState::Ready, run.readyMs - startMs_);
+            json.field("alreadyOn", run.alreadyOn).endObject();
+        }
+        json.endArray().endObject();
+    }
+
+private:
+    enum class Check : uint8_t { Pulse, Sense, Tcp };
+
+    struct StepRun {
+        PlanStepState state = PlanStepState::Pending;
+        bool pressed = false;
+        bool alreadyOn = false;
+        bool probing = false;
+        uint32_t pressedMs = 0;
+        uint32_t readyMs = 0;
+        uint32_t nextProbeMs = 0;
+        uint32_t priority = 0;  // ここから最後のステップまでの最長経路（ミリ秒）
+    };
+
+    static Check checkOf(const PlanStep& step) {
+        if (!step.ready || !step.ready[0]) return Check::Pulse;
+        return planNameEqual(step.ready, "sense") ? Check::Sense : Check::Tcp;
+    }
+
+    static bool terminal(PlanStepState state) {
+        return state == PlanStepState::Ready || state == PlanStepState::Failed || state == PlanStepState::Skipped;
+    }
+
+    // 0: 押せる  1: まだ  -1: 先行ステップが失敗した
+    int depsState(int index, uint32_t nowMs) const {
+        int result = 0;
+        for (const PlanDep& dep : plan_->steps[index].after) {
+            if (dep.channel < 0) continue;
+            const StepRun& run = steps_[planStepOf(*plan_, dep.channel)];
+            if (run.state == PlanStepState::Failed || run.state == PlanStepState::Skipped) return -1;
+            if (run.state != PlanStepState::Ready || (int32_t)(nowMs - (run.readyMs + dep.delayMs)) < 0) result = 1;
+        }
+        return result;
+    }
+
+    bool pollStarted(int index, uint32_t nowMs) {
+        StepRun& run = steps_[index];
+        const PlanStep& step = plan_->steps[index];
+        bool pulseDone = (int32_t)(nowMs - (run.pressedMs + pulseMs_)) >= 0;
+        Check check = checkOf(step);
+        if (pulseDone && (check == Check::Pulse || (check == Check::Sense && platform_.powerState(step.channel) == 1))) {
+            markReady(index, nowMs, false);
+            return true;
+        }
+        if (nowMs - run.pressedMs > plan_->readyTimeoutMs) {
+            run.state = PlanStepState::Failed;
+            return true;
+        }
+        return false;
+    }
+
+    // 空きがある分だけ、優先度の高い順に押す
+    bool pressWaiting(uint32_t nowMs) {
+        int starting = 0;
+        for (int i = 0; i < plan_->stepCount; i++) starting += steps_[i].state == PlanStepState::Started;
+        bool progressed = false;
+        while (plan_->maxConcurrent == 0 || starting < plan_->maxConcurrent) {
+            int best = -1;
+            for (int i = 0; i < plan_->stepCount; i++) {
+                if (steps_[i].state != PlanStepState::Waiting || steps_[i].pressed) continue;
+                if (best < 0 || steps_[i].priority > steps_[best].priority) best = i;
+            }
+            if (best < 0) break;
+            StepRun& run = steps_[best];
+            progressed = true;
+            if (platform_.powerState(plan_->steps[best].channel) == 1) {
+                markReady(best, nowMs, true);  // 待っている間に電源が入った
+                continue;
+            }
+            CommandResult result = platform_.press(plan_->steps[best].channel);
+            if (result == CommandResult::Full) break;  // 次の poll() で押し直す
+            if (result == CommandResult::InvalidChannel) {
+                run.state = PlanStepState::Failed;
+            } else {
+                run.state = PlanStepState::Started;
+                run.pressed = true;
+                run.pressedMs = nowMs;
+                run.nextProbeMs = nowMs + pulseMs_;
+                starting++;
+            }
+        }
+        return progressed;
+    }
+
+    void markReady(int index, uint32_t nowMs, bool alreadyOn) {
+        steps_[index].state = PlanStepState::Ready;
+        steps_[index].readyMs = nowMs;
+        steps_[index].alreadyOn = alreadyOn;
+    }
+
+    void finish(PlanState state, uint32_t nowMs) {
+        state_ = state;
+        endMs_ = nowMs;
+    }
+
+    // 後ろのステップから決まるので、値が変わらなくなるまで繰り返す（DAGなので stepCount 回で収まる）
+    void computePriorities() {
+        const int count = plan_->stepCount;
+        for (int pass = 0; pass < count; pass++) {
+            bool changed = false;
+            for (int i = 0; i < count; i++) {
+                uint32_t longest = 0;
+                for (int j = 0; j < count; j++) {
+                    for (const PlanDep& dep : plan_->steps[j].after) {
+                        if (dep.channel != plan_->steps[i].channel) continue;
+                        uint32_t path = dep.delayMs + steps_[j].priority;
+                        if (path > longest) longest = path;
+                    }
+                }
+                uint32_t priority = pulseMs_ + longest;
+                if (priority != steps_[i].priority) {
+                    steps_[i].priority = priority;
+                    changed = true;
+                }
+            }
+            if (!changed) break;
+        }
+    }
+
+    static void writeTime(JsonWriter& json, const char* name, bool set, uint32_t ms) {
+        json.key(name);
+        if (set) {
+            json.value(ms);
+        } else {
+            json.raw("null");
+        }
+    }
+
+    Platform& platform_;
+    uint32_t pulseMs_;
+    const PowerPlan* plan_ = nullptr;
+    PlanState state_ = PlanState::Idle;
+    uint32_t runId_ = 0;
+    int nextProbeStep_ = 0;
+    uint32_t startMs_ = 0;
+    uint32_t endMs_ = 0;
+    StepRun steps_[N];  // チャンネルは重複しないので N で足りる
+};
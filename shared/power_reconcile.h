@@ -0,0 +1,349 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "json_writer.h"
+#include "power_commands.h"
+#include "power_plan.h"
+#include "pulse_engine.h"
+
+// 電源の目標状態（実機・シミュレータ共通、PUT /api/state/{i}）
+//
+// /api/power は押すたびに反転するので、タイムアウトした要求を自動化が送り直すとPCを切り戻してしまう。
+// ここではチャンネルごとに目標（on / off）だけを覚え、観測した電源状態と違うときだけ押す。
+// 同じ目標を何度送っても、合っていれば押さない。
+//
+// 観測：電源LED入力があればその値（デバウンス済み）。なければ POWER_STATE_PROBES の "<host>:<port>" へのTCP接続で、
+//   接続できれば on、RECONCILE_PROBE_MISSES 回続けて失敗したら off とする（1回の失敗では切れたとみなさない）。
+//   どちらもないチャンネルには目標を置けない（押下ごとの反転による推定では、合っているか分からない）。
+//
+// 違っていれば押して変わるのを待ち（通常押しは onTimeoutMs / offTimeoutMs、長押しはパルス幅 + RECONCILE_LONG_SETTLE_MS）、
+// 変わらなければ押し直す。通常押しを maxPresses 回使い切ったら長押しに上げる：
+//   off : 長押し（強制シャットダウン）
+//   on  : TCPでしか観測できないチャンネルは、電源は入っているが応答しない（ハングした）PCかもしれないので、
+//         長押しで切ってから通常押しでもう一度入れる。電源LED入力でOFFと分かっていれば長押しは意味がないので上げない
+// それでも合わなければ failed にして押すのをやめる（同じ目標をもう一度送るとやり直す）。
+// 合ったあとで外から変わった（手で切った、落ちた）ときは、押した回数を数え直して合わせにいく。
+//
+// スレッドセーフではないので呼び出し側で直列化する。TCP接続はブロックするので PlanRunner と同じく
+// dueProbes() で対象を取り出し、ロックの外で接続して probeResult() で返す。
+// Platform: CommandResult press(int channel, PulseKind kind);  // 電源ボタンを押す（キューに積む）
+//           int powerState(int channel);                       // 電源LED入力 1:ON 0:OFF -1:入力なし
+
+static constexpr uint32_t RECONCILE_PROBE_INTERVAL_MS = 2000;
+static constexpr int RECONCILE_PROBE_MISSES = 3;
+static constexpr uint32_t RECONCILE_LONG_SETTLE_MS = 5000;
+// 1回の poll で取り出す確認の数（残りは次の poll で取り出す。実機では probes をタスクのスタックに置く）
+static constexpr int RECONCILE_MAX_PROBES_PER_POLL = 4;
+
+struct ReconcileConfig {
+    int maxPresses;         // 長押しに上げるまでの通常押しの回数
+    uint32_t onTimeoutMs;   // 通常押しから on になるまで待つ時間（起動時間）
+    uint32_t offTimeoutMs;  // 通常押しから off になるまで待つ時間（シャットダウン時間）
+    uint32_t longPressMs;   // 長押しのパルス幅
+};
+
+// TCPで確かめる対象（host は NUL 終端）
+struct ReconcileProbe {
+    uint32_t epoch;  // 押すたびに変わる（押す前に始めた確認の結果を捨てるため）
+    int channel;
+    char host[64];
+    uint16_t port;
+};
+
+// POWER_STATE_PROBES の検証（static_assert 用）：各要素は "" か "<host>:<port>"
+template <size_t N>
+constexpr bool stateProbesValid(const char* const (&probes)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        if (!probes[i]) return false;
+        if (probes[i][0] == '\0') continue;
+        if (planReadyPort(probes[i]) == 0) return false;
+        size_t hostLen = 0;
+        for (size_t j = 0; probes[i][j]; j++) {
+            if (probes[i][j] == ':') hostLen = j;
+        }
+        if (hostLen >= sizeof(ReconcileProbe::host)) return false;
+    }
+    return true;
+}
+
+enum class DesiredPower : uint8_t { None, Off, On };
+
+inline const char* desiredPowerName(DesiredPower desired) {
+    switch (desired) {
+        case DesiredPower::Off: return "off";
+        case DesiredPower::On:  return "on";
+        default:                return "none";
+    }
+}
+
+// "on" / "off"。それ以外なら false
+inline bool parseDesiredPower(const char* value, DesiredPower& desired) {
+    if (strcmp(value, "on") == 0) {
+        desired = DesiredPower::On;
+    } else if (strcmp(value, "off") == 0) {
+        desired = DesiredPower::Off;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+enum class ReconcileState : uint8_t {
+    Idle,       // 目標なし
+    Observing,  // 電源状態がまだ分からない（TCPの確認待ち）
+    Converged,  // 目標と合っている
+    Pressing,   // 押した。変わるのを待っている
+    Failed      // 押し直しと長押しでも合わなかった
+};
+
+inline const char* reconcileStateName(ReconcileState state) {
+    switch (state) {
+        case ReconcileState::Idle:      return "idle";
+        case ReconcileState::Observing: return "observing";
+        case ReconcileState::Converged: return "converged";
+        case ReconcileState::Pressing:  return "pressing";
+        case ReconcileState::Failed:    return "failed";
+    }
+    return "unknown";
+}
+
+enum class ReconcileSetResult : uint8_t {
+    Accepted,
+    InvalidChannel,
+    NoObservation  // 電源LED入力もTCPの確認先もない
+};
+
+template <int N, typename Platform>
+class PowerReconciler {
+public:
+    PowerReconciler(Platform& platform, const char* const (&probes)[N], const ReconcileConfig& config)
+        : platform_(platform), probes_(probes), config_(config) {}
+
+    // channel の目標を desired にする（None で外す）。目標が変わったときと failed のときは押した回数を数え直す
+    ReconcileSetResult set(int channel, DesiredPower desired, uint32_t nowMs) {
+        if (channel < 0 || channel >= N) return ReconcileSetResult::InvalidChannel;
+        Channel& ch = channels_[channel];
+        if (desired == DesiredPower::None) {
+            uint32_t epoch = ch.epoch + 1;
+            ch = Channel();
+            ch.epoch = epoch;
+            return ReconcileSetResult::Accepted;
+        }
+        if (platform_.powerState(channel) < 0 && probes_[channel][0] == '\0') return ReconcileSetResult::NoObservation;
+        if (desired != ch.desired || ch.state == ReconcileState::Failed) {
+            if (ch.desired == DesiredPower::None) ch.nextProbeMs = nowMs;
+            ch.desired = desired;
+            ch.presses = 0;
+            ch.longPresses = 0;
+            if (ch.state != ReconcileState::Pressing) ch.state = ReconcileState::Observing;
+        }
+        pollChannel(channel, nowMs);
+        return ReconcileSetResult::Accepted;
+    }
+
+    void poll(uint32_t nowMs) {
+        for (int i = 0; i < N; i++) pollChannel(i, nowMs);
+    }
+
+    // 目標のあるチャンネルがある（呼び出し側は poll() を回し続ける）
+    bool active() const {
+        for (int i = 0; i < N; i++) {
+            if (channels_[i].desired != DesiredPower::None) return true;
+        }
+        return false;
+    }
+
+    // TCPで確かめる時期が来たチャンネルを out に書き、数を返す（結果は probeResult() で返す）
+    // cap 個で打ち切ったときは次の呼び出しを続きのチャンネルから探す（先頭のチャンネルばかり確かめない）
+    int dueProbes(uint32_t nowMs, ReconcileProbe* out, int cap) {
+        int n = 0;
+        for (int k = 0; k < N && n < cap; k++) {
+            int i = (nextProbeChannel_ + k) % N;
+            Channel& ch = channels_[i];
+            if (ch.desired == DesiredPower::None || ch.probing || probes_[i][0] == '\0') continue;
+            if ((int32_t)(nowMs - ch.nextProbeMs) < 0 || platform_.powerState(i) >= 0) continue;
+            ch.probing = true;
+            ch.nextProbeMs = nowMs + RECONCILE_PROBE_INTERVAL_MS;
+            const char* target = probes_[i];
+            size_t hostLen = strrchr(target, ':') - target;
+            if (hostLen >= sizeof(out[n].host)) hostLen = sizeof(out[n].host) - 1;
+            out[n].epoch = ch.epoch;
+            out[n].channel = i;
+            memcpy(out[n].host, target, hostLen);
+            out[n].host[hostLen] = '\0';
+            out[n].port = (uint16_t)planReadyPort(target);
+            n++;
+            nextProbeChannel_ = (i + 1) % N;
+        }
+        return n;
+    }
+
+    void probeResult(const ReconcileProbe& probe, bool reachable, uint32_t nowMs) {
+        if (probe.channel < 0 || probe.channel >= N) return;
+        Channel& ch = channels_[probe.channel];
+        if (probe.epoch != ch.epoch) return;
+        ch.probing = false;
+        if (reachable) {
+            ch.misses = 0;
+            ch.observed = 1;
+        } else if (ch.misses < RECONCILE_PROBE_MISSES && ++ch.misses == RECONCILE_PROBE_MISSES) {
+            ch.observed = 0;
+        }
+        pollChannel(probe.channel, nowMs);
+    }
+
+    DesiredPower desired(int channel) const { return channels_[channel].desired; }
+    ReconcileState state(int channel) const { return channels_[channel].state; }
+
+    // /api/status のフィールド（オブジェクトの中身のみ）
+    //   "desired":     各PCの目標（"on" / "off"、なければ null）
+    //   "convergence": 各PCの調整の状態（idle / observing / converged / pressing / failed）
+    void writeStatusFields(JsonWriter& json) const {
+        json.key("desired").beginArray();
+        for (int i = 0; i < N; i++) {
+            if (channels_[i].desired == DesiredPower::None) {
+                json.raw("null");
+            } else {
+                json.value(desiredPowerName(channels_[i].desired));
+            }
+        }
+        json.endArray();
+        json.key("convergence").beginArray();
+        for (int i = 0; i < N; i++) json.value(reconcileStateName(channels_[i].state));
+        json.endArray();
+    }
+
+    // {"pcIndex":0,"name":"PC1","desired":"on","observed":"off","observedBy":"sense","state":"pressing",
+    //  "presses":1,"longPresses":0,"retryInMs":118500}
+    // observed はまだ分からなければ null、retryInMs は押して待っている間だけ（それ以外は null）
+    void writeChannelJson(JsonWriter& json, int channel, uint32_t nowMs, const char* name) {
+        const Channel& ch = channels_[channel];
+        int sensedState = platform_.powerState(channel);
+        bool sensed = sensedState >= 0;
+        int observed = sensed ? sensedState : ch.observed;
+        json.beginObject()
+            .field("pcIndex", channel)
+            .field("name", name);
+        json.key("desired");
+        if (ch.desired == DesiredPower::None) {
+            json.raw("null");
+        } else {
+            json.value(desiredPowerName(ch.desired));
+        }
+        json.key("observed");
+        if (observed < 0) {
+            json.raw("null");
+        } else {
+            json.value(observed ? "on" : "off");
+        }
+        json.key("observedBy");
+        if (sensed) {
+            json.value("sense");
+        } else if (probes_[channel][0]) {
+            json.value("tcp");
+        } else {
+            json.raw("null");
+        }
+        json.field("state", reconcileStateName(ch.state))
+            .field("presses", ch.presses)
+            .field("longPresses", ch.longPresses)
+            .key("retryInMs");
+        if (ch.state == ReconcileState::Pressing && (int32_t)(ch.deadlineMs - nowMs) > 0) {
+            json.value(ch.deadlineMs - nowMs);
+        } else {
+            json.raw("null");
+        }
+        json.endObject();
+    }
+
+private:
+    struct Channel {
+        DesiredPower desired = DesiredPower::None;
+        ReconcileState state = ReconcileState::Idle;
+        uint8_t presses = 0;      // 今の目標で押した通常押しの回数
+        uint8_t longPresses = 0;  // 同じく長押しの回数
+        int8_t observed = -1;     // TCPで確かめた状態（1:on 0:off -1:まだ分からない）
+        uint8_t misses = 0;       // TCP接続が続けて失敗した回数
+        bool probing = false;
+        uint32_t epoch = 0;
+        uint32_t deadlineMs = 0;  // 押したあと、変わるのを待つ期限
+        uint32_t nextProbeMs = 0;
+    };
+
+    // 1:on 0:off -1:まだ分からない
+    int observe(int channel) {
+        int sensed = platform_.powerState(channel);
+        return sensed >= 0 ? sensed : channels_[channel].observed;
+    }
+
+    void pollChannel(int channel, uint32_t nowMs) {
+        Channel& ch = channels_[channel];
+        if (ch.desired == DesiredPower::None) return;
+        int want = ch.desired == DesiredPower::On ? 1 : 0;
+        int observed = observe(channel);
+        if (observed == want) {
+            ch.state = ReconcileState::Converged;
+            return;
+        }
+        if (ch.state == ReconcileState::Failed) return;
+        if (ch.state == ReconcileState::Pressing && (int32_t)(nowMs - ch.deadlineMs) < 0) return;
+        if (observed < 0) {
+            ch.state = ReconcileState::Observing;
+            return;
+        }
+        if (ch.state == ReconcileState::Converged) {
+            // 合っていたのが外から変わった
+            ch.presses = 0;
+            ch.longPresses = 0;
+        }
+        PulseKind kind;
+        if (!nextPress(channel, kind)) {
+            ch.state = ReconcileState::Failed;
+            return;
+        }
+        CommandResult result = platform_.press(channel, kind);
+        if (result == CommandResult::Full) return;  // 次の poll() で押し直す
+        if (result == CommandResult::InvalidChannel) {
+            ch.state = ReconcileState::Failed;
+            return;
+        }
+        bool isLong = kind == PulseKind::Long;
+        if (isLong) {
+            ch.longPresses++;
+        } else {
+            ch.presses++;
+        }
+        ch.state = ReconcileState::Pressing;
+        ch.deadlineMs = nowMs + (isLong ? config_.longPressMs + RECONCILE_LONG_SETTLE_MS
+                                        : want ? config_.onTimeoutMs : config_.offTimeoutMs);
+        // 押す前のTCPの結果は使わない（切れていくPCはしばらく接続でき、起動中のPCは接続できない）
+        ch.epoch++;
+        ch.probing = false;
+        ch.observed = -1;
+        ch.misses = 0;
+        ch.nextProbeMs = nowMs;
+    }
+
+    bool nextPress(int channel, PulseKind& kind) {
+        const Channel& ch = channels_[channel];
+        kind = PulseKind::Short;
+        if (ch.desired == DesiredPower::Off) {
+            if (ch.presses < config_.maxPresses) return true;
+            kind = PulseKind::Long;
+            return ch.longPresses == 0;
+        }
+        // 長押しで切ったあとは、入れ直す通常押しをもう1回許す
+        if (ch.presses < config_.maxPresses + ch.longPresses) return true;
+        kind = PulseKind::Long;
+        return ch.longPresses == 0 && platform_.powerState(channel) < 0;
+    }
+
+    Platform& platform_;
+    const char* const (&probes_)[N];
+    ReconcileConfig config_;
+    Channel channels_[N];
+    int nextProbeChannel_ = 0;
+};
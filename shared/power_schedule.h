@@ -0,0 +1,419 @@
+#pragma once
+
+#include <initializer_list>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channel_bitset.h"
+#include "json_writer.h"
+#include "power_commands.h"
+#include "timer_wheel.h"
+#include "wall_clock.h"
+
+// 予約運転（実機・シミュレータ共通、/api/schedules）
+//
+// 予約は「曜日・時刻（SCHEDULE_UTC_OFFSET_MINUTES の地方時、分単位）に、チャンネルの集合へ操作する」の表。
+// 表は Store に保存し、起動時に読み戻す。時刻は SNTP の同期を WallClock に渡して保ち、同期するまでは動かない。
+//
+// 次に動く時刻を WallClock で単調時計の秒に直し、TimerWheel に登録する。満了したら操作して次の回を登録し直す。
+// 同期で時刻の対応が変わったら全件を登録し直す（同期で時刻が先へ跳んで通り過ぎた回は実行しない）。
+// 呼び出し側は poll() を msUntilNext() 後に呼べばよく、何も起きない秒に起きる必要はない。
+//
+// 操作（ScheduleAction）：
+//   on       : 電源ボタンを押す。電源LED入力でONと分かっているチャンネルは押さない
+//   off      : 電源ボタンを押す（OSのシャットダウン）。電源LED入力でOFFと分かっているチャンネルは押さない
+//   forceoff : 長押し（強制シャットダウン）。電源LED入力でOFFと分かっているチャンネルは押さない
+// 電源LED入力のないチャンネルは /api/power と同じく状態によらず押す。
+//
+// PowerScheduler はスレッドセーフではないので呼び出し側で直列化する。
+// Platform: CommandResult press(int channel, PulseKind kind);  // pressPowerButton / 長押しと同じ経路
+//           void skipped(int channel, PulseKind kind);          // 状態が揃っていて押さなかった
+//           int powerState(int channel);                        // 電源LED入力 1:ON 0:OFF -1:入力なし
+// Store:    bool load(ScheduleTable<N, M>& table);  void save(const ScheduleTable<N, M>& table);
+
+enum class ScheduleAction : uint8_t { On, Off, ForceOff };
+
+inline const char* scheduleActionName(ScheduleAction action) {
+    switch (action) {
+        case ScheduleAction::On:       return "on";
+        case ScheduleAction::Off:      return "off";
+        case ScheduleAction::ForceOff: return "forceoff";
+    }
+    return "unknown";
+}
+
+static constexpr uint8_t SCHEDULE_EVERY_DAY = 0x7F;    // bit0 が日曜、bit6 が土曜
+static constexpr uint16_t SCHEDULE_NO_TIME = 0xFFFF;  // 時刻が未設定
+
+// 保存する形式（実機はNVS、シミュレータはファイル。パディングなし）
+template <int N>
+struct ScheduleEntry {
+    uint8_t used;
+    uint8_t enabled;
+    ScheduleAction action;
+    uint8_t days;          // 動く曜日のビット
+    uint16_t minuteOfDay;  // 地方時の0:00からの分
+    uint16_t reserved;
+    ChannelMask<N> channels;
+};
+
+template <int N, int M>
+struct ScheduleTable {
+    uint32_t magic;
+    ScheduleEntry<N> entries[M];
+    uint32_t check;  // magic から entries の終わりまでの FNV-1a（check は末尾でパディングなし）
+};
+
+static const uint32_t SCHEDULE_TABLE_MAGIC = 0x53434831;  // "SCH1"
+
+template <int N, int M>
+uint32_t scheduleTableCheck(const ScheduleTable<N, M>& table) {
+    const uint8_t* p = (const uint8_t*)&table;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(table) - sizeof(table.check); i++) hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+// 使える予約か（新規作成で項目が足りない場合と、読み戻した表の検査に使う）
+template <int N>
+bool scheduleEntryValid(const ScheduleEntry<N>& entry) {
+    return entry.used == 1 && entry.enabled <= 1 && (uint8_t)entry.action <= (uint8_t)ScheduleAction::ForceOff &&
+           entry.days != 0 && (entry.days & ~SCHEDULE_EVERY_DAY) == 0 && entry.minuteOfDay < 24 * 60 &&
+           entry.channels.any();
+}
+
+// 項目を未設定にした新しい予約（毎日、有効）
+template <int N>
+ScheduleEntry<N> newScheduleEntry() {
+    ScheduleEntry<N> entry = ScheduleEntry<N>();
+    entry.used = 1;
+    entry.enabled = 1;
+    entry.action = (ScheduleAction)0xFF;
+    entry.days = SCHEDULE_EVERY_DAY;
+    entry.minuteOfDay = SCHEDULE_NO_TIME;
+    return entry;
+}
+
+// after（UNIX秒）より後で、最初に days・minuteOfDay に当たる時刻（UNIX秒）
+inline uint32_t nextScheduleTime(uint8_t days, uint16_t minuteOfDay, uint32_t after, int32_t utcOffsetMinutes) {
+    int64_t offset = (int64_t)utcOffsetMinutes * 60;
+    int64_t local = (int64_t)after + offset;
+    int64_t day = local / 86400;
+    for (int i = 0; i <= 7; i++) {
+        int weekday = (int)((day + i + 4) % 7);  // 1970-01-01 は木曜
+        int64_t candidate = (day + i) * 86400 + (int64_t)minuteOfDay * 60 - offset;
+        if (candidate > (int64_t)after && (days >> weekday) & 1) return (uint32_t)candidate;
+    }
+    return 0;  // days が空
+}
+
+// ---- フォームの値の解釈 ----
+
+// "07:00"
+inline bool parseScheduleTime(const char* text, uint16_t& minuteOfDay) {
+    if (!text || strlen(text) != 5 || text[2] != ':') return false;
+    for (int i : {0, 1, 3, 4}) {
+        if (text[i] < '0' || text[i] > '9') return false;
+    }
+    int hour = (text[0] - '0') * 10 + (text[1] - '0');
+    int minute = (text[3] - '0') * 10 + (text[4] - '0');
+    if (hour > 23 || minute > 59) return false;
+    minuteOfDay = (uint16_t)(hour * 60 + minute);
+    return true;
+}
+
+static constexpr const char* SCHEDULE_DAY_NAMES[] = {"sun", "mon", "tue", "wed", "thu", "fri", "sat"};
+
+// "daily" / "weekdays" / "weekends" / "mon,wed,fri"
+inline bool parseScheduleDays(const char* text, uint8_t& days) {
+    if (!text || !*text) return false;
+    if (strcmp(text, "daily") == 0) {
+        days = SCHEDULE_EVERY_DAY;
+        return true;
+    }
+    if (strcmp(text, "weekdays") == 0) {
+        days = 0x3E;
+        return true;
+    }
+    if (strcmp(text, "weekends") == 0) {
+        days = 0x41;
+        return true;
+    }
+    uint8_t bits = 0;
+    for (const char* p = text;;) {
+        int day = -1;
+        for (int d = 0; d < 7; d++) {
+            if (strncmp(p, SCHEDULE_DAY_NAMES[d], 3) == 0) day = d;
+        }
+        if (day < 0) return false;
+        bits |= (uint8_t)(1u << day);
+        p += 3;
+        if (*p == '\0') break;
+        if (*p != ',' || p[1] == '\0') return false;
+        p++;
+    }
+    days = bits;
+    return true;
+}
+
+inline bool parseScheduleAction(const char* text, ScheduleAction& action) {
+    for (ScheduleAction a : {ScheduleAction::On, ScheduleAction::Off, ScheduleAction::ForceOff}) {
+        if (text && strcmp(text, scheduleActionName(a)) == 0) {
+            action = a;
+            return true;
+        }
+    }
+    return false;
+}
+
+// time / action / channels（または mask）/ days / enabled のうち渡された項目で entry を書き換える。
+// param(name) は値（なければ nullptr）を返し、次に呼ぶまで有効であればよい。
+// 不正な値があればエラーメッセージを返す（entry は途中まで書き換わっている）
+template <int N, typename Param>
+const char* applyScheduleParams(ScheduleEntry<N>& entry, Param param) {
+    if (const char* value = param("time")) {
+        if (!parseScheduleTime(value, entry.minuteOfDay)) return "Invalid time (HH:MM)";
+    }
+    if (const char* value = param("action")) {
+        if (!parseScheduleAction(value, entry.action)) return "Invalid action (on, off or forceoff)";
+    }
+    if (const char* value = param("channels")) {
+        ChannelMask<N> channels;
+        if (!parseChannelList(value, channels)) return "Invalid channel list";
+        entry.channels = channels;
+    } else if (const char* value = param("mask")) {
+        ChannelMask<N> channels;
+        if (!parseChannelBitmask(value, channels)) return "Invalid channel list";
+        entry.channels = channels;
+    }
+    if (const char* value = param("days")) {
+        if (!parseScheduleDays(value, entry.days)) return "Invalid days (daily, weekdays, weekends or mon,tue,...)";
+    }
+    if (const char* value = param("enabled")) {
+        if (strcmp(value, "1") != 0 && strcmp(value, "0") != 0) return "Invalid enabled (1 or 0)";
+        entry.enabled = value[0] == '1';
+    }
+    if (!scheduleEntryValid(entry)) return "time, action and channels are required";
+    return nullptr;
+}
+
+// ---- 実行 ----
+
+template <int N, int M, typename Platform, typename Store>
+class PowerScheduler {
+public:
+    static constexpr uint32_t NEVER = UINT32_MAX;
+
+    PowerScheduler(Platform& platform, Store& store, int32_t utcOffsetMinutes)
+        : platform_(platform), store_(store), utcOffsetMinutes_(utcOffsetMinutes), table_() {}
+
+    // 保存した表を読み戻す（壊れていれば空にする）。時刻が合うまでは登録しない
+    void begin() {
+        if (!store_.load(table_) || table_.magic != SCHEDULE_TABLE_MAGIC || table_.check != scheduleTableCheck(table_)) {
+            table_ = ScheduleTable<N, M>();
+        }
+        for (ScheduleEntry<N>& entry : table_.entries) {
+            if (entry.used && !scheduleEntryValid(entry)) entry = ScheduleEntry<N>();
+        }
+    }
+
+    // SNTPの同期（monoUs の時点の時刻が unixUs）。時刻の対応が変わるので全件を登録し直す
+    void sync(uint64_t monoUs, uint64_t unixUs) {
+        clock_.sync(monoUs, unixUs);
+        for (int id = 0; id < M; id++) arm(id, monoUs);
+    }
+
+    // 期限の来た予約を実行し、実行した数を返す
+    int poll(uint64_t monoUs) {
+        return wheel_.advance(tickOf(monoUs), [this, monoUs](int id) { run(id, monoUs); });
+    }
+
+    // 次に poll() を呼ぶまでのミリ秒（予約がなければ NEVER）
+    uint32_t msUntilNext(uint64_t monoUs) const {
+        uint32_t tick = wheel_.nextTick();
+        if (tick == TimerWheel<M>::NEVER) return NEVER;
+        uint64_t dueUs = (uint64_t)tick * 1000000ULL;
+        return dueUs > monoUs ? (uint32_t)((dueUs - monoUs + 999) / 1000) : 0;
+    }
+
+    // 追加した予約の id（満杯なら -1）
+    int add(const ScheduleEntry<N>& entry, uint64_t monoUs) {
+        for (int id = 0; id < M; id++) {
+            if (table_.entries[id].used) continue;
+            table_.entries[id] = entry;
+            runs_[id] = Run();
+            save();
+            arm(id, monoUs);
+            return id;
+        }
+        return -1;
+    }
+
+    bool update(int id, const ScheduleEntry<N>& entry, uint64_t monoUs) {
+        if (!exists(id)) return false;
+        table_.entries[id] = entry;
+        save();
+        arm(id, monoUs);
+        return true;
+    }
+
+    bool remove(int id) {
+        if (!exists(id)) return false;
+        table_.entries[id] = ScheduleEntry<N>();
+        save();
+        wheel_.cancel(id);
+        return true;
+    }
+
+    bool exists(int id) const { return id >= 0 && id < M && table_.entries[id].used; }
+
+    int count() const {
+        int used = 0;
+        for (const ScheduleEntry<N>& entry : table_.entries) used += entry.used ? 1 : 0;
+        return used;
+    }
+
+    const ScheduleEntry<N>& entry(int id) const { return table_.entries[id]; }
+    const WallClock& clock() const { return clock_; }
+
+    // {"id":0,"enabled":true,"action":"off","time":"01:00","days":"daily","channels":[7,8],
+    //  "nextRun":1760630400,"lastRun":null,"lastQueued":0,"lastSkipped":0,"lastRejected":0}
+    // 時刻はUNIX秒（時刻が合っていない、無効、まだ動いていなければ null）
+    void writeEntryJson(JsonWriter& json, int id) const {
+        const ScheduleEntry<N>& entry = table_.entries[id];
+        const Run& run = runs_[id];
+        char time[8];
+        snprintf(time, sizeof(time), "%02u:%02u", (unsigned)(entry.minuteOfDay / 60), (unsigned)(entry.minuteOfDay % 60));
+        json.beginObject()
+            .field("id", id)
+            .field("enabled", entry.enabled == 1)
+            .field("action", scheduleActionName(entry.action))
+            .field("time", time);
+        writeDays(json, entry.days);
+        json.key("channels").beginArray();
+        entry.channels.forEach([&json](int channel) { json.value(channel); });
+        json.endArray();
+        writeTime(json, "nextRun", wheel_.armed(id), nextUnix_[id]);
+        writeTime(json, "lastRun", run.unixTime != 0, run.unixTime);
+        json.field("lastQueued", run.queued)
+            .field("lastSkipped", run.skipped)
+            .field("lastRejected", run.rejected)
+            .endObject();
+    }
+
+    // {"clock":{"synced":true,"time":1760600000,"utcOffsetMinutes":540,"driftPpb":-12400,"lastOffsetUs":-830,
+    //           "syncs":5,"steps":1,"lastSyncAgoS":1200},"schedules":[...]}
+    void writeJson(JsonWriter& json, uint64_t monoUs) const {
+        json.beginObject().key("clock").beginObject().field("synced", clock_.synced());
+        writeTime(json, "time", clock_.synced(), clock_.unixAt(monoUs));
+        json.field("utcOffsetMinutes", utcOffsetMinutes_)
+            .field("driftPpb", clock_.driftPpb())
+            .field("lastOffsetUs", clock_.lastOffsetUs())
+            .field("syncs", clock_.syncs())
+            .field("steps", clock_.steps());
+        writeTime(json, "lastSyncAgoS", clock_.synced(), (uint32_t)((monoUs - clock_.lastSyncMonoUs()) / 1000000ULL));
+        json.endObject().key("schedules").beginArray();
+        for (int id = 0; id < M; id++) {
+            if (table_.entries[id].used) writeEntryJson(json, id);
+        }
+        json.endArray().endObject();
+    }
+
+private:
+    // 直近の実行（RAMだけに持つ）
+    struct Run {
+        uint32_t unixTime = 0;
+        uint8_t queued = 0;
+        uint8_t skipped = 0;
+        uint8_t rejected = 0;
+    };
+
+    static uint32_t tickOf(uint64_t monoUs) { return (uint32_t)(monoUs / 1000000ULL); }
+
+    // 次の回を登録する（無効・時刻未同期なら外す）
+    // 同期で時刻が戻っても、実行済みの回はもう一度実行しない
+    void arm(int id, uint64_t monoUs) {
+        const ScheduleEntry<N>& entry = table_.entries[id];
+        if (!entry.used || !entry.enabled || !clock_.synced()) {
+            wheel_.cancel(id);
+            return;
+        }
+        uint32_t now = clock_.unixAt(monoUs);
+        armAfter(id, now > runs_[id].unixTime ? now : runs_[id].unixTime);
+    }
+
+    void armAfter(int id, uint32_t afterUnix) {
+        const ScheduleEntry<N>& entry = table_.entries[id];
+        uint32_t next = nextScheduleTime(entry.days, entry.minuteOfDay, afterUnix, utcOffsetMinutes_);
+        nextUnix_[id] = next;
+        // 単調時計で next に達した後の最初の tick
+        uint64_t dueUs = clock_.monoUsAt((uint64_t)next * 1000000ULL);
+        wheel_.schedule(id, (uint32_t)((dueUs + 999999ULL) / 1000000ULL));
+    }
+
+    void run(int id, uint64_t monoUs) {
+        const ScheduleEntry<N>& entry = table_.entries[id];
+        Run& run = runs_[id];
+        run = Run();
+        run.unixTime = nextUnix_[id];
+        PulseKind kind = entry.action == ScheduleAction::ForceOff ? PulseKind::Long : PulseKind::Short;
+        int skipState = entry.action == ScheduleAction::On ? 1 : 0;
+        entry.channels.forEach([&](int channel) {
+            if (platform_.powerState(channel) == skipState) {
+                platform_.skipped(channel, kind);
+                run.skipped++;
+                return;
+            }
+            CommandResult result = platform_.press(channel, kind);
+            if (result == CommandResult::Queued || result == CommandResult::Coalesced) {
+                run.queued++;
+            } else {
+                run.rejected++;
+            }
+        });
+        // 遅れて実行したときに同じ回をもう一度登録しないよう、実行した回と現在の遅い方より後にする
+        uint32_t now = clock_.unixAt(monoUs);
+        armAfter(id, now > run.unixTime ? now : run.unixTime);
+    }
+
+    void save() {
+        table_.magic = SCHEDULE_TABLE_MAGIC;
+        table_.check = scheduleTableCheck(table_);
+        store_.save(table_);
+    }
+
+    static void writeDays(JsonWriter& json, uint8_t days) {
+        if (days == SCHEDULE_EVERY_DAY) {
+            json.field("days", "daily");
+            return;
+        }
+        char text[32] = "";
+        size_t len = 0;
+        for (int d = 0; d < 7; d++) {
+            if (!((days >> d) & 1)) continue;
+            len += snprintf(text + len, sizeof(text) - len, "%s%s", len ? "," : "", SCHEDULE_DAY_NAMES[d]);
+        }
+        json.field("days", text);
+    }
+
+    static void writeTime(JsonWriter& json, const char* name, bool set, uint32_t value) {
+        json.key(name);
+        if (set) {
+            json.value(value);
+        } else {
+            json.raw("null");
+        }
+    }
+
+    Platform& platform_;
+    Store& store_;
+    int32_t utcOffsetMinutes_;
+    WallClock clock_;
+    TimerWheel<M> wheel_;
+    ScheduleTable<N, M> table_;
+    uint32_t nextUnix_[M] = {};
+    Run runs_[M];
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "channel_bitset.h"
+#include "json_writer.h"
+
+// 電源LED入力のデバウンス（実機・シミュレータ共通）
+//
+// サンプラが一定周期で sample() を呼ぶ。直近 Samples 回の読み取り値がすべて同じになったときだけ
+// 安定状態を更新するので、LEDの点滅開始やフォトカプラのチャタリングで状態が揺れない。
+// 安定状態が変わったら true を返す。
+template <int N, int Samples>
+class PowerSenseDebouncer {
+    static_assert(Samples >= 1 && Samples <= 8, "Samples must be 1..8");
+
+public:
+    PowerSenseDebouncer() {
+        for (int i = 0; i < N; i++) {
+            history_[i] = 0;
+            stable_[i] = false;
+        }
+    }
+
+    bool sample(int channel, bool raw) {
+        if (channel < 0 || channel >= N) return false;
+
+        const uint8_t mask = (uint8_t)((1u << Samples) - 1);
+        history_[channel] = (uint8_t)(((history_[channel] << 1) | (raw ? 1 : 0)) & mask);
+
+        bool next = stable_[channel];
+        if (history_[channel] == mask) {
+            next = true;
+        } else if (history_[channel] == 0) {
+            next = false;
+        }
+        if (next == stable_[channel]) return false;
+        stable_[channel] = next;
+        return true;
+    }
+
+    bool stable(int channel) const { return stable_[channel]; }
+
+private:
+    uint8_t history_[N];
+    bool stable_[N];
+};
+
+// /api/status の状態フィールドを書く（オブジェクトの中身のみ）
+//   "states":    各PCの状態（検出入力があれば実測、なければ押下ごとの反転による推定）
+//   "sensed":    電源LED入力で実測しているチャンネル
+//   "stateBits", "sensedBits": 上記を32チャンネルずつ詰めたビット列
+template <int N>
+inline void writeChannelStates(JsonWriter& json, const ChannelBitset<N>& states,
+                               const ChannelBitset<N>& sensed) {
+    json.key("states").beginArray();
+    for (int i = 0; i < N; i++) json.value(states.test(i));
+    json.endArray();
+
+    json.key("sensed").beginArray();
+    for (int i = 0; i < N; i++) json.value(sensed.test(i));
+    json.endArray();
+
+    json.key("stateBits").beginArray();
+    for (int i = 0; i < ChannelBitset<N>::WORDS; i++) json.value(states.word(i));
+    json.endArray();
+
+    json.key("sensedBits").beginArray();
+    for (int i = 0; i < ChannelBitset<N>::WORDS; i++) json.value(sensed.word(i));
+    json.endArray();
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "channel_bitset.h"
+
+// 電源ボタンパルスの種類
+enum class PulseKind : uint8_t {
+    Short,  // 通常押し（電源ON/OFF）
+    Long    // 長押し（強制シャットダウン）
+};
+
+// パルス開始要求の結果
+enum class PulseResult : uint8_t {
+    Pending,        // パルス開始済み、タイマー発火でピンを解放する
+    Busy,           // 同じチャンネルでパルス実行中
+    InvalidChannel, // 範囲外のチャンネル
+    IoError         // ピンに書けなかった（エキスパンダのNACKなど）。押していないのでチャンネルは空いたまま
+};
+
+// 一括パルスの受付結果
+template <int N>
+struct PulseBatchResult {
+    ChannelMask<N> started;  // 最初のウェーブで押したチャンネル
+    ChannelMask<N> queued;   // 後続のウェーブで押すチャンネル
+    ChannelMask<N> busy;     // 実行中のため受け付けなかったチャンネル
+    ChannelMask<N> failed;   // 最初のウェーブで押せなかったチャンネル（IoError と同じ）
+    int waves = 0;
+};
+
+// チャンネルごとのパルス状態機械（実機・シミュレータ共通）
+//
+// begin() はピンをHIGHにしてワンショットタイマーを張るだけで即座に戻る。
+// タイマーが発火したら release() でピンをLOWに戻して完了通知を出す。ピンを戻せなければ（エキスパンダの
+// NACK など）チャンネルは Asserted のまま false を返すので、呼び出し側が成功するまでやり直す。
+// beginBatch() は複数チャンネルを1回のレジスタ書き込みでまとめてHIGHにし、まとめて解放する。
+// 同時に押す数に上限がある場合はウェーブに分け、前のウェーブの解放と同時に次を押す。
+// 押す書き込みが失敗したら書いた分を戻してチャンネルを空け、onPulseFailed() を呼ぶ（パルスは始めない）。
+// プラットフォーム依存部分は Platform に委譲する：
+//   bool writePin(int channel, bool level);                      // 書けなければ false
+//   bool writeMask(const ChannelMask<N>& channels, bool level);
+//   void armTimer(int channel, uint32_t durationMs);
+//   void onPulseStart(int channel, PulseKind kind);
+//   void onPulseComplete(int channel, PulseKind kind);
+//   void onPulseFailed(int channel, PulseKind kind);              // 押せなかった
+template <int N, typename Platform>
+class PulseEngine {
+public:
+    explicit PulseEngine(Platform& platform) : platform_(platform) {
+        for (int i = 0; i < N; i++) {
+            state_[i].store(Idle, std::memory_order_relaxed);
+        }
+    }
+
+    // パルスを開始する（HTTPハンドラから呼ばれる、ブロックしない）
+    PulseResult begin(int channel, PulseKind kind, uint32_t durationMs) {
+        if (channel < 0 || channel >= N) return PulseResult::InvalidChannel;
+
+        uint8_t expected = Idle;
+        if (!state_[channel].compare_exchange_strong(expected, Asserted,
+                                                     std::memory_order_acq_rel)) {
+            return PulseResult::Busy;
+        }
+
+        kind_[channel] = kind;
+        if (!platform_.writePin(channel, true)) {
+            // 写しを戻す（押せなかったピンを後の書き込みで押さない）
+            platform_.writePin(channel, false);
+            state_[channel].store(Idle, std::memory_order_release);
+            platform_.onPulseFailed(channel, kind);
+            return PulseResult::IoError;
+        }
+        platform_.onPulseStart(channel, kind);
+        platform_.armTimer(channel, durationMs);
+        return PulseResult::Pending;
+    }
+
+    // 複数チャンネルを同時に押す。maxConcurrent <= 0 なら上限なし
+    PulseBatchResult<N> beginBatch(const ChannelMask<N>& requested, PulseKind kind,
+                                   uint32_t durationMs, int maxConcurrent) {
+        PulseBatchResult<N> result;
+        ChannelMask<N> claimed;
+        requested.forEach([&](int channel) {
+            uint8_t expected = Idle;
+            if (state_[channel].compare_exchange_strong(expected, Queued,
+                                                        std::memory_order_acq_rel)) {
+                kind_[channel] = kind;
+                claimed.set(channel);
+            } else {
+                result.busy.set(channel);
+            }
+        });
+        if (!claimed.any()) return result;
+
+        int cap = maxConcurrent > 0 ? maxConcurrent : N;
+        result.waves = (claimed.count() + cap - 1) / cap;
+        result.started = startWave(claimed, durationMs, cap, &result.failed);
+        result.queued = claimed;
+        return result;
+    }
+
+    // タイマー発火後に呼ぶ：ピンを解放して完了を通知する。
+    // ピンを戻せなければ何も変えずに false（チャンネルは空かないので、あとで呼び直す）
+    bool release(int channel) {
+        if (channel < 0 || channel >= N) return true;
+        if (state_[channel].load(std::memory_order_acquire) != Asserted) return true;
+
+        if (batch_[channel].active) return releaseWave(channel);
+
+        if (!platform_.writePin(channel, false)) return false;
+        PulseKind kind = kind_[channel];
+        // 完了通知（状態反転など）を済ませてから次のパルスを受け付ける
+        platform_.onPulseComplete(channel, kind);
+        state_[channel].store(Idle, std::memory_order_release);
+        return true;
+    }
+
+    // channel のタイマーで離すチャンネル（一括押しならウェーブ全体）。
+    // 解放を待っている間は変わらないので、タイマーのコールバックから読める
+    ChannelMask<N> pulseChannels(int channel) const {
+        ChannelMask<N> channels;
+        if (channel < 0 || channel >= N) return channels;
+        if (batch_[channel].active) return batch_[channel].channels;
+        channels.set(channel);
+        return channels;
+    }
+
+    bool busy(int channel) const {
+        if (channel < 0 || channel >= N) return false;
+        return state_[channel].load(std::memory_order_acquire) != Idle;
+    }
+
+    int channelCount() const { return N; }
+
+private:
+    enum : uint8_t { Idle = 0, Asserted = 1, Queued = 2 };
+
+    // ウェーブの情報は先頭チャンネル（タイマーを張るチャンネル）に持たせる
+    struct Wave {
+        bool active = false;
+        ChannelMask<N> channels;
+        ChannelMask<N> remaining;
+        uint32_t durationMs = 0;
+        int cap = 0;
+    };
+
+    // remaining から cap 個ずつ取り出して押す。押せなかったウェーブは飛ばして次を押し、failed に加える。
+    // 押したウェーブ（なければ空）を返す
+    ChannelMask<N> startWave(ChannelMask<N>& remaining, uint32_t durationMs, int cap, ChannelMask<N>* failed) {
+        while (remaining.any()) {
+            ChannelMask<N> channels = remaining.take(cap);
+            if (pressWave(channels, remaining, durationMs, cap)) return channels;
+            if (failed) channels.forEach([&](int channel) { failed->set(channel); });
+        }
+        return ChannelMask<N>();
+    }
+
+    bool pressWave(const ChannelMask<N>& channels, const ChannelMask<N>& remaining,
+                   uint32_t durationMs, int cap) {
+        int lead = channels.first();
+        Wave& wave = batch_[lead];
+        wave.channels = channels;
+        wave.remaining = remaining;
+        wave.durationMs = durationMs;
+        wave.cap = cap;
+
+        channels.forEach([&](int channel) {
+            state_[channel].store(Asserted, std::memory_order_release);
+        });
+        if (!platform_.writeMask(channels, true)) {
+            platform_.writeMask(channels, false);
+            channels.forEach([&](int channel) {
+                state_[channel].store(Idle, std::memory_order_release);
+                platform_.onPulseFailed(channel, kind_[channel]);
+            });
+            return false;
+        }
+        wave.active = true;
+        channels.forEach([&](int channel) { platform_.onPulseStart(channel, kind_[channel]); });
+        platform_.armTimer(lead, durationMs);
+        return true;
+    }
+
+    bool releaseWave(int lead) {
+        Wave wave = batch_[lead];
+        if (!platform_.writeMask(wave.channels, false)) return false;
+        batch_[lead].active = false;
+
+        wave.channels.forEach([&](int channel) {
+            platform_.onPulseComplete(channel, kind_[channel]);
+            state_[channel].store(Idle, std::memory_order_release);
+        });
+
+        if (wave.remaining.any()) startWave(wave.remaining, wave.durationMs, wave.cap, nullptr);
+        return true;
+    }
+
+    Platform& platform_;
+    std::atomic<uint8_t> state_[N];
+    PulseKind kind_[N] = {};
+    Wave batch_[N];
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "metrics.h"
+
+// 表駆動のルーティング（実機・シミュレータ共通、確保なし）
+//
+// パターンはリテラルと整数パラメータ {i}、文字列パラメータ {s} の並び。例： "/api/power/{i}"
+// 表の先頭から順に照合し、最初に一致したエントリを返す（"/api/power/batch" は
+// "/api/power/{i}" より前に置く）。{i} は0以上の10進数にだけ一致するので、
+// "/api/power/abc" はどのエントリにも一致しない。{s} は '/' を含まない1文字以上に一致する。
+
+enum class HttpMethod : uint8_t {
+    Get,
+    Post,
+    Put,
+    Delete,
+    Other
+};
+
+// method は NUL 終端していなくてよい（長さ len）
+inline HttpMethod parseHttpMethod(const char* method, size_t len) {
+    if (len == 3 && memcmp(method, "GET", 3) == 0) return HttpMethod::Get;
+    if (len == 4 && memcmp(method, "POST", 4) == 0) return HttpMethod::Post;
+    if (len == 3 && memcmp(method, "PUT", 3) == 0) return HttpMethod::Put;
+    if (len == 6 && memcmp(method, "DELETE", 6) == 0) return HttpMethod::Delete;
+    return HttpMethod::Other;
+}
+
+inline HttpMethod parseHttpMethod(const char* method) { return parseHttpMethod(method, strlen(method)); }
+
+// パスから取り出したパラメータ（{s} は path 上の開始位置を values に、長さを lengths に入れる）
+struct RouteParams {
+    static constexpr int MAX = 2;
+    int32_t values[MAX] = {};
+    uint16_t lengths[MAX] = {};
+    int count = 0;
+
+    int32_t operator[](int index) const { return index < count ? values[index] : -1; }
+};
+
+template <typename Handler>
+struct RouteEntry {
+    HttpMethod method;
+    const char* pattern;
+    Route metric;  // /api/metrics の route ラベル
+    Handler handler;
+};
+
+// pattern と path（長さ len、クエリは含めない）を照合する
+inline bool matchRoutePattern(const char* pattern, const char* path, size_t len, RouteParams& params) {
+    params.count = 0;
+    size_t i = 0;
+    while (*pattern) {
+        if (pattern[0] == '{' && pattern[1] == 'i' && pattern[2] == '}') {
+            if (i >= len || path[i] < '0' || path[i] > '9' || params.count >= RouteParams::MAX) return false;
+            int32_t value = 0;
+            while (i < len && path[i] >= '0' && path[i] <= '9') {
+                if (value > 99999999) return false;  // 桁あふれ防止（チャンネル番号には十分）
+                value = value * 10 + (path[i] - '0');
+                i++;
+            }
+            params.values[params.count++] = value;
+            pattern += 3;
+            continue;
+        }
+        if (pattern[0] == '{' && pattern[1] == 's' && pattern[2] == '}') {
+            size_t start = i;
+            while (i < len && path[i] != '/') i++;
+            if (i == start || i - start > 0xFFFF || params.count >= RouteParams::MAX) return false;
+            params.values[params.count] = (int32_t)start;
+            params.lengths[params.count++] = (uint16_t)(i - start);
+            pattern += 3;
+            continue;
+        }
+        if (i >= len || path[i] != *pattern) return false;
+        i++;
+        pattern++;
+    }
+    return i == len;
+}
+
+// 一致したエントリ（なければ nullptr）
+template <typename Handler, size_t N>
+const RouteEntry<Handler>* matchRoute(const RouteEntry<Handler> (&table)[N], HttpMethod method,
+                                      const char* path, size_t len, RouteParams& params) {
+    for (size_t r = 0; r < N; r++) {
+        if (table[r].method != method) continue;
+        if (matchRoutePattern(table[r].pattern, path, len, params)) return &table[r];
+    }
+    return nullptr;
+}
+
+// 表の書式チェック（static_assert 用）：'/' で始まり、'{' は {i} か {s} だけ
+constexpr bool routePatternValid(const char* pattern) {
+    if (pattern[0] != '/') return false;
+    int params = 0;
+    for (const char* p = pattern; *p; p++) {
+        if (*p == '{') {
+            if ((p[1] != 'i' && p[1] != 's') || p[2] != '}') return false;
+            params++;
+            p += 2;
+        } else if (*p == '}') {
+            return false;
+        }
+    }
+    return params <= RouteParams::MAX;
+}
+
+template <typename Handler, size_t N>
+constexpr bool routeTableValid(const RouteEntry<Handler> (&table)[N]) {
+    for (size_t r = 0; r < N; r++) {
+        if (!routePatternValid(table[r].pattern)) return false;
+    }
+    return true;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// SHA-256 と HMAC-SHA256（FIPS 180-4 / RFC 2104）のポータブルな実装
+// シミュレータと loadgen で使う。実機は mbedtls（ESP32のSHAアクセラレータ）で同じ値を計算する。
+
+class Sha256 {
+public:
+    static constexpr size_t DIGEST_BYTES = 32;
+    static constexpr size_t BLOCK_BYTES = 64;
+
+    Sha256() { reset(); }
+
+    void reset() {
+        static const uint32_t INIT[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                         0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(state_, INIT, sizeof(state_));
+        bufferLen_ = 0;
+        totalLen_ = 0;
+    }
+
+    void update(const void* data, size_t len) {
+        const uint8_t* p = (const uint8_t*)data;
+        totalLen_ += len;
+        if (bufferLen_ > 0) {
+            size_t n = BLOCK_BYTES - bufferLen_;
+            if (n > len) n = len;
+            memcpy(buffer_ + bufferLen_, p, n);
+            bufferLen_ += n;
+            p += n;
+            len -= n;
+            if (bufferLen_ < BLOCK_BYTES) return;
+            compress(buffer_);
+            bufferLen_ = 0;
+        }
+        while (len >= BLOCK_BYTES) {
+            compress(p);
+            p += BLOCK_BYTES;
+            len -= BLOCK_BYTES;
+        }
+        memcpy(buffer_, p, len);
+        bufferLen_ = len;
+    }
+
+    void finish(uint8_t digest[DIGEST_BYTES]) {
+        uint64_t bits = totalLen_ * 8;
+        uint8_t pad[BLOCK_BYTES + 8] = {0x80};
+        size_t padLen = (bufferLen_ < 56 ? 56 : 120) - bufferLen_;
+        for (int i = 0; i < 8; i++) pad[padLen + i] = (uint8_t)(bits >> (56 - 8 * i));
+        update(pad, padLen + 8);
+        for (int i = 0; i < 8; i++) {
+            digest[i * 4] = (uint8_t)(state_[i] >> 24);
+            digest[i * 4 + 1] = (uint8_t)(state_[i] >> 16);
+            digest[i * 4 + 2] = (uint8_t)(state_[i] >> 8);
+            digest[i * 4 + 3] = (uint8_t)state_[i];
+        }
+    }
+
+private:
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const uint8_t* block) {
+        static const uint32_t K[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+                   ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+        uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state_[0] += a;
+        state_[1] += b;
+        state_[2] += c;
+        state_[3] += d;
+        state_[4] += e;
+        state_[5] += f;
+        state_[6] += g;
+        state_[7] += h;
+    }
+
+    uint32_t state_[8];
+    uint8_t buffer_[BLOCK_BYTES];
+    size_t bufferLen_;
+    uint64_t totalLen_;
+};
+
+// 鍵を固定したHMAC-SHA256。ipad/opad を処理した状態を保持し、1メッセージごとにそれをコピーして使う
+class HmacSha256 {
+public:
+    static constexpr size_t TAG_BYTES = Sha256::DIGEST_BYTES;
+
+    HmacSha256(const void* key, size_t keyLen) {
+        uint8_t block[Sha256::BLOCK_BYTES] = {};
+        if (keyLen > Sha256::BLOCK_BYTES) {
+            Sha256 hash;
+            hash.update(key, keyLen);
+            hash.finish(block);
+        } else {
+            memcpy(block, key, keyLen);
+        }
+        uint8_t pad[Sha256::BLOCK_BYTES];
+        for (size_t i = 0; i < sizeof(pad); i++) pad[i] = block[i] ^ 0x36;
+        inner_.update(pad, sizeof(pad));
+        for (size_t i = 0; i < sizeof(pad); i++) pad[i] = block[i] ^ 0x5c;
+        outer_.update(pad, sizeof(pad));
+    }
+
+    void operator()(const void* data, size_t len, uint8_t tag[TAG_BYTES]) const {
+        Sha256 inner = inner_;
+        inner.update(data, len);
+        uint8_t digest[Sha256::DIGEST_BYTES];
+        inner.finish(digest);
+        Sha256 outer = outer_;
+        outer.update(digest, sizeof(digest));
+        outer.finish(tag);
+    }
+
+private:
+    Sha256 inner_;
+    Sha256 outer_;
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <stdint.h>
+
+// 階層タイマーホイール（実機・シミュレータ共通、確保なし）
+//
+// 時刻は整数の tick（予約運転では単調時計の秒）。64スロットの段を4段重ね、段 L のスロットは 64^L tick を受け持つ。
+// タイマーは満了 tick と現在の tick のビットが最初に異なる段に、満了 tick のその段のビットで決まるスロットへ入れる。
+// 上の段のスロットは、現在の tick がそのスロットの範囲に入った時点で下の段へ入れ直す（カスケード）。
+// 4段（2^24 tick、秒なら約194日）より先のタイマーは overflow に置き、2^24 ごとに入れ直す。
+//
+// 各段の空きスロットはビットマップで持つので、次に何かが起きる tick（nextTick()）は段数に比例する手間で分かり、
+// advance() は何も起きない tick を飛ばす。1 tick あたりの手間はタイマーの数によらない
+// （タイマー1つが入れ直される回数は段数まで）。
+//
+// id は 0〜N-1 の固定のスロットで、呼び出し側が自分の表の添字をそのまま使う。スレッドセーフではない。
+
+template <int N>
+class TimerWheel {
+public:
+    static constexpr uint32_t NEVER = UINT32_MAX;
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+
+    static_assert(N > 0 && N < 0x7FFF, "TimerWheel holds up to 32766 timers");
+
+    explicit TimerWheel(uint32_t now = 0) : current_(now) {
+        for (int i = 0; i < LISTS; i++) heads_[i] = NONE;
+        for (int i = 0; i < N; i++) nodes_[i] = Node();
+    }
+
+    uint32_t now() const { return current_; }
+
+    bool armed(int id) const { return id >= 0 && id < N && nodes_[id].list != NONE; }
+
+    uint32_t expiry(int id) const { return armed(id) ? nodes_[id].expiry : NEVER; }
+
+    // id を expiry に満了するよう登録する（登録済みなら置き換える）。過ぎた時刻なら次の tick で満了する
+    void schedule(int id, uint32_t expiry) {
+        if (id < 0 || id >= N) return;
+        cancel(id);
+        nodes_[id].expiry = (int32_t)(expiry - current_) > 0 ? expiry : current_ + 1;
+        place(id);
+    }
+
+    void cancel(int id) {
+        if (!armed(id)) return;
+        unlink(id);
+    }
+
+    // 次に advance() で何かが起きる（満了するかカスケードする）tick。タイマーがなければ NEVER
+    uint32_t nextTick() const {
+        uint32_t next = NEVER;
+        for (int level = 0; level < LEVELS; level++) {
+            if (!occupied_[level]) continue;
+            // 占有スロットは現在位置より後ろだけ（同じ位置なら1つ下の段に入る）
+            int slot = __builtin_ctzll(occupied_[level]);
+            int shift = SLOT_BITS * level;
+            uint32_t base = (uint32_t)(((uint64_t)current_ >> (shift + SLOT_BITS)) << (shift + SLOT_BITS));
+            uint64_t tick = (uint64_t)base + ((uint64_t)slot << shift);
+            if (tick < next) next = (uint32_t)tick;
+        }
+        if (heads_[OVERFLOW] != NONE) {
+            uint64_t tick = (((uint64_t)current_ >> RANGE_BITS) + 1) << RANGE_BITS;
+            if (tick < next) next = tick > NEVER - 1 ? NEVER - 1 : (uint32_t)tick;
+        }
+        return next;
+    }
+
+    // now まで進め、満了したタイマーごとに fire(id) を呼ぶ（満了 tick の順）。満了した数を返す
+    // fire の中で schedule() してよい（満了 tick が now 以前なら、この呼び出しの中でもう一度満了する）
+    template <typename Fire>
+    int advance(uint32_t now, Fire&& fire) {
+        int fired = 0;
+        while ((int32_t)(now - current_) > 0) {
+            uint32_t next = nextTick();
+            if (next == NEVER || (int32_t)(next - now) > 0) {
+                current_ = now;
+                break;
+            }
+            current_ = next;
+            cascade();
+            fired += expire(fire);
+        }
+        return fired;
+    }
+
+private:
+    static constexpr int RANGE_BITS = SLOT_BITS * LEVELS;
+    static constexpr int OVERFLOW = LEVELS * SLOTS;
+    static constexpr int LISTS = OVERFLOW + 1;
+    static constexpr int16_t NONE = -1;
+
+    struct Node {
+        uint32_t expiry = 0;
+        int16_t prev = NONE;
+        int16_t next = NONE;
+        int16_t list = NONE;  // 入っているリスト（NONE なら未登録）
+    };
+
+    // 現在の tick との差で段とスロットを決めて入れる（カスケードでは満了 tick が現在の tick と等しいことがある）
+    void place(int id) {
+        uint32_t expiry = nodes_[id].expiry;
+        uint32_t diff = expiry ^ current_;
+        for (int level = 0; level < LEVELS; level++) {
+            int shift = SLOT_BITS * level;
+            if ((diff >> (shift + SLOT_BITS)) == 0) {
+                int slot = (int)((expiry >> shift) & (SLOTS - 1));
+                link(id, level * SLOTS + slot);
+                occupied_[level] |= 1ULL << slot;
+                return;
+            }
+        }
+        link(id, OVERFLOW);
+    }
+
+    void link(int id, int list) {
+        Node& node = nodes_[id];
+        node.list = (int16_t)list;
+        node.prev = NONE;
+        node.next = heads_[list];
+        if (node.next != NONE) nodes_[node.next].prev = (int16_t)id;
+        heads_[list] = (int16_t)id;
+    }
+
+    void unlink(int id) {
+        Node& node = nodes_[id];
+        int list = node.list;
+        if (node.prev != NONE) {
+            nodes_[node.prev].next = node.next;
+        } else {
+            heads_[list] = node.next;
+        }
+        if (node.next != NONE) nodes_[node.next].prev = node.prev;
+        node.list = node.prev = node.next = NONE;
+        if (list != OVERFLOW && heads_[list] == NONE) occupied_[list / SLOTS] &= ~(1ULL << (list % SLOTS));
+    }
+
+    // リストを取り外して、入っていたタイマーを現在の tick から入れ直す
+    void replace(int list) {
+        int id = heads_[list];
+        while (id != NONE) {
+            int next = nodes_[id].next;
+            unlink(id);
+            place(id);
+            id = next;
+        }
+    }
+
+    // 現在の tick が範囲の先頭になった上の段のスロットを、上の段から順に入れ直す
+    void cascade() {
+        if ((current_ & ((1u << RANGE_BITS) - 1)) == 0) replace(OVERFLOW);
+        for (int level = LEVELS - 1; level >= 1; level--) {
+            int shift = SLOT_BITS * level;
+            if ((current_ & ((1u << shift) - 1)) != 0) continue;
+            replace(level * SLOTS + (int)((current_ >> shift) & (SLOTS - 1)));
+        }
+    }
+
+    template <typename Fire>
+    int expire(Fire& fire) {
+        int list = (int)(current_ & (SLOTS - 1));
+        int fired = 0;
+        while (heads_[list] != NONE) {
+            int id = heads_[list];
+            unlink(id);
+            fire(id);
+            fired++;
+        }
+        return fired;
+    }
+
+    uint32_t current_;
+    uint64_t occupied_[LEVELS] = {};
+    int16_t heads_[LISTS];
+    Node nodes_[N];
+};
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json_writer.h"
+#include "metrics.h"
+#include "power_commands.h"
+
+// 要求と電源操作のトレース（実機・シミュレータ共通、/api/trace）
+//
+// 計測点は開始・終了のイベントをRAM上の固定長リングに書く。書き込みはロックなし（fetch_add で位置を取り、
+// スロットごとの seq で書き終わりを示す）で、一周したら古いものから上書きする。無効のときは
+// enabled() のアトミックな読み出し1回だけで戻る。
+// /api/trace は Chrome Trace Event 形式（Perfetto / chrome://tracing で開ける）で書き出す。
+//
+// Clock::nowUs() は単調増加のマイクロ秒、Clock::threadId() はタスク（スレッド）の識別子。
+
+enum class TracePoint : uint8_t {
+    HttpParse,    // リクエストの解析（シミュレータのみ。実機は ESPAsyncWebServer の中）
+    HttpHandler,  // ルートのハンドラ（arg は Route）
+    HttpSend,     // 応答の送信（シミュレータのみ）
+    Queued,       // コマンドがキューに入ってからパルスを始めるまで（非同期、id はチャンネルと種類）
+    Rejected,     // キューに入れなかった（瞬間、detail は CommandResult、長押しなら 0x80）
+    Drain,        // コマンドワーカーの1回の処理
+    Pulse,        // パルス（非同期、id はチャンネル、detail は PulseKind）
+    PulseFailed   // ピンに書けず押せなかった（瞬間、arg はチャンネル、detail は PulseKind）
+};
+
+// Chrome Trace Event の ph
+enum class TracePhase : uint8_t { Begin = 'B', End = 'E', AsyncBegin = 'b', AsyncEnd = 'e', Instant = 'i' };
+
+inline const char* tracePointName(TracePoint point) {
+    switch (point) {
+        case TracePoint::HttpParse:   return "http.parse";
+        case TracePoint::HttpHandler: return "http.handler";
+        case TracePoint::HttpSend:    return "http.send";
+        case TracePoint::Queued:      return "command.queued";
+        case TracePoint::Rejected:    return "command.rejected";
+        case TracePoint::Drain:       return "worker.drain";
+        case TracePoint::Pulse:       return "pulse";
+        case TracePoint::PulseFailed: return "pulse.failed";
+    }
+    return "unknown";
+}
+
+struct TraceEvent {
+    uint64_t tsUs;
+    uint32_t tid;
+    uint32_t arg;
+    TracePoint point;
+    TracePhase phase;
+    uint8_t detail;
+};
+
+template <typename Clock, size_t Capacity>
+class TraceBuffer {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    TraceBuffer() {
+        for (Slot& slot : slots_) slot.seq.store(0, std::memory_order_relaxed);
+    }
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+    void setEnabled(bool on) { enabled_.store(on, std::memory_order_relaxed); }
+
+    // 書き込み中の記録と重なっても、読み出し側は seq で捨てるので安全
+    void clear() { head_.store(0, std::memory_order_relaxed); }
+
+    void record(TracePoint point, TracePhase phase, uint32_t arg = 0, uint8_t detail = 0) {
+        if (!enabled()) return;
+        uint64_t now = Clock::nowUs();
+        uint32_t index = head_.fetch_add(1, std::memory_order_relaxed);
+        Slot& slot = slots_[index & (Capacity - 1)];
+        slot.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.tsLow.store((uint32_t)now, std::memory_order_relaxed);
+        slot.tsHigh.store((uint32_t)(now >> 32), std::memory_order_relaxed);
+        slot.tid.store(Clock::threadId(), std::memory_order_relaxed);
+        slot.arg.store(arg, std::memory_order_relaxed);
+        slot.meta.store((uint32_t)point | (uint32_t)phase << 8 | (uint32_t)detail << 16, std::memory_order_relaxed);
+        slot.seq.store(index + 1, std::memory_order_release);
+    }
+
+    // 読み出せる範囲 [first, end)（古いものは上書きされている）
+    uint32_t end() const { return head_.load(std::memory_order_acquire); }
+    uint32_t first() const {
+        uint32_t head = end();
+        return head > Capacity ? head - (uint32_t)Capacity : 0;
+    }
+
+    // index 番目のイベント。上書きされた・書き込み中なら false
+    bool read(uint32_t index, TraceEvent& event) const {
+        const Slot& slot = slots_[index & (Capacity - 1)];
+        if (slot.seq.load(std::memory_order_acquire) != index + 1) return false;
+        uint32_t low = slot.tsLow.load(std::memory_order_relaxed);
+        uint32_t high = slot.tsHigh.load(std::memory_order_relaxed);
+        uint32_t meta = slot.meta.load(std::memory_order_relaxed);
+        event.tid = slot.tid.load(std::memory_order_relaxed);
+        event.arg = slot.arg.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != index + 1) return false;
+        event.tsUs = (uint64_t)high << 32 | low;
+        event.point = (TracePoint)(meta & 0xFF);
+        event.phase = (TracePhase)((meta >> 8) & 0xFF);
+        event.detail = (uint8_t)(meta >> 16);
+        return true;
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    // 32ビットのアトミックだけを使う（ESP32で64ビットのアトミックはロックになる）
+    struct Slot {
+        std::atomic<uint32_t> seq;  // index + 1（0は書き込み中）
+        std::atomic<uint32_t> tsLow;
+        std::atomic<uint32_t> tsHigh;
+        std::atomic<uint32_t> tid;
+        std::atomic<uint32_t> arg;
+        std::atomic<uint32_t> meta;  // point | phase << 8 | detail << 16
+    };
+
+    std::atomic<bool> enabled_{false};
+    std::atomic<uint32_t> head_{0};
+    Slot slots_[Capacity];
+};
+
+// スコープの開始・終了を記録する（無効なら何もしない）
+template <typename Buffer>
+class TraceScope {
+public:
+    TraceScope(Buffer& buffer, TracePoint point, uint32_t arg = 0) : buffer_(buffer), point_(point), arg_(arg) {
+        active_ = buffer.enabled();
+        if (active_) buffer.record(point, TracePhase::Begin, arg);
+    }
+    ~TraceScope() {
+        if (active_) buffer_.record(point_, TracePhase::End, arg_);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    Buffer& buffer_;
+    TracePoint point_;
+    uint32_t arg_;
+    bool active_;
+};
+
+// 非同期イベントの id（同じチャンネルの通常押しと長押しは別々に待つ）
+inline uint32_t traceCommandId(int channel, PulseKind kind) {
+    return (uint32_t)channel * 2 + (kind == PulseKind::Long ? 1 : 0);
+}
+
+// submit() の結果。キューに入ったら待ちの開始、まとめた・満杯なら瞬間イベント
+template <typename Buffer>
+inline void traceSubmit(Buffer& trace, int channel, PulseKind kind, CommandResult result) {
+    if (!trace.enabled() || channel < 0) return;
+    if (result == CommandResult::Queued) {
+        trace.record(TracePoint::Queued, TracePhase::AsyncBegin, traceCommandId(channel, kind));
+    } else if (result == CommandResult::Coalesced || result == CommandResult::Full) {
+        trace.record(TracePoint::Rejected, TracePhase::Instant, (uint32_t)channel,
+                     (uint8_t)((uint8_t)result | (kind == PulseKind::Long ? 0x80 : 0)));
+    }
+}
+
+// ワーカーがキューから取り出して開始を試みた結果。Busy 以外なら待ちは終わり
+template <typename Buffer>
+inline void traceCommandStart(Buffer& trace, int channel, PulseKind kind, PulseResult result) {
+    if (result != PulseResult::Busy) trace.record(TracePoint::Queued, TracePhase::AsyncEnd, traceCommandId(channel, kind));
+}
+
+// POST /api/trace の応答 {"enabled":true,"events":120,"recorded":120,"capacity":512}
+// recorded は消去してからの総数（capacity を超えた分は上書きされている）
+template <typename Buffer>
+inline void writeTraceState(JsonWriter& json, const Buffer& trace) {
+    json.beginObject()
+        .field("enabled", trace.enabled())
+        .field("events", (uint32_t)(trace.end() - trace.first()))
+        .field("recorded", trace.end())
+        .field("capacity", (uint32_t)Buffer::capacity())
+        .endObject();
+}
+
+// Chrome Trace Event 形式の書き出し（MetricsRenderer と同じく、render() を0が返るまで呼ぶ）
+// {"displayTimeUnit":"ms","traceEvents":[
+//  {"name":"http.handler power","cat":"http","ph":"B","ts":1200,"pid":1,"tid":3},...]}
+template <typename Buffer>
+class TraceRenderer {
+public:
+    TraceRenderer(const Buffer& buffer, const char* const* channelNames, int channels)
+        : buffer_(buffer), names_(channelNames), channels_(channels), next_(buffer.first()), end_(buffer.end()) {}
+
+    size_t render(char* buf, size_t cap) {
+        size_t written = 0;
+        while (written < cap) {
+            if (lineOff_ == lineLen_) {
+                if (!nextLine()) break;
+            }
+            size_t n = lineLen_ - lineOff_;
+            if (n > cap - written) n = cap - written;
+            memcpy(buf + written, line_ + lineOff_, n);
+            lineOff_ += n;
+            written += n;
+        }
+        return written;
+    }
+
+private:
+    bool nextLine() {
+        lineOff_ = 0;
+        lineLen_ = 0;
+        if (!started_) {
+            started_ = true;
+            append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+            return true;
+        }
+        TraceEvent event;
+        while (next_ != end_) {
+            if (buffer_.read(next_++, event)) {
+                writeEvent(event);
+                return true;
+            }
+        }
+        if (!finished_) {
+            finished_ = true;
+            append("\n]}\n");
+            return true;
+        }
+        return false;
+    }
+
+    void writeEvent(const TraceEvent& event) {
+        append(first_ ? "\n" : ",\n");
+        first_ = false;
+        const char* cat = event.point == TracePoint::Pulse || event.point == TracePoint::PulseFailed ? "pulse" : "command";
+        char name[48];
+        snprintf(name, sizeof(name), "%s", tracePointName(event.point));
+        if (event.point == TracePoint::HttpHandler) {
+            cat = "http";
+            snprintf(name, sizeof(name), "%s %s", tracePointName(event.point), routeLabel((Route)event.arg));
+        } else if (event.point == TracePoint::HttpParse || event.point == TracePoint::HttpSend) {
+            cat = "http";
+        } else if (event.point == TracePoint::Pulse && event.detail == (uint8_t)PulseKind::Long) {
+            snprintf(name, sizeof(name), "pulse.long");
+        }
+        append("{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%lu", name, cat,
+               (char)event.phase, (unsigned long long)event.tsUs, (unsigned long)event.tid);
+        switch (event.point) {
+            case TracePoint::Queued:
+            case TracePoint::Pulse:
+            case TracePoint::PulseFailed:
+            case TracePoint::Rejected: {
+                int channel = event.point == TracePoint::Queued ? (int)(event.arg / 2) : (int)event.arg;
+                bool isLong = event.point == TracePoint::Queued     ? (event.arg & 1) != 0
+                              : event.point == TracePoint::Rejected ? (event.detail & 0x80) != 0
+                                                                    : event.detail == (uint8_t)PulseKind::Long;
+                if (event.phase == TracePhase::AsyncBegin || event.phase == TracePhase::AsyncEnd) {
+                    append(",\"id\":%lu", (unsigned long)event.arg);
+                } else if (event.phase == TracePhase::Instant) {
+                    append(",\"s\":\"t\"");
+                }
+                const char* label = channel >= 0 && channel < channels_ ? names_[channel] : "";
+                char escaped[48];
+                escapeJson(label, escaped, sizeof(escaped));
+                append(",\"args\":{\"channel\":%d,\"pc\":\"%s\",\"kind\":\"%s\"", channel, escaped,
+                       isLong ? "long" : "short");
+                if (event.point == TracePoint::Rejected) {
+                    bool full = (event.detail & 0x7F) == (uint8_t)CommandResult::Full;
+                    append(",\"result\":\"%s\"", full ? "full" : "coalesced");
+                }
+                append("}");
+                break;
+            }
+            default:
+                break;
+        }
+        append("}");
+    }
+
+    void append(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(line_ + lineLen_, sizeof(line_) - lineLen_, fmt, args);
+        va_end(args);
+        if (n > 0) lineLen_ += (size_t)n < sizeof(line_) - lineLen_ ? (size_t)n : sizeof(line_) - lineLen_ - 1;
+    }
+
+    static void escapeJson(const char* in, char* out, size_t cap) {
+        size_t o = 0;
+        for (; *in && o + 2 < cap; in++) {
+            if (*in == '\\' || *in == '"') out[o++] = '\\';
+            if ((unsigned char)*in >= 0x20) out[o++] = *in;
+        }
+        out[o] = '\0';
+    }
+
+    const Buffer& buffer_;
+    const char* const* names_;
+    int channels_;
+    uint32_t next_;
+    uint32_t end_;
+    bool started_ = false;
+    bool finished_ = false;
+    bool first_ = true;
+    char line_[256];
+    size_t lineLen_ = 0;
+    size_t lineOff_ = 0;
+};
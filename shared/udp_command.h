@@ -0,0 +1,268 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "power_commands.h"
+#include "pulse_engine.h"
+
+// 認証付きUDP制御プロトコル（実機・シミュレータ共通）
+//
+// HTTPの接続確立やヘッダー解析を省き、1データグラムの要求に1データグラムのACKで答える。
+// 要求（56バイト、整数はリトルエンディアン）:
+//   0  'P' 'C'
+//   2  version (1)
+//   3  action (1=押す, 2=長押し)
+//   4  clientId (u32)  送信元ごとに固定の識別子
+//   8  nonce (u64)     送信時刻（UNIX時刻のマイクロ秒）。同じ clientId では単調増加させる
+//   16 channels (u64)  対象チャンネルのビットマスク（0 なら何もせずACKだけ返す）。チャンネル0〜63だけを指定でき、
+//                      64以降のチャンネル（I/Oエキスパンダで増やした分）はHTTPで操作する
+//   24 tag[32]         先頭24バイトの HMAC-SHA256
+// ACK（52バイト）:
+//   0  'P' 'C' version (action | 0x80)
+//   4  clientId, 8 nonce（要求と同じ）
+//   16 status, 17 queueDepth, 18 予約(2)
+//   20 accepted (u64)  受け付けたチャンネル
+//   28 rejected (u64)  キュー満杯・範囲外で受け付けなかったチャンネル
+//   36 tag[16]         先頭36バイトの HMAC-SHA256 の先頭16バイト
+//
+// タグが合わない要求には何も返さない（鍵を知らない送信元にはACKが届かないので、
+// 送信元を偽装した反射・増幅には使えない。ACKは要求より小さい）。
+// 受け付けた要求は pressPowerButton() / longPressPowerButtonAsync() と同じキューに積む。
+
+static const uint8_t UDP_COMMAND_VERSION = 1;
+static const size_t UDP_COMMAND_REQUEST_BYTES = 56;
+static const size_t UDP_COMMAND_SIGNED_BYTES = 24;
+static const size_t UDP_COMMAND_ACK_BYTES = 52;
+static const size_t UDP_COMMAND_ACK_SIGNED_BYTES = 36;
+static const size_t UDP_COMMAND_TAG_BYTES = 32;
+static const size_t UDP_COMMAND_ACK_TAG_BYTES = 16;
+
+enum class UdpAction : uint8_t {
+    Press = 1,
+    LongPress = 2
+};
+
+enum class UdpStatus : uint8_t {
+    Ok,          // すべてのチャンネルを受け付けた
+    Partial,     // 一部のチャンネルを受け付けなかった（rejected を参照）
+    Replay,      // 処理済みの nonce か、時刻が大きくずれている（再送ならACKが失われただけ）
+    BadRequest   // 認証は通ったが version / action が不正
+};
+
+struct UdpCommand {
+    UdpAction action;
+    uint32_t clientId;
+    uint64_t nonce;
+    uint64_t channels;
+};
+
+inline uint64_t udpLoad(const uint8_t* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+inline void udpStore(uint8_t* p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+// タグの比較（一致するまでの時間で中身が分からないよう、常に全バイトを比べる）
+inline bool udpTagEqual(const uint8_t* a, const uint8_t* b, size_t len) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; i++) diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+// 送信側：要求を組み立てる（hmac(data, len, tag[32]) は鍵を設定済みのHMAC-SHA256）
+template <typename Hmac>
+size_t writeUdpCommand(uint8_t* out, const UdpCommand& command, Hmac& hmac) {
+    out[0] = 'P';
+    out[1] = 'C';
+    out[2] = UDP_COMMAND_VERSION;
+    out[3] = (uint8_t)command.action;
+    udpStore(out + 4, command.clientId, 4);
+    udpStore(out + 8, command.nonce, 8);
+    udpStore(out + 16, command.channels, 8);
+    hmac(out, UDP_COMMAND_SIGNED_BYTES, out + UDP_COMMAND_SIGNED_BYTES);
+    return UDP_COMMAND_REQUEST_BYTES;
+}
+
+struct UdpAck {
+    uint8_t action;
+    uint32_t clientId;
+    uint64_t nonce;
+    UdpStatus status;
+    uint8_t queueDepth;
+    uint64_t accepted;
+    uint64_t rejected;
+};
+
+// 送信側：ACKを検証して読む（タグが合わなければ false）
+template <typename Hmac>
+bool parseUdpAck(const uint8_t* data, size_t len, Hmac& hmac, UdpAck& ack) {
+    if (len != UDP_COMMAND_ACK_BYTES || data[0] != 'P' || data[1] != 'C' || data[2] != UDP_COMMAND_VERSION) {
+        return false;
+    }
+    uint8_t tag[UDP_COMMAND_TAG_BYTES];
+    hmac(data, UDP_COMMAND_ACK_SIGNED_BYTES, tag);
+    if (!udpTagEqual(tag, data + UDP_COMMAND_ACK_SIGNED_BYTES, UDP_COMMAND_ACK_TAG_BYTES)) return false;
+    ack.action = data[3] & 0x7F;
+    ack.clientId = (uint32_t)udpLoad(data + 4, 4);
+    ack.nonce = udpLoad(data + 8, 8);
+    ack.status = (UdpStatus)data[16];
+    ack.queueDepth = data[17];
+    ack.accepted = udpLoad(data + 20, 8);
+    ack.rejected = udpLoad(data + 28, 8);
+    return true;
+}
+
+// 再送攻撃の防止：clientId ごとに最大の nonce と、その手前64個の受信済みビットを持つ
+//
+// 時刻が合っていれば（nowUnixUs != 0）、現在時刻から maxSkewUs 以上ずれた nonce も拒否する。
+// 時刻が合う前は表だけで判定するので、再起動直後は再起動前の要求を再送されると通ってしまう。
+// 表が一杯になったら最も長く使われていない clientId を追い出し、その最大 nonce を下限として覚える
+// （nonce が時刻なので、追い出された clientId の古い要求はこの下限で弾かれる）。
+// 単一のタスク・スレッドから呼ぶこと。
+template <int Clients>
+class UdpReplayGuard {
+public:
+    static const int WINDOW = 64;
+
+    // 新しい nonce なら記録して true
+    bool accept(uint32_t clientId, uint64_t nonce, uint64_t nowUnixUs, uint64_t maxSkewUs) {
+        if (nowUnixUs != 0) {
+            if (nonce + maxSkewUs < nowUnixUs || nonce > nowUnixUs + maxSkewUs) return false;
+        }
+        tick_++;
+        Entry* entry = find(clientId);
+        if (!entry) {
+            if (nonce <= evictedFloor_) return false;
+            entry = allocate(clientId);
+            entry->highest = nonce;
+            entry->seen = 1;
+            return true;
+        }
+        entry->lastUsed = tick_;
+        if (nonce > entry->highest) {
+            uint64_t shift = nonce - entry->highest;
+            entry->seen = shift >= (uint64_t)WINDOW ? 1 : (entry->seen << shift) | 1;
+            entry->highest = nonce;
+            return true;
+        }
+        uint64_t age = entry->highest - nonce;
+        if (age >= (uint64_t)WINDOW) return false;
+        uint64_t bit = 1ULL << age;
+        if (entry->seen & bit) return false;
+        entry->seen |= bit;
+        return true;
+    }
+
+private:
+    struct Entry {
+        uint32_t clientId;
+        bool used;
+        uint64_t highest;
+        uint64_t seen;      // bit i は highest - i を受信済み
+        uint32_t lastUsed;
+    };
+
+    Entry* find(uint32_t clientId) {
+        for (int i = 0; i < Clients; i++) {
+            if (entries_[i].used && entries_[i].clientId == clientId) return &entries_[i];
+        }
+        return nullptr;
+    }
+
+    Entry* allocate(uint32_t clientId) {
+        Entry* victim = &entries_[0];
+        for (int i = 0; i < Clients; i++) {
+            if (!entries_[i].used) {
+                victim = &entries_[i];
+                break;
+            }
+            if ((int32_t)(entries_[i].lastUsed - victim->lastUsed) < 0) victim = &entries_[i];
+        }
+        if (victim->used && victim->highest > evictedFloor_) evictedFloor_ = victim->highest;
+        victim->clientId = clientId;
+        victim->used = true;
+        victim->lastUsed = tick_;
+        return victim;
+    }
+
+    Entry entries_[Clients] = {};
+    uint64_t evictedFloor_ = 0;
+    uint32_t tick_ = 0;
+};
+
+// 受信側：要求を検証・実行し、reply にACKを書いてその長さを返す（返信しないなら0）
+//
+// hmac(data, len, tag[32]) は鍵を設定済みのHMAC-SHA256、
+// submit(channel, kind) は CommandResult を返す（pressPowerButton と同じキューに積む）、
+// depth() はACKに載せるキューの深さ。
+template <int N, int Clients>
+class UdpCommandServer {
+public:
+    explicit UdpCommandServer(uint32_t maxSkewS) : maxSkewUs_((uint64_t)maxSkewS * 1000000ULL) {}
+
+    template <typename Hmac, typename Submit, typename Depth>
+    size_t handle(const uint8_t* data, size_t len, uint64_t nowUnixUs, Hmac& hmac, Submit submit, Depth depth,
+                  uint8_t* reply, size_t cap) {
+        if (len != UDP_COMMAND_REQUEST_BYTES || data[0] != 'P' || data[1] != 'C') return 0;
+        if (cap < UDP_COMMAND_ACK_BYTES) return 0;
+        uint8_t tag[UDP_COMMAND_TAG_BYTES];
+        hmac(data, UDP_COMMAND_SIGNED_BYTES, tag);
+        if (!udpTagEqual(tag, data + UDP_COMMAND_SIGNED_BYTES, UDP_COMMAND_TAG_BYTES)) return 0;
+
+        UdpCommand command;
+        command.action = (UdpAction)data[3];
+        command.clientId = (uint32_t)udpLoad(data + 4, 4);
+        command.nonce = udpLoad(data + 8, 8);
+        command.channels = udpLoad(data + 16, 8);
+
+        uint64_t accepted = 0;
+        uint64_t rejected = 0;
+        UdpStatus status;
+        if (data[2] != UDP_COMMAND_VERSION ||
+            (command.action != UdpAction::Press && command.action != UdpAction::LongPress)) {
+            status = UdpStatus::BadRequest;
+        } else if (!guard_.accept(command.clientId, command.nonce, nowUnixUs, maxSkewUs_)) {
+            status = UdpStatus::Replay;
+        } else {
+            PulseKind kind = command.action == UdpAction::LongPress ? PulseKind::Long : PulseKind::Short;
+            // ボードにないチャンネルは rejected に入れる（N が64より大きくても、このマスクで指定できるのは63まで）
+            for (int ch = 0; ch < 64; ch++) {
+                uint64_t bit = 1ULL << ch;
+                if (!(command.channels & bit)) continue;
+                CommandResult result = ch < N ? submit(ch, kind) : CommandResult::InvalidChannel;
+                if (result == CommandResult::Queued || result == CommandResult::Coalesced) {
+                    accepted |= bit;
+                } else {
+                    rejected |= bit;
+                }
+            }
+            status = rejected ? UdpStatus::Partial : UdpStatus::Ok;
+        }
+
+        int queueDepth = depth();
+        reply[0] = 'P';
+        reply[1] = 'C';
+        reply[2] = UDP_COMMAND_VERSION;
+        reply[3] = data[3] | 0x80;
+        udpStore(reply + 4, command.clientId, 4);
+        udpStore(reply + 8, command.nonce, 8);
+        reply[16] = (uint8_t)status;
+        reply[17] = (uint8_t)(queueDepth > 255 ? 255 : queueDepth);
+        reply[18] = 0;
+        reply[19] = 0;
+        udpStore(reply + 20, accepted, 8);
+        udpStore(reply + 28, rejected, 8);
+        hmac(reply, UDP_COMMAND_ACK_SIGNED_BYTES, tag);
+        for (size_t i = 0; i < UDP_COMMAND_ACK_TAG_BYTES; i++) reply[UDP_COMMAND_ACK_SIGNED_BYTES + i] = tag[i];
+        return UDP_COMMAND_ACK_BYTES;
+    }
+
+private:
+    UdpReplayGuard<Clients> guard_;
+    uint64_t maxSkewUs_;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+// SNTPで合わせる時刻（実機・シミュレータ共通）
+//
+// 単調時計（実機は esp_timer、シミュレータはタイマーの時計）の値と、同期で受け取ったUNIX時刻の対応を持つ。
+// 同期と同期の間は、前回までの同期で測った単調時計の進みの速さのずれ（ppb）で補正して時刻を出す。
+// 水晶の誤差（数十ppm）は1時間で数十〜百ミリ秒になり、同期の間隔が長い（ネットワークが止まった）ほど大きくなる。
+//
+// 同期のたびに、予測した時刻との差（オフセット）をその間の経過時間で割った分だけ速さを直す。
+// 2回目以降は半分ずつ直す（同期ごとの揺らぎで大きく振れないように）。
+// オフセットが STEP_US を超えたら（初回、手で時刻を変えた等）時刻だけを合わせ、速さは直さない。
+// 時刻は単調時計に対して単調に増えるが、同期の瞬間には前後に跳ぶことがある。スレッドセーフではない。
+
+class WallClock {
+public:
+    static constexpr int64_t STEP_US = 1000000;           // これより大きいずれは速さの誤差とみなさない
+    static constexpr uint64_t MIN_INTERVAL_US = 60000000;  // これより短い間隔では速さを測らない
+    static constexpr int32_t MAX_DRIFT_PPB = 500000;       // ±500ppm
+
+    bool synced() const { return syncs_ > 0; }
+
+    // monoUs の時点の正しい時刻が unixUs だった
+    void sync(uint64_t monoUs, uint64_t unixUs) {
+        if (synced()) {
+            int64_t offset = (int64_t)(unixUs - unixUsAt(monoUs));
+            uint64_t elapsed = monoUs - baseMonoUs_;
+            lastOffsetUs_ = offset;
+            if (offset > -STEP_US && offset < STEP_US && elapsed >= MIN_INTERVAL_US) {
+                int64_t correction = offset * 1000000000LL / (int64_t)elapsed;
+                if (rated_) correction /= 2;
+                int64_t ppb = (int64_t)driftPpb_ + correction;
+                if (ppb > MAX_DRIFT_PPB) ppb = MAX_DRIFT_PPB;
+                if (ppb < -MAX_DRIFT_PPB) ppb = -MAX_DRIFT_PPB;
+                driftPpb_ = (int32_t)ppb;
+                rated_ = true;
+            } else if (offset <= -STEP_US || offset >= STEP_US) {
+                steps_++;
+            }
+        }
+        baseMonoUs_ = monoUs;
+        baseUnixUs_ = unixUs;
+        syncs_++;
+    }
+
+    // monoUs の時点のUNIX時刻（マイクロ秒）。同期前は0
+    uint64_t unixUsAt(uint64_t monoUs) const {
+        if (!synced()) return 0;
+        int64_t elapsed = (int64_t)(monoUs - baseMonoUs_);
+        return baseUnixUs_ + (uint64_t)(elapsed + elapsed / 1000 * driftPpb_ / 1000000);
+    }
+
+    // UNIX時刻 unixUs になる単調時計の値（unixUsAt の逆）。同期前は0
+    uint64_t monoUsAt(uint64_t unixUs) const {
+        if (!synced()) return 0;
+        int64_t elapsed = (int64_t)(unixUs - baseUnixUs_);
+        return baseMonoUs_ + (uint64_t)(elapsed - elapsed / 1000 * driftPpb_ / (1000000 + driftPpb_ / 1000));
+    }
+
+    uint32_t unixAt(uint64_t monoUs) const { return (uint32_t)(unixUsAt(monoUs) / 1000000ULL); }
+
+    int32_t driftPpb() const { return driftPpb_; }
+    int64_t lastOffsetUs() const { return lastOffsetUs_; }
+    uint64_t lastSyncMonoUs() const { return baseMonoUs_; }
+    uint32_t syncs() const { return syncs_; }
+    uint32_t steps() const { return steps_; }
+
+private:
+    uint64_t baseMonoUs_ = 0;
+    uint64_t baseUnixUs_ = 0;
+    int32_t driftPpb_ = 0;
+    int64_t lastOffsetUs_ = 0;
+    uint32_t syncs_ = 0;
+    uint32_t steps_ = 0;
+    bool rated_ = false;
+};
@@ -1,125 +1,88 @@
 #pragma once
 
-#include <sstream>
-#include <string>
-#include <vector>
-
-// 共通のWeb UIを生成（日本語表示、軽量）
-inline std::string buildWebUI(const std::vector<std::string>& pcNames,
-                              const std::string& platformLabel,
-                              const std::string& modeLabel,
-                              int pcCount) {
-    std::ostringstream html;
-
-    // 1) ヘッダーと先頭部分
-    html << R"HTML(<!DOCTYPE html>
-<html lang="ja">
-<head>
-    <meta charset="UTF-8">
-    <meta name="viewport" content="width=device-width, initial-scale=1.0">
-    <title>PC電源制御</title>
-    <style>
-        * { margin: 0; padding: 0; box-sizing: border-box; }
-        body { font-family: -apple-system, BlinkMacSystemFont, 'Segoe UI', sans-serif; background: #f7f7f7; color: #222; padding: 16px; }
-        .wrap { max-width: 760px; margin: 0 auto; }
-        h1 { font-size: 1.6rem; margin-bottom: 12px; }
-        .meta { font-size: 0.9rem; color: #555; margin-bottom: 16px; }
-        .info { background: #fff; border: 1px solid #ddd; padding: 12px; margin-bottom: 12px; }
-        .grid { display: grid; gap: 10px; grid-template-columns: repeat(auto-fit, minmax(240px, 1fr)); margin-bottom: 12px; }
-        .card { background: #fff; border: 1px solid #ddd; padding: 12px; }
-        .name { font-weight: 600; margin-bottom: 6px; }
-        .btn { width: 100%; padding: 10px; margin-top: 6px; border: 1px solid #ccc; background: #f0f0f0; cursor: pointer; font-weight: 600; }
-        .btn:active { background: #e0e0e0; }
-        .message { margin-top: 8px; padding: 8px; display: none; border: 1px solid #ccc; background: #fafafa; }
-    </style>
-</head>
-<body>
-    <div class="wrap">
-        <h1>PC電源制御</h1>
-        <div class="meta">プラットフォーム: )HTML";
-
-    // 2) プラットフォームとモード
-    html << platformLabel << " / モード: " << modeLabel << R"HTML(</div>
-
-        <div class="grid" id="pcGrid"></div>
-
-        <div class="info">
-            <div>接続PC台数: <span id="pcCount">)HTML";
-
-    // 3) 台数
-    html << pcCount << R"HTML(</span></div>
-            <div id="message" class="message"></div>
-        </div>
-    </div>
-
-    <script>
-        const pcNames = [)HTML";
-
-    // 4) PC名の配列を挿入
-    for (size_t i = 0; i < pcNames.size(); ++i) {
-        html << "\"" << pcNames[i] << "\"";
-        if (i + 1 < pcNames.size()) html << ",";
-    }
-
-    // 5) 残りのスクリプト
-    html << R"HTML(];
-
-        function showMessage(text, isSuccess) {
-            const msg = document.getElementById('message');
-            msg.textContent = text;
-            msg.className = 'message ' + (isSuccess ? 'success' : 'error');
-            msg.style.display = 'block';
-            setTimeout(() => { msg.style.display = 'none'; }, 3000);
-        }
-
-        async function togglePower(pcIndex) {
-            try {
-                const response = await fetch(`/api/power/${pcIndex}`, { method: 'POST' });
-                const data = await response.json();
-                if (response.ok && data.success) {
-                    showMessage(data.message || '電源操作を実行しました', true);
-                } else {
-                    showMessage('エラー: ' + (data.message || response.statusText || '不明なエラー'), false);
-                }
-            } catch (error) {
-                showMessage('通信エラー: ' + (error.message || error.toString()), false);
-            }
+#include <string.h>
+#include <strings.h>
+
+// 共通のWeb UI（日本語表示、軽量）
+//
+// ページ本体は shared/web/index.html。ビルド前に tools/embed_web_ui.py が
+// gzip圧縮して web_ui_gz.h に埋め込むので、リクエストごとにHTMLを組み立てることはない。
+// 機器ごとの情報（PC名、台数、プラットフォーム）はページから /api/info で取得する。
+#include "web_ui_gz.h"
+
+// If-None-Match の値が埋め込みページのETagと一致するか
+// カンマ区切りの複数指定、"*"、弱いETag（W/"..."）の比較に対応する
+inline bool webUiEtagMatches(const char* ifNoneMatch) {
+    if (ifNoneMatch == nullptr) return false;
+
+    const size_t etagLen = sizeof(WEB_UI_ETAG) - 1;
+    const char* p = ifNoneMatch;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (*p == '\0') break;
+        if (*p == '*') return true;
+        if (p[0] == 'W' && p[1] == '/') p += 2;
+
+        const char* end = p;
+        while (*end && *end != ',') end++;
+        const char* trimmed = end;
+        while (trimmed > p && (trimmed[-1] == ' ' || trimmed[-1] == '\t')) trimmed--;
+
+        if ((size_t)(trimmed - p) == etagLen && strncmp(p, WEB_UI_ETAG, etagLen) == 0) {
+            return true;
         }
+        p = end;
+    }
+    return false;
+}
 
-        async function longPressPower(pcIndex) {
-            if (!confirm(`${pcNames[pcIndex]} を強制シャットダウンしますか？\n電源ボタンを5秒間長押しします。`)) return;
-            try {
-                showMessage(`${pcNames[pcIndex]} の電源ボタンを長押ししています...`, true);
-                const response = await fetch(`/api/longpress/${pcIndex}`, { method: 'POST' });
-                const data = await response.json();
-                if (response.ok && data.success) {
-                    showMessage(data.message || '強制シャットダウンを実行しました', true);
-                } else {
-                    showMessage('エラー: ' + (data.message || response.statusText || '不明なエラー'), false);
-                }
-            } catch (error) {
-                showMessage('通信エラー: ' + (error.message || error.toString()), false);
+// Accept-Encoding の1項目の q が0か（"gzip;q=0" など、送ってはいけない指定）
+inline bool webUiQualityIsZero(const char* params, const char* end) {
+    const char* p = params;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ';')) p++;
+        if (end - p >= 2 && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+            p += 2;
+            if (p >= end || *p != '0') return false;
+            for (p++; p < end && *p != ';' && *p != ' ' && *p != '\t'; p++) {
+                if (*p != '.' && *p != '0') return false;
             }
+            return true;
         }
+        while (p < end && *p != ';') p++;
+    }
+    return false;
+}
 
-        function updatePCCards() {
-            const grid = document.getElementById('pcGrid');
-            grid.innerHTML = '';
-            pcNames.forEach((name, index) => {
-                const card = document.createElement('div');
-                card.className = 'card';
-                card.innerHTML =
-                    "<div class='name'>" + name + "</div>" +
-                    "<button class='btn' onclick='togglePower(" + index + ")'>電源トグル</button>" +
-                    "<button class='btn' onclick='longPressPower(" + index + ")'>強制シャットダウン (5秒)</button>";
-                grid.appendChild(card);
-            });
+// Accept-Encoding でgzipを受け取れるか（"gzip" / "x-gzip" / "*"、q=0 は受け取れない）
+// 埋め込みページはgzipしか持たないので、ヘッダがない要求（curl など）も受け取れないとみなす
+inline bool webUiAcceptsGzip(const char* acceptEncoding) {
+    if (acceptEncoding == nullptr) return false;
+
+    int gzip = -1;  // -1 は指定なし
+    int any = -1;
+    const char* p = acceptEncoding;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (*p == '\0') break;
+
+        const char* end = p;
+        while (*end && *end != ',') end++;
+        const char* nameEnd = p;
+        while (nameEnd < end && *nameEnd != ';' && *nameEnd != ' ' && *nameEnd != '\t') nameEnd++;
+        size_t len = (size_t)(nameEnd - p);
+        int accepted = webUiQualityIsZero(nameEnd, end) ? 0 : 1;
+
+        if ((len == 4 && strncasecmp(p, "gzip", 4) == 0) || (len == 6 && strncasecmp(p, "x-gzip", 6) == 0)) {
+            gzip = accepted;
+        } else if (len == 1 && *p == '*') {
+            any = accepted;
         }
-
-        updatePCCards();
-    </script>
-</body>
-</html>)HTML";
-
-    return html.str();
+        p = end;
+    }
+    return gzip >= 0 ? gzip == 1 : any == 1;
 }
+
+// gzipを受け取れないクライアントへの 406 の本文
+constexpr char WEB_UI_GZIP_REQUIRED[] =
+    "This page is served gzip-compressed only. Open it in a web browser (or use curl --compressed).\n";
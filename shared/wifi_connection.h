@@ -0,0 +1,215 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// WiFi接続の状態機械（実機・シミュレータ共通、ブロックしない）
+//
+// 前回つながったAPのBSSID・チャンネルとIPアドレス一式（リース）を保存しておき、起動時や再接続時は
+// まずそれを使って接続する（スキャンを省く高速接続。WIFI_REUSE_IP ならDHCPも省く）。fastTimeoutMs 以内につながらなければ
+// 通常の接続（スキャン + DHCP）に切り替え、それも connectTimeoutMs 以内につながらなければ
+// 指数バックオフで待ってから最初からやり直す。つながったら新しいリースを保存する。
+// 接続が切れたら即座に再接続を始める。
+//
+// poll(nowMs) を loop() などから繰り返し呼ぶ。nowMs の原点は起動時刻（millis() と同じ）。
+// プラットフォーム依存部分は Driver と Store に委譲する：
+//   Driver: void begin(const WifiLease* lease);  // lease が nullptr なら通常の接続
+//           bool connected();                    // 接続済みでIPアドレスがある
+//           bool readLease(WifiLease& lease);    // 接続中のAPとIPアドレス
+//           void stop();
+//   Store:  bool load(WifiLease& lease); void save(const WifiLease& lease);
+
+// 保存する接続情報（IPv4アドレスは a<<24|b<<16|c<<8|d）
+struct WifiLease {
+    uint32_t magic;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t reserved;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint32_t check;  // magic から dns までの FNV-1a
+};
+
+static const uint32_t WIFI_LEASE_MAGIC = 0x57464C31;  // "WFL1"
+
+inline uint32_t wifiLeaseCheck(const WifiLease& lease) {
+    const uint8_t* p = (const uint8_t*)&lease;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(WifiLease, check); i++) hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+inline void sealWifiLease(WifiLease& lease) {
+    lease.magic = WIFI_LEASE_MAGIC;
+    lease.reserved = 0;
+    lease.check = wifiLeaseCheck(lease);
+}
+
+inline bool wifiLeaseValid(const WifiLease& lease) {
+    return lease.magic == WIFI_LEASE_MAGIC && lease.check == wifiLeaseCheck(lease) && lease.channel != 0 &&
+           lease.ip != 0;
+}
+
+inline bool sameWifiLease(const WifiLease& a, const WifiLease& b) {
+    return memcmp(a.bssid, b.bssid, sizeof(a.bssid)) == 0 && a.channel == b.channel && a.ip == b.ip &&
+           a.gateway == b.gateway && a.subnet == b.subnet && a.dns == b.dns;
+}
+
+enum class WifiState : uint8_t {
+    Idle,         // begin() 前
+    FastConnect,  // 保存したリースで接続中
+    Connect,      // スキャン + DHCP で接続中
+    Ready,        // 接続済み
+    Backoff       // 失敗後の待ち
+};
+
+inline const char* wifiStateName(WifiState state) {
+    switch (state) {
+        case WifiState::Idle:        return "idle";
+        case WifiState::FastConnect: return "fast_connect";
+        case WifiState::Connect:     return "connect";
+        case WifiState::Ready:       return "ready";
+        case WifiState::Backoff:     return "backoff";
+    }
+    return "unknown";
+}
+
+enum class WifiEvent : uint8_t {
+    None,
+    Ready,  // つながった（起動後の初回なら Webサーバ等を起動する）
+    Lost    // 切れた（再接続を始めた）
+};
+
+struct WifiTiming {
+    uint32_t fastTimeoutMs;
+    uint32_t connectTimeoutMs;
+    uint32_t backoffMinMs;
+    uint32_t backoffMaxMs;
+};
+
+template <typename Driver, typename Store>
+class WifiConnection {
+public:
+    WifiConnection(Driver& driver, Store& store, const WifiTiming& timing)
+        : driver_(driver), store_(store), timing_(timing) {}
+
+    void begin(uint32_t nowMs) {
+        outageStartMs_ = nowMs;
+        attempt(nowMs);
+    }
+
+    WifiEvent poll(uint32_t nowMs) {
+        switch (state_) {
+            case WifiState::FastConnect:
+            case WifiState::Connect:
+                if (driver_.connected()) {
+                    becomeReady(nowMs);
+                    return WifiEvent::Ready;
+                }
+                if ((int32_t)(nowMs - deadlineMs_) < 0) break;
+                driver_.stop();
+                if (state_ == WifiState::FastConnect) {
+                    // 保存したAPが見つからない・チャンネルが変わった等。スキャンからやり直す
+                    fastFailures_++;
+                    startConnect(nowMs);
+                } else {
+                    uint32_t delay = timing_.backoffMinMs;
+                    for (uint32_t i = 0; i < failures_ && delay < timing_.backoffMaxMs; i++) delay *= 2;
+                    if (delay > timing_.backoffMaxMs) delay = timing_.backoffMaxMs;
+                    failures_++;
+                    state_ = WifiState::Backoff;
+                    deadlineMs_ = nowMs + delay;
+                }
+                break;
+            case WifiState::Backoff:
+                if ((int32_t)(nowMs - deadlineMs_) >= 0) attempt(nowMs);
+                break;
+            case WifiState::Ready:
+                if (!driver_.connected()) {
+                    outageStartMs_ = nowMs;
+                    lost_++;
+                    attempt(nowMs);
+                    return WifiEvent::Lost;
+                }
+                break;
+            case WifiState::Idle:
+                break;
+        }
+        return WifiEvent::None;
+    }
+
+    // 次に poll() が必要になるまでの時間（0 なら期限なし。Driver の状態が変わったら呼ぶ）
+    uint32_t msUntilDeadline(uint32_t nowMs) const {
+        if (state_ != WifiState::FastConnect && state_ != WifiState::Connect && state_ != WifiState::Backoff) return 0;
+        int32_t left = (int32_t)(deadlineMs_ - nowMs);
+        return left > 0 ? (uint32_t)left : 1;
+    }
+
+    WifiState state() const { return state_; }
+    bool ready() const { return state_ == WifiState::Ready; }
+    bool everReady() const { return bootToReadyMs_ != 0; }
+
+    // 起動からつながるまでの時間（まだなら0）と、直近の切断からつながるまでの時間
+    uint32_t bootToReadyMs() const { return bootToReadyMs_; }
+    uint32_t lastReconnectMs() const { return lastReconnectMs_; }
+
+    uint32_t fastConnects() const { return fastConnects_; }
+    uint32_t fastFailures() const { return fastFailures_; }
+    uint32_t linkLosses() const { return lost_; }
+    uint32_t consecutiveFailures() const { return failures_; }
+
+private:
+    void attempt(uint32_t nowMs) {
+        if (store_.load(lease_) && wifiLeaseValid(lease_)) {
+            state_ = WifiState::FastConnect;
+            deadlineMs_ = nowMs + timing_.fastTimeoutMs;
+            driver_.begin(&lease_);
+        } else {
+            startConnect(nowMs);
+        }
+    }
+
+    void startConnect(uint32_t nowMs) {
+        state_ = WifiState::Connect;
+        deadlineMs_ = nowMs + timing_.connectTimeoutMs;
+        driver_.begin(nullptr);
+    }
+
+    void becomeReady(uint32_t nowMs) {
+        if (state_ == WifiState::FastConnect) fastConnects_++;
+        state_ = WifiState::Ready;
+        failures_ = 0;
+        uint32_t elapsed = nowMs - outageStartMs_;
+        if (bootToReadyMs_ == 0) {
+            bootToReadyMs_ = nowMs > 0 ? nowMs : 1;
+        } else {
+            lastReconnectMs_ = elapsed > 0 ? elapsed : 1;
+        }
+        // 変わったときだけ書く（NVSの書き込み回数を抑える）
+        WifiLease current = {};
+        if (driver_.readLease(current)) {
+            WifiLease saved = {};
+            if (!store_.load(saved) || !wifiLeaseValid(saved) || !sameWifiLease(saved, current)) {
+                sealWifiLease(current);
+                store_.save(current);
+            }
+        }
+    }
+
+    Driver& driver_;
+    Store& store_;
+    WifiTiming timing_;
+    WifiState state_ = WifiState::Idle;
+    WifiLease lease_ = {};
+    uint32_t deadlineMs_ = 0;
+    uint32_t outageStartMs_ = 0;
+    uint32_t failures_ = 0;
+    uint32_t bootToReadyMs_ = 0;
+    uint32_t lastReconnectMs_ = 0;
+    uint32_t fastConnects_ = 0;
+    uint32_t fastFailures_ = 0;
+    uint32_t lost_ = 0;
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Wake-on-LAN マジックパケットの受信（実機・シミュレータ共通）
+//
+// マジックパケットは 0xFF が6バイト続いた後に対象のMACアドレスが16回並ぶ。
+// 宛先MACを config.h の PC_MAC_ADDRESSES から作った表（コンパイル時にソート済み）で
+// 二分探索してチャンネルを決める。
+
+// "aa:bb:cc:dd:ee:ff"（区切りは ':' または '-'、大文字小文字は問わない）を48ビット値にする
+constexpr int macHexDigit(char c) {
+    return c >= '0' && c <= '9' ? c - '0'
+         : c >= 'a' && c <= 'f' ? c - 'a' + 10
+         : c >= 'A' && c <= 'F' ? c - 'A' + 10
+         : -1;
+}
+
+constexpr bool parseMacAddress(const char* text, uint64_t& mac) {
+    mac = 0;
+    for (int i = 0; i < 6; i++) {
+        const char* p = text + i * 3;
+        int hi = macHexDigit(p[0]);
+        if (hi < 0) return false;
+        int lo = macHexDigit(p[1]);
+        if (lo < 0) return false;
+        mac = (mac << 8) | (uint64_t)(hi * 16 + lo);
+        char sep = p[2];
+        if (i < 5 ? (sep != ':' && sep != '-') : sep != '\0') return false;
+    }
+    return true;
+}
+
+struct MacChannel {
+    uint64_t mac;
+    int channel;
+};
+
+// MACアドレス → チャンネルの表（MAC順）
+template <int N>
+struct MacChannelTable {
+    MacChannel entries[N];
+    int count;
+
+    // 見つからなければ -1
+    int lookup(uint64_t mac) const {
+        int lo = 0;
+        int hi = count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (entries[mid].mac < mac) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo < count && entries[lo].mac == mac ? entries[lo].channel : -1;
+    }
+};
+
+// 空文字列（""）のチャンネルは表に入れない
+template <int N>
+constexpr MacChannelTable<N> buildMacChannelTable(const char* const (&macs)[N]) {
+    MacChannelTable<N> table{};
+    for (int ch = 0; ch < N; ch++) {
+        uint64_t mac = 0;
+        if (!parseMacAddress(macs[ch], mac)) continue;
+        int i = table.count++;
+        while (i > 0 && table.entries[i - 1].mac > mac) {
+            table.entries[i] = table.entries[i - 1];
+            i--;
+        }
+        table.entries[i] = MacChannel{mac, ch};
+    }
+    return table;
+}
+
+// 表の書式チェック（static_assert 用）："" か正しいMACで、重複がない
+template <int N>
+constexpr bool macTableValid(const char* const (&macs)[N]) {
+    for (int i = 0; i < N; i++) {
+        uint64_t a = 0;
+        if (macs[i][0] == '\0') continue;
+        if (!parseMacAddress(macs[i], a)) return false;
+        for (int j = 0; j < i; j++) {
+            uint64_t b = 0;
+            if (parseMacAddress(macs[j], b) && a == b) return false;
+        }
+    }
+    return true;
+}
+
+// data のどこかにマジックパケットがあれば宛先MACを返す（SecureOnパスワード等の後続データは無視）
+inline bool parseMagicPacket(const uint8_t* data, size_t len, uint64_t& mac) {
+    const size_t BODY = 6 + 16 * 6;
+    for (size_t start = 0; start + BODY <= len; start++) {
+        // 同期列（0xFF が7個以上続く場合は、ずらした位置で一致する）
+        bool sync = true;
+        for (int i = 0; i < 6 && sync; i++) sync = data[start + i] == 0xFF;
+        if (!sync) continue;
+        const uint8_t* target = data + start + 6;
+        bool match = true;
+        for (size_t i = 6; i < 16 * 6 && match; i++) match = target[i] == target[i % 6];
+        if (!match) continue;
+        mac = 0;
+        for (int b = 0; b < 6; b++) mac = (mac << 8) | target[b];
+        return true;
+    }
+    return false;
+}
+
+// チャンネルごとのクールダウン（WoLツールの再送で電源を入れた直後に切らないようにする）
+template <int N>
+class WolCooldown {
+public:
+    WolCooldown() {
+        for (int i = 0; i < N; i++) until_[i].store(0, std::memory_order_relaxed);
+    }
+
+    // クールダウン中でなければ nowMs + cooldownMs まで確保して true
+    bool tryAcquire(int channel, uint32_t nowMs, uint32_t cooldownMs) {
+        uint32_t until = until_[channel].load(std::memory_order_relaxed);
+        do {
+            if (until != 0 && (int32_t)(nowMs - until) < 0) return false;
+        } while (!until_[channel].compare_exchange_weak(until, (nowMs + cooldownMs) | 1,
+                                                        std::memory_order_acq_rel));
+        return true;
+    }
+
+private:
+    std::atomic<uint32_t> until_[N];
+};
@@ -0,0 +1,215 @@
+// HTTPリクエスト解析のマイクロベンチマーク
+//
+// 同じリクエストの並びを次の2通りで解析し、1要求あたりの時間・スループット・ヒープ確保回数を比べる。
+//   copying     : HttpServer の旧実装（受信バッファから method/path/headers/body を std::string へ
+//                 substr でコピーし、Content-Length と Connection をヘッダー文字列から探す）
+//   incremental : simulator/http_parser.h（受信バッファを指す string_view、確保なし）
+// それぞれ、全体が1回で届いた場合と、segment バイトずつ届いた場合（受信のたびに解析し直す）を測る。
+// 旧実装は届くたびにヘッダー部の先頭から空行を探し直す。
+//
+// ビルドと実行（リポジトリのルートで）：
+//   g++ -std=c++17 -O2 -I./simulator -o http_parse_bench simulator/bench/http_parse_bench.cpp
+//   ./http_parse_bench [iterations] [segment]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <strings.h>
+
+#include "http_parser.h"
+
+static size_t g_allocations = 0;
+
+void* operator new(size_t size) {
+    g_allocations++;
+    void* p = malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// Web UI と curl・監視からの典型的な要求
+const char* const REQUESTS[] = {
+    "GET /api/status HTTP/1.1\r\nHost: 192.168.1.50\r\nUser-Agent: curl/8.5.0\r\nAccept: */*\r\n\r\n",
+    "GET / HTTP/1.1\r\nHost: 192.168.1.50\r\nConnection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/126.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate\r\nAccept-Language: ja,en-US;q=0.9,en;q=0.8\r\n"
+    "If-None-Match: \"5d41402abc4b2a76\"\r\nCache-Control: max-age=0\r\n\r\n",
+    "POST /api/power/3 HTTP/1.1\r\nHost: 192.168.1.50\r\nContent-Length: 0\r\n\r\n",
+    "POST /api/power/batch HTTP/1.1\r\nHost: 192.168.1.50\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 21\r\n\r\nchannels=0,1,2&max=2",
+    "GET /api/metrics HTTP/1.1\r\nHost: 192.168.1.50:80\r\nUser-Agent: Prometheus/2.53.0\r\n"
+    "Accept: application/openmetrics-text;version=1.0.0,text/plain;version=0.0.4;q=0.5,*/*;q=0.1\r\n"
+    "Accept-Encoding: gzip\r\nX-Prometheus-Scrape-Timeout-Seconds: 10\r\n\r\n",
+};
+const int REQUEST_COUNT = sizeof(REQUESTS) / sizeof(REQUESTS[0]);
+
+// ---- copying: 旧 HttpServer::Worker::parse() ----
+
+struct CopyingRequest {
+    std::string method;
+    std::string path;
+    std::string query;
+    std::string version;
+    std::string headers;
+    std::string body;
+    bool keepAlive = true;
+
+    std::string header(const char* name) const {
+        size_t nameLen = strlen(name);
+        size_t pos = 0;
+        while (pos < headers.size()) {
+            size_t eol = headers.find("\r\n", pos);
+            if (eol == std::string::npos) eol = headers.size();
+            size_t colon = headers.find(':', pos);
+            if (colon != std::string::npos && colon < eol && colon - pos == nameLen &&
+                strncasecmp(headers.c_str() + pos, name, nameLen) == 0) {
+                size_t v = colon + 1;
+                while (v < eol && (headers[v] == ' ' || headers[v] == '\t')) v++;
+                size_t e = eol;
+                while (e > v && (headers[e - 1] == ' ' || headers[e - 1] == '\t')) e--;
+                return headers.substr(v, e - v);
+            }
+            pos = eol + 2;
+        }
+        return std::string();
+    }
+};
+
+size_t parseCopying(const std::string& in, size_t start, CopyingRequest& request) {
+    size_t headerEnd = in.find("\r\n\r\n", start);
+    if (headerEnd == std::string::npos) return 0;
+
+    size_t lineEnd = in.find("\r\n", start);
+    std::string line = in.substr(start, lineEnd - start);
+    size_t sp1 = line.find(' ');
+    size_t sp2 = line.find(' ', sp1 == std::string::npos ? 0 : sp1 + 1);
+    if (sp1 != std::string::npos && sp2 != std::string::npos) {
+        request.method = line.substr(0, sp1);
+        request.path = line.substr(sp1 + 1, sp2 - sp1 - 1);
+        size_t q = request.path.find('?');
+        if (q != std::string::npos) {
+            request.query = request.path.substr(q + 1);
+            request.path.resize(q);
+        }
+        request.version = line.substr(sp2 + 1);
+    }
+    request.headers = in.substr(lineEnd + 2, headerEnd + 2 - (lineEnd + 2));
+
+    size_t contentLength = 0;
+    std::string cl = request.header("Content-Length");
+    if (!cl.empty()) contentLength = strtoul(cl.c_str(), nullptr, 10);
+    size_t total = headerEnd + 4 - start + contentLength;
+    if (in.size() - start < total) return 0;
+    request.body = in.substr(headerEnd + 4, contentLength);
+
+    std::string connection = request.header("Connection");
+    if (request.version == "HTTP/1.0") {
+        request.keepAlive = strcasecmp(connection.c_str(), "keep-alive") == 0;
+    } else {
+        request.keepAlive = strcasecmp(connection.c_str(), "close") != 0;
+    }
+    return total;
+}
+
+// ---- 計測 ----
+
+static volatile size_t g_sink = 0;
+
+// 受信バッファ（接続ごとに使い回す）に segment バイトずつ積み、揃ったら解析して消す
+size_t runCopying(const std::string& wire, size_t segment, std::string& buffer) {
+    size_t requests = 0;
+    for (size_t fed = 0; fed < wire.size();) {
+        size_t n = std::min(segment, wire.size() - fed);
+        buffer.append(wire, fed, n);
+        fed += n;
+        size_t consumed = 0;
+        while (true) {
+            CopyingRequest request;
+            size_t used = parseCopying(buffer, consumed, request);
+            if (used == 0) break;
+            consumed += used;
+            g_sink += request.path.size() + request.body.size() + request.keepAlive;
+            requests++;
+        }
+        if (consumed > 0) buffer.erase(0, consumed);
+    }
+    return requests;
+}
+
+size_t runIncremental(const std::string& wire, size_t segment, std::string& buffer) {
+    HttpRequestParser parser;
+    HttpRequest request;
+    size_t requests = 0;
+    for (size_t fed = 0; fed < wire.size();) {
+        size_t n = std::min(segment, wire.size() - fed);
+        buffer.append(wire, fed, n);
+        fed += n;
+        size_t consumed = 0;
+        while (true) {
+            size_t used = 0;
+            HttpParseStatus status = parser.parse(std::string_view(buffer).substr(consumed), request, used);
+            if (status != HttpParseStatus::Complete) break;
+            consumed += used;
+            g_sink += request.path.size() + request.body.size() + request.keepAlive;
+            requests++;
+        }
+        if (consumed == buffer.size()) {
+            buffer.clear();
+        } else if (consumed > 0) {
+            buffer.erase(0, consumed);
+        }
+    }
+    return requests;
+}
+
+void run(const char* name, size_t (*fn)(const std::string&, size_t, std::string&), const std::string& wire,
+         size_t segment, int iterations) {
+    std::string buffer;
+    buffer.reserve(16384);
+    for (int i = 0; i < iterations / 10; i++) fn(wire, segment, buffer);  // ウォームアップ
+
+    size_t requests = 0;
+    size_t allocsBefore = g_allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) requests += fn(wire, segment, buffer);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    double mbps = (double)wire.size() * iterations / (ns / 1e9) / (1024 * 1024);
+    printf("%-12s %-10s %9.1f ns/req %9.1f MiB/s %8.1f allocs/req\n", name,
+           segment >= wire.size() ? "whole" : "segmented", ns / requests, mbps,
+           (double)(g_allocations - allocsBefore) / requests);
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    size_t segment = argc > 2 ? (size_t)atoi(argv[2]) : 64;
+
+    // パイプライン化された1回分の送信（全要求を連結）
+    std::string wire;
+    for (const char* request : REQUESTS) wire += request;
+
+    // 2通りの解析結果が一致することを確認
+    std::string a, b;
+    if (runCopying(wire, wire.size(), a) != (size_t)REQUEST_COUNT ||
+        runIncremental(wire, wire.size(), b) != (size_t)REQUEST_COUNT ||
+        runIncremental(wire, 1, b) != (size_t)REQUEST_COUNT) {
+        fprintf(stderr, "request count mismatch\n");
+        return 1;
+    }
+
+    printf("requests=%d bytes=%zu iterations=%d segment=%zu\n", REQUEST_COUNT, wire.size(), iterations, segment);
+    run("copying", runCopying, wire, wire.size(), iterations);
+    run("incremental", runIncremental, wire, wire.size(), iterations);
+    run("copying", runCopying, wire, segment, iterations / 4);
+    run("incremental", runIncremental, wire, segment, iterations / 4);
+    return 0;
+}
@@ -0,0 +1,182 @@
+// JSONレスポンス生成のマイクロベンチマーク
+//
+// /api/info と /api/status の本文を次の3通りで生成し、1回あたりの時間とヒープ確保回数を比べる。
+//   arduino-string : 実機の旧実装（Arduino String の += / + 連結）を再現したもの
+//   ostringstream  : シミュレータの旧実装
+//   json-writer    : shared/json_writer.h（固定バッファ）
+//
+// ビルドと実行（リポジトリのルートで）：
+//   g++ -std=c++17 -O2 -I./shared -I./src -o json_bench simulator/bench/json_bench.cpp
+//   ./json_bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <string>
+
+#include "config.h"
+#include "json_writer.h"
+
+static size_t g_allocations = 0;
+
+void* operator new(size_t size) {
+    g_allocations++;
+    void* p = malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// Arduino String の確保パターンを再現する最小実装
+// 連結のたびに必要長ちょうどへ realloc し、operator+ は一時オブジェクトを作る。
+class EmuString {
+public:
+    EmuString() {}
+    EmuString(const char* s) { append(s, strlen(s)); }
+    explicit EmuString(int v) {
+        char tmp[12];
+        int n = snprintf(tmp, sizeof(tmp), "%d", v);
+        append(tmp, (size_t)n);
+    }
+    EmuString(const EmuString& o) { append(o.buf_ ? o.buf_ : "", o.len_); }
+    ~EmuString() { free(buf_); }
+
+    EmuString& operator+=(const EmuString& o) { return append(o.buf_ ? o.buf_ : "", o.len_); }
+    EmuString& operator+=(const char* s) { return append(s, strlen(s)); }
+    friend EmuString operator+(const EmuString& a, const EmuString& b) {
+        EmuString r(a);
+        r += b;
+        return r;
+    }
+    friend EmuString operator+(const char* a, const EmuString& b) {
+        EmuString r(a);
+        r += b;
+        return r;
+    }
+    friend EmuString operator+(const EmuString& a, const char* b) {
+        EmuString r(a);
+        r += b;
+        return r;
+    }
+
+    size_t length() const { return len_; }
+
+private:
+    EmuString& append(const char* s, size_t n) {
+        g_allocations++;
+        buf_ = (char*)realloc(buf_, len_ + n + 1);
+        memcpy(buf_ + len_, s, n);
+        len_ += n;
+        buf_[len_] = '\0';
+        return *this;
+    }
+
+    char* buf_ = nullptr;
+    size_t len_ = 0;
+};
+
+bool pcStates[NUM_PHOTOCOUPLERS] = {};
+
+size_t infoArduinoString() {
+    EmuString json = "{";
+    json += "\"ip\":\"" + EmuString("192.168.1.100") + "\",";
+    json += "\"numPCs\":" + EmuString(NUM_PHOTOCOUPLERS) + ",";
+    json += "\"pcNames\":[";
+    for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
+        json += "\"" + EmuString(PC_NAMES[i]) + "\"";
+        if (i < NUM_PHOTOCOUPLERS - 1) json += ",";
+    }
+    json += "]}";
+    return json.length();
+}
+
+size_t statusArduinoString() {
+    EmuString json = "{\"states\":[";
+    for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
+        json += pcStates[i] ? "true" : "false";
+        if (i < NUM_PHOTOCOUPLERS - 1) json += ",";
+    }
+    json += "]}";
+    return json.length();
+}
+
+size_t infoOstringstream() {
+    std::ostringstream json;
+    json << "{\"ip\":\"192.168.1.100\",\"numPCs\":" << NUM_PHOTOCOUPLERS << ",\"pcNames\":[";
+    for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
+        json << "\"" << PC_NAMES[i] << "\"";
+        if (i < NUM_PHOTOCOUPLERS - 1) json << ",";
+    }
+    json << "]}";
+    return json.str().size();
+}
+
+size_t statusOstringstream() {
+    std::ostringstream json;
+    json << "{\"states\":[";
+    for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
+        json << (pcStates[i] ? "true" : "false");
+        if (i < NUM_PHOTOCOUPLERS - 1) json << ",";
+    }
+    json << "]}";
+    return json.str().size();
+}
+
+size_t infoJsonWriter() {
+    char buf[1024];
+    JsonWriter json(buf, sizeof(buf));
+    json.beginObject()
+        .field("ip", "192.168.1.100")
+        .field("numPCs", NUM_PHOTOCOUPLERS)
+        .key("pcNames").beginArray();
+    for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
+        json.value(PC_NAMES[i]);
+    }
+    json.endArray().endObject();
+    return json.length();
+}
+
+size_t statusJsonWriter() {
+    char buf[256];
+    JsonWriter json(buf, sizeof(buf));
+    json.beginObject().key("states").beginArray();
+    for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
+        json.value(pcStates[i]);
+    }
+    json.endArray().endObject();
+    return json.length();
+}
+
+static volatile size_t g_sink = 0;
+
+void run(const char* name, size_t (*fn)(), int iterations) {
+    for (int i = 0; i < iterations / 10; i++) g_sink += fn();  // ウォームアップ
+
+    size_t allocsBefore = g_allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) g_sink += fn();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    double allocs = (double)(g_allocations - allocsBefore) / iterations;
+    printf("%-28s %10.1f ns/op %8.1f allocs/op %6zu bytes\n", name, ns, allocs, fn());
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    for (int i = 0; i < NUM_PHOTOCOUPLERS; i += 2) pcStates[i] = true;
+
+    printf("channels=%d iterations=%d\n", NUM_PHOTOCOUPLERS, iterations);
+    run("info/arduino-string", infoArduinoString, iterations);
+    run("info/ostringstream", infoOstringstream, iterations);
+    run("info/json-writer", infoJsonWriter, iterations);
+    run("status/arduino-string", statusArduinoString, iterations);
+    run("status/ostringstream", statusOstringstream, iterations);
+    run("status/json-writer", statusJsonWriter, iterations);
+    return 0;
+}
@@ -0,0 +1,177 @@
+// ルーティングのマイクロベンチマーク
+//
+// 同じ要求の並びを次の3通りで振り分け、1要求あたりの時間とヒープ確保回数を比べる。
+//   async-regex : 実機の旧実装（ESPAsyncWebServer の AsyncCallbackWebHandler::canHandle を
+//                 登録順に呼ぶ。正規表現ルートは呼ばれるたびに std::regex を構築して照合する）
+//   if-else     : シミュレータの旧実装（std::string の比較と find、std::stoi）
+//   router      : shared/router.h のルート表
+//
+// ビルドと実行（リポジトリのルートで）：
+//   g++ -std=c++17 -O2 -I./shared -I./src -o router_bench simulator/bench/router_bench.cpp
+//   ./router_bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <regex>
+#include <string>
+
+#include "router.h"
+
+static size_t g_allocations = 0;
+
+void* operator new(size_t size) {
+    g_allocations++;
+    void* p = malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+struct Request {
+    const char* method;
+    const char* url;
+};
+
+// Web UIを開いたままの典型的な並び（ポーリング・操作・404）
+const Request REQUESTS[] = {
+    {"GET", "/api/status"},       {"GET", "/"},
+    {"GET", "/api/info"},         {"POST", "/api/power/3"},
+    {"GET", "/api/status"},       {"POST", "/api/longpress/12"},
+    {"POST", "/api/power/batch"}, {"GET", "/api/metrics"},
+    {"GET", "/favicon.ico"},      {"GET", "/api/status"},
+};
+const int REQUEST_COUNT = sizeof(REQUESTS) / sizeof(REQUESTS[0]);
+
+// ---- async-regex: AsyncCallbackWebHandler の照合を再現 ----
+
+enum { M_GET = 1, M_POST = 2 };
+
+struct CallbackHandler {
+    int method;
+    const char* uri;
+    bool isRegex;
+    int id;
+};
+
+// 旧 setupWebServer() の登録順
+const CallbackHandler CALLBACK_HANDLERS[] = {
+    {M_GET, "/", false, 0},
+    {M_GET, "/api/info", false, 1},
+    {M_GET, "/api/status", false, 2},
+    {M_POST, "^/api/power/([0-9]+)$", true, 3},
+    {M_POST, "/api/power/batch", false, 4},
+    {M_POST, "^/api/longpress/([0-9]+)$", true, 5},
+    {M_GET, "/api/metrics", false, 6},
+};
+
+int dispatchAsyncRegex(const Request& req, int& param) {
+    int method = req.method[0] == 'G' ? M_GET : M_POST;
+    std::string url(req.url);  // request->url() は String
+    for (const CallbackHandler& h : CALLBACK_HANDLERS) {
+        if (!(h.method & method)) continue;
+        if (h.isRegex) {
+            std::regex pattern(h.uri);
+            std::smatch matches;
+            if (std::regex_search(url, matches, pattern)) {
+                param = std::stoi(matches[1].str());  // pathArg(0).toInt()
+                return h.id;
+            }
+        } else {
+            std::string uri(h.uri);
+            if (uri == url || url.rfind(uri + "/", 0) == 0) return h.id;
+        }
+    }
+    return -1;
+}
+
+// ---- if-else: 旧 handleRequest() の振り分け ----
+
+int dispatchIfElse(const Request& req, int& param) {
+    std::string method(req.method);
+    std::string path(req.url);
+    if (method == "GET" && path == "/") return 0;
+    if (method == "GET" && path == "/api/info") return 1;
+    if (method == "GET" && path == "/api/status") return 2;
+    if (method == "GET" && path == "/api/events") return 7;
+    if (method == "GET" && path == "/api/sim/gpio") return 8;
+    if (method == "POST" && path == "/api/power/batch") return 4;
+    if (method == "POST" && path.find("/api/power/") == 0) {
+        param = std::stoi(path.substr(11));
+        return 3;
+    }
+    if (method == "POST" && path.find("/api/longpress/") == 0) {
+        param = std::stoi(path.substr(15));
+        return 5;
+    }
+    if (method == "GET" && path == "/api/metrics") return 6;
+    return -1;
+}
+
+// ---- router: shared/router.h ----
+
+typedef int RouteId;
+
+constexpr RouteEntry<RouteId> ROUTES[] = {
+    {HttpMethod::Get, "/", Route::Index, 0},
+    {HttpMethod::Get, "/api/info", Route::Info, 1},
+    {HttpMethod::Get, "/api/status", Route::Status, 2},
+    {HttpMethod::Get, "/api/events", Route::Events, 7},
+    {HttpMethod::Get, "/api/metrics", Route::Metrics, 6},
+    {HttpMethod::Get, "/api/sim/gpio", Route::Other, 8},
+    {HttpMethod::Post, "/api/power/batch", Route::PowerBatch, 4},
+    {HttpMethod::Post, "/api/power/{i}", Route::Power, 3},
+    {HttpMethod::Post, "/api/longpress/{i}", Route::LongPress, 5},
+};
+static_assert(routeTableValid(ROUTES), "bad route table");
+
+int dispatchRouter(const Request& req, int& param) {
+    RouteParams params;
+    const RouteEntry<RouteId>* route =
+        matchRoute(ROUTES, parseHttpMethod(req.method), req.url, strlen(req.url), params);
+    if (!route) return -1;
+    if (params.count > 0) param = params[0];
+    return route->handler;
+}
+
+static volatile int g_sink = 0;
+
+void run(const char* name, int (*fn)(const Request&, int&), int iterations) {
+    int param = 0;
+    for (int i = 0; i < iterations / 10; i++) g_sink += fn(REQUESTS[i % REQUEST_COUNT], param);  // ウォームアップ
+
+    size_t allocsBefore = g_allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) g_sink += fn(REQUESTS[i % REQUEST_COUNT], param) + param;
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    double allocs = (double)(g_allocations - allocsBefore) / iterations;
+    printf("%-14s %10.1f ns/req %8.1f allocs/req\n", name, ns, allocs);
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+    // 3通りの振り分け結果が一致することを確認
+    for (const Request& req : REQUESTS) {
+        int a = 0, b = 0, c = 0;
+        int ra = dispatchAsyncRegex(req, a);
+        int rb = dispatchIfElse(req, b);
+        int rc = dispatchRouter(req, c);
+        if (ra != rb || rb != rc || a != b || b != c) {
+            fprintf(stderr, "mismatch for %s %s: %d/%d/%d\n", req.method, req.url, ra, rb, rc);
+            return 1;
+        }
+    }
+
+    printf("requests=%d iterations=%d\n", REQUEST_COUNT, iterations);
+    run("async-regex", dispatchAsyncRegex, iterations / 20);  // 遅いので回数を減らす
+    run("if-else", dispatchIfElse, iterations);
+    run("router", dispatchRouter, iterations);
+    return 0;
+}
@@ -0,0 +1,81 @@
+// トレースの計測点のコスト
+//
+// ハンドラの入口と同じ TraceScope（開始・終了の2イベント）を、次の3通りで回して1回あたりの時間を比べる。
+//   none     : 計測点なし
+//   disabled : TraceBuffer が無効（既定。enabled() の読み出しだけ）
+//   enabled  : 有効（時刻の取得とリングへの書き込み）
+// enabled はスレッド数を変えて、リングの位置を取り合うときの遅さも見る。
+//
+// ビルドと実行（リポジトリのルートで）：
+//   g++ -std=c++17 -O2 -I./shared -I./src -o trace_bench simulator/bench/trace_bench.cpp -lpthread
+//   ./trace_bench [iterations]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "trace.h"
+
+struct BenchClock {
+    static uint64_t nowUs() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    static uint32_t threadId() {
+        static std::atomic<uint32_t> next(1);
+        thread_local uint32_t id = next.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+};
+
+typedef TraceBuffer<BenchClock, 512> BenchTrace;
+static BenchTrace g_trace;
+static volatile uint32_t g_sink = 0;
+
+// ハンドラの代わり（最適化で消えないように volatile へ書く）
+__attribute__((noinline)) static void handler(uint32_t i) { g_sink = g_sink + i; }
+
+__attribute__((noinline)) static void traced(uint32_t i) {
+    TraceScope<BenchTrace> span(g_trace, TracePoint::HttpHandler, (uint32_t)Route::Status);
+    handler(i);
+}
+
+static double nsPerCall(void (*fn)(uint32_t), int iterations, int threads) {
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([fn, iterations] {
+            for (int i = 0; i < iterations; i++) fn((uint32_t)i);
+        });
+    }
+    for (auto& w : workers) w.join();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 5000000;
+
+    printf("iterations=%d, ring=%zu events\n", iterations, BenchTrace::capacity());
+    nsPerCall(handler, iterations / 10, 1);  // ウォームアップ
+    printf("%-20s %8.2f ns/call\n", "none", nsPerCall(handler, iterations, 1));
+    g_trace.setEnabled(false);
+    printf("%-20s %8.2f ns/call\n", "disabled", nsPerCall(traced, iterations, 1));
+    g_trace.setEnabled(true);
+    printf("%-20s %8.2f ns/call\n", "enabled", nsPerCall(traced, iterations, 1));
+    for (int threads : {2, 4}) {
+        char name[32];
+        snprintf(name, sizeof(name), "enabled, %d threads", threads);
+        printf("%-20s %8.2f ns/call (wall / per-thread call)\n", name, nsPerCall(traced, iterations, threads));
+    }
+
+    // 一周した後も、残っている範囲がすべて読めること
+    TraceEvent event;
+    uint32_t readable = 0;
+    for (uint32_t i = g_trace.first(); i != g_trace.end(); i++) readable += g_trace.read(i, event) ? 1 : 0;
+    printf("recorded=%u readable=%u\n", g_trace.end(), readable);
+    return 0;
+}
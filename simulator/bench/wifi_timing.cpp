@@ -0,0 +1,145 @@
+// WiFi接続から使えるようになるまでの時間（仮想時間、決定的）
+//
+// simulator/fake_wifi.h の接続時間モデル（スキャン 2500ms、アソシエーション 150ms、DHCP 1200ms）で、
+// 次の2通りの起動がWebサーバを始めるまでの時間を比べる。
+//   blocking      : 実機の旧実装（setup() の delay(1000) のあと WiFi.begin() を最大15秒待ち、
+//                   つながらなければWebサーバを起動しない）
+//   state-machine : shared/wifi_connection.h（保存したBSSID・チャンネル・IPで高速接続、失敗したら
+//                   スキャン、さらに失敗したらバックオフで再試行）
+//
+// ビルドと実行（リポジトリのルートで）：
+//   g++ -std=c++17 -O2 -I./shared -I./src -I./simulator -o wifi_timing simulator/bench/wifi_timing.cpp
+//   ./wifi_timing
+
+#include <cstdio>
+#include <cstdint>
+
+#include "config.h"
+#include "fake_wifi.h"
+#include "wifi_connection.h"
+
+static uint64_t g_nowUs = 0;
+
+struct BenchClock {
+    static uint64_t nowUs() { return g_nowUs; }
+};
+
+typedef FakeWifiDriver<BenchClock> BenchDriver;
+
+// メモリ上の保存先
+struct MemoryStore {
+    bool has = false;
+    WifiLease lease = {};
+    uint32_t writes = 0;
+
+    bool load(WifiLease& out) {
+        if (!has) return false;
+        out = lease;
+        return true;
+    }
+    void save(const WifiLease& in) {
+        lease = in;
+        has = true;
+        writes++;
+    }
+};
+
+struct Scenario {
+    const char* name;
+    bool cached;          // 前回のリースがある
+    uint8_t apChannel;    // 起動時のAPのチャンネル（リースは6）
+    uint32_t apDownMs;    // 起動からAPが戻るまで
+};
+
+static const uint32_t BLOCKING_SETUP_DELAY_MS = 1000;
+static const uint32_t BLOCKING_TIMEOUT_MS = 15000;  // 500ms x 30回
+static const uint32_t LIMIT_MS = 600000;
+
+static uint32_t nowMs() { return (uint32_t)(g_nowUs / 1000); }
+
+// 旧実装：スキャンから始めてつながるまで（またはタイムアウトまで）setup() が止まる
+static uint32_t blockingReadyMs(const Scenario& s) {
+    g_nowUs = 0;
+    BenchDriver driver(false);
+    if (s.apDownMs > 0 || s.apChannel != 6) driver.drop(s.apDownMs, s.apChannel);
+    g_nowUs = (uint64_t)BLOCKING_SETUP_DELAY_MS * 1000;
+    driver.begin(nullptr);
+    uint32_t ready = driver.msUntilReady();
+    if (ready == 0 || ready > BLOCKING_TIMEOUT_MS) return 0;  // Webサーバを起動しないまま
+    return nowMs() + ready;
+}
+
+// 新実装：期限かドライバがつながる時刻まで仮想時間を飛ばしながら poll() する
+static void stateMachine(const Scenario& s, uint32_t& readyMs, uint32_t& fastFailures, uint32_t& backoffs) {
+    g_nowUs = 0;
+    BenchDriver driver(WIFI_REUSE_IP);
+    MemoryStore store;
+    if (s.cached) {
+        WifiLease lease = {};
+        g_nowUs = 0;
+        BenchDriver seed(WIFI_REUSE_IP);
+        seed.begin(nullptr);
+        g_nowUs = (uint64_t)seed.msUntilReady() * 1000;
+        seed.connected();
+        seed.readLease(lease);
+        sealWifiLease(lease);
+        store.save(lease);
+        g_nowUs = 0;
+    }
+    if (s.apDownMs > 0 || s.apChannel != 6) driver.drop(s.apDownMs, s.apChannel);
+
+    WifiConnection<BenchDriver, MemoryStore> wifi(
+        driver, store, {WIFI_FAST_CONNECT_TIMEOUT_MS, WIFI_CONNECT_TIMEOUT_MS, WIFI_BACKOFF_MIN_MS, WIFI_BACKOFF_MAX_MS});
+    wifi.begin(nowMs());
+    readyMs = 0;
+    backoffs = 0;
+    while (nowMs() < LIMIT_MS) {
+        WifiState before = wifi.state();
+        if (wifi.poll(nowMs()) == WifiEvent::Ready) {
+            readyMs = wifi.bootToReadyMs();
+            break;
+        }
+        if (wifi.state() == WifiState::Backoff && before != WifiState::Backoff) backoffs++;
+        uint32_t delay = wifi.msUntilDeadline(nowMs());
+        uint32_t ready = driver.msUntilReady();
+        if (ready != 0 && (delay == 0 || ready < delay)) delay = ready;
+        if (delay == 0) break;
+        g_nowUs += (uint64_t)delay * 1000;
+    }
+    fastFailures = wifi.fastFailures();
+}
+
+int main() {
+    const Scenario scenarios[] = {
+        {"cold boot (no cache)", false, 6, 0},
+        {"warm boot (cached lease)", true, 6, 0},
+        {"warm boot, AP moved to ch 11", true, 11, 0},
+        {"power cut, AP back after 20 s", true, 6, 20000},
+        {"power cut, AP back after 90 s", true, 6, 90000},
+    };
+
+    printf("Time until the web server starts (virtual ms)\n");
+    printf("connect model: scan %u + assoc %u + DHCP %u ms, reuse IP %s\n", BenchDriver::Timing().scanMs,
+           BenchDriver::Timing().assocMs, BenchDriver::Timing().dhcpMs, WIFI_REUSE_IP ? "yes" : "no");
+    printf("timeouts: fast %u, connect %u, backoff %u..%u ms\n\n", (unsigned)WIFI_FAST_CONNECT_TIMEOUT_MS,
+           (unsigned)WIFI_CONNECT_TIMEOUT_MS, (unsigned)WIFI_BACKOFF_MIN_MS, (unsigned)WIFI_BACKOFF_MAX_MS);
+    printf("%-32s %12s %14s %14s %9s\n", "scenario", "blocking", "state-machine", "fast-failures", "backoffs");
+    for (const Scenario& s : scenarios) {
+        uint32_t blocking = blockingReadyMs(s);
+        uint32_t ready = 0, fastFailures = 0, backoffs = 0;
+        stateMachine(s, ready, fastFailures, backoffs);
+        char blockingText[16], readyText[16];
+        if (blocking) {
+            snprintf(blockingText, sizeof(blockingText), "%u", blocking);
+        } else {
+            snprintf(blockingText, sizeof(blockingText), "never");
+        }
+        if (ready) {
+            snprintf(readyText, sizeof(readyText), "%u", ready);
+        } else {
+            snprintf(readyText, sizeof(readyText), "never");
+        }
+        printf("%-32s %12s %14s %14u %9u\n", s.name, blockingText, readyText, fastFailures, backoffs);
+    }
+    return 0;
+}
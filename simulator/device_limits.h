@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// ESP32の資源の制約の模擬（--device-limits、HttpServer::setLimits()）
+//
+// シミュレータのHTTPサーバはホストのスレッドとメモリを使い放題なので、負荷試験の結果が実機
+// （AsyncTCP と lwIP）よりずっと良く見える。ここで決めた制約をHTTPサーバに課す：
+//   maxSockets    : 同時に開いておけるTCP接続の数。満杯の間は accept() しないので、新しい接続は
+//                   listen() の acceptBacklog 個までカーネルで待ち、それを超えたSYNは落ちる（クライアントが再送する）
+//   heapBytes     : 接続ごとの固定の確保（socketBytes）と受信・送信バッファを数えるヒープ。足りなければ
+//                   新しい接続はすぐに閉じ、処理中の接続には 503 を返して閉じる
+//   handlerCostUs : 1要求ごとにI/Oスレッドを止める時間（CPU時間の代わり）。I/Oワーカーは1つにするので、
+//                   実機の async_tcp タスクと同じく受信・ハンドラ・送信が1本のスレッドで順に動く
+//   latencyMs     : 応答を送り始めるまでの往復の遅延
+//   lossPercent   : 要求・応答のそれぞれが失われる確率。失われると再送（初回 RTO_MS、以後倍）の分だけ遅れる
+// 値が0の制約は課さない。時間はすべて実時間（--clock に関係しない）。
+struct DeviceLimits {
+    static constexpr uint32_t RTO_MS = 1000;  // RFC 6298 の初期値
+    static constexpr int MAX_RETRANSMITS = 6;
+
+    int maxSockets = 0;
+    int acceptBacklog = 0;
+    size_t heapBytes = 0;
+    size_t socketBytes = 0;
+    uint32_t handlerCostUs = 0;
+    uint32_t latencyMs = 0;
+    uint32_t lossPercent = 0;
+
+    // 実機に近い値（目安。ESP-IDF の CONFIG_LWIP_MAX_ACTIVE_TCP の既定が16、Wi-Fi と各タスクを除いた空きヒープの一部）
+    void setEsp32Defaults() {
+        maxSockets = 16;
+        acceptBacklog = 5;
+        heapBytes = 64 * 1024;
+        socketBytes = 3 * 1024;
+        handlerCostUs = 1000;
+        latencyMs = 5;
+    }
+
+    bool enabled() const {
+        return maxSockets > 0 || heapBytes > 0 || handlerCostUs > 0 || latencyMs > 0 || lossPercent > 0;
+    }
+
+    // ---- 計数（I/Oスレッドから更新し、/api/sim/limits から読む） ----
+
+    std::atomic<int> openSockets{0};
+    std::atomic<int> peakSockets{0};
+    std::atomic<uint32_t> acceptPauses{0};     // 満杯で accept() を止めた回数
+    std::atomic<uint32_t> heapRejects{0};      // ヒープが足りずに閉じた接続
+    std::atomic<uint32_t> retransmits{0};      // 失われて再送した要求・応答
+    std::atomic<uint64_t> requests{0};
+    std::atomic<size_t> heapUsed{0};
+    std::atomic<size_t> heapPeak{0};
+
+    bool socketsFull() const { return maxSockets > 0 && openSockets.load() >= maxSockets; }
+
+    void socketOpened() {
+        int open = ++openSockets;
+        int peak = peakSockets.load();
+        while (open > peak && !peakSockets.compare_exchange_weak(peak, open)) {
+        }
+    }
+
+    void socketClosed() { openSockets--; }
+
+    // bytes を確保する。予算を超えるなら確保せず false（force なら超えても確保する）
+    bool reserve(size_t bytes, bool force = false) {
+        size_t used = heapUsed.load();
+        do {
+            if (!force && heapBytes > 0 && used + bytes > heapBytes) return false;
+        } while (!heapUsed.compare_exchange_weak(used, used + bytes));
+        size_t peak = heapPeak.load();
+        while (used + bytes > peak && !heapPeak.compare_exchange_weak(peak, used + bytes)) {
+        }
+        return true;
+    }
+
+    void release(size_t bytes) { heapUsed -= bytes; }
+
+    // 要求を受けてから応答を送り始めるまでの遅延（往復の遅延と、要求・応答それぞれの再送）。rng は呼び出し側の乱数
+    template <typename Rng>
+    uint32_t responseDelayMs(Rng& rng) {
+        uint32_t delay = latencyMs;
+        for (int segment = 0; segment < 2 && lossPercent > 0; segment++) {
+            uint32_t rto = RTO_MS;
+            for (int attempt = 0; attempt < MAX_RETRANSMITS && rng() % 100 < lossPercent; attempt++) {
+                delay += rto;
+                rto *= 2;
+                retransmits++;
+            }
+        }
+        return delay;
+    }
+
+    // 空きヒープ（予算がなければ0）と、これまでの最小値（ESP.getMinFreeHeap() に相当）
+    size_t heapFree() const {
+        size_t used = heapUsed.load();
+        return heapBytes > used ? heapBytes - used : 0;
+    }
+    size_t minHeapFree() const {
+        size_t peak = heapPeak.load();
+        return heapBytes > peak ? heapBytes - peak : 0;
+    }
+};
@@ -2,204 +2,1663 @@
 #include <string>
 #include <thread>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <cstring>
+#include <cstdlib>
 #include <vector>
-#include <sstream>
+#include <malloc.h>
+#include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
 
 #include "web_ui.h"
 #include "config.h"
+#include "audit_log.h"
+#include "channel_bitset.h"
+#include "gpio_mask.h"
+#include "io_expander.h"
+#include "json_writer.h"
+#include "metrics.h"
+#include "mpsc_ring.h"
+#include "power_api.h"
+#include "power_commands.h"
+#include "power_events.h"
+#include "power_plan.h"
+#include "power_reconcile.h"
+#include "power_schedule.h"
+#include "power_sense.h"
+#include "pulse_engine.h"
+#include "router.h"
+#include "sha256.h"
+#include "trace.h"
+#include "timer_service.h"
+#include "udp_command.h"
+#include "wifi_connection.h"
+#include "device_limits.h"
+#include "http_server.h"
+#include "host_model.h"
+#include "mmap_storage.h"
+#include "sim_gpio.h"
+#include "sim_i2c.h"
+#include "udp_listener.h"
+#include "fake_wifi.h"
+#include "wol.h"
 
 // 実機用config.hをそのまま利用
 
-// HTTPレスポンスヘッダーを生成
-std::string createHttpResponse(int statusCode, const std::string& contentType, const std::string& body) {
-    std::ostringstream response;
-    std::string statusText = (statusCode == 200) ? "OK" : 
-                            (statusCode == 404) ? "Not Found" : "Bad Request";
-    
-    response << "HTTP/1.1 " << statusCode << " " << statusText << "\r\n";
-    response << "Content-Type: " << contentType << "\r\n";
-    response << "Content-Length: " << body.length() << "\r\n";
-    response << "Connection: close\r\n";
-    response << "Access-Control-Allow-Origin: *\r\n";
-    response << "\r\n";
-    response << body;
-    
-    return response.str();
+// HTTPレスポンスを生成（ヘッダーはHttpServerが付与する）
+HttpResponse createHttpResponse(int statusCode, const std::string& contentType, const std::string& body) {
+    HttpResponse response;
+    response.status = statusCode;
+    response.contentType = contentType;
+    response.body = body;
+    return response;
 }
 
-// 電源ボタンを押す（シミュレート）
-void pressPowerButton(int pcIndex) {
-    std::cout << "[INFO] Pressing power button for " << PC_NAMES[pcIndex] 
-              << " (GPIO " << PHOTOCOUPLER_PINS[pcIndex] << ")" << std::endl;
-    
-    // GPIOをHIGHに設定（シミュレート）
-    std::cout << "[GPIO] Pin " << PHOTOCOUPLER_PINS[pcIndex] << " -> HIGH" << std::endl;
-    std::this_thread::sleep_for(std::chrono::milliseconds(POWER_PULSE_MS));
-    
-    // GPIOをLOWに設定（シミュレート）
-    std::cout << "[GPIO] Pin " << PHOTOCOUPLER_PINS[pcIndex] << " -> LOW" << std::endl;
-    
-    std::cout << "[INFO] " << PC_NAMES[pcIndex] << " power button pressed." << std::endl;
+// JsonWriterで組み立てた本文からレスポンスを生成
+HttpResponse createJsonResponse(int statusCode, const JsonWriter& json) {
+    if (!json.ok()) {
+        return createHttpResponse(500, "application/json", "{\"error\":\"Response too large\"}");
+    }
+    return createHttpResponse(statusCode, "application/json", std::string(json.c_str(), json.length()));
+}
+
+// 各PCの状態を保存（実機と同じく、実測チャンネルはサンプラが、それ以外はパルス完了時の反転で更新）
+ChannelBitset<NUM_PHOTOCOUPLERS> pcStates;
+
+// 電源LED入力を持つチャンネル（config.h の POWER_SENSE_PINS、または --sense-all）
+ChannelBitset<NUM_PHOTOCOUPLERS> sensedChannels;
+
+// 離す書き込みがエキスパンダに届かず、やり直しているチャンネル（/api/status の stuck と /api/metrics、--i2c-nack で再現できる）
+ChannelBitset<NUM_PHOTOCOUPLERS> stuckOutputs;
+std::atomic<uint32_t> releaseRetries(0);
+
+// 最後の押下がピンに書けず、押せなかったチャンネル（/api/status の pressFailed、次に押せたら消す）
+ChannelBitset<NUM_PHOTOCOUPLERS> pressFailed;
+
+// /api/metrics の計測値（実機と同じメトリクス名で出す）
+// HTTPの処理時間は実時間で測る。パルスの時間や稼働時間はタイマーの時計（--clock）で測る
+struct SimClock {
+    static uint64_t nowUs() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+HttpMetrics httpMetrics;
+PulseMetrics<NUM_PHOTOCOUPLERS> pulseMetrics;
+
+// SSE配信先のサーバ（main()で設定）
+HttpServer* eventServer = nullptr;
+
+void writeReconcileStatus(JsonWriter& json);
+
+// 全PCの状態（/api/status の本文、SSE接続時のスナップショット）
+void writeStatusJson(JsonWriter& json) {
+    json.beginObject();
+    writeChannelStates(json, pcStates, sensedChannels);
+    json.key("stuck");
+    writeChannelList(json, stuckOutputs.mask());
+    json.key("pressFailed");
+    writeChannelList(json, pressFailed.mask());
+    writeReconcileStatus(json);
+    json.endObject();
 }
 
-// 電源ボタンを長押し（シミュレート）
-void longPressPowerButton(int pcIndex) {
-    std::cout << "[INFO] Long pressing power button for " << PC_NAMES[pcIndex]
-              << " (GPIO " << PHOTOCOUPLER_PINS[pcIndex] << ") - "
-              << POWER_LONG_PRESS_MS << "ms" << std::endl;
+// 電源イベントを /api/events の購読者へ送る
+void publishPowerEvent(int channel, PowerEventType type, PulseKind kind) {
+    PowerEvent event = makePowerEvent(channel, type, kind, pcStates.test(channel));
+    char data[128];
+    JsonWriter json(data, sizeof(data));
+    writePowerEvent(json, event);
+
+    char frame[192];
+    size_t len = formatSseEvent(frame, sizeof(frame), "power", event.seq, json.c_str());
+    if (eventServer && len > 0) eventServer->broadcast(std::string(frame, len));
+}
+
+// esp_timerの代わりにタイマースレッドでピンを解放する
+TimerService timers;
+
+// 要求と電源操作のトレース（/api/trace、実機と同じイベント）
+// 時刻はタイマーの時計（--clock）。fast では仮想時間が止まっている間のHTTPの処理は幅0になる
+struct SimTraceClock {
+    static uint64_t nowUs() { return timers.nowUs(); }
+    // スレッドごとの通し番号（1から）
+    static uint32_t threadId() {
+        static std::atomic<uint32_t> next(1);
+        thread_local uint32_t id = next.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+};
+typedef TraceBuffer<SimTraceClock, TRACE_BUFFER_EVENTS> SimTraceBuffer;
+SimTraceBuffer traceBuffer;
+
+// 電源操作の監査ログ（実機のLittleFSの代わりにmmapしたファイル、--audit-file）
+// 記録はどのスレッドからでもキューに積み、auditWriterLoop() がログへ移す
+typedef AuditLog<MmapStorage, AUDIT_LOG_RECORDS> SimAuditLog;
+MmapStorage auditStorage;
+SimAuditLog auditLog(auditStorage, AUDIT_FLUSH_INTERVAL_MS);
+MpscRing<AuditRecord, 64> auditQueue;
+
+void recordAudit(AuditEvent event, AuditResult result, AuditSource source, int channel, PulseKind kind,
+                 uint32_t client, uint32_t arg, uint8_t maskWord = 0) {
+    AuditRecord record = makeAuditRecord(event, result, source, channel, kind, client, arg,
+                                         (uint32_t)(timers.nowUs() / 1000), (uint32_t)time(nullptr), maskWord);
+    if (!auditQueue.tryPush(record)) {
+        std::cout << "[WARN] Audit queue full, record dropped" << std::endl;
+    }
+}
 
-    std::cout << "[GPIO] Pin " << PHOTOCOUPLER_PINS[pcIndex] << " -> HIGH" << std::endl;
-    std::this_thread::sleep_for(std::chrono::milliseconds(POWER_LONG_PRESS_MS));
-    std::cout << "[GPIO] Pin " << PHOTOCOUPLER_PINS[pcIndex] << " -> LOW" << std::endl;
+// 一括押しはチャンネルマスクを32チャンネルずつのレコードに分けて残す（空のワードは書かない）
+void recordBatchAudit(AuditResult result, AuditSource source, uint32_t client,
+                      const ChannelMask<NUM_PHOTOCOUPLERS>& channels) {
+    for (int i = 0; i < ChannelMask<NUM_PHOTOCOUPLERS>::WORDS; i++) {
+        if (!channels.words[i]) continue;
+        recordAudit(AuditEvent::Batch, result, source, -1, PulseKind::Short, client, channels.words[i], (uint8_t)i);
+    }
+}
 
-    std::cout << "[INFO] " << PC_NAMES[pcIndex] << " power button long pressed (forced shutdown)" << std::endl;
+// 実機の loop() に相当：溜まった監査レコードをログへ移し、期限が来たらファイルへ書く
+void auditWriterLoop() {
+    for (;;) {
+        AuditRecord record;
+        while (auditQueue.tryPop(record)) auditLog.append(record);
+        auditLog.flushIfDue((uint32_t)(SimClock::nowUs() / 1000));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
 }
 
-// HTMLページを生成（共通ビルダー使用）
-std::string getIndexHTML() {
-    std::vector<std::string> names;
+// 電源ボタンの先にあるPC（電源LED入力を模擬、遅延は --sense-delay-ms）
+HostModel<NUM_PHOTOCOUPLERS> hosts(timers, 3000);
+
+// チャンネルの出力先（実機と同じ表）。GPIO出力レジスタとI2Cのエキスパンダのモデルに書き込み、
+// /api/sim/gpio と /api/sim/i2c で確認できる
+static_assert(channelOutputsValid(PHOTOCOUPLER_PINS, IO_EXPANDERS, IO_EXPANDER_SDA_PIN, IO_EXPANDER_SCL_PIN),
+              "PHOTOCOUPLER_PINS / IO_EXPANDERS: invalid or duplicate pin, unknown expander, or pin used by I2C");
+constexpr int NUM_IO_EXPANDERS = sizeof(IO_EXPANDERS) / sizeof(IO_EXPANDERS[0]);
+constexpr ChannelOutputMap<NUM_PHOTOCOUPLERS, NUM_IO_EXPANDERS> OUTPUT_MAP =
+    buildChannelOutputMap(PHOTOCOUPLER_PINS, IO_EXPANDERS);
+SimGpio gpio;
+SimI2cBus<NUM_IO_EXPANDERS> i2cBus(IO_EXPANDERS, IO_EXPANDER_I2C_HZ);
+
+struct SimChannelHw {
+    void gpioWrite(const GpioBankMask& mask, bool level) {
+        gpio.write(mask, level, timers.nowUs());
+        std::cout << "[GPIO] " << (level ? "w1ts" : "w1tc") << " low=0x" << std::hex << mask.low
+                  << " high=0x" << mask.high << std::dec << std::endl;
+    }
+    bool i2cWrite(uint8_t address, const uint8_t* data, size_t len) {
+        bool ack = i2cBus.write(address, data, len, timers.nowUs());
+        std::cout << "[I2C] 0x" << std::hex << (unsigned)address << std::dec << " " << len << " bytes"
+                  << (ack ? "" : " NACK") << std::endl;
+        return ack;
+    }
+    void lockBus() { busMutex.lock(); }
+    void unlockBus() { busMutex.unlock(); }
+    std::mutex busMutex;
+};
+
+SimChannelHw channelHw;
+ChannelDriver<NUM_PHOTOCOUPLERS, NUM_IO_EXPANDERS, SimChannelHw> channelDriver(channelHw, OUTPUT_MAP, IO_EXPANDERS);
+
+// パルス状態機械のシミュレータ用バインディング（実機と同じく、タイマーが期限を知らせてワーカーが離す）
+// 離す書き込みの失敗は releaseExpiredPulses() がやり直し、押す書き込みの失敗は onPulseFailed() で知らせる
+struct SimPulsePlatform {
+    bool writePin(int channel, bool level) { return channelDriver.write(channel, level); }
+    bool writeMask(const ChannelMask<NUM_PHOTOCOUPLERS>& channels, bool level) {
+        return channelDriver.write(channels, level);
+    }
+    void armTimer(int channel, uint32_t durationMs);
+    void onPulseStart(int channel, PulseKind kind) {
+        pressFailed.set(channel, false);
+        pulseMetrics.started(channel, kind, timers.nowUs());
+        traceBuffer.record(TracePoint::Pulse, TracePhase::AsyncBegin, channel, (uint8_t)kind);
+        publishPowerEvent(channel, PowerEventType::PulseStart, kind);
+        recordAudit(AuditEvent::PulseStart, AuditResult::Started, AuditSource::Internal, channel, kind, 0,
+                    kind == PulseKind::Long ? POWER_LONG_PRESS_MS : POWER_PULSE_MS);
+    }
+    void onPulseComplete(int channel, PulseKind kind);
+    // 押せなかった（状態は変えない）
+    void onPulseFailed(int channel, PulseKind kind) {
+        pressFailed.set(channel, true);
+        traceBuffer.record(TracePoint::PulseFailed, TracePhase::Instant, channel, (uint8_t)kind);
+        publishPowerEvent(channel, PowerEventType::PulseFailed, kind);
+        recordAudit(AuditEvent::PulseStart, AuditResult::IoError, AuditSource::Internal, channel, kind, 0, 0);
+        std::cout << "[WARN] I/O expander write failed, " << PC_NAMES[channel] << " power button not pressed"
+                  << std::endl;
+    }
+};
+
+SimPulsePlatform pulsePlatform;
+PulseEngine<NUM_PHOTOCOUPLERS, SimPulsePlatform> pulseEngine(pulsePlatform);
+
+// 電源操作コマンドのキューと常駐ワーカー（実機の ulTaskNotifyTake / xTaskNotifyGive に相当）
+PowerCommandQueue<NUM_PHOTOCOUPLERS, POWER_COMMAND_QUEUE_SIZE> powerCommands;
+std::mutex commandWorkerMutex;
+std::condition_variable commandWorkerCv;
+bool commandWorkerNotified = false;
+
+// ワーカーを起こす（キュー投入時とパルス完了時）
+// 仮想時計では、ワーカーが処理を終えて次のタイマーを登録するまで時刻を進めない
+void wakeCommandWorker() {
+    {
+        std::lock_guard<std::mutex> lock(commandWorkerMutex);
+        if (commandWorkerNotified) return;
+        commandWorkerNotified = true;
+        timers.beginWork();
+    }
+    commandWorkerCv.notify_one();
+}
+
+// 期限が来たチャンネル（ワーカーが離す）
+ChannelBitset<NUM_PHOTOCOUPLERS> releaseDue;
+ChannelMask<NUM_PHOTOCOUPLERS> releaseRetrying;  // 離すのをやり直しているパルス（先頭チャンネル、ワーカーだけが触る）
+
+void SimPulsePlatform::armTimer(int channel, uint32_t durationMs) {
+    timers.schedule(durationMs, [channel] {
+        // 本体のGPIOは時間どおりにここで離し、エキスパンダ（I2C）はワーカーが離す
+        channelDriver.writeNative(pulseEngine.pulseChannels(channel), false);
+        releaseDue.set(channel, true);
+        wakeCommandWorker();
+    });
+}
+
+void SimPulsePlatform::onPulseComplete(int channel, PulseKind kind) {
+    pulseMetrics.completed(channel, timers.nowUs());
+    traceBuffer.record(TracePoint::Pulse, TracePhase::AsyncEnd, channel, (uint8_t)kind);
+    recordAudit(AuditEvent::PulseEnd, AuditResult::Completed, AuditSource::Internal, channel, kind, 0, 0);
+    hosts.onPulseComplete(channel, kind);
+    if (sensedChannels.test(channel)) {
+        // 実測しているチャンネルはサンプラが状態を更新する
+        publishPowerEvent(channel, PowerEventType::PulseEnd, kind);
+        std::cout << "[INFO] " << PC_NAMES[channel] << " power button released" << std::endl;
+    } else if (kind == PulseKind::Long) {
+        pcStates.set(channel, false);
+        publishPowerEvent(channel, PowerEventType::PulseEnd, kind);
+        std::cout << "[INFO] " << PC_NAMES[channel] << " power button long pressed (forced shutdown)" << std::endl;
+    } else {
+        bool on = pcStates.flip(channel);
+        publishPowerEvent(channel, PowerEventType::PulseEnd, kind);
+        std::cout << "[INFO] " << PC_NAMES[channel] << " power button pressed. New state: "
+                  << (on ? "ON" : "OFF") << std::endl;
+    }
+}
+
+// 電源LED入力のデバウンス（実機と同じ周期・回数）
+PowerSenseDebouncer<NUM_PHOTOCOUPLERS, POWER_SENSE_DEBOUNCE_SAMPLES> powerSenseDebouncer;
+
+// 周期サンプリング（タイマースレッドで実行し、次回を再登録する）
+void samplePowerSense() {
     for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
-        names.emplace_back(PC_NAMES[i]);
+        if (!sensedChannels.test(i)) continue;
+        if (powerSenseDebouncer.sample(i, hosts.ledOn(i))) {
+            bool on = powerSenseDebouncer.stable(i);
+            pcStates.set(i, on);
+            publishPowerEvent(i, PowerEventType::State, PulseKind::Short);
+            std::cout << "[SENSE] " << PC_NAMES[i] << " power state sensed: "
+                      << (on ? "ON" : "OFF") << std::endl;
+        }
     }
-    return buildWebUI(names, "macOS ARM64", "ESP32シミュレータ", NUM_PHOTOCOUPLERS);
+    timers.schedule(POWER_SENSE_INTERVAL_MS, samplePowerSense);
 }
 
-// HTTPリクエストを処理
-void handleRequest(int clientSocket, const std::string& request) {
-    std::istringstream iss(request);
-    std::string method, path, version;
-    iss >> method >> path >> version;
-    
-    std::cout << "[HTTP] " << method << " " << path << std::endl;
-    
-    std::string response;
-    
-    if (method == "GET" && path == "/") {
-        response = createHttpResponse(200, "text/html; charset=utf-8", getIndexHTML());
-    }
-    else if (method == "GET" && path == "/api/info") {
-        std::ostringstream json;
-        json << "{\"ip\":\"localhost\",\"numPCs\":" << NUM_PHOTOCOUPLERS << ",\"pcNames\":[";
-        for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
-            json << "\"" << PC_NAMES[i] << "\"";
-            if (i < NUM_PHOTOCOUPLERS - 1) json << ",";
-        }
-        json << "]}";
-        response = createHttpResponse(200, "application/json", json.str());
-    }
-    else if (method == "GET" && path == "/api/status") {
-        // 状態を保持しないため常にfalseを返す
-        std::ostringstream json;
-        json << "{\"states\":[";
-        for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
-            json << "false";
-            if (i < NUM_PHOTOCOUPLERS - 1) json << ",";
-        }
-        json << "]}";
-        response = createHttpResponse(200, "application/json", json.str());
-    }
-    else if (method == "POST" && path.find("/api/power/") == 0) {
-        int pcIndex = std::stoi(path.substr(11));
-        if (pcIndex >= 0 && pcIndex < NUM_PHOTOCOUPLERS) {
-            pressPowerButton(pcIndex);
-            std::ostringstream json;
-              json << "{\"success\":true,\"message\":\"" << PC_NAMES[pcIndex] 
-                  << " の電源ボタンを押しました\",\"pcIndex\":" << pcIndex << "}";
-            response = createHttpResponse(200, "application/json", json.str());
-        } else {
-            response = createHttpResponse(400, "application/json", "{\"success\":false,\"message\":\"Invalid PC index\"}");
-        }
-    }
-    else if (method == "POST" && path.find("/api/longpress/") == 0) {
-        int pcIndex = std::stoi(path.substr(15));
-        if (pcIndex >= 0 && pcIndex < NUM_PHOTOCOUPLERS) {
-            longPressPowerButton(pcIndex);
-            std::ostringstream json;
-              json << "{\"success\":true,\"message\":\"" << PC_NAMES[pcIndex] 
-                  << " の電源ボタンを長押ししました (強制シャットダウン)\",\"pcIndex\":" << pcIndex 
-                  << ",\"duration\":" << POWER_LONG_PRESS_MS << "}";
-            response = createHttpResponse(200, "application/json", json.str());
+void initPowerSense(bool senseAll) {
+    for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
+        if (senseAll || POWER_SENSE_PINS[i] >= 0) sensedChannels.set(i, true);
+    }
+    if (!sensedChannels.any()) return;
+    timers.schedule(POWER_SENSE_INTERVAL_MS, samplePowerSense);
+    std::cout << "[INFO] Power sense inputs initialized (simulated)" << std::endl;
+}
+
+// キューから取り出したコマンドでパルスを開始する（ワーカースレッドで実行）
+PulseResult startPowerCommand(int pcIndex, PulseKind kind) {
+    uint32_t durationMs = kind == PulseKind::Long ? POWER_LONG_PRESS_MS : POWER_PULSE_MS;
+    PulseResult result = pulseEngine.begin(pcIndex, kind, durationMs);
+    traceCommandStart(traceBuffer, pcIndex, kind, result);
+    if (result == PulseResult::Pending) {
+        char pin[24];
+        formatOutputPin(pin, sizeof(pin), PHOTOCOUPLER_PINS[pcIndex]);
+        if (kind == PulseKind::Long) {
+            std::cout << "[INFO] Long pressing power button for " << PC_NAMES[pcIndex]
+                      << " (" << pin << ") - " << POWER_LONG_PRESS_MS << "ms" << std::endl;
         } else {
-            response = createHttpResponse(400, "application/json", "{\"success\":false,\"message\":\"Invalid PC index\"}");
+            std::cout << "[INFO] Pressing power button for " << PC_NAMES[pcIndex] << " (" << pin << ")" << std::endl;
         }
     }
-    else {
-        response = createHttpResponse(404, "application/json", "{\"error\":\"Not found\"}");
+    return result;
+}
+
+// キューから取り出した一括押しを始める（ワーカースレッドで実行、maxConcurrent 台ずつのウェーブに分ける）
+PulseBatchResult<NUM_PHOTOCOUPLERS> startBatchCommand(const ChannelMask<NUM_PHOTOCOUPLERS>& channels,
+                                                      int maxConcurrent) {
+    PulseBatchResult<NUM_PHOTOCOUPLERS> result =
+        pulseEngine.beginBatch(channels, PulseKind::Short, POWER_PULSE_MS, maxConcurrent);
+    channels.forEach([&](int channel) {
+        if (result.busy.test(channel)) return;
+        traceCommandStart(traceBuffer, channel, PulseKind::Short,
+                          result.failed.test(channel) ? PulseResult::IoError : PulseResult::Pending);
+    });
+    std::cout << "[INFO] Batch press: " << result.started.count() << " started, "
+              << result.queued.count() << " queued, " << result.busy.count() << " busy, "
+              << result.failed.count() << " failed (" << result.waves << " waves)" << std::endl;
+    return result;
+}
+
+// 期限が来たパルスを離す（ワーカースレッドで実行）。エキスパンダに書けなければチャンネルを空けずに
+// タイマーを張り直し、離せるまでやり直す。その間、書けなかったエキスパンダのチャンネルを stuckOutputs に載せる
+void releaseExpiredPulses() {
+    releaseDue.take().forEach([](int channel) {
+        ChannelMask<NUM_PHOTOCOUPLERS> channels = pulseEngine.pulseChannels(channel);
+        if (pulseEngine.release(channel)) {
+            if (releaseRetrying.test(channel)) {
+                std::cout << "[INFO] " << PC_NAMES[channel] << " power button released after retry" << std::endl;
+            }
+            releaseRetrying.set(channel, false);
+            stuckOutputs.set(channels, false);
+            return;
+        }
+        ChannelMask<NUM_PHOTOCOUPLERS> failed = channelDriver.failed(channels);
+        if (!releaseRetrying.test(channel)) {
+            std::cout << "[WARN] I/O expander write failed, " << PC_NAMES[failed.any() ? failed.first() : channel]
+                      << " power button still pressed (retrying)" << std::endl;
+        }
+        releaseRetrying.set(channel);
+        stuckOutputs.set(channels, false);
+        stuckOutputs.set(failed, true);
+        releaseRetries.fetch_add(1, std::memory_order_relaxed);
+        pulsePlatform.armTimer(channel, IO_EXPANDER_RETRY_MS);
+    });
+}
+
+// 常駐ワーカー：通知を待ってパルスを離し、キューを処理する
+void commandWorkerLoop() {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(commandWorkerMutex);
+            commandWorkerCv.wait(lock, [] { return commandWorkerNotified; });
+            commandWorkerNotified = false;
+        }
+        releaseExpiredPulses();
+        {
+            TraceScope<SimTraceBuffer> span(traceBuffer, TracePoint::Drain);
+            powerCommands.drain(startPowerCommand, startBatchCommand);
+        }
+        timers.endWork();
     }
-    
-    send(clientSocket, response.c_str(), response.length(), 0);
 }
 
-int main() {
+// 電源ボタンを押す（キューに積むだけ、同じチャンネルの操作は順番に実行される）
+CommandResult pressPowerButton(int pcIndex) {
+    CommandResult result = powerCommands.submit(pcIndex, PulseKind::Short);
+    traceSubmit(traceBuffer, pcIndex, PulseKind::Short, result);
+    if (result == CommandResult::Queued) wakeCommandWorker();
+    return result;
+}
+
+// 電源ボタンを長押し（通常押しと同じキューを通る）
+CommandResult longPressPowerButton(int pcIndex) {
+    CommandResult result = powerCommands.submit(pcIndex, PulseKind::Long);
+    traceSubmit(traceBuffer, pcIndex, PulseKind::Long, result);
+    if (result == CommandResult::Queued) wakeCommandWorker();
+    return result;
+}
+
+// キューが満杯（503、少し待って再送してもらう）
+HttpResponse createQueueFullResponse() {
+    HttpResponse response = createHttpResponse(503, "application/json", "{\"success\":false,\"message\":\"Command queue full\"}");
+    response.extraHeaders = "Retry-After: 1\r\n";
+    return response;
+}
+
+// 電源操作の受付結果を返す（202 受付 / 503 キュー満杯 / 400 範囲外）
+HttpResponse createCommandResponse(CommandResult result, int pcIndex, const char* action, uint32_t durationMs) {
+    if (result == CommandResult::InvalidChannel) {
+        return createHttpResponse(400, "application/json", "{\"success\":false,\"message\":\"Invalid PC index\"}");
+    }
+    if (result == CommandResult::Full) {
+        std::cout << "[WARN] Command queue full, request for " << PC_NAMES[pcIndex] << " rejected" << std::endl;
+        return createQueueFullResponse();
+    }
+    char buf[256];
+    JsonWriter json(buf, sizeof(buf));
+    writeCommandAccepted(json, result, pcIndex, PC_NAMES[pcIndex], action, durationMs, powerCommands.depth());
+    return createJsonResponse(202, json);
+}
+
+// 複数PCの電源ボタンを同時に押す（1件の要求としてキューに積む。チャンネルごとのまとめ・順番は通常押しと同じ）
+BatchSubmitResult<NUM_PHOTOCOUPLERS> pressPowerButtonBatch(const ChannelMask<NUM_PHOTOCOUPLERS>& channels,
+                                                           int maxConcurrent) {
+    BatchSubmitResult<NUM_PHOTOCOUPLERS> result = powerCommands.submitBatch(channels, maxConcurrent);
+    channels.forEach([&](int channel) {
+        traceSubmit(traceBuffer, channel, PulseKind::Short,
+                    result.queued.test(channel) ? CommandResult::Queued
+                    : result.coalesced.test(channel) ? CommandResult::Coalesced : result.result);
+    });
+    if (result.result == CommandResult::Queued) {
+        wakeCommandWorker();
+    } else if (result.result == CommandResult::Full) {
+        std::cout << "[WARN] Command queue full, batch press rejected" << std::endl;
+    }
+    return result;
+}
+
+// Wake-on-LAN（実機と同じく config.h の PC_MAC_ADDRESSES で宛先を引く）
+static_assert(sizeof(PC_MAC_ADDRESSES) / sizeof(PC_MAC_ADDRESSES[0]) == NUM_PHOTOCOUPLERS,
+              "PC_MAC_ADDRESSES must have one entry per photocoupler (\"\" if unused)");
+static_assert(macTableValid(PC_MAC_ADDRESSES), "PC_MAC_ADDRESSES has a malformed or duplicate MAC address");
+constexpr MacChannelTable<NUM_PHOTOCOUPLERS> WOL_TABLE = buildMacChannelTable(PC_MAC_ADDRESSES);
+WolCooldown<NUM_PHOTOCOUPLERS> wolCooldown;
+
+// 受信したマジックパケットを /api/power と同じ経路で処理する（UDP受信スレッドで実行）
+void handleMagicPacket(const uint8_t* data, size_t len, uint32_t client, uint16_t) {
+    uint64_t mac;
+    if (!parseMagicPacket(data, len, mac)) return;
+    int pcIndex = WOL_TABLE.lookup(mac);
+    if (pcIndex < 0) return;  // 他のマシン宛て
+
+    // 電源LED入力でONと分かっていれば押さない（押すと切れてしまう）
+    if (sensedChannels.test(pcIndex) && pcStates.test(pcIndex)) {
+        std::cout << "[WOL] " << PC_NAMES[pcIndex] << " is already on, magic packet ignored" << std::endl;
+        recordAudit(AuditEvent::Press, AuditResult::Skipped, AuditSource::Wol, pcIndex, PulseKind::Short, client, 0);
+        return;
+    }
+    if (!wolCooldown.tryAcquire(pcIndex, (uint32_t)(timers.nowUs() / 1000), WOL_COOLDOWN_MS)) {
+        recordAudit(AuditEvent::Press, AuditResult::Skipped, AuditSource::Wol, pcIndex, PulseKind::Short, client, 0);
+        return;
+    }
+    CommandResult result = pressPowerButton(pcIndex);
+    recordAudit(AuditEvent::Press, auditResultOf(result), AuditSource::Wol, pcIndex, PulseKind::Short, client,
+                POWER_PULSE_MS);
+    std::cout << "[WOL] Magic packet for " << PC_NAMES[pcIndex] << " from " << (client >> 24) << "."
+              << ((client >> 16) & 0xFF) << "." << ((client >> 8) & 0xFF) << "." << (client & 0xFF) << std::endl;
+}
+
+// 認証付きUDP制御プロトコル（実機と同じ形式、鍵は config.h の UDP_COMMAND_KEY か --udp-key）
+// 受信スレッドは1つなので、再送防止の表はロックなしで使える
+UdpCommandServer<NUM_PHOTOCOUPLERS, 16> udpCommands(UDP_COMMAND_MAX_SKEW_S);
+
+size_t handleUdpCommand(const HmacSha256& hmac, const uint8_t* data, size_t len, uint32_t client,
+                        uint8_t* reply, size_t cap) {
+    uint64_t nowUnixUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::system_clock::now().time_since_epoch()).count();
+    auto submit = [client](int pcIndex, PulseKind kind) {
+        bool isLong = kind == PulseKind::Long;
+        CommandResult result = isLong ? longPressPowerButton(pcIndex) : pressPowerButton(pcIndex);
+        recordAudit(isLong ? AuditEvent::LongPress : AuditEvent::Press, auditResultOf(result), AuditSource::Udp,
+                    pcIndex, kind, client, isLong ? POWER_LONG_PRESS_MS : POWER_PULSE_MS);
+        return result;
+    };
+    return udpCommands.handle(data, len, nowUnixUs, hmac, submit, [] { return powerCommands.depth(); },
+                              reply, cap);
+}
+
+// WiFi接続（実機と同じ状態機械を、接続時間とAPの停止を模擬するドライバで回す。/api/sim/wifi）
+// シミュレータのHTTPはWiFiの状態に関係なく受け付ける。時刻はタイマーの時計（--clock）
+struct TimerClock {
+    static uint64_t nowUs() { return timers.nowUs(); }
+};
+typedef FakeWifiDriver<TimerClock> SimWifiDriver;
+SimWifiDriver wifiDriver(WIFI_REUSE_IP);
+FileWifiStore wifiStore;
+WifiConnection<SimWifiDriver, FileWifiStore> wifi(
+    wifiDriver, wifiStore,
+    {WIFI_FAST_CONNECT_TIMEOUT_MS, WIFI_CONNECT_TIMEOUT_MS, WIFI_BACKOFF_MIN_MS, WIFI_BACKOFF_MAX_MS});
+std::mutex wifiMutex;
+uint32_t wifiTimerGeneration = 0;
+uint32_t wifiReadyCount = 0;
+
+// 状態機械を回し、次に回す時刻（期限かドライバがつながる時刻）にタイマーを1つだけ置く
+// 周期タイマーにしないのは、Fast モードで何も起きない時刻を刻み続けないため。wifiMutex を持って呼ぶ
+void pollWifiLocked() {
+    uint32_t now = (uint32_t)(timers.nowUs() / 1000);
+    uint32_t fastBefore = wifi.fastConnects();
+    WifiEvent event = wifi.poll(now);
+    if (event == WifiEvent::Ready) {
+        uint32_t ms = wifiReadyCount++ == 0 ? wifi.bootToReadyMs() : wifi.lastReconnectMs();
+        std::cout << "[WIFI] Connected in " << ms << " ms ("
+                  << (wifi.fastConnects() != fastBefore ? "cached BSSID/channel" : "scan") << ")" << std::endl;
+    } else if (event == WifiEvent::Lost) {
+        std::cout << "[WIFI] Connection lost, reconnecting" << std::endl;
+    }
+    uint32_t delay = wifi.msUntilDeadline(now);
+    uint32_t ready = wifiDriver.msUntilReady();
+    if (ready != 0 && (delay == 0 || ready < delay)) delay = ready;
+    uint32_t generation = ++wifiTimerGeneration;
+    if (delay == 0) return;
+    timers.schedule(delay, [generation] {
+        std::lock_guard<std::mutex> lock(wifiMutex);
+        if (generation == wifiTimerGeneration) pollWifiLocked();
+    });
+}
+
+void writeWifiJson(JsonWriter& json) {
+    json.beginObject()
+        .field("state", wifiStateName(wifi.state()))
+        .field("bootToReadyMs", wifi.bootToReadyMs())
+        .field("lastReconnectMs", wifi.lastReconnectMs())
+        .field("fastConnects", wifi.fastConnects())
+        .field("fastFailures", wifi.fastFailures())
+        .field("linkLosses", wifi.linkLosses())
+        .field("consecutiveFailures", wifi.consecutiveFailures())
+        .field("apChannel", wifiDriver.channel())
+        .field("apDownForMs", wifiDriver.apDownForMs())
+        .endObject();
+}
+
+// 電源投入プラン（/api/plan、実機と同じ PlanRunner）
+// 準備完了のTCP確認は既定ではPCのモデルで代用する（電源LEDがONなら接続できたとみなす）。
+// --plan-probe tcp なら実際に接続する（ブロックするので別スレッドで行い、その間 Fast モードの時計は止まる）
+static_assert(powerPlansValid(POWER_PLANS, NUM_PHOTOCOUPLERS),
+              "POWER_PLANS has an unknown or duplicate channel, a cycle, or a malformed readiness check");
+
+struct SimPlanPlatform {
+    CommandResult press(int channel) {
+        CommandResult result = pressPowerButton(channel);
+        recordAudit(AuditEvent::Press, auditResultOf(result), AuditSource::Plan, channel, PulseKind::Short, 0,
+                    POWER_PULSE_MS);
+        return result;
+    }
+
+    int powerState(int channel) { return sensedChannels.test(channel) ? (pcStates.test(channel) ? 1 : 0) : -1; }
+};
+
+static const uint32_t PLAN_POLL_MS = 100;
+static const int PLAN_PROBE_TIMEOUT_MS = 1000;
+
+SimPlanPlatform planPlatform;
+PlanRunner<NUM_PHOTOCOUPLERS, SimPlanPlatform> planRunner(planPlatform, POWER_PULSE_MS);
+std::mutex planMutex;
+bool planTimerArmed = false;
+bool planProbeTcp = false;
+
+bool tcpReachable(const char* host, uint16_t port, int timeoutMs) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addr = nullptr;
+    if (getaddrinfo(host, std::to_string(port).c_str(), &hints, &addr) != 0) return false;
+    int fd = socket(addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    bool ok = false;
+    if (fd >= 0) {
+        int rc = connect(fd, addr->ai_addr, addr->ai_addrlen);
+        if (rc == 0) {
+            ok = true;
+        } else if (errno == EINPROGRESS) {
+            struct pollfd p = {fd, POLLOUT, 0};
+            int err = 0;
+            socklen_t len = sizeof(err);
+            ok = poll(&p, 1, timeoutMs) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
+        }
+        close(fd);
+    }
+    freeaddrinfo(addr);
+    return ok;
+}
+
+// 実行中は PLAN_POLL_MS ごとに回す（終わったらタイマーを置かない）。planMutex を持って呼ぶ
+void armPlanTimerLocked();
+
+void pollPlan() {
+    PlanProbe probes[PLAN_MAX_PROBES_PER_POLL];
+    int count = 0;
+    {
+        std::lock_guard<std::mutex> lock(planMutex);
+        planTimerArmed = false;
+        uint32_t now = (uint32_t)(timers.nowUs() / 1000);
+        PlanState before = planRunner.state();
+        planRunner.poll(now);
+        count = planRunner.dueProbes(now, probes, PLAN_MAX_PROBES_PER_POLL);
+        if (!planProbeTcp) {
+            for (int i = 0; i < count; i++) {
+                int channel = planRunner.plan()->steps[probes[i].step].channel;
+                planRunner.probeResult(probes[i], hosts.reachable(channel), now);
+            }
+            count = 0;
+        }
+        if (before == PlanState::Running && !planRunner.running()) {
+            std::cout << "[PLAN] " << planRunner.plan()->name << " " << planStateName(planRunner.state()) << std::endl;
+        }
+        armPlanTimerLocked();
+    }
+    if (count == 0) return;
+    std::vector<PlanProbe> pending(probes, probes + count);
+    timers.beginWork();
+    std::thread([pending] {
+        for (const PlanProbe& probe : pending) {
+            bool reachable = tcpReachable(probe.host, probe.port, PLAN_PROBE_TIMEOUT_MS);
+            std::lock_guard<std::mutex> lock(planMutex);
+            planRunner.probeResult(probe, reachable, (uint32_t)(timers.nowUs() / 1000));
+        }
+        timers.endWork();
+    }).detach();
+}
+
+void armPlanTimerLocked() {
+    if (planTimerArmed || !planRunner.running()) return;
+    planTimerArmed = true;
+    timers.schedule(PLAN_POLL_MS, pollPlan);
+}
+
+// 予約運転（/api/schedules、実機と同じ PowerScheduler）
+// 表は --schedule-file に保存する。時計はタイマーの時計（--clock）を単調時計として、実機と同じく
+// SNTP_SYNC_INTERVAL_MS ごとに同期する。同期で渡す正しい時刻は「起動時のホストの時刻 + 経過時間」で、
+// --clock-drift-ppm を指定すると単調時計がその分だけ速く（負なら遅く）進み、WallClock の補正を確かめられる。
+// POST /api/sim/ntp?time=<UNIX秒> で正しい時刻そのものを変えて、すぐに同期する
+struct SimSchedulePlatform {
+    CommandResult press(int channel, PulseKind kind) {
+        bool isLong = kind == PulseKind::Long;
+        CommandResult result = isLong ? longPressPowerButton(channel) : pressPowerButton(channel);
+        recordAudit(isLong ? AuditEvent::LongPress : AuditEvent::Press, auditResultOf(result), AuditSource::Schedule,
+                    channel, kind, 0, isLong ? POWER_LONG_PRESS_MS : POWER_PULSE_MS);
+        std::cout << "[SCHEDULE] " << (isLong ? "Long press " : "Press ") << PC_NAMES[channel] << std::endl;
+        return result;
+    }
+
+    void skipped(int channel, PulseKind kind) {
+        recordAudit(kind == PulseKind::Long ? AuditEvent::LongPress : AuditEvent::Press, AuditResult::Skipped,
+                    AuditSource::Schedule, channel, kind, 0, 0);
+        std::cout << "[SCHEDULE] " << PC_NAMES[channel] << " is already in the requested state" << std::endl;
+    }
+
+    int powerState(int channel) { return sensedChannels.test(channel) ? (pcStates.test(channel) ? 1 : 0) : -1; }
+};
+
+typedef ScheduleTable<NUM_PHOTOCOUPLERS, SCHEDULE_MAX_ENTRIES> SimScheduleTable;
+typedef ScheduleEntry<NUM_PHOTOCOUPLERS> SimScheduleEntry;
+
+// 実機のNVSの代わりのファイル（空文字列なら保存しない）
+class FileScheduleStore {
+public:
+    void setPath(const std::string& path) { path_ = path; }
+
+    bool load(SimScheduleTable& table) {
+        if (path_.empty()) return false;
+        FILE* file = fopen(path_.c_str(), "rb");
+        if (!file) return false;
+        bool ok = fread(&table, sizeof(table), 1, file) == 1;
+        fclose(file);
+        return ok;
+    }
+
+    void save(const SimScheduleTable& table) {
+        if (path_.empty()) return;
+        FILE* file = fopen(path_.c_str(), "wb");
+        if (!file) return;
+        fwrite(&table, sizeof(table), 1, file);
+        fclose(file);
+    }
+
+private:
+    std::string path_;
+};
+
+SimSchedulePlatform schedulePlatform;
+FileScheduleStore scheduleStore;
+PowerScheduler<NUM_PHOTOCOUPLERS, SCHEDULE_MAX_ENTRIES, SimSchedulePlatform, FileScheduleStore> scheduler(
+    schedulePlatform, scheduleStore, SCHEDULE_UTC_OFFSET_MINUTES);
+std::mutex scheduleMutex;
+uint32_t scheduleTimerGeneration = 0;
+int64_t ntpBaseUnixUs = 0;  // 単調時計が0のときの正しい時刻
+double clockDriftPpm = 0;
+
+// 模擬のNTPサーバが返す時刻
+uint64_t simulatedNtpUnixUs(uint64_t monoUs) {
+    return (uint64_t)(ntpBaseUnixUs + (int64_t)monoUs - (int64_t)((double)monoUs * clockDriftPpm / 1e6));
+}
+
+// 期限の来た予約を実行し、次の予約の時刻にタイマーを1つだけ置く。scheduleMutex を持って呼ぶ
+void pollScheduleLocked() {
+    uint64_t now = timers.nowUs();
+    scheduler.poll(now);
+    uint32_t delay = scheduler.msUntilNext(now);
+    uint32_t generation = ++scheduleTimerGeneration;
+    if (delay == scheduler.NEVER) return;
+    timers.schedule(delay, [generation] {
+        std::lock_guard<std::mutex> lock(scheduleMutex);
+        if (generation == scheduleTimerGeneration) pollScheduleLocked();
+    });
+}
+
+void syncScheduleClockLocked() {
+    uint64_t now = timers.nowUs();
+    scheduler.sync(now, simulatedNtpUnixUs(now));
+    pollScheduleLocked();
+}
+
+bool clockSyncRunning = false;
+
+// 実機の SNTP の定期同期に相当する。ずれのない同期は表示しない
+// 予約がなくなったら止める（--clock fast で、同期のタイマーだけで仮想時間が進み続けないように）
+void syncScheduleClockPeriodically() {
+    std::lock_guard<std::mutex> lock(scheduleMutex);
+    syncScheduleClockLocked();
+    const WallClock& clock = scheduler.clock();
+    if (clock.lastOffsetUs() != 0) {
+        std::cout << "[NTP] Synchronized (offset " << clock.lastOffsetUs() << " us, drift " << clock.driftPpb()
+                  << " ppb)" << std::endl;
+    }
+    clockSyncRunning = scheduler.count() > 0;
+    if (clockSyncRunning) timers.schedule(SNTP_SYNC_INTERVAL_MS, syncScheduleClockPeriodically);
+}
+
+// 予約を追加したら定期同期を再開する。scheduleMutex を持って呼ぶ
+void resumeClockSyncLocked() {
+    if (clockSyncRunning) return;
+    clockSyncRunning = true;
+    timers.schedule(SNTP_SYNC_INTERVAL_MS, syncScheduleClockPeriodically);
+}
+
+// 目標状態（/api/state、実機と同じ PowerReconciler）
+// 電源状態のTCP確認は電源投入プランと同じく、既定ではPCのモデルで代用する（--plan-probe tcp なら実際に接続する）。
+// 目標のあるチャンネルがある間は RECONCILE_POLL_MS ごとにタイマーで回す
+static_assert(sizeof(POWER_STATE_PROBES) / sizeof(POWER_STATE_PROBES[0]) == NUM_PHOTOCOUPLERS,
+              "POWER_STATE_PROBES must have one entry per photocoupler (\"\" if unused)");
+static_assert(stateProbesValid(POWER_STATE_PROBES), "POWER_STATE_PROBES has a malformed \"<host>:<port>\"");
+
+struct SimReconcilePlatform {
+    CommandResult press(int channel, PulseKind kind) {
+        bool isLong = kind == PulseKind::Long;
+        CommandResult result = isLong ? longPressPowerButton(channel) : pressPowerButton(channel);
+        recordAudit(isLong ? AuditEvent::LongPress : AuditEvent::Press, auditResultOf(result), AuditSource::Reconcile,
+                    channel, kind, 0, isLong ? POWER_LONG_PRESS_MS : POWER_PULSE_MS);
+        return result;
+    }
+
+    int powerState(int channel) { return sensedChannels.test(channel) ? (pcStates.test(channel) ? 1 : 0) : -1; }
+};
+
+static const uint32_t RECONCILE_POLL_MS = 500;
+
+SimReconcilePlatform reconcilePlatform;
+PowerReconciler<NUM_PHOTOCOUPLERS, SimReconcilePlatform> reconciler(
+    reconcilePlatform, POWER_STATE_PROBES,
+    {RECONCILE_MAX_PRESSES, RECONCILE_ON_TIMEOUT_MS, RECONCILE_OFF_TIMEOUT_MS, POWER_LONG_PRESS_MS});
+std::mutex reconcileMutex;
+bool reconcileTimerArmed = false;
+
+void writeReconcileStatus(JsonWriter& json) {
+    std::lock_guard<std::mutex> lock(reconcileMutex);
+    reconciler.writeStatusFields(json);
+}
+
+// 状態が変わったチャンネルをログに出す。reconcileMutex を持って呼ぶ
+void logReconcileChanges(const ReconcileState (&before)[NUM_PHOTOCOUPLERS]) {
+    for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
+        ReconcileState state = reconciler.state(i);
+        if (state == before[i]) continue;
+        std::cout << "[STATE] " << PC_NAMES[i] << " " << reconcileStateName(state) << " (desired "
+                  << desiredPowerName(reconciler.desired(i)) << ")" << std::endl;
+    }
+}
+
+void armReconcileTimerLocked();
+
+void pollReconcile() {
+    ReconcileProbe probes[RECONCILE_MAX_PROBES_PER_POLL];
+    ReconcileState before[NUM_PHOTOCOUPLERS];
+    int count = 0;
+    {
+        std::lock_guard<std::mutex> lock(reconcileMutex);
+        reconcileTimerArmed = false;
+        uint32_t now = (uint32_t)(timers.nowUs() / 1000);
+        for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) before[i] = reconciler.state(i);
+        reconciler.poll(now);
+        count = reconciler.dueProbes(now, probes, RECONCILE_MAX_PROBES_PER_POLL);
+        if (!planProbeTcp) {
+            for (int i = 0; i < count; i++) reconciler.probeResult(probes[i], hosts.reachable(probes[i].channel), now);
+            count = 0;
+        }
+        logReconcileChanges(before);
+        armReconcileTimerLocked();
+    }
+    if (count == 0) return;
+    std::vector<ReconcileProbe> pending(probes, probes + count);
+    timers.beginWork();
+    std::thread([pending] {
+        ReconcileState before[NUM_PHOTOCOUPLERS];
+        for (const ReconcileProbe& probe : pending) {
+            bool reachable = tcpReachable(probe.host, probe.port, PLAN_PROBE_TIMEOUT_MS);
+            std::lock_guard<std::mutex> lock(reconcileMutex);
+            for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) before[i] = reconciler.state(i);
+            reconciler.probeResult(probe, reachable, (uint32_t)(timers.nowUs() / 1000));
+            logReconcileChanges(before);
+        }
+        timers.endWork();
+    }).detach();
+}
+
+// 目標のあるチャンネルがなくなったらタイマーを置かない。reconcileMutex を持って呼ぶ
+void armReconcileTimerLocked() {
+    if (reconcileTimerArmed || !reconciler.active()) return;
+    reconcileTimerArmed = true;
+    timers.schedule(RECONCILE_POLL_MS, pollReconcile);
+}
+
+// 埋め込みのgzip済みページを返す（実機と同じくETagによる304に対応、gzipを受け取れなければ 406）
+HttpResponse serveIndexHTML(const HttpRequest& request) {
+    std::string acceptEncoding(request.header("Accept-Encoding"));
+    if (acceptEncoding.empty() || !webUiAcceptsGzip(acceptEncoding.c_str())) {
+        HttpResponse response = createHttpResponse(406, "text/plain", WEB_UI_GZIP_REQUIRED);
+        response.extraHeaders = "Vary: Accept-Encoding\r\n";
+        return response;
+    }
+    HttpResponse response;
+    response.extraHeaders = "ETag: " WEB_UI_ETAG "\r\nVary: Accept-Encoding\r\n";
+    std::string ifNoneMatch(request.header("If-None-Match"));
+    if (!ifNoneMatch.empty() && webUiEtagMatches(ifNoneMatch.c_str())) {
+        response.status = 304;
+        return response;
+    }
+    response.contentType = "text/html; charset=utf-8";
+    response.extraHeaders += "Content-Encoding: gzip\r\nCache-Control: no-cache\r\n";
+    response.staticBody = WEB_UI_GZ;
+    response.staticBodyLen = WEB_UI_GZ_LEN;
+    return response;
+}
+
+// スクレイプ時点の状態
+// ヒープはglibcの統計（空きの合計・先頭の解放可能領域・観測した最小値）、WiFiは固定値
+SystemGauges readSystemGauges() {
+    static std::atomic<uint32_t> minFree(UINT32_MAX);
+    struct mallinfo2 info = mallinfo2();
+    SystemGauges gauges;
+    gauges.heapFree = (uint32_t)info.fordblks;
+    gauges.heapLargestBlock = (uint32_t)info.keepcost;
+    uint32_t seen = minFree.load(std::memory_order_relaxed);
+    while (gauges.heapFree < seen && !minFree.compare_exchange_weak(seen, gauges.heapFree)) {
+    }
+    gauges.heapMinFree = seen < gauges.heapFree ? seen : gauges.heapFree;
+    gauges.wifiRssi = -50;
+    {
+        std::lock_guard<std::mutex> lock(wifiMutex);
+        gauges.wifiReconnects = wifiReadyCount > 0 ? wifiReadyCount - 1 : 0;
+        gauges.wifiBootToReadyMs = wifi.bootToReadyMs();
+        gauges.wifiLastReconnectMs = wifi.lastReconnectMs();
+    }
+    gauges.commandQueueDepth = (uint32_t)powerCommands.depth();
+    gauges.eventQueueDepth = 0;  // シミュレータはSSEへ直接配信する
+    gauges.stuckOutputs = (uint32_t)stuckOutputs.mask().count();
+    gauges.releaseRetries = releaseRetries.load(std::memory_order_relaxed);
+    gauges.uptimeSeconds = (uint32_t)(timers.nowUs() / 1000000ULL);
+    return gauges;
+}
+
+// ---- APIハンドラ（ルート表から呼ばれる） ----
+
+HttpResponse handleIndex(const HttpRequest& request, const RouteParams&) {
+    return serveIndexHTML(request);
+}
+
+HttpResponse handleInfo(const HttpRequest&, const RouteParams&) {
+    char buf[1024];
+    JsonWriter json(buf, sizeof(buf));
+    json.beginObject()
+        .field("ip", "localhost")
+        .field("platform", "macOS ARM64")
+        .field("mode", "ESP32シミュレータ")
+        .field("numPCs", NUM_PHOTOCOUPLERS)
+        .key("pcNames").beginArray();
+    for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
+        json.value(PC_NAMES[i]);
+    }
+    json.endArray().endObject();
+    return createJsonResponse(200, json);
+}
+
+HttpResponse handleStatus(const HttpRequest&, const RouteParams&) {
+    char buf[statusJsonCapacity<NUM_PHOTOCOUPLERS>()];
+    JsonWriter json(buf, sizeof(buf));
+    writeStatusJson(json);
+    return createJsonResponse(200, json);
+}
+
+// SSE: 接続時に現在の状態を送り、以降は電源イベントを配信する
+HttpResponse handleEvents(const HttpRequest&, const RouteParams&) {
+    char buf[statusJsonCapacity<NUM_PHOTOCOUPLERS>()];
+    JsonWriter json(buf, sizeof(buf));
+    writeStatusJson(json);
+    if (!json.ok()) return createJsonResponse(500, json);
+    char frame[statusJsonCapacity<NUM_PHOTOCOUPLERS>() + 64];  // SSE の id / event / data 行の分
+    size_t len = formatSseEvent(frame, sizeof(frame), "status", nextPowerEventSeq(), json.c_str());
+    HttpResponse response;
+    response.eventStream = true;
+    response.body.assign(frame, len);
+    return response;
+}
+
+HttpResponse handleMetrics(const HttpRequest&, const RouteParams&) {
+    MetricsRenderer<NUM_PHOTOCOUPLERS> renderer(httpMetrics, pulseMetrics, readSystemGauges(), PC_NAMES);
+    HttpResponse response;
+    char chunk[1024];
+    size_t n;
+    while ((n = renderer.render(chunk, sizeof(chunk))) > 0) response.body.append(chunk, n);
+    response.contentType = "text/plain; version=0.0.4";
+    return response;
+}
+
+// ?since=<seq>（省略時は残っている最古から）&limit=<件数>
+HttpResponse handleAudit(const HttpRequest& request, const RouteParams&) {
+    std::string value;
+    uint32_t since = request.param("since", value) ? (uint32_t)strtoul(value.c_str(), nullptr, 10) : 0;
+    uint32_t limit = request.param("limit", value) ? (uint32_t)strtoul(value.c_str(), nullptr, 10) : 0;
+    AuditRenderer<SimAuditLog> renderer(auditLog, since, limit);
+    HttpResponse response;
+    char chunk[1024];
+    size_t n;
+    while ((n = renderer.render(chunk, sizeof(chunk))) > 0) response.body.append(chunk, n);
+    response.contentType = "application/json";
+    return response;
+}
+
+// Chrome Trace Event 形式（Perfetto の Open trace file で開ける）
+HttpResponse handleTrace(const HttpRequest&, const RouteParams&) {
+    TraceRenderer<SimTraceBuffer> renderer(traceBuffer, PC_NAMES, NUM_PHOTOCOUPLERS);
+    HttpResponse response;
+    char chunk[1024];
+    size_t n;
+    while ((n = renderer.render(chunk, sizeof(chunk))) > 0) response.body.append(chunk, n);
+    response.contentType = "application/json";
+    return response;
+}
+
+// ?enabled=1|0 で開始・停止、?clear=1 で消去
+HttpResponse handleTraceControl(const HttpRequest& request, const RouteParams&) {
+    std::string value;
+    if (request.param("enabled", value)) traceBuffer.setEnabled(value == "1");
+    if (request.param("clear", value) && value == "1") traceBuffer.clear();
+    char buf[128];
+    JsonWriter json(buf, sizeof(buf));
+    writeTraceState(json, traceBuffer);
+    return createJsonResponse(200, json);
+}
+
+// 設定されているプランの一覧と、実行中のプラン
+HttpResponse handlePlans(const HttpRequest&, const RouteParams&) {
+    char buf[2048];
+    JsonWriter json(buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(planMutex);
+    json.beginObject().key("plans").beginArray();
+    for (const PowerPlan& plan : POWER_PLANS) {
+        if (!plan.name) continue;
+        json.beginObject()
+            .field("name", plan.name)
+            .field("steps", plan.stepCount)
+            .field("maxConcurrent", plan.maxConcurrent)
+            .field("readyTimeoutMs", plan.readyTimeoutMs)
+            .endObject();
+    }
+    json.endArray().key("running");
+    if (planRunner.running()) {
+        json.value(planRunner.plan()->name);
+    } else {
+        json.raw("null");
+    }
+    json.endObject();
+    return createJsonResponse(200, json);
+}
+
+// 進捗（最後に実行したプランでなければ idle）
+HttpResponse handlePlanStatus(const HttpRequest& request, const RouteParams& params) {
+    const PowerPlan* plan = findPowerPlan(POWER_PLANS, request.path.data() + params[0], params.lengths[0]);
+    if (!plan) return createHttpResponse(404, "application/json", "{\"error\":\"Unknown plan\"}");
+    char buf[8192];
+    JsonWriter json(buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(planMutex);
+    if (planRunner.plan() == plan) {
+        planRunner.writeJson(json, (uint32_t)(timers.nowUs() / 1000), PC_NAMES);
+    } else {
+        json.beginObject().field("plan", plan->name).field("state", "idle").endObject();
+    }
+    return createJsonResponse(200, json);
+}
+
+HttpResponse handlePlanStart(const HttpRequest& request, const RouteParams& params) {
+    const PowerPlan* plan = findPowerPlan(POWER_PLANS, request.path.data() + params[0], params.lengths[0]);
+    if (!plan) return createHttpResponse(404, "application/json", "{\"error\":\"Unknown plan\"}");
+    char buf[8192];
+    JsonWriter json(buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(planMutex);
+    uint32_t now = (uint32_t)(timers.nowUs() / 1000);
+    int badChannel = -1;
+    switch (planRunner.start(*plan, now, badChannel)) {
+        case PlanStartResult::Busy:
+            json.beginObject().field("error", "Another plan is running").field("running", planRunner.plan()->name).endObject();
+            return createJsonResponse(409, json);
+        case PlanStartResult::NoSense:
+            json.beginObject().field("error", "No power sense input for a \"sense\" step").field("channel", badChannel).endObject();
+            return createJsonResponse(409, json);
+        case PlanStartResult::Started:
+            break;
+    }
+    std::cout << "[PLAN] " << plan->name << " started" << std::endl;
+    armPlanTimerLocked();
+    planRunner.writeJson(json, now, PC_NAMES);
+    return createJsonResponse(202, json);
+}
+
+// 中止（押したPCはそのまま、まだ押していないステップを押さない）
+HttpResponse handlePlanCancel(const HttpRequest& request, const RouteParams& params) {
+    const PowerPlan* plan = findPowerPlan(POWER_PLANS, request.path.data() + params[0], params.lengths[0]);
+    if (!plan) return createHttpResponse(404, "application/json", "{\"error\":\"Unknown plan\"}");
+    char buf[8192];
+    JsonWriter json(buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(planMutex);
+    uint32_t now = (uint32_t)(timers.nowUs() / 1000);
+    if (planRunner.plan() != plan || !planRunner.cancel(now)) {
+        return createHttpResponse(409, "application/json", "{\"error\":\"Plan is not running\"}");
+    }
+    std::cout << "[PLAN] " << plan->name << " cancelled" << std::endl;
+    planRunner.writeJson(json, now, PC_NAMES);
+    return createJsonResponse(200, json);
+}
+
+HttpResponse handleSchedules(const HttpRequest&, const RouteParams&) {
+    char buf[8192];
+    JsonWriter json(buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(scheduleMutex);
+    scheduler.writeJson(json, timers.nowUs());
+    return createJsonResponse(200, json);
+}
+
+// クエリまたはフォーム本文の値で予約を書き換える（不正ならエラーの本文を返す）
+const char* applyScheduleRequest(const HttpRequest& request, SimScheduleEntry& entry) {
+    std::string value;
+    return applyScheduleParams(entry, [&request, &value](const char* name) -> const char* {
+        return request.param(name, value) ? value.c_str() : nullptr;
+    });
+}
+
+HttpResponse createScheduleErrorResponse(const char* error) {
+    char buf[160];
+    JsonWriter json(buf, sizeof(buf));
+    json.beginObject().field("error", error).endObject();
+    return createJsonResponse(400, json);
+}
+
+HttpResponse createScheduleEntryResponse(int code, int id) {
+    char buf[512];
+    JsonWriter json(buf, sizeof(buf));
+    scheduler.writeEntryJson(json, id);
+    return createJsonResponse(code, json);
+}
+
+// time=HH:MM&action=on|off|forceoff&channels=7,8,9&days=daily|weekdays|weekends|mon,tue&enabled=1|0
+HttpResponse handleScheduleCreate(const HttpRequest& request, const RouteParams&) {
+    SimScheduleEntry entry = newScheduleEntry<NUM_PHOTOCOUPLERS>();
+    if (const char* error = applyScheduleRequest(request, entry)) return createScheduleErrorResponse(error);
+    std::lock_guard<std::mutex> lock(scheduleMutex);
+    int id = scheduler.add(entry, timers.nowUs());
+    if (id < 0) return createHttpResponse(409, "application/json", "{\"error\":\"Schedule table full\"}");
+    resumeClockSyncLocked();
+    pollScheduleLocked();
+    return createScheduleEntryResponse(201, id);
+}
+
+HttpResponse handleScheduleGet(const HttpRequest&, const RouteParams& params) {
+    std::lock_guard<std::mutex> lock(scheduleMutex);
+    if (!scheduler.exists(params[0])) {
+        return createHttpResponse(404, "application/json", "{\"error\":\"Unknown schedule\"}");
+    }
+    return createScheduleEntryResponse(200, params[0]);
+}
+
+// 渡した項目だけ変わる
+HttpResponse handleScheduleUpdate(const HttpRequest& request, const RouteParams& params) {
+    std::lock_guard<std::mutex> lock(scheduleMutex);
+    if (!scheduler.exists(params[0])) {
+        return createHttpResponse(404, "application/json", "{\"error\":\"Unknown schedule\"}");
+    }
+    SimScheduleEntry entry = scheduler.entry(params[0]);
+    if (const char* error = applyScheduleRequest(request, entry)) return createScheduleErrorResponse(error);
+    scheduler.update(params[0], entry, timers.nowUs());
+    pollScheduleLocked();
+    return createScheduleEntryResponse(200, params[0]);
+}
+
+HttpResponse handleScheduleDelete(const HttpRequest&, const RouteParams& params) {
+    std::lock_guard<std::mutex> lock(scheduleMutex);
+    if (!scheduler.remove(params[0])) {
+        return createHttpResponse(404, "application/json", "{\"error\":\"Unknown schedule\"}");
+    }
+    pollScheduleLocked();
+    char buf[64];
+    JsonWriter json(buf, sizeof(buf));
+    json.beginObject().field("deleted", params[0]).endObject();
+    return createJsonResponse(200, json);
+}
+
+HttpResponse createStateResponse(int code, int pcIndex) {
+    char buf[320];
+    JsonWriter json(buf, sizeof(buf));
+    {
+        std::lock_guard<std::mutex> lock(reconcileMutex);
+        reconciler.writeChannelJson(json, pcIndex, (uint32_t)(timers.nowUs() / 1000), PC_NAMES[pcIndex]);
+    }
+    return createJsonResponse(code, json);
+}
+
+HttpResponse createInvalidIndexResponse() {
+    return createHttpResponse(400, "application/json", "{\"success\":false,\"message\":\"Invalid PC index\"}");
+}
+
+bool validStateChannel(int pcIndex) { return pcIndex >= 0 && pcIndex < NUM_PHOTOCOUPLERS; }
+
+HttpResponse handleStateGet(const HttpRequest&, const RouteParams& params) {
+    if (!validStateChannel(params[0])) return createInvalidIndexResponse();
+    return createStateResponse(200, params[0]);
+}
+
+// state=on|off（200 既に合っている / 202 合わせにいく / 400 不正な値 / 409 観測できない）
+HttpResponse handleStatePut(const HttpRequest& request, const RouteParams& params) {
+    int pcIndex = params[0];
+    if (!validStateChannel(pcIndex)) return createInvalidIndexResponse();
+    std::string value;
+    DesiredPower desired;
+    if (!request.param("state", value) || !parseDesiredPower(value.c_str(), desired)) {
+        return createHttpResponse(400, "application/json", "{\"error\":\"state must be on or off\"}");
+    }
+    ReconcileSetResult result;
+    ReconcileState state;
+    {
+        std::lock_guard<std::mutex> lock(reconcileMutex);
+        ReconcileState before[NUM_PHOTOCOUPLERS];
+        for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) before[i] = reconciler.state(i);
+        result = reconciler.set(pcIndex, desired, (uint32_t)(timers.nowUs() / 1000));
+        state = reconciler.state(pcIndex);
+        logReconcileChanges(before);
+        armReconcileTimerLocked();
+    }
+    if (result == ReconcileSetResult::NoObservation) {
+        return createHttpResponse(409, "application/json",
+                                  "{\"error\":\"No power sense input or state probe for this PC\"}");
+    }
+    return createStateResponse(state == ReconcileState::Converged ? 200 : 202, pcIndex);
+}
+
+HttpResponse handleStateDelete(const HttpRequest&, const RouteParams& params) {
+    if (!validStateChannel(params[0])) return createInvalidIndexResponse();
+    {
+        std::lock_guard<std::mutex> lock(reconcileMutex);
+        reconciler.set(params[0], DesiredPower::None, (uint32_t)(timers.nowUs() / 1000));
+    }
+    return createStateResponse(200, params[0]);
+}
+
+// PCのモデルを外から変える：hung=1|0（電源は入っているが応答しない）、power=on|off（手で電源を入れた・切った）
+HttpResponse handleSimHost(const HttpRequest& request, const RouteParams& params) {
+    int pcIndex = params[0];
+    if (!validStateChannel(pcIndex)) return createInvalidIndexResponse();
+    std::string value;
+    if (request.param("hung", value)) hosts.setHung(pcIndex, value == "1");
+    if (request.param("power", value)) {
+        if (value != "on" && value != "off") {
+            return createHttpResponse(400, "application/json", "{\"error\":\"power must be on or off\"}");
+        }
+        hosts.setPowered(pcIndex, value == "on");
+    }
+    char buf[128];
+    JsonWriter json(buf, sizeof(buf));
+    json.beginObject()
+        .field("pcIndex", pcIndex)
+        .field("powered", hosts.ledOn(pcIndex))
+        .field("hung", hosts.hung(pcIndex))
+        .field("reachable", hosts.reachable(pcIndex))
+        .endObject();
+    return createJsonResponse(200, json);
+}
+
+// 模擬のNTPサーバの時刻を ?time=<UNIX秒> に変えて（省略時はそのまま）すぐに同期する
+HttpResponse handleSimNtp(const HttpRequest& request, const RouteParams&) {
+    std::string value;
+    char buf[8192];
+    JsonWriter json(buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(scheduleMutex);
+    if (request.param("time", value)) {
+        char* end = nullptr;
+        unsigned long long time = strtoull(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || time < 1600000000ULL || time > 4000000000ULL) {
+            return createHttpResponse(400, "application/json", "{\"error\":\"Invalid time\"}");
+        }
+        uint64_t now = timers.nowUs();
+        ntpBaseUnixUs += (int64_t)(time * 1000000ULL) - (int64_t)simulatedNtpUnixUs(now);
+    }
+    syncScheduleClockLocked();
+    scheduler.writeJson(json, timers.nowUs());
+    return createJsonResponse(200, json);
+}
+
+HttpResponse handleSimGpio(const HttpRequest&, const RouteParams&) {
+    char buf[4096];
+    JsonWriter json(buf, sizeof(buf));
+    gpio.writeJson(json);
+    return createJsonResponse(200, json);
+}
+
+HttpResponse handleSimI2c(const HttpRequest&, const RouteParams&) {
+    char buf[4096];
+    JsonWriter json(buf, sizeof(buf));
+    json.beginObject();
+    i2cBus.writeFields(json);
+    channelHw.lockBus();
+    json.field("driverTransactions", channelDriver.transactions())
+        .field("busErrors", channelDriver.busErrors())
+        .field("skippedWrites", channelDriver.skippedWrites());
+    channelHw.unlockBus();
+    json.endObject();
+    return createJsonResponse(200, json);
+}
+
+HttpResponse handleSimClock(const HttpRequest&, const RouteParams&) {
+    ClockMode mode = timers.mode();
+    char factor[32];
+    snprintf(factor, sizeof(factor), "%g", timers.factor());
+    char buf[256];
+    JsonWriter json(buf, sizeof(buf));
+    json.beginObject()
+        .field("mode", mode == ClockMode::Fast ? "fast" : mode == ClockMode::Scaled ? "scaled" : "real")
+        .key("factor").raw(factor)
+        .field("nowMs", timers.nowUs() / 1000)
+        .field("pendingTimers", timers.pending())
+        .endObject();
+    return createJsonResponse(200, json);
+}
+
+// 資源の制約の模擬（--device-limits 等、simulator/device_limits.h）
+DeviceLimits deviceLimits;
+
+HttpResponse handleSimLimits(const HttpRequest&, const RouteParams&) {
+    char buf[512];
+    JsonWriter json(buf, sizeof(buf));
+    json.beginObject()
+        .field("enabled", deviceLimits.enabled())
+        .field("maxSockets", deviceLimits.maxSockets)
+        .field("acceptBacklog", deviceLimits.acceptBacklog)
+        .field("heapBytes", deviceLimits.heapBytes)
+        .field("socketBytes", deviceLimits.socketBytes)
+        .field("handlerCostUs", deviceLimits.handlerCostUs)
+        .field("latencyMs", deviceLimits.latencyMs)
+        .field("lossPercent", deviceLimits.lossPercent)
+        .field("openSockets", deviceLimits.openSockets.load())
+        .field("peakSockets", deviceLimits.peakSockets.load())
+        .field("acceptPauses", deviceLimits.acceptPauses.load())
+        .field("heapUsed", deviceLimits.heapUsed.load())
+        .field("heapFree", deviceLimits.heapFree())
+        .field("minHeapFree", deviceLimits.minHeapFree())
+        .field("heapRejects", deviceLimits.heapRejects.load())
+        .field("retransmits", deviceLimits.retransmits.load())
+        .field("requests", deviceLimits.requests.load())
+        .endObject();
+    return createJsonResponse(200, json);
+}
+
+HttpResponse handleSimWifi(const HttpRequest&, const RouteParams&) {
+    char buf[512];
+    JsonWriter json(buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    writeWifiJson(json);
+    return createJsonResponse(200, json);
+}
+
+// APを止めてリンクを切る。?down_ms=<APが戻るまで>（既定0）&channel=<戻ったときのチャンネル>（任意）
+HttpResponse handleSimWifiDrop(const HttpRequest& request, const RouteParams&) {
+    std::string value;
+    char* end = nullptr;
+    unsigned long downMs = 0;
+    unsigned long channel = 0;
+    if (request.param("down_ms", value)) {
+        downMs = strtoul(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || downMs > 3600000) {
+            return createHttpResponse(400, "application/json", "{\"error\":\"Invalid down_ms\"}");
+        }
+    }
+    if (request.param("channel", value)) {
+        channel = strtoul(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || channel < 1 || channel > 13) {
+            return createHttpResponse(400, "application/json", "{\"error\":\"Invalid channel\"}");
+        }
+    }
+    char buf[512];
+    JsonWriter json(buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    wifiDriver.drop((uint32_t)downMs, (uint8_t)channel);
+    pollWifiLocked();
+    writeWifiJson(json);
+    return createJsonResponse(200, json);
+}
+
+// ?channels=0,1,2 または ?mask=0x7、任意で ?max=同時押し上限（フォーム本文でも可）
+HttpResponse handlePowerBatch(const HttpRequest& request, const RouteParams&) {
+    ChannelMask<NUM_PHOTOCOUPLERS> channels;
+    bool valid = false;
+    std::string value;
+    if (request.param("channels", value)) {
+        valid = parseChannelList(value.c_str(), channels);
+    } else if (request.param("mask", value)) {
+        valid = parseChannelBitmask(value.c_str(), channels);
+    }
+    if (!valid || !channels.any()) {
+        return createHttpResponse(400, "application/json", "{\"success\":false,\"message\":\"Invalid channel list\"}");
+    }
+    int maxConcurrent = MAX_CONCURRENT_PULSES;
+    if (request.param("max", value)) {
+        int requested = atoi(value.c_str());
+        // 設定値より緩くはできない
+        if (requested > 0 && (maxConcurrent <= 0 || requested < maxConcurrent)) maxConcurrent = requested;
+    }
+    BatchSubmitResult<NUM_PHOTOCOUPLERS> result = pressPowerButtonBatch(channels, maxConcurrent);
+    recordBatchAudit(auditResultOf(result.result), AuditSource::Http, request.remoteAddr, channels);
+    if (result.result == CommandResult::Full) return createQueueFullResponse();
+    char buf[512];
+    JsonWriter json(buf, sizeof(buf));
+    writeBatchAccepted(json, result, maxConcurrent, POWER_PULSE_MS, powerCommands.depth());
+    return createJsonResponse(202, json);
+}
+
+HttpResponse handlePower(const HttpRequest& request, const RouteParams& params) {
+    int pcIndex = params[0];
+    CommandResult result = pressPowerButton(pcIndex);
+    recordAudit(AuditEvent::Press, auditResultOf(result), AuditSource::Http, pcIndex, PulseKind::Short,
+                request.remoteAddr, POWER_PULSE_MS);
+    return createCommandResponse(result, pcIndex, " の電源ボタン操作を受け付けました", POWER_PULSE_MS);
+}
+
+HttpResponse handleLongPress(const HttpRequest& request, const RouteParams& params) {
+    int pcIndex = params[0];
+    CommandResult result = longPressPowerButton(pcIndex);
+    recordAudit(AuditEvent::LongPress, auditResultOf(result), AuditSource::Http, pcIndex, PulseKind::Long,
+                request.remoteAddr, POWER_LONG_PRESS_MS);
+    return createCommandResponse(result, pcIndex, " の電源ボタン長押し (強制シャットダウン) を受け付けました",
+                                 POWER_LONG_PRESS_MS);
+}
+
+// ルート表（実機の API_ROUTES と同じ順序。/api/sim/ 以下はシミュレータ専用）
+typedef HttpResponse (*SimRouteHandler)(const HttpRequest& request, const RouteParams& params);
+
+constexpr RouteEntry<SimRouteHandler> API_ROUTES[] = {
+    {HttpMethod::Get,  "/",                  Route::Index,      handleIndex},
+    {HttpMethod::Get,  "/api/info",          Route::Info,       handleInfo},
+    {HttpMethod::Get,  "/api/status",        Route::Status,     handleStatus},
+    {HttpMethod::Get,  "/api/events",        Route::Events,     handleEvents},
+    {HttpMethod::Get,  "/api/metrics",       Route::Metrics,    handleMetrics},
+    {HttpMethod::Get,  "/api/audit",         Route::Audit,      handleAudit},
+    {HttpMethod::Get,  "/api/trace",         Route::Trace,      handleTrace},
+    {HttpMethod::Post, "/api/trace",         Route::Trace,      handleTraceControl},
+    {HttpMethod::Get,  "/api/plans",         Route::Plan,       handlePlans},
+    {HttpMethod::Get,  "/api/plan/{s}",      Route::Plan,       handlePlanStatus},
+    {HttpMethod::Post, "/api/plan/{s}",      Route::Plan,       handlePlanStart},
+    {HttpMethod::Delete, "/api/plan/{s}",    Route::Plan,       handlePlanCancel},
+    {HttpMethod::Get,  "/api/schedules",     Route::Schedule,   handleSchedules},
+    {HttpMethod::Post, "/api/schedules",     Route::Schedule,   handleScheduleCreate},
+    {HttpMethod::Get,  "/api/schedules/{i}", Route::Schedule,   handleScheduleGet},
+    {HttpMethod::Put,  "/api/schedules/{i}", Route::Schedule,   handleScheduleUpdate},
+    {HttpMethod::Delete, "/api/schedules/{i}", Route::Schedule, handleScheduleDelete},
+    {HttpMethod::Get,  "/api/state/{i}",     Route::State,      handleStateGet},
+    {HttpMethod::Put,  "/api/state/{i}",     Route::State,      handleStatePut},
+    {HttpMethod::Delete, "/api/state/{i}",   Route::State,      handleStateDelete},
+    {HttpMethod::Get,  "/api/sim/gpio",      Route::Other,      handleSimGpio},
+    {HttpMethod::Get,  "/api/sim/i2c",       Route::Other,      handleSimI2c},
+    {HttpMethod::Get,  "/api/sim/clock",     Route::Other,      handleSimClock},
+    {HttpMethod::Get,  "/api/sim/limits",    Route::Other,      handleSimLimits},
+    {HttpMethod::Get,  "/api/sim/wifi",      Route::Other,      handleSimWifi},
+    {HttpMethod::Post, "/api/sim/wifi/drop", Route::Other,      handleSimWifiDrop},
+    {HttpMethod::Post, "/api/sim/ntp",       Route::Other,      handleSimNtp},
+    {HttpMethod::Post, "/api/sim/host/{i}",  Route::Other,      handleSimHost},
+    {HttpMethod::Post, "/api/power/batch",   Route::PowerBatch, handlePowerBatch},
+    {HttpMethod::Post, "/api/power/{i}",     Route::Power,      handlePower},
+    {HttpMethod::Post, "/api/longpress/{i}", Route::LongPress,  handleLongPress},
+};
+static_assert(routeTableValid(API_ROUTES), "API_ROUTES has a malformed pattern");
+
+// HTTPリクエストを処理
+HttpResponse handleRequest(const HttpRequest& request) {
+    std::cout << "[HTTP] " << request.method << " " << request.path << std::endl;
+
+    RouteParams params;
+    const RouteEntry<SimRouteHandler>* route =
+        matchRoute(API_ROUTES, parseHttpMethod(request.method.data(), request.method.size()), request.path.data(), request.path.size(), params);
+    Route metric = route ? route->metric : Route::NotFound;
+    RouteTimer<SimClock> timer(httpMetrics, metric);
+    TraceScope<SimTraceBuffer> span(traceBuffer, TracePoint::HttpHandler, (uint32_t)metric);
+    if (!route) {
+        return createHttpResponse(404, "application/json", "{\"error\":\"Not found\"}");
+    }
+    return route->handler(request, params);
+}
+
+// --clock / SIM_CLOCK の値： real | fast | 倍率（例 10 で10倍速）
+bool parseClockMode(const char* value, ClockMode& mode, double& factor) {
+    if (strcmp(value, "real") == 0) {
+        mode = ClockMode::Real;
+        factor = 1.0;
+        return true;
+    }
+    if (strcmp(value, "fast") == 0) {
+        mode = ClockMode::Fast;
+        factor = 1.0;
+        return true;
+    }
+    char* end = nullptr;
+    double f = strtod(value, &end);
+    if (end == value || *end != '\0' || !(f > 0)) return false;
+    mode = f == 1.0 ? ClockMode::Real : ClockMode::Scaled;
+    factor = f;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int port = WEB_SERVER_PORT;
+    int workers = (int)std::thread::hardware_concurrency();
+    if (workers < 2) workers = 2;
+    if (workers > 8) workers = 8;
+    bool senseAll = false;
+    std::string auditFile = "sim_audit.bin";
+    std::string wifiCache = "sim_wifi.bin";
+    std::string scheduleFile = "sim_schedules.bin";
+    std::vector<uint16_t> wolPorts;
+    bool wolPortsGiven = false;
+    int udpPort = UDP_COMMAND_PORT;
+    std::string udpKey = UDP_COMMAND_KEY;
+    ClockMode clockMode = ClockMode::Real;
+    double clockFactor = 1.0;
+    // 資源の制約。-1 は --device-limits の値（なければ制限なし）のまま
+    bool deviceLimitsPreset = false;
+    long maxSockets = -1, acceptBacklog = -1, heapKb = -1, handlerCostUs = -1, netLatencyMs = -1, netLossPercent = -1;
+    const char* clockEnv = getenv("SIM_CLOCK");
+    if (clockEnv && *clockEnv && !parseClockMode(clockEnv, clockMode, clockFactor)) {
+        std::cerr << "Invalid SIM_CLOCK: " << clockEnv << std::endl;
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (arg == "--workers" && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (arg == "--sense-all") {
+            senseAll = true;
+        } else if (arg == "--sense-delay-ms" && i + 1 < argc) {
+            hosts.setDelay((uint32_t)atoi(argv[++i]));
+        } else if (arg == "--clock" && i + 1 < argc && parseClockMode(argv[i + 1], clockMode, clockFactor)) {
+            i++;
+        } else if (arg == "--wol-port" && i + 1 < argc) {
+            // 複数指定できる。0 なら受信しない
+            int wolPort = atoi(argv[++i]);
+            wolPortsGiven = true;
+            if (wolPort > 0) wolPorts.push_back((uint16_t)wolPort);
+        } else if (arg == "--udp-port" && i + 1 < argc) {
+            udpPort = atoi(argv[++i]);
+        } else if (arg == "--udp-key" && i + 1 < argc) {
+            udpKey = argv[++i];
+        } else if (arg == "--audit-file" && i + 1 < argc) {
+            auditFile = argv[++i];
+        } else if (arg == "--plan-probe" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode != "model" && mode != "tcp") {
+                std::cerr << "--plan-probe must be model or tcp" << std::endl;
+                return 1;
+            }
+            planProbeTcp = mode == "tcp";
+        } else if (arg == "--schedule-file" && i + 1 < argc) {
+            // 空文字列なら保存しない
+            scheduleFile = argv[++i];
+        } else if (arg == "--clock-drift-ppm" && i + 1 < argc) {
+            clockDriftPpm = atof(argv[++i]);
+            if (clockDriftPpm <= -500 || clockDriftPpm >= 500) {
+                std::cerr << "--clock-drift-ppm must be between -500 and 500" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--device-limits") {
+            deviceLimitsPreset = true;
+        } else if (arg == "--max-sockets" && i + 1 < argc) {
+            maxSockets = atol(argv[++i]);
+        } else if (arg == "--accept-backlog" && i + 1 < argc) {
+            acceptBacklog = atol(argv[++i]);
+        } else if (arg == "--heap-kb" && i + 1 < argc) {
+            heapKb = atol(argv[++i]);
+        } else if (arg == "--handler-cost-us" && i + 1 < argc) {
+            handlerCostUs = atol(argv[++i]);
+        } else if (arg == "--net-latency-ms" && i + 1 < argc) {
+            netLatencyMs = atol(argv[++i]);
+        } else if (arg == "--net-loss" && i + 1 < argc) {
+            netLossPercent = atol(argv[++i]);
+            if (netLossPercent < 0 || netLossPercent > 99) {
+                std::cerr << "--net-loss must be between 0 and 99 (percent)" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--i2c-nack" && i + 1 < argc) {
+            long percent = atol(argv[++i]);
+            if (percent < 0 || percent > 99) {
+                std::cerr << "--i2c-nack must be between 0 and 99 (percent)" << std::endl;
+                return 1;
+            }
+            i2cBus.setNackPercent((uint32_t)percent);
+        } else if (arg == "--wifi-cache" && i + 1 < argc) {
+            // 空文字列なら保存しない（毎回コールドブート）
+            wifiCache = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--port N] [--workers N] [--sense-all] [--sense-delay-ms N]"
+                      << " [--clock real|fast|FACTOR] [--audit-file PATH] [--wifi-cache PATH]"
+                      << " [--plan-probe model|tcp] [--schedule-file PATH] [--clock-drift-ppm N]"
+                      << " [--device-limits] [--max-sockets N] [--accept-backlog N] [--heap-kb N]"
+                      << " [--handler-cost-us N] [--net-latency-ms N] [--net-loss PCT] [--i2c-nack PCT]"
+                      << " [--wol-port N]... [--udp-port N] [--udp-key KEY]" << std::endl;
+            return 1;
+        }
+    }
+
+    timers.setClock(clockMode, clockFactor);
+
+    if (deviceLimitsPreset) deviceLimits.setEsp32Defaults();
+    if (maxSockets >= 0) deviceLimits.maxSockets = (int)maxSockets;
+    if (acceptBacklog >= 0) deviceLimits.acceptBacklog = (int)acceptBacklog;
+    if (heapKb >= 0) deviceLimits.heapBytes = (size_t)heapKb * 1024;
+    if (handlerCostUs >= 0) deviceLimits.handlerCostUs = (uint32_t)handlerCostUs;
+    if (netLatencyMs >= 0) deviceLimits.latencyMs = (uint32_t)netLatencyMs;
+    if (netLossPercent >= 0) deviceLimits.lossPercent = (uint32_t)netLossPercent;
+    // 実機の async_tcp タスクと同じく、受信・ハンドラ・送信を1本のスレッドで順に動かす
+    if (deviceLimits.enabled()) workers = 1;
+
     std::cout << "\n=================================" << std::endl;
     std::cout << "ESP32 HTTP Server Simulator" << std::endl;
     std::cout << "Platform: macOS ARM64 (Docker)" << std::endl;
     std::cout << "=================================\n" << std::endl;
     
-    // ソケット作成
-    int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverSocket < 0) {
-        std::cerr << "Error creating socket" << std::endl;
+    HttpServer server(handleRequest);
+    eventServer = &server;
+    traceBuffer.setEnabled(TRACE_ENABLED_AT_BOOT);
+    server.setPhaseHook([](HttpServer::Phase phase, bool begin) {
+        traceBuffer.record(phase == HttpServer::Phase::Parse ? TracePoint::HttpParse : TracePoint::HttpSend,
+                           begin ? TracePhase::Begin : TracePhase::End);
+    });
+    if (deviceLimits.enabled()) server.setLimits(&deviceLimits);
+    if (!server.listen((uint16_t)port, deviceLimits.acceptBacklog > 0 ? deviceLimits.acceptBacklog : 128)) {
+        std::cerr << "Error binding socket: " << strerror(errno) << std::endl;
         return 1;
     }
     
-    // SO_REUSEADDRオプションを設定
-    int opt = 1;
-    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-    
-    // アドレス設定
-    struct sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = INADDR_ANY;
-    serverAddr.sin_port = htons(WEB_SERVER_PORT);
-    
-    // バインド
-    if (bind(serverSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
-        std::cerr << "Error binding socket" << std::endl;
-        close(serverSocket);
-        return 1;
+    if (OUTPUT_MAP.usesExpanders() && !channelDriver.begin()) {
+        std::cout << "[WARN] I/O expander not responding, will retry on first press" << std::endl;
     }
-    
-    // リッスン
-    if (listen(serverSocket, 10) < 0) {
-        std::cerr << "Error listening" << std::endl;
-        close(serverSocket);
-        return 1;
-    }
-    
     std::cout << "[INFO] Photocouplers initialized (simulated)" << std::endl;
-    std::cout << "[INFO] Web server started on port " << WEB_SERVER_PORT << std::endl;
-    std::cout << "[INFO] Access: http://localhost:" << WEB_SERVER_PORT << std::endl;
-    std::cout << "\n[INFO] System ready! Waiting for connections...\n" << std::endl;
-    
-    // 接続を受け付ける
-    while (true) {
-        struct sockaddr_in clientAddr;
-        socklen_t clientLen = sizeof(clientAddr);
-        int clientSocket = accept(serverSocket, (struct sockaddr*)&clientAddr, &clientLen);
-        
-        if (clientSocket < 0) {
-            std::cerr << "Error accepting connection" << std::endl;
-            continue;
-        }
-        
-        // リクエストを読み取る
-        char buffer[4096] = {0};
-        read(clientSocket, buffer, sizeof(buffer));
-        std::string request(buffer);
-        
-        // 別スレッドでリクエストを処理
-        std::thread([clientSocket, request]() {
-            handleRequest(clientSocket, request);
-            close(clientSocket);
-        }).detach();
+    if (deviceLimits.enabled()) {
+        std::cout << "[INFO] Device limits: " << deviceLimits.maxSockets << " sockets, backlog "
+                  << deviceLimits.acceptBacklog << ", heap " << deviceLimits.heapBytes / 1024 << " KB, "
+                  << deviceLimits.handlerCostUs << " us/request, latency " << deviceLimits.latencyMs << " ms, loss "
+                  << deviceLimits.lossPercent << "% (1 worker)" << std::endl;
+    }
+    if (clockMode != ClockMode::Real) {
+        std::cout << "[INFO] Simulated clock: "
+                  << (clockMode == ClockMode::Fast ? "fast (virtual time)" : std::to_string(clockFactor) + "x") << std::endl;
+    }
+    if (!auditStorage.open(auditFile.c_str(), SimAuditLog::FILE_BYTES)) {
+        std::cerr << "[WARN] Cannot open audit log " << auditFile << ": " << strerror(errno) << std::endl;
     }
+    auditLog.begin();
+    std::thread(auditWriterLoop).detach();
+    std::cout << "[INFO] Audit log: " << auditFile << " (boot " << auditLog.boot() << ", next seq "
+              << auditLog.nextSeq() << ")" << std::endl;
+    initPowerSense(senseAll);
+    wifiStore.setPath(wifiCache);
+    {
+        std::lock_guard<std::mutex> lock(wifiMutex);
+        wifi.begin((uint32_t)(timers.nowUs() / 1000));
+        pollWifiLocked();
+    }
+    std::cout << "[INFO] Connecting to WiFi (simulated, lease cache: "
+              << (wifiCache.empty() ? "none" : wifiCache) << ")" << std::endl;
+
+    // 予約運転（起動時のホストの時刻を模擬のNTPサーバの時刻にする）
+    ntpBaseUnixUs = (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count() - (int64_t)timers.nowUs();
+    scheduleStore.setPath(scheduleFile);
+    {
+        std::lock_guard<std::mutex> lock(scheduleMutex);
+        scheduler.begin();
+        clockSyncRunning = true;
+    }
+    // 最初の同期もタイマーのスレッドで行う（--clock fast で、次の同期を登録する前に時計が予約の時刻まで進まないように）
+    timers.schedule(0, syncScheduleClockPeriodically);
+    std::cout << "[INFO] Schedules: " << (scheduleFile.empty() ? "not saved" : scheduleFile) << std::endl;
+
+    // 実機と同じくUDPポート7と9で受ける（特権ポートなので、権限がなければ --wol-port で変える）
+    if (!wolPortsGiven) wolPorts = {7, 9};
+    static UdpListener wolListener([](const uint8_t* data, size_t len, uint32_t client, uint16_t remotePort,
+                                      uint8_t*, size_t) {
+        handleMagicPacket(data, len, client, remotePort);
+        return (size_t)0;
+    });
+    for (uint16_t wolPort : wolPorts) {
+        if (wolListener.listen(wolPort)) {
+            std::cout << "[INFO] Wake-on-LAN listening on UDP port " << wolPort << std::endl;
+        } else {
+            std::cerr << "[WARN] Cannot listen for Wake-on-LAN on UDP port " << wolPort << ": "
+                      << strerror(errno) << std::endl;
+        }
+    }
+    // 鍵が空ならUDP制御は無効
+    static HmacSha256 udpHmac(udpKey.data(), udpKey.size());
+    static UdpListener udpListener([](const uint8_t* data, size_t len, uint32_t client, uint16_t,
+                                      uint8_t* reply, size_t cap) {
+        return handleUdpCommand(udpHmac, data, len, client, reply, cap);
+    });
+    if (!udpKey.empty() && udpPort > 0) {
+        if (udpListener.listen((uint16_t)udpPort)) {
+            std::cout << "[INFO] UDP command protocol listening on UDP port " << udpPort << std::endl;
+        } else {
+            std::cerr << "[WARN] Cannot listen for UDP commands on port " << udpPort << ": "
+                      << strerror(errno) << std::endl;
+        }
+    }
+    std::thread(commandWorkerLoop).detach();
+    std::cout << "[INFO] Web server started on port " << port << " (" << workers << " workers)" << std::endl;
+    std::cout << "[INFO] Access: http://localhost:" << port << std::endl;
+    std::cout << "\n[INFO] System ready! Waiting for connections...\n" << std::endl;
     
-    close(serverSocket);
+    server.run(workers);
     return 0;
 }
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "wifi_connection.h"
+
+// シミュレータ用のWiFiドライバ（shared/wifi_connection.h の Driver）
+//
+// 接続にかかる時間を段階ごとに模擬する：スキャン（全チャンネル）→ 認証・アソシエーション → DHCP。
+// 保存したリースで始めた接続はスキャンを省き、reuseIp ならDHCPも省く。リースのBSSIDかチャンネルが
+// 今のAPと違えば（APの入れ替え・チャンネル変更）その接続はつながらない。
+// drop() でリンクを切り、APを downMs の間止める。止まっている間に始めた接続はAPが戻ってからつながる。
+//
+// Clock::nowUs() は起動からのマイクロ秒。スレッドセーフではないので呼び出し側で直列化する。
+template <typename Clock>
+class FakeWifiDriver {
+public:
+    struct Timing {
+        uint32_t scanMs = 2500;
+        uint32_t assocMs = 150;
+        uint32_t dhcpMs = 1200;
+    };
+
+    explicit FakeWifiDriver(bool reuseIp, const Timing& timing = Timing()) : reuseIp_(reuseIp), timing_(timing) {}
+
+    void begin(const WifiLease* lease) {
+        link_ = false;
+        attempting_ = true;
+        fast_ = lease != nullptr;
+        matches_ = !lease || (lease->channel == channel_ && memcmp(lease->bssid, BSSID, sizeof(BSSID)) == 0);
+        readyAtMs_ = completionMs(nowMs());
+    }
+
+    bool connected() {
+        if (!link_ && attempting_ && matches_ && (int32_t)(nowMs() - readyAtMs_) >= 0) {
+            link_ = true;
+            attempting_ = false;
+        }
+        return link_;
+    }
+
+    bool readLease(WifiLease& lease) {
+        if (!link_) return false;
+        memcpy(lease.bssid, BSSID, sizeof(BSSID));
+        lease.channel = channel_;
+        lease.ip = 0xC0A80132;       // 192.168.1.50
+        lease.gateway = 0xC0A80101;  // 192.168.1.1
+        lease.subnet = 0xFFFFFF00;
+        lease.dns = 0xC0A80101;
+        return true;
+    }
+
+    void stop() {
+        link_ = false;
+        attempting_ = false;
+    }
+
+    // 接続中の試行がつながるまでの時間（つながらない・試行していなければ0）
+    uint32_t msUntilReady() const {
+        if (!attempting_ || !matches_) return 0;
+        int32_t left = (int32_t)(readyAtMs_ - nowMs());
+        return left > 0 ? (uint32_t)left : 1;
+    }
+
+    // リンクを切り、APを downMs の間止める。channel が 0 でなければAPのチャンネルを変える
+    void drop(uint32_t downMs, uint8_t channel) {
+        uint32_t now = nowMs();
+        link_ = false;
+        apUpAtMs_ = now + downMs;
+        if (channel != 0 && channel != channel_) {
+            channel_ = channel;
+            if (fast_) matches_ = false;
+        }
+        if (attempting_) readyAtMs_ = completionMs(now);
+    }
+
+    uint8_t channel() const { return channel_; }
+
+    uint32_t apDownForMs() const {
+        int32_t left = (int32_t)(apUpAtMs_ - nowMs());
+        return left > 0 ? (uint32_t)left : 0;
+    }
+
+    const Timing& timing() const { return timing_; }
+
+private:
+    static constexpr uint8_t BSSID[6] = {0x02, 0x57, 0x4F, 0x4C, 0x41, 0x50};
+
+    static uint32_t nowMs() { return (uint32_t)(Clock::nowUs() / 1000); }
+
+    // now に始めた（またはAPが戻るのを待っている）試行がつながる時刻
+    uint32_t completionMs(uint32_t now) const {
+        uint32_t start = (int32_t)(apUpAtMs_ - now) > 0 ? apUpAtMs_ : now;
+        uint32_t at = start + timing_.assocMs;
+        if (!fast_) at += timing_.scanMs;
+        if (!fast_ || !reuseIp_) at += timing_.dhcpMs;
+        return at;
+    }
+
+    bool reuseIp_;
+    Timing timing_;
+    uint8_t channel_ = 6;
+    uint32_t apUpAtMs_ = 0;
+    bool link_ = false;
+    bool attempting_ = false;
+    bool fast_ = false;
+    bool matches_ = false;
+    uint32_t readyAtMs_ = 0;
+};
+
+// リースの保存先（実機のNVSの代わりのファイル。path が空なら保存しない＝毎回コールドブート）
+class FileWifiStore {
+public:
+    explicit FileWifiStore(const std::string& path = std::string()) : path_(path) {}
+
+    void setPath(const std::string& path) { path_ = path; }
+
+    bool load(WifiLease& lease) {
+        if (path_.empty()) return false;
+        FILE* file = fopen(path_.c_str(), "rb");
+        if (!file) return false;
+        bool ok = fread(&lease, sizeof(lease), 1, file) == 1;
+        fclose(file);
+        return ok;
+    }
+
+    void save(const WifiLease& lease) {
+        if (path_.empty()) return;
+        FILE* file = fopen(path_.c_str(), "wb");
+        if (!file) return;
+        fwrite(&lease, sizeof(lease), 1, file);
+        fclose(file);
+    }
+
+private:
+    std::string path_;
+};
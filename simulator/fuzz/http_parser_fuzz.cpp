@@ -0,0 +1,240 @@
+// simulator/http_parser.h のファズハーネス
+//
+// 入力をパイプライン化されたリクエストの並びとして次の2通りで解析し、結果が一致することを確かめる。
+//   一括    : 全体を一度に渡す
+//   分割    : 入力の先頭バイトで決めた大きさ（1〜16バイト）ずつ受信したように、伸びるバッファで渡す
+// あわせて、ビューが受信バッファの中を指すこと、consumed が正でバッファを超えないこと、
+// 本文の長さが Content-Length と一致すること、エラーのステータスが想定内であることを確かめる。
+// 違反したら abort() する（サニタイザ・libFuzzer が入力を保存する）。
+//
+// libFuzzer（clang）:
+//   clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address,undefined -DUSE_LIBFUZZER -I./simulator
+//       -o http_parser_fuzz simulator/fuzz/http_parser_fuzz.cpp
+//   ./http_parser_fuzz -max_len=4096
+// 単体（g++。シードを変異させて回す。ファイルを渡すとその入力だけを試す）:
+//   g++ -std=c++17 -g -O1 -fsanitize=address,undefined -I./simulator
+//       -o http_parser_fuzz simulator/fuzz/http_parser_fuzz.cpp
+//   ./http_parser_fuzz [iterations] | ./http_parser_fuzz crash-file...
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "http_parser.h"
+
+namespace {
+
+// 比較用に1件分の結果をバッファからの位置で持つ
+struct Parsed {
+    HttpParseStatus status;
+    int error;
+    size_t consumed;
+    std::string method, path, query, version, body;
+    size_t headerCount;
+    bool keepAlive;
+
+    bool operator==(const Parsed& o) const {
+        return status == o.status && error == o.error && consumed == o.consumed && method == o.method &&
+               path == o.path && query == o.query && version == o.version && body == o.body &&
+               headerCount == o.headerCount && keepAlive == o.keepAlive;
+    }
+};
+
+void check(bool ok, const char* what) {
+    if (!ok) {
+        fprintf(stderr, "invariant violated: %s\n", what);
+        abort();
+    }
+}
+
+bool within(std::string_view outer, std::string_view inner) {
+    if (inner.empty()) return true;
+    return inner.data() >= outer.data() && inner.data() + inner.size() <= outer.data() + outer.size();
+}
+
+Parsed record(HttpParseStatus status, const HttpRequestParser& parser, const HttpRequest& request,
+              std::string_view in, size_t consumed) {
+    Parsed p = {};
+    p.status = status;
+    p.error = status == HttpParseStatus::Error ? parser.errorStatus() : 0;
+    if (status != HttpParseStatus::Complete) return p;
+
+    check(consumed > 0 && consumed <= in.size(), "consumed out of range");
+    std::string_view mine = in.substr(0, consumed);
+    check(within(mine, request.method) && within(mine, request.path) && within(mine, request.query) &&
+              within(mine, request.version) && within(mine, request.body),
+          "view outside the request");
+    check(request.headerCount <= HTTP_MAX_HEADERS, "too many headers");
+    for (size_t i = 0; i < request.headerCount; i++) {
+        check(within(mine, request.headers[i].name) && within(mine, request.headers[i].value),
+              "header outside the request");
+        check(!request.headers[i].name.empty(), "empty header name");
+    }
+    check(!request.method.empty() && !request.path.empty(), "empty method or path");
+    check(request.body.size() <= HttpRequestParser::MAX_BODY_BYTES, "body over the limit");
+    std::string_view length = request.header("Content-Length");
+    uint64_t declared = length.empty() ? 0 : strtoull(std::string(length).c_str(), nullptr, 10);
+    check(declared == request.body.size(), "body length differs from Content-Length");
+
+    p.consumed = consumed;
+    p.method.assign(request.method);
+    p.path.assign(request.path);
+    p.query.assign(request.query);
+    p.version.assign(request.version);
+    p.body.assign(request.body);
+    p.headerCount = request.headerCount;
+    p.keepAlive = request.keepAlive;
+    return p;
+}
+
+// 全体を一度に渡す（HttpServer と同じく、Complete のたびに次のリクエストの先頭から）
+std::vector<Parsed> parseWhole(std::string_view in) {
+    std::vector<Parsed> out;
+    HttpRequestParser parser;
+    size_t offset = 0;
+    while (true) {
+        HttpRequest request;
+        size_t consumed = 0;
+        std::string_view rest = in.substr(offset);
+        HttpParseStatus status = parser.parse(rest, request, consumed);
+        out.push_back(record(status, parser, request, rest, consumed));
+        if (status != HttpParseStatus::Complete) break;
+        offset += consumed;
+    }
+    return out;
+}
+
+// step バイトずつ受信したように渡す（受信バッファは伸びるときに移動する）
+std::vector<Parsed> parseSplit(std::string_view in, size_t step) {
+    std::vector<Parsed> out;
+    HttpRequestParser parser;
+    std::string buffer;
+    size_t fed = 0;
+    while (true) {
+        HttpRequest request;
+        size_t consumed = 0;
+        HttpParseStatus status = parser.parse(buffer, request, consumed);
+        if (status == HttpParseStatus::Incomplete && fed < in.size()) {
+            size_t n = std::min(step, in.size() - fed);
+            buffer.append(in.data() + fed, n);
+            fed += n;
+            continue;
+        }
+        out.push_back(record(status, parser, request, buffer, consumed));
+        if (status != HttpParseStatus::Complete) break;
+        buffer.erase(0, consumed);
+    }
+    return out;
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    std::string_view in((const char*)data, size);
+    std::vector<Parsed> whole = parseWhole(in);
+    size_t step = size > 0 ? (size_t)(data[0] % 16) + 1 : 1;
+    std::vector<Parsed> split = parseSplit(in, step);
+    check(whole.size() == split.size(), "request count differs when split");
+    for (size_t i = 0; i < whole.size(); i++) check(whole[i] == split[i], "result differs when split");
+
+    const Parsed& last = whole.back();
+    if (last.status == HttpParseStatus::Error) {
+        int e = last.error;
+        check(e == 400 || e == 413 || e == 431 || e == 501 || e == 505, "unexpected error status");
+    }
+    return 0;
+}
+
+#ifndef USE_LIBFUZZER
+
+namespace {
+
+const char* const SEEDS[] = {
+    "GET / HTTP/1.1\r\nHost: esp32\r\n\r\n",
+    "GET /api/status HTTP/1.1\r\nHost: x\r\nConnection: keep-alive\r\n\r\nGET /api/info HTTP/1.0\r\n\r\n",
+    "POST /api/power/batch HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 12\r\n\r\nchannels=0,1",
+    "POST /api/power/3?x=1 HTTP/1.1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+    "DELETE /api/plan/cluster HTTP/1.1\r\nIf-None-Match: \"abc\"\r\n\r\n",
+    "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n",
+    "GET / HTTP/2.0\r\n\r\n",
+    "GET / HTTP/1.1\r\n folded: x\r\n\r\n",
+};
+
+const char* const TOKENS[] = {"\r\n", "\r\n\r\n", ":", " ", "Content-Length: ", "Connection: close",
+                              "Transfer-Encoding", "HTTP/1.1", "HTTP/1.0", "?", "\t", "99999999999999999999"};
+
+std::string mutate(std::mt19937& rng, const std::string& seed) {
+    std::string s = seed;
+    int rounds = 1 + (int)(rng() % 8);
+    for (int r = 0; r < rounds; r++) {
+        size_t pos = s.empty() ? 0 : rng() % (s.size() + 1);
+        switch (rng() % 6) {
+            case 0:  // 1バイト書き換え
+                if (!s.empty()) s[pos % s.size()] = (char)(rng() & 0xFF);
+                break;
+            case 1:  // 削除
+                if (!s.empty()) s.erase(pos % s.size(), 1 + rng() % 8);
+                break;
+            case 2:  // 字句の挿入
+                s.insert(pos, TOKENS[rng() % (sizeof(TOKENS) / sizeof(TOKENS[0]))]);
+                break;
+            case 3:  // 別のシードをつなぐ（パイプライン）
+                s += SEEDS[rng() % (sizeof(SEEDS) / sizeof(SEEDS[0]))];
+                break;
+            case 4:  // 長いヘッダー
+                s.insert(pos, std::string(rng() % 9000, 'a'));
+                break;
+            default:  // 数字の書き換え（Content-Length）
+                for (char& c : s) {
+                    if (c >= '0' && c <= '9' && rng() % 4 == 0) c = (char)('0' + rng() % 10);
+                }
+                break;
+        }
+    }
+    return s;
+}
+
+void runFile(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+    std::string data;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) data.append(buf, n);
+    fclose(file);
+    LLVMFuzzerTestOneInput((const uint8_t*)data.data(), data.size());
+    printf("%s: ok\n", path);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc > 1 && atoi(argv[1]) == 0) {
+        for (int i = 1; i < argc; i++) runFile(argv[i]);
+        return 0;
+    }
+    long iterations = argc > 1 ? atol(argv[1]) : 200000;
+    std::mt19937 rng(12345);
+    long complete = 0, errors = 0;
+    for (const char* seed : SEEDS) LLVMFuzzerTestOneInput((const uint8_t*)seed, strlen(seed));
+    for (long i = 0; i < iterations; i++) {
+        std::string input = mutate(rng, SEEDS[rng() % (sizeof(SEEDS) / sizeof(SEEDS[0]))]);
+        LLVMFuzzerTestOneInput((const uint8_t*)input.data(), input.size());
+        std::vector<Parsed> results = parseWhole(input);
+        complete += (long)results.size() - 1;
+        errors += results.back().status == HttpParseStatus::Error ? 1 : 0;
+    }
+    printf("iterations=%ld requests=%ld errors=%ld: ok\n", iterations, complete, errors);
+    return 0;
+}
+
+#endif
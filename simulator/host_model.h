@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "pulse_engine.h"
+#include "timer_service.h"
+
+// 電源ボタンの先にあるPCのモデル（電源LED入力を模擬する）
+//
+// 通常押しのパルスが終わると、delayMs 後に電源状態が反転する（起動・シャットダウンにかかる時間）。
+// 長押しは強制シャットダウンなので、パルス終了と同時にOFFになる。
+// サンプラは ledOn() を実機の digitalRead() の代わりに読む。
+// ハングしたPC（setHung）は電源LEDが点いたまま応答せず（reachable() が false）、通常押しを無視する。
+// 長押しで電源が切れるとハングも解ける。
+template <int N>
+class HostModel {
+public:
+    HostModel(TimerService& timers, uint32_t delayMs) : timers_(timers), delayMs_(delayMs) {
+        for (int i = 0; i < N; i++) {
+            powered_[i].store(false, std::memory_order_relaxed);
+            hung_[i].store(false, std::memory_order_relaxed);
+        }
+    }
+
+    void setDelay(uint32_t delayMs) { delayMs_ = delayMs; }
+
+    // パルス完了時に呼ぶ
+    void onPulseComplete(int channel, PulseKind kind) {
+        if (channel < 0 || channel >= N) return;
+        if (kind == PulseKind::Long) {
+            hung_[channel].store(false, std::memory_order_release);
+            powered_[channel].store(false, std::memory_order_release);
+            return;
+        }
+        if (hung_[channel].load(std::memory_order_acquire)) return;
+        bool target = !powered_[channel].load(std::memory_order_acquire);
+        timers_.schedule(delayMs_, [this, channel, target] {
+            powered_[channel].store(target, std::memory_order_release);
+        });
+    }
+
+    bool ledOn(int channel) const {
+        if (channel < 0 || channel >= N) return false;
+        return powered_[channel].load(std::memory_order_acquire);
+    }
+
+    bool hung(int channel) const {
+        if (channel < 0 || channel >= N) return false;
+        return hung_[channel].load(std::memory_order_acquire);
+    }
+
+    // 電源が入っていて応答する（電源状態のTCP確認の代わり）
+    bool reachable(int channel) const { return ledOn(channel) && !hung(channel); }
+
+    // ハングさせる（電源が入る）・解く
+    void setHung(int channel, bool hung) {
+        if (channel < 0 || channel >= N) return;
+        if (hung) powered_[channel].store(true, std::memory_order_release);
+        hung_[channel].store(hung, std::memory_order_release);
+    }
+
+    // 手で電源を入れた・切った（切ればハングも解ける）
+    void setPowered(int channel, bool powered) {
+        if (channel < 0 || channel >= N) return;
+        if (!powered) hung_[channel].store(false, std::memory_order_release);
+        powered_[channel].store(powered, std::memory_order_release);
+    }
+
+private:
+    TimerService& timers_;
+    uint32_t delayMs_;
+    std::atomic<bool> powered_[N];
+    std::atomic<bool> hung_[N];
+};
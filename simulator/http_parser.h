@@ -0,0 +1,327 @@
+#pragma once
+
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <strings.h>
+
+// HTTP/1.1 リクエストの逐次パーサ（シミュレータとゲートウェイの HttpServer 用、確保なし）
+//
+// 接続の受信バッファ（リクエストの先頭から）を受信のたびに渡すと、前回の続きから読み進める。
+// ヘッダー部の終わり（空行）が見つかるまでは走査済みの位置だけを覚える。見つかったらリクエストラインと
+// ヘッダーを検証して先頭からのオフセットで記録する（バッファが伸びて移動しても使える）。
+// 本文が Content-Length 分揃ったら、HttpRequest の各フィールドをバッファ内を指す string_view で埋める。
+// ビューはバッファを変更するまで（ハンドラを呼び終えるまで）有効。
+//
+// 受け付けないもの（errorStatus() の応答を返して接続を閉じる）：
+//   ヘッダー部が MAX_HEADER_BYTES を超える・ヘッダーが HTTP_MAX_HEADERS 個を超える → 431
+//   Content-Length が MAX_BODY_BYTES を超える → 413（本文を待たずに返す）
+//   Transfer-Encoding（chunked 等） → 501
+//   HTTP/1.0, HTTP/1.1 以外 → 505
+//   不正なリクエストライン・ヘッダー名・Content-Length、行の折り返し、制御文字 → 400
+
+static constexpr size_t HTTP_MAX_HEADERS = 32;
+
+struct HttpHeaderField {
+    std::string_view name;
+    std::string_view value;  // 前後の空白は除いてある
+};
+
+// 受信したHTTPリクエスト（文字列は受信バッファを指す）
+struct HttpRequest {
+    std::string_view method;
+    std::string_view path;
+    std::string_view query;    // '?' 以降（なければ空）
+    std::string_view version;
+    std::string_view body;
+    HttpHeaderField headers[HTTP_MAX_HEADERS];
+    size_t headerCount = 0;
+    bool keepAlive = true;
+    uint32_t remoteAddr = 0;  // 接続元のIPv4アドレス（a<<24|b<<16|c<<8|d）
+
+    // ヘッダー値を取得（名前は大文字小文字を区別しない。なければ空）
+    std::string_view header(const char* name) const {
+        size_t nameLen = strlen(name);
+        for (size_t i = 0; i < headerCount; i++) {
+            const HttpHeaderField& field = headers[i];
+            if (field.name.size() == nameLen && strncasecmp(field.name.data(), name, nameLen) == 0) {
+                return field.value;
+            }
+        }
+        return std::string_view();
+    }
+
+    // クエリまたはフォーム本文（application/x-www-form-urlencoded）のパラメータを取得
+    // 実機の request->getParam(name) / getParam(name, true) に相当する
+    bool param(const char* name, std::string& value) const {
+        if (findParam(query, name, value)) return true;
+        std::string_view type = header("Content-Type");
+        static const char FORM[] = "application/x-www-form-urlencoded";
+        if (type.size() >= sizeof(FORM) - 1 && strncasecmp(type.data(), FORM, sizeof(FORM) - 1) == 0) {
+            return findParam(body, name, value);
+        }
+        return false;
+    }
+
+private:
+    static bool findParam(std::string_view params, const char* name, std::string& value) {
+        size_t nameLen = strlen(name);
+        size_t pos = 0;
+        while (pos < params.size()) {
+            size_t amp = params.find('&', pos);
+            if (amp == std::string_view::npos) amp = params.size();
+            size_t eq = params.find('=', pos);
+            size_t keyEnd = (eq != std::string_view::npos && eq < amp) ? eq : amp;
+            if (keyEnd - pos == nameLen && params.compare(pos, nameLen, name) == 0) {
+                value = keyEnd < amp ? urlDecode(params.substr(keyEnd + 1, amp - keyEnd - 1)) : std::string();
+                return true;
+            }
+            pos = amp + 1;
+        }
+        return false;
+    }
+
+    static int hexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        return (tolower((unsigned char)c) - 'a') + 10;
+    }
+
+    static std::string urlDecode(std::string_view s) {
+        std::string out;
+        out.reserve(s.size());
+        for (size_t i = 0; i < s.size(); i++) {
+            if (s[i] == '+') {
+                out += ' ';
+            } else if (s[i] == '%' && i + 2 < s.size() && isxdigit((unsigned char)s[i + 1]) &&
+                       isxdigit((unsigned char)s[i + 2])) {
+                out += (char)(hexValue(s[i + 1]) * 16 + hexValue(s[i + 2]));
+                i += 2;
+            } else {
+                out += s[i];
+            }
+        }
+        return out;
+    }
+};
+
+enum class HttpParseStatus : uint8_t {
+    Incomplete,  // 続きを受信してから、同じリクエストの先頭からもう一度渡す
+    Complete,    // request を埋めた。consumed バイトがこのリクエスト
+    Error        // errorStatus() を返して接続を閉じる
+};
+
+class HttpRequestParser {
+public:
+    static constexpr size_t MAX_HEADER_BYTES = 8192;  // リクエストラインと空行を含む
+    static constexpr size_t MAX_BODY_BYTES = 64 * 1024;
+
+    // in は受信済みのデータ（このリクエストの先頭から）。Complete を返したら次のリクエストの先頭から渡す
+    HttpParseStatus parse(std::string_view in, HttpRequest& request, size_t& consumed) {
+        if (error_ != 0) return HttpParseStatus::Error;
+        if (headEnd_ == 0) {
+            // 前回の走査の末尾3バイトは空行の一部かもしれないので含めて探す
+            size_t from = scanned_ > 3 ? scanned_ - 3 : 0;
+            size_t blank = in.find("\r\n\r\n", from);
+            if (blank == std::string_view::npos || blank + 4 > MAX_HEADER_BYTES) {
+                scanned_ = in.size();
+                if (in.size() < MAX_HEADER_BYTES) return HttpParseStatus::Incomplete;
+                fail(431);
+                return HttpParseStatus::Error;
+            }
+            if (!parseHead(in.substr(0, blank + 2))) return HttpParseStatus::Error;
+            headEnd_ = blank + 4;
+        }
+        if (in.size() - headEnd_ < contentLength_) return HttpParseStatus::Incomplete;
+
+        request.method = view(in, method_);
+        request.version = view(in, version_);
+        std::string_view target = view(in, target_);
+        size_t q = target.find('?');
+        request.path = target.substr(0, q);
+        request.query = q == std::string_view::npos ? std::string_view() : target.substr(q + 1);
+        for (size_t i = 0; i < headerCount_; i++) {
+            request.headers[i].name = view(in, names_[i]);
+            request.headers[i].value = view(in, values_[i]);
+        }
+        request.headerCount = headerCount_;
+        request.body = in.substr(headEnd_, contentLength_);
+        request.keepAlive = keepAlive_;
+        consumed = headEnd_ + contentLength_;
+        reset();
+        return HttpParseStatus::Complete;
+    }
+
+    // Error のときに返す応答ステータス
+    int errorStatus() const { return error_; }
+
+    void reset() {
+        scanned_ = 0;
+        headEnd_ = 0;
+        headerCount_ = 0;
+        contentLength_ = 0;
+        error_ = 0;
+    }
+
+private:
+    // ヘッダー部の中の位置（MAX_HEADER_BYTES 以下なので16ビット）
+    struct Span {
+        uint16_t offset;
+        uint16_t length;
+    };
+
+    static std::string_view view(std::string_view in, Span span) { return in.substr(span.offset, span.length); }
+
+    static Span span(size_t offset, size_t length) { return Span{(uint16_t)offset, (uint16_t)length}; }
+
+    // 文字の種類（RFC 9110 の token 文字と、リクエストターゲット・ヘッダー値に使える文字）
+    enum : uint8_t { TOKEN = 1, VISIBLE = 2, FIELD = 4 };
+
+    struct CharClasses {
+        uint8_t bits[256];
+        constexpr CharClasses() : bits() {
+            for (int c = 0x21; c < 0x7F; c++) bits[c] |= VISIBLE | FIELD;
+            for (int c = 0x80; c < 0x100; c++) bits[c] |= VISIBLE | FIELD;
+            bits[(int)' '] |= FIELD;
+            bits[(int)'\t'] |= FIELD;
+            for (int c = '0'; c <= '9'; c++) bits[c] |= TOKEN;
+            for (int c = 'a'; c <= 'z'; c++) bits[c] |= TOKEN;
+            for (int c = 'A'; c <= 'Z'; c++) bits[c] |= TOKEN;
+            const char* symbols = "!#$%&'*+-.^_`|~";
+            for (const char* p = symbols; *p; p++) bits[(int)*p] |= TOKEN;
+        }
+    };
+
+    static bool is(char c, uint8_t cls) {
+        static constexpr CharClasses CLASSES;
+        return (CLASSES.bits[(unsigned char)c] & cls) != 0;
+    }
+
+    // s がすべて cls の文字か
+    static bool all(std::string_view s, uint8_t cls) {
+        for (char c : s) {
+            if (!is(c, cls)) return false;
+        }
+        return true;
+    }
+
+    bool fail(int status) {
+        error_ = status;
+        return false;
+    }
+
+    // head はリクエストラインから最後のヘッダー行の CRLF まで
+    bool parseHead(std::string_view head) {
+        size_t eol = head.find("\r\n");
+        if (!parseRequestLine(head.substr(0, eol))) return false;
+
+        bool http10 = view(head, version_) == "HTTP/1.0";
+        bool close = false;
+        bool keepAlive = false;
+        bool haveLength = false;
+        size_t pos = eol + 2;
+        while (pos < head.size()) {
+            size_t end = head.find("\r\n", pos);
+            std::string_view line = head.substr(pos, end - pos);
+            // 行の折り返し（obs-fold）と、名前の前後の空白は受け付けない
+            size_t colon = line.find(':');
+            if (colon == 0 || colon == std::string_view::npos) return fail(400);
+            if (!all(line.substr(0, colon), TOKEN)) return fail(400);
+            size_t v = colon + 1;
+            size_t e = line.size();
+            while (v < e && (line[v] == ' ' || line[v] == '\t')) v++;
+            while (e > v && (line[e - 1] == ' ' || line[e - 1] == '\t')) e--;
+            if (!all(line.substr(v, e - v), FIELD)) return fail(400);
+            if (headerCount_ == HTTP_MAX_HEADERS) return fail(431);
+            names_[headerCount_] = span(pos, colon);
+            values_[headerCount_] = span(pos + v, e - v);
+            headerCount_++;
+
+            std::string_view name = line.substr(0, colon);
+            std::string_view value = line.substr(v, e - v);
+            if (equalsIgnoreCase(name, "Content-Length")) {
+                size_t length = 0;
+                if (!parseLength(value, length)) return false;
+                if (haveLength && length != contentLength_) return fail(400);
+                haveLength = true;
+                contentLength_ = length;
+            } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+                return fail(501);
+            } else if (equalsIgnoreCase(name, "Connection")) {
+                scanConnection(value, close, keepAlive);
+            }
+            pos = end + 2;
+        }
+        keepAlive_ = http10 ? keepAlive && !close : !close;
+        return true;
+    }
+
+    // METHOD SP request-target SP HTTP-version
+    bool parseRequestLine(std::string_view line) {
+        size_t sp1 = line.find(' ');
+        if (sp1 == 0 || sp1 == std::string_view::npos || sp1 > 16) return fail(400);
+        if (!all(line.substr(0, sp1), TOKEN)) return fail(400);
+        size_t sp2 = line.find(' ', sp1 + 1);
+        if (sp2 == std::string_view::npos || sp2 == sp1 + 1) return fail(400);
+        std::string_view target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+        if ((target[0] != '/' && target != "*") || !all(target, VISIBLE)) return fail(400);
+        std::string_view version = line.substr(sp2 + 1);
+        if (version != "HTTP/1.1" && version != "HTTP/1.0") {
+            bool http = version.size() == 8 && version.compare(0, 5, "HTTP/") == 0 && isdigit((unsigned char)version[5]) &&
+                        version[6] == '.' && isdigit((unsigned char)version[7]);
+            return fail(http ? 505 : 400);
+        }
+        method_ = span(0, sp1);
+        target_ = span(sp1 + 1, target.size());
+        version_ = span(sp2 + 1, version.size());
+        return true;
+    }
+
+    bool parseLength(std::string_view value, size_t& length) {
+        if (value.empty()) return fail(400);
+        length = 0;
+        for (char c : value) {
+            if (c < '0' || c > '9') return fail(400);
+            length = length * 10 + (size_t)(c - '0');
+            if (length > MAX_BODY_BYTES) return fail(413);
+        }
+        return true;
+    }
+
+    // Connection: の値（カンマ区切りのトークン）
+    static void scanConnection(std::string_view value, bool& close, bool& keepAlive) {
+        size_t pos = 0;
+        while (pos <= value.size()) {
+            size_t comma = value.find(',', pos);
+            if (comma == std::string_view::npos) comma = value.size();
+            size_t b = pos;
+            size_t e = comma;
+            while (b < e && (value[b] == ' ' || value[b] == '\t')) b++;
+            while (e > b && (value[e - 1] == ' ' || value[e - 1] == '\t')) e--;
+            std::string_view token = value.substr(b, e - b);
+            if (equalsIgnoreCase(token, "close")) close = true;
+            if (equalsIgnoreCase(token, "keep-alive")) keepAlive = true;
+            pos = comma + 1;
+        }
+    }
+
+    static bool equalsIgnoreCase(std::string_view a, const char* b) {
+        size_t len = strlen(b);
+        return a.size() == len && strncasecmp(a.data(), b, len) == 0;
+    }
+
+    size_t scanned_ = 0;  // 空行を探し終えた位置
+    size_t headEnd_ = 0;  // 空行の次（0ならヘッダー部が未完）
+    Span method_ = {};
+    Span target_ = {};
+    Span version_ = {};
+    Span names_[HTTP_MAX_HEADERS] = {};
+    Span values_[HTTP_MAX_HEADERS] = {};
+    size_t headerCount_ = 0;
+    size_t contentLength_ = 0;
+    bool keepAlive_ = true;
+    int error_ = 0;
+};
@@ -0,0 +1,746 @@
+#pragma once
+
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "device_limits.h"
+#include "http_parser.h"
+
+struct HttpResponse;
+
+// 保留した応答を返す関数（任意のスレッドから1回だけ呼ぶ）
+using HttpReply = std::function<void(HttpResponse)>;
+
+// ハンドラが返すHTTPレスポンス
+struct HttpResponse {
+    int status = 200;
+    std::string contentType;
+    std::string body;
+    std::string extraHeaders;  // "Name: value\r\n" の連結
+
+    // 静的データ（埋め込みWeb UI等）をコピーせずに送る場合に設定する
+    const uint8_t* staticBody = nullptr;
+    size_t staticBodyLen = 0;
+
+    // trueならServer-Sent Eventsのストリームとして接続を保持し、bodyを最初のイベントとして送る
+    bool eventStream = false;
+
+    // 設定されていれば応答を保留し、I/Oスレッドからこれを呼ぶ。ブロックする処理は別のスレッドへ渡し、
+    // 終わったら渡された HttpReply で応答する（その接続の後続のリクエストはそれまで処理しない）。
+    // リクエストは呼び出しの後に無効になるので、必要な値はコピーして持っていくこと
+    std::function<void(HttpReply)> deferred;
+
+    size_t bodySize() const { return staticBody ? staticBodyLen : body.size(); }
+};
+
+inline const char* httpStatusText(int statusCode) {
+    switch (statusCode) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 406: return "Not Acceptable";
+        case 409: return "Conflict";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        case 505: return "HTTP Version Not Supported";
+        default:  return "Error";
+    }
+}
+
+// epollベースのHTTP/1.1サーバ
+//
+// 固定数のI/Oワーカーがそれぞれepollインスタンスを持ち、リスニングソケットを
+// EPOLLEXCLUSIVEで共有して接続を受け付ける。接続は受け付けたワーカーが最後まで担当する。
+// Keep-Alive、パイプライン化されたリクエスト、部分的な読み書きに対応する（解析と上限は http_parser.h）。
+// ハンドラはI/Oスレッド上で実行されるので、ブロックする処理（電源パルス等）は
+// 別のエグゼキュータ（TimerService）へ渡すこと。応答を待たせる場合は deferred を返す。
+// eventStream を返した接続はSSE購読者になり、broadcast() の内容が全購読者へ送られる。
+// setLimits() で実機の資源の制約（device_limits.h）を課せる。
+class HttpServer {
+public:
+    using Handler = std::function<HttpResponse(const HttpRequest&)>;
+
+    // トレース用のフック。リクエストの解析と応答の送信の前後に I/O スレッドから呼ぶ（nullptr なら呼ばない）
+    enum class Phase : uint8_t { Parse, Send };
+    using PhaseHook = void (*)(Phase phase, bool begin);
+
+    static constexpr int IDLE_TIMEOUT_SEC = 60;
+    static constexpr int STREAM_PING_SEC = 15;
+    static constexpr size_t MAX_STREAM_BACKLOG = 1024 * 1024;
+
+    explicit HttpServer(Handler handler) : handler_(std::move(handler)) {}
+
+    ~HttpServer() {
+        if (listenFd_ >= 0) close(listenFd_);
+    }
+
+    bool listen(uint16_t port, int backlog) {
+        listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd_ < 0) return false;
+
+        int opt = 1;
+        setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(port);
+
+        if (bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr)) < 0) return false;
+        if (::listen(listenFd_, backlog) < 0) return false;
+        return true;
+    }
+
+    // run() の前に設定する
+    void setPhaseHook(PhaseHook hook) { phaseHook_ = hook; }
+    void setLimits(DeviceLimits* limits) { limits_ = limits; }
+
+    // ワーカーを起動してブロックする
+    void run(int workerCount) {
+        if (workerCount < 1) workerCount = 1;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < workerCount; i++) {
+            threads.emplace_back([this] { Worker(*this).loop(); });
+        }
+        for (auto& t : threads) t.join();
+    }
+
+    // 全SSE購読者へ送る（任意のスレッドから呼べる）
+    void broadcast(const std::string& data) {
+        std::shared_ptr<const std::string> message = std::make_shared<const std::string>(data);
+        std::lock_guard<std::mutex> lock(workersMutex_);
+        for (Worker* worker : workers_) worker->post(message);
+    }
+
+private:
+    // 送信待ちデータ。ownedが空でなければそれを、空ならexternalを送る
+    struct OutSegment {
+        std::string owned;
+        const uint8_t* external = nullptr;
+        size_t externalLen = 0;
+        size_t offset = 0;
+
+        const char* data() const {
+            return external ? (const char*)external : owned.data();
+        }
+        size_t size() const { return external ? externalLen : owned.size(); }
+    };
+
+    struct Connection {
+        int fd;
+        uint64_t id = 0;  // fd は再利用されるので、保留した応答の宛先はこれで確かめる
+        std::string in;  // 未処理の受信データ（先頭は処理中のリクエストの先頭）
+        HttpRequestParser parser;
+        std::deque<OutSegment> out;
+        bool closeAfterWrite = false;
+        bool wantWrite = false;
+        bool streaming = false;
+        bool awaiting = false;         // 保留した応答（deferred）を待っている
+        bool awaitingKeepAlive = true;
+        bool peerClosed = false;       // 相手が送信を終えた（保留中の応答を返してから閉じる）
+        uint32_t remoteAddr = 0;
+        std::chrono::steady_clock::time_point lastActive;
+        std::chrono::steady_clock::time_point sendAt;  // これより前は送らない（limits の遅延）
+        size_t heapCharged = 0;                          // limits のヒープに数えている量
+    };
+
+    class Worker {
+    public:
+        explicit Worker(HttpServer& server) : server_(server) {
+            epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+            ev.data.fd = server_.listenFd_;
+            epoll_ctl(epollFd_, EPOLL_CTL_ADD, server_.listenFd_, &ev);
+
+            // broadcast() からの通知用
+            eventFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.fd = eventFd_;
+            epoll_ctl(epollFd_, EPOLL_CTL_ADD, eventFd_, &ev);
+
+            std::lock_guard<std::mutex> lock(server_.workersMutex_);
+            server_.workers_.push_back(this);
+        }
+
+        ~Worker() {
+            {
+                std::lock_guard<std::mutex> lock(server_.workersMutex_);
+                for (size_t i = 0; i < server_.workers_.size(); i++) {
+                    if (server_.workers_[i] == this) {
+                        server_.workers_.erase(server_.workers_.begin() + (long)i);
+                        break;
+                    }
+                }
+            }
+            for (auto& entry : conns_) close(entry.first);
+            close(eventFd_);
+            close(epollFd_);
+        }
+
+        void post(const std::shared_ptr<const std::string>& message) {
+            {
+                std::lock_guard<std::mutex> lock(mailboxMutex_);
+                mailbox_.push_back(message);
+            }
+            wake();
+        }
+
+        // 保留した応答を届ける（任意のスレッドから）
+        void postReply(int fd, uint64_t id, HttpResponse response) {
+            {
+                std::lock_guard<std::mutex> lock(mailboxMutex_);
+                replies_.push_back(Reply{fd, id, std::move(response)});
+            }
+            wake();
+        }
+
+        void loop() {
+            struct epoll_event events[64];
+            auto lastSweep = std::chrono::steady_clock::now();
+            while (true) {
+                if (acceptPaused_ && !server_.limits_->socketsFull()) setAccepting(true);
+                int n = epoll_wait(epollFd_, events, 64, delayedTimeoutMs());
+                if (n < 0 && errno != EINTR) {
+                    std::cerr << "[ERROR] epoll_wait: " << strerror(errno) << std::endl;
+                    return;
+                }
+                for (int i = 0; i < n; i++) {
+                    int fd = events[i].data.fd;
+                    if (fd == server_.listenFd_) {
+                        acceptAll();
+                        continue;
+                    }
+                    if (fd == eventFd_) {
+                        uint64_t count;
+                        ssize_t ignored = read(eventFd_, &count, sizeof(count));
+                        (void)ignored;
+                        deliverReplies();
+                        deliverBroadcasts();
+                        continue;
+                    }
+                    auto it = conns_.find(fd);
+                    if (it == conns_.end()) continue;
+                    Connection& conn = *it->second;
+                    if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                        closeConnection(fd);
+                        continue;
+                    }
+                    if ((events[i].events & EPOLLIN) && !onReadable(conn)) {
+                        closeConnection(fd);
+                        continue;
+                    }
+                    bool sending = server_.phaseHook_ && !conn.streaming && !conn.out.empty();
+                    if (sending) server_.phaseHook_(Phase::Send, true);
+                    bool ok = flush(conn);
+                    if (sending) server_.phaseHook_(Phase::Send, false);
+                    if (!ok) {
+                        closeConnection(fd);
+                    } else {
+                        updateHeap(conn, true);
+                    }
+                }
+                if (!delayed_.empty()) flushDelayed();
+
+                auto now = std::chrono::steady_clock::now();
+                if (now - lastSweep >= std::chrono::seconds(1)) {
+                    sweepIdle(now);
+                    lastSweep = now;
+                }
+            }
+        }
+
+    private:
+        struct Reply {
+            int fd;
+            uint64_t id;
+            HttpResponse response;
+        };
+
+        void wake() {
+            uint64_t one = 1;
+            ssize_t ignored = write(eventFd_, &one, sizeof(one));
+            (void)ignored;
+        }
+
+        void acceptAll() {
+            DeviceLimits* limits = server_.limits_;
+            while (true) {
+                // 満杯なら受け付けを止め、新しい接続は listen() のバックログで待たせる
+                if (limits && limits->socketsFull()) {
+                    setAccepting(false);
+                    return;
+                }
+                struct sockaddr_in peer;
+                socklen_t peerLen = sizeof(peer);
+                int fd = accept4(server_.listenFd_, (struct sockaddr*)&peer, &peerLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                        std::cerr << "Error accepting connection" << std::endl;
+                    }
+                    return;
+                }
+                if (limits && !limits->reserve(limits->socketBytes)) {
+                    limits->heapRejects++;
+                    close(fd);
+                    continue;
+                }
+                if (limits) limits->socketOpened();
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+                std::unique_ptr<Connection> conn(new Connection());
+                conn->fd = fd;
+                conn->id = ++nextConnId_;
+                conn->remoteAddr = peer.sin_family == AF_INET ? ntohl(peer.sin_addr.s_addr) : 0;
+                conn->lastActive = std::chrono::steady_clock::now();
+                conn->heapCharged = limits ? limits->socketBytes : 0;
+
+                struct epoll_event ev;
+                memset(&ev, 0, sizeof(ev));
+                ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+                ev.data.fd = fd;
+                epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+                conns_[fd] = std::move(conn);
+            }
+        }
+
+        // 読めるだけ読み、揃ったリクエストを受信のたびに処理する（受信バッファは最大のリクエスト程度に収まる）
+        bool onReadable(Connection& conn) {
+            char buf[16384];
+            bool peerClosed = false;
+            while (true) {
+                ssize_t n = read(conn.fd, buf, sizeof(buf));
+                if (n > 0) {
+                    // エラーを返した接続とSSE購読中の接続に届いたデータは読み捨てる
+                    if (conn.closeAfterWrite || conn.streaming) continue;
+                    conn.in.append(buf, (size_t)n);
+                    if (!updateHeap(conn, false)) {
+                        rejectForHeap(conn);
+                        continue;
+                    }
+                    processRequests(conn);
+                    continue;
+                }
+                if (n == 0) {
+                    peerClosed = true;
+                    break;
+                }
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return false;
+            }
+            conn.lastActive = std::chrono::steady_clock::now();
+
+            // 相手が送信を終えていても、処理済みの応答は書き切ってから閉じる
+            if (peerClosed) {
+                conn.peerClosed = true;
+                if (!conn.awaiting) conn.closeAfterWrite = true;
+            }
+            return true;
+        }
+
+        // 揃ったリクエストを順にハンドラへ渡す（パイプライン化されていれば複数）
+        void processRequests(Connection& conn) {
+            size_t consumed = 0;
+            HttpRequest request;  // parse() が Complete のたびに全フィールドを書き換える
+            request.remoteAddr = conn.remoteAddr;
+            while (!conn.closeAfterWrite && !conn.streaming && !conn.awaiting) {
+                size_t used = 0;
+                if (server_.phaseHook_) server_.phaseHook_(Phase::Parse, true);
+                HttpParseStatus status =
+                    conn.parser.parse(std::string_view(conn.in).substr(consumed), request, used);
+                if (server_.phaseHook_) server_.phaseHook_(Phase::Parse, false);
+                if (status == HttpParseStatus::Incomplete) break;
+                if (status == HttpParseStatus::Error) {
+                    queueError(conn, conn.parser.errorStatus());
+                    consumed = conn.in.size();
+                    break;
+                }
+                consumed += used;
+                if (server_.limits_) spendHandlerCost();
+                HttpResponse response = server_.handler_(request);
+                if (response.deferred) {
+                    startDeferred(conn, response, request.keepAlive);
+                    continue;
+                }
+                queueResponse(conn, response, request.keepAlive);
+            }
+            // 確保した領域は残す（次のリクエストで再利用する）
+            if (consumed == conn.in.size()) {
+                conn.in.clear();
+            } else if (consumed > 0) {
+                conn.in.erase(0, consumed);
+            }
+        }
+
+        // 応答を保留し、ハンドラの処理を始める。応答は postReply() で届く。
+        // ワーカーは run() の間は残るが、念のため server_ の一覧にあるときだけ届ける
+        void startDeferred(Connection& conn, HttpResponse& response, bool keepAlive) {
+            conn.awaiting = true;
+            conn.awaitingKeepAlive = keepAlive;
+            HttpServer* server = &server_;
+            Worker* self = this;
+            int fd = conn.fd;
+            uint64_t id = conn.id;
+            response.deferred([server, self, fd, id](HttpResponse reply) {
+                std::lock_guard<std::mutex> lock(server->workersMutex_);
+                for (Worker* worker : server->workers_) {
+                    if (worker == self) {
+                        worker->postReply(fd, id, std::move(reply));
+                        break;
+                    }
+                }
+            });
+        }
+
+        // 届いた応答を送り、待たせていた後続のリクエストを処理する（接続が閉じていれば捨てる）
+        void deliverReplies() {
+            std::vector<Reply> replies;
+            {
+                std::lock_guard<std::mutex> lock(mailboxMutex_);
+                replies.swap(replies_);
+            }
+            for (Reply& reply : replies) {
+                auto it = conns_.find(reply.fd);
+                if (it == conns_.end() || it->second->id != reply.id || !it->second->awaiting) continue;
+                Connection& conn = *it->second;
+                conn.awaiting = false;
+                conn.lastActive = std::chrono::steady_clock::now();
+                if (reply.response.deferred || reply.response.eventStream) {
+                    queueError(conn, 500);
+                } else {
+                    queueResponse(conn, reply.response, conn.awaitingKeepAlive);
+                    processRequests(conn);
+                }
+                if (conn.peerClosed && !conn.awaiting) conn.closeAfterWrite = true;
+                if (!flush(conn)) {
+                    closeConnection(reply.fd);
+                } else {
+                    updateHeap(conn, true);
+                }
+            }
+        }
+
+        // 解析できなかったリクエストへの応答（接続は閉じる）
+        void queueError(Connection& conn, int status) {
+            HttpResponse response;
+            response.status = status;
+            response.contentType = "application/json";
+            response.body = std::string("{\"error\":\"") + httpStatusText(status) + "\"}";
+            queueResponse(conn, response, false);
+        }
+
+        void queueResponse(Connection& conn, const HttpResponse& response, bool keepAlive) {
+            if (server_.limits_) delayResponse(conn);
+            if (response.eventStream) {
+                queueStreamStart(conn, response);
+                return;
+            }
+
+            char head[256];
+            int len = snprintf(head, sizeof(head),
+                               "HTTP/1.1 %d %s\r\n"
+                               "%s%s%s"
+                               "Content-Length: %zu\r\n"
+                               "Connection: %s\r\n"
+                               "Access-Control-Allow-Origin: *\r\n",
+                               response.status, httpStatusText(response.status),
+                               response.contentType.empty() ? "" : "Content-Type: ",
+                               response.contentType.c_str(),
+                               response.contentType.empty() ? "" : "\r\n",
+                               response.bodySize(),
+                               keepAlive ? "keep-alive" : "close");
+
+            // 小さな応答はヘッダーと本文を1つのバッファにまとめ、パイプライン時は前の応答に連結する
+            if (conn.out.empty() || conn.out.back().external || conn.out.back().offset > 0) {
+                conn.out.emplace_back();
+            }
+            std::string& buf = conn.out.back().owned;
+            buf.append(head, (size_t)len);
+            buf.append(response.extraHeaders);
+            buf.append("\r\n");
+            if (response.staticBody) {
+                OutSegment segment;
+                segment.external = response.staticBody;
+                segment.externalLen = response.staticBodyLen;
+                conn.out.push_back(std::move(segment));
+            } else {
+                buf.append(response.body);
+            }
+            if (!keepAlive) conn.closeAfterWrite = true;
+        }
+
+        // SSEストリームを開始する（Content-Lengthなしで接続を保持する）
+        void queueStreamStart(Connection& conn, const HttpResponse& response) {
+            conn.out.emplace_back();
+            std::string& buf = conn.out.back().owned;
+            buf.append("HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/event-stream\r\n"
+                       "Cache-Control: no-cache\r\n"
+                       "Connection: keep-alive\r\n"
+                       "Access-Control-Allow-Origin: *\r\n");
+            buf.append(response.extraHeaders);
+            buf.append("\r\n");
+            buf.append(response.body);
+            conn.streaming = true;
+        }
+
+        void deliverBroadcasts() {
+            std::vector<std::shared_ptr<const std::string>> messages;
+            {
+                std::lock_guard<std::mutex> lock(mailboxMutex_);
+                messages.swap(mailbox_);
+            }
+            if (messages.empty()) return;
+
+            std::vector<int> dead;
+            for (auto& entry : conns_) {
+                Connection& conn = *entry.second;
+                if (!conn.streaming) continue;
+                for (auto& message : messages) appendStream(conn, *message);
+                if (pendingBytes(conn) > MAX_STREAM_BACKLOG || !flush(conn)) {
+                    dead.push_back(entry.first);  // 読まない購読者は切断する
+                } else {
+                    updateHeap(conn, true);
+                }
+            }
+            for (int fd : dead) closeConnection(fd);
+        }
+
+        void appendStream(Connection& conn, const std::string& data) {
+            if (conn.out.empty() || conn.out.back().external) conn.out.emplace_back();
+            conn.out.back().owned.append(data);
+        }
+
+        size_t pendingBytes(const Connection& conn) const {
+            size_t total = 0;
+            for (auto& segment : conn.out) total += segment.size() - segment.offset;
+            return total;
+        }
+
+        // 書けるだけ書く（writev相当）。残りがあればEPOLLOUTを待つ
+        bool flush(Connection& conn) {
+            if (!conn.out.empty() && conn.sendAt > std::chrono::steady_clock::now()) {
+                delayed_.insert(conn.fd);
+                return true;
+            }
+            while (!conn.out.empty()) {
+                struct iovec iov[16];
+                int iovCount = 0;
+                for (auto it = conn.out.begin(); it != conn.out.end() && iovCount < 16; ++it) {
+                    iov[iovCount].iov_base = (void*)(it->data() + it->offset);
+                    iov[iovCount].iov_len = it->size() - it->offset;
+                    iovCount++;
+                }
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = (size_t)iovCount;
+
+                ssize_t n = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        setWantWrite(conn, true);
+                        return true;
+                    }
+                    return false;
+                }
+                size_t written = (size_t)n;
+                while (written > 0) {
+                    OutSegment& front = conn.out.front();
+                    size_t remaining = front.size() - front.offset;
+                    if (written < remaining) {
+                        front.offset += written;
+                        break;
+                    }
+                    written -= remaining;
+                    conn.out.pop_front();
+                }
+            }
+            setWantWrite(conn, false);
+            return !conn.closeAfterWrite;
+        }
+
+        void setWantWrite(Connection& conn, bool want) {
+            if (conn.wantWrite == want) return;
+            conn.wantWrite = want;
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (want ? (uint32_t)EPOLLOUT : 0u);
+            ev.data.fd = conn.fd;
+            epoll_ctl(epollFd_, EPOLL_CTL_MOD, conn.fd, &ev);
+        }
+
+        void sweepIdle(std::chrono::steady_clock::time_point now) {
+            std::vector<int> idle;
+            for (auto& entry : conns_) {
+                Connection& conn = *entry.second;
+                if (conn.streaming) {
+                    // SSEはコメント行を定期的に送って切断を検出する
+                    if (now - conn.lastActive > std::chrono::seconds(STREAM_PING_SEC)) {
+                        conn.lastActive = now;
+                        appendStream(conn, ": ping\n\n");
+                        if (!flush(conn)) idle.push_back(entry.first);
+                    }
+                    continue;
+                }
+                if (!conn.awaiting && now - conn.lastActive > std::chrono::seconds(IDLE_TIMEOUT_SEC)) {
+                    idle.push_back(entry.first);
+                }
+            }
+            for (int fd : idle) closeConnection(fd);
+        }
+
+        void closeConnection(int fd) {
+            auto it = conns_.find(fd);
+            if (it != conns_.end() && server_.limits_) {
+                server_.limits_->release(it->second->heapCharged);
+                server_.limits_->socketClosed();
+            }
+            epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+            close(fd);
+            conns_.erase(fd);
+            delayed_.erase(fd);
+        }
+
+        // ---- limits（device_limits.h） ----
+
+        // 満杯の間は待ち受けソケットを epoll から外す（EPOLLEXCLUSIVE は MOD できないので DEL / ADD）
+        void setAccepting(bool accepting) {
+            if (acceptPaused_ == !accepting) return;
+            acceptPaused_ = !accepting;
+            if (accepting) {
+                struct epoll_event ev;
+                memset(&ev, 0, sizeof(ev));
+                ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+                ev.data.fd = server_.listenFd_;
+                epoll_ctl(epollFd_, EPOLL_CTL_ADD, server_.listenFd_, &ev);
+            } else {
+                epoll_ctl(epollFd_, EPOLL_CTL_DEL, server_.listenFd_, nullptr);
+                server_.limits_->acceptPauses++;
+            }
+        }
+
+        // 接続の固定分と受信・送信バッファをヒープに数え直す（静的データはフラッシュにあるので数えない）。
+        // 増えた分を確保できなければ false
+        bool updateHeap(Connection& conn, bool force) {
+            DeviceLimits* limits = server_.limits_;
+            if (!limits) return true;
+            size_t usage = limits->socketBytes + conn.in.capacity();
+            for (auto& segment : conn.out) usage += segment.owned.size();
+            if (usage > conn.heapCharged) {
+                if (!limits->reserve(usage - conn.heapCharged, force)) return false;
+            } else {
+                limits->release(conn.heapCharged - usage);
+            }
+            conn.heapCharged = usage;
+            return true;
+        }
+
+        // 受信を捨てて 503 を返し、閉じる
+        void rejectForHeap(Connection& conn) {
+            server_.limits_->heapRejects++;
+            std::string().swap(conn.in);
+            queueError(conn, 503);
+            updateHeap(conn, true);
+        }
+
+        // I/Oスレッドを止めてCPU時間の代わりにする（ワーカーが1つなら、その間ほかの接続も待つ）
+        void spendHandlerCost() {
+            server_.limits_->requests++;
+            if (server_.limits_->handlerCostUs > 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(server_.limits_->handlerCostUs));
+            }
+        }
+
+        // 応答を遅延の分だけ後に送る。前の応答より先には送らない（TCPの順序どおり）
+        void delayResponse(Connection& conn) {
+            uint32_t delayMs = server_.limits_->responseDelayMs(rng_);
+            if (delayMs == 0) return;
+            auto at = std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs);
+            if (at > conn.sendAt) conn.sendAt = at;
+        }
+
+        int delayedTimeoutMs() const {
+            int timeout = 1000;
+            auto now = std::chrono::steady_clock::now();
+            for (int fd : delayed_) {
+                auto it = conns_.find(fd);
+                if (it == conns_.end()) continue;
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(it->second->sendAt - now).count() + 1;
+                if (wait < timeout) timeout = wait < 0 ? 0 : (int)wait;
+            }
+            return timeout;
+        }
+
+        // 遅延が明けた接続を送る（まだなら flush() が delayed_ に戻す）
+        void flushDelayed() {
+            std::vector<int> due(delayed_.begin(), delayed_.end());
+            delayed_.clear();
+            for (int fd : due) {
+                auto it = conns_.find(fd);
+                if (it == conns_.end()) continue;
+                if (!flush(*it->second)) {
+                    closeConnection(fd);
+                } else {
+                    updateHeap(*it->second, true);
+                }
+            }
+        }
+
+        HttpServer& server_;
+        int epollFd_;
+        int eventFd_;
+        std::unordered_map<int, std::unique_ptr<Connection>> conns_;
+        std::mutex mailboxMutex_;
+        std::vector<std::shared_ptr<const std::string>> mailbox_;
+        std::vector<Reply> replies_;
+        uint64_t nextConnId_ = 0;
+        bool acceptPaused_ = false;
+        std::unordered_set<int> delayed_;  // 遅延が明けるのを待っている接続
+        std::minstd_rand rng_;
+    };
+
+    Handler handler_;
+    PhaseHook phaseHook_ = nullptr;
+    DeviceLimits* limits_ = nullptr;
+    int listenFd_ = -1;
+    std::mutex workersMutex_;
+    std::vector<Worker*> workers_;
+};
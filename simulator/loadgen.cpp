@@ -0,0 +1,621 @@
+// HTTP APIの負荷生成・レイテンシ計測ツール
+//
+// キープアライブ接続を多数張り、指定した比率で GET / , /api/info, /api/status と電源操作を送り続ける。
+// 各接続は応答を受け取ってから次の要求を送る（クローズドループ）。
+// シミュレータにも実機のアドレスにも使える。--json で回帰検出用のJSONを出力する。
+// --udp-key を付けると、HTTPの代わりに認証付きUDP制御プロトコル（shared/udp_command.h）で
+// 電源操作を送り、ACKまでの時間を測る（HTTPとのレイテンシ比較用）。
+//
+// ビルド（リポジトリのルートで。Dockerイメージでは /app/loadgen としてビルド済み）：
+//   g++ -std=c++17 -O2 -I./shared -o loadgen simulator/loadgen.cpp -lpthread
+//
+// 例：
+//   ./loadgen --host 127.0.0.1 --port 8080 --connections 64 --duration 10
+//   ./loadgen --host 192.168.1.50 --port 80 --connections 4 --mix status:8,info:1,index:1 --json
+//   ./loadgen --mix status:9,power:1 --power-channels 0,1   # 電源操作を含める（実機では本当に押される）
+//   ./loadgen --port 7770 --udp-key secret --connections 4  # UDP制御プロトコルで押す
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "json_writer.h"
+#include "sha256.h"
+#include "udp_command.h"
+
+namespace {
+
+// 要求の種類
+enum Op { OpIndex, OpInfo, OpStatus, OpPower, OpLongPress, OpCount };
+
+const char* OP_NAMES[OpCount] = {"index", "info", "status", "power", "longpress"};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    std::string port = "8080";
+    int connections = 16;
+    int threads = 0;
+    double durationS = 10.0;
+    long maxRequests = 0;  // 0なら時間で終了
+    int timeoutMs = 5000;
+    int weights[OpCount] = {1, 1, 8, 0, 0};
+    std::vector<int> powerChannels = {0};
+    bool json = false;
+    std::string udpKey;  // 空でなければUDP制御プロトコルを使う
+
+    bool udp() const { return !udpKey.empty(); }
+};
+
+// 1スレッド分の集計
+struct Stats {
+    std::vector<uint32_t> latencyUs[OpCount];
+    long responses[OpCount] = {};
+    long non2xx[OpCount] = {};
+    long status503 = 0;
+    long timeouts = 0;
+    long connectFailures = 0;
+    long connectionErrors = 0;  // 送受信中の切断・リセット
+    long bytesIn = 0;
+};
+
+uint64_t nowUs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool parseMix(const char* text, int* weights) {
+    for (int i = 0; i < OpCount; i++) weights[i] = 0;
+    std::string s(text);
+    size_t pos = 0;
+    while (pos < s.size()) {
+        size_t comma = s.find(',', pos);
+        if (comma == std::string::npos) comma = s.size();
+        std::string item = s.substr(pos, comma - pos);
+        size_t colon = item.find(':');
+        std::string name = item.substr(0, colon);
+        int weight = colon == std::string::npos ? 1 : atoi(item.c_str() + colon + 1);
+        int op = -1;
+        for (int i = 0; i < OpCount; i++) {
+            if (name == OP_NAMES[i]) op = i;
+        }
+        if (op < 0 || weight < 0) return false;
+        weights[op] = weight;
+        pos = comma + 1;
+    }
+    int total = 0;
+    for (int i = 0; i < OpCount; i++) total += weights[i];
+    return total > 0;
+}
+
+// 1本のキープアライブ接続
+struct Connection {
+    int fd = -1;
+    bool connecting = false;
+    std::string out;
+    size_t outOff = 0;
+    std::string in;
+    Op op = OpStatus;
+    bool pending = false;  // 応答待ちの要求がある
+    uint64_t startUs = 0;
+    uint64_t deadlineUs = 0;
+    uint64_t nonce = 0;    // UDP：応答待ちの要求の nonce
+};
+
+class Worker {
+public:
+    Worker(const Options& options, const addrinfo* addr, int connections, unsigned seed,
+           std::atomic<long>& remaining, uint64_t endUs)
+        : options_(options), addr_(addr), count_(connections), seed_(seed), remaining_(remaining),
+          endUs_(endUs), hmac_(options.udpKey.data(), options.udpKey.size()) {
+        for (int i = 0; i < OpCount; i++) totalWeight_ += options_.weights[i];
+        // UDPの clientId はスレッドごと（同時に応答待ちの要求が再送防止の窓64個に収まるようにする）
+        clientId_ = (uint32_t)rand_r(&seed_) ^ (uint32_t)getpid();
+    }
+
+    void run() {
+        epfd_ = epoll_create1(0);
+        conns_.resize(count_);
+        for (int i = 0; i < count_; i++) open(i);
+
+        epoll_event events[64];
+        // --requests 指定時は、予定数を送り切って応答を受け終えたら終わる
+        while (nowUs() < endUs_ && !(stopped_ && inFlight_ == 0)) {
+            int n = epoll_wait(epfd_, events, 64, 10);
+            for (int i = 0; i < n; i++) {
+                int index = (int)events[i].data.u32;
+                Connection& c = conns_[index];
+                int fd = c.fd;
+                if (fd < 0) continue;
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    // UDPでは相手のポートが閉じている（ICMP port unreachable）ので接続失敗として扱う
+                    fail(index, c.connecting || options_.udp());
+                    continue;
+                }
+                if (c.connecting && (events[i].events & EPOLLOUT)) {
+                    int err = 0;
+                    socklen_t len = sizeof(err);
+                    getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                    if (err != 0) {
+                        fail(index, true);
+                        continue;
+                    }
+                    c.connecting = false;
+                }
+                if (events[i].events & EPOLLOUT) flush(index);
+                // 送信中に張り直した場合は新しい接続のイベントを待つ
+                if ((events[i].events & EPOLLIN) && c.fd == fd) receive(index);
+            }
+            sweepTimeouts();
+        }
+        for (Connection& c : conns_) {
+            if (c.fd >= 0) close(c.fd);
+        }
+        close(epfd_);
+    }
+
+    Stats stats;
+
+private:
+    void open(int index) {
+        Connection& c = conns_[index];
+        drop(c);
+        c = Connection();
+        c.fd = socket(addr_->ai_family, (options_.udp() ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK, 0);
+        if (c.fd < 0) {
+            stats.connectFailures++;
+            return;
+        }
+        int one = 1;
+        if (!options_.udp()) setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(c.fd, addr_->ai_addr, addr_->ai_addrlen) < 0 && errno != EINPROGRESS) {
+            close(c.fd);
+            c.fd = -1;
+            stats.connectFailures++;
+            return;
+        }
+        c.connecting = !options_.udp();
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.u32 = (uint32_t)index;
+        epoll_ctl(epfd_, EPOLL_CTL_ADD, c.fd, &ev);
+        startRequest(index);
+    }
+
+    // 接続失敗・切断。接続を張り直す（接続自体に失敗した場合は少し待つ）
+    void fail(int index, bool duringConnect) {
+        Connection& c = conns_[index];
+        if (duringConnect) {
+            stats.connectFailures++;
+        } else {
+            stats.connectionErrors++;
+        }
+        close(c.fd);
+        c.fd = -1;
+        drop(c);
+        if (duringConnect) usleep(10000);
+        if (nowUs() < endUs_ && !stopped_) open(index);
+    }
+
+    // 応答待ちの要求を失った
+    void drop(Connection& c) {
+        if (c.pending) inFlight_--;
+        c.pending = false;
+    }
+
+    Op pickOp() {
+        int r = (int)(rand_r(&seed_) % (unsigned)totalWeight_);
+        for (int i = 0; i < OpCount; i++) {
+            if (r < options_.weights[i]) return (Op)i;
+            r -= options_.weights[i];
+        }
+        return OpStatus;
+    }
+
+    void startRequest(int index) {
+        if (options_.maxRequests > 0 && remaining_.fetch_sub(1) <= 0) {
+            stopped_ = true;
+            return;
+        }
+        Connection& c = conns_[index];
+        c.pending = true;
+        inFlight_++;
+        c.op = pickOp();
+        if (options_.udp()) {
+            startUdpRequest(c);
+            flush(index);
+            return;
+        }
+        char path[64];
+        const char* method = "GET";
+        switch (c.op) {
+            case OpIndex:  snprintf(path, sizeof(path), "/"); break;
+            case OpInfo:   snprintf(path, sizeof(path), "/api/info"); break;
+            case OpStatus: snprintf(path, sizeof(path), "/api/status"); break;
+            default: {
+                int channel = options_.powerChannels[rand_r(&seed_) % options_.powerChannels.size()];
+                snprintf(path, sizeof(path), c.op == OpPower ? "/api/power/%d" : "/api/longpress/%d", channel);
+                method = "POST";
+                break;
+            }
+        }
+        char request[256];
+        int len = snprintf(request, sizeof(request),
+                           "%s %s HTTP/1.1\r\nHost: %s\r\nAccept-Encoding: gzip\r\n%s\r\n", method, path,
+                           options_.host.c_str(), method[0] == 'P' ? "Content-Length: 0\r\n" : "");
+        c.out.assign(request, (size_t)len);
+        c.outOff = 0;
+        c.in.clear();
+        c.startUs = nowUs();
+        c.deadlineUs = c.startUs + (uint64_t)options_.timeoutMs * 1000;
+        if (!c.connecting) flush(index);
+    }
+
+    // UDP制御プロトコルの要求（nonce は UNIX時刻のマイクロ秒で、このスレッド内で単調増加）
+    void startUdpRequest(Connection& c) {
+        uint64_t unixUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::system_clock::now().time_since_epoch()).count();
+        lastNonce_ = std::max(lastNonce_ + 1, unixUs);
+        UdpCommand command;
+        command.action = c.op == OpLongPress ? UdpAction::LongPress : UdpAction::Press;
+        command.clientId = clientId_;
+        command.nonce = lastNonce_;
+        command.channels = 1ULL << options_.powerChannels[rand_r(&seed_) % options_.powerChannels.size()];
+        uint8_t packet[UDP_COMMAND_REQUEST_BYTES];
+        writeUdpCommand(packet, command, hmac_);
+        c.out.assign((const char*)packet, sizeof(packet));
+        c.outOff = 0;
+        c.nonce = command.nonce;
+        c.startUs = nowUs();
+        c.deadlineUs = c.startUs + (uint64_t)options_.timeoutMs * 1000;
+    }
+
+    // ACKを待つ。HTTPのステータスに読み替えて集計する（Partial → 503、Replay → 409、BadRequest → 400）
+    void receiveUdp(int index) {
+        Connection& c = conns_[index];
+        uint8_t buf[512];
+        for (;;) {
+            ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+                fail(index, true);  // ICMP port unreachable など
+                return;
+            }
+            stats.bytesIn += n;
+            UdpAck ack;
+            if (!c.pending || !parseUdpAck(buf, (size_t)n, hmac_, ack) || ack.nonce != c.nonce) continue;
+
+            uint64_t elapsed = nowUs() - c.startUs;
+            drop(c);
+            stats.latencyUs[c.op].push_back((uint32_t)std::min<uint64_t>(elapsed, UINT32_MAX));
+            stats.responses[c.op]++;
+            int status = ack.status == UdpStatus::Ok        ? 200
+                       : ack.status == UdpStatus::Partial   ? 503
+                       : ack.status == UdpStatus::Replay    ? 409
+                       : 400;
+            if (status != 200) stats.non2xx[c.op]++;
+            if (status == 503) stats.status503++;
+            startRequest(index);
+            if (c.fd < 0) return;
+        }
+    }
+
+    void flush(int index) {
+        Connection& c = conns_[index];
+        while (c.outOff < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.outOff, c.out.size() - c.outOff, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+                fail(index, false);
+                return;
+            }
+            c.outOff += (size_t)n;
+        }
+    }
+
+    void receive(int index) {
+        if (options_.udp()) {
+            receiveUdp(index);
+            return;
+        }
+        Connection& c = conns_[index];
+        char buf[16384];
+        for (;;) {
+            ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                c.in.append(buf, (size_t)n);
+                stats.bytesIn += n;
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            fail(index, false);  // 切断（n == 0）またはエラー
+            return;
+        }
+
+        int status = 0;
+        bool keepAlive = true;
+        if (!complete(c.in, status, keepAlive)) return;
+
+        uint64_t elapsed = nowUs() - c.startUs;
+        drop(c);
+        stats.latencyUs[c.op].push_back((uint32_t)std::min<uint64_t>(elapsed, UINT32_MAX));
+        stats.responses[c.op]++;
+        if (status < 200 || status >= 300) stats.non2xx[c.op]++;
+        if (status == 503) stats.status503++;
+
+        if (!keepAlive) {
+            close(c.fd);
+            c.fd = -1;
+            if (nowUs() < endUs_ && !stopped_) open(index);
+            return;
+        }
+        startRequest(index);
+    }
+
+    // 応答が揃ったか（Content-Length と chunked に対応）
+    static bool complete(const std::string& in, int& status, bool& keepAlive) {
+        size_t headerEnd = in.find("\r\n\r\n");
+        if (headerEnd == std::string::npos) return false;
+        if (in.size() < 12) return false;
+        status = atoi(in.c_str() + 9);
+
+        std::string headers = in.substr(0, headerEnd + 2);
+        for (char& ch : headers) ch = (char)tolower((unsigned char)ch);
+        keepAlive = headers.find("\r\nconnection: close\r\n") == std::string::npos;
+
+        size_t cl = headers.find("\r\ncontent-length:");
+        if (cl != std::string::npos) {
+            size_t length = strtoul(headers.c_str() + cl + 17, nullptr, 10);
+            return in.size() >= headerEnd + 4 + length;
+        }
+        if (headers.find("\r\ntransfer-encoding: chunked\r\n") != std::string::npos) {
+            return in.find("\r\n0\r\n\r\n", headerEnd) != std::string::npos;
+        }
+        return status == 204 || status == 304;
+    }
+
+    void sweepTimeouts() {
+        uint64_t now = nowUs();
+        for (int i = 0; i < count_; i++) {
+            Connection& c = conns_[i];
+            if (c.fd >= 0 && c.pending && now > c.deadlineUs) {
+                stats.timeouts++;
+                close(c.fd);
+                c.fd = -1;
+                open(i);
+            }
+        }
+    }
+
+    const Options& options_;
+    const addrinfo* addr_;
+    int count_;
+    unsigned seed_;
+    std::atomic<long>& remaining_;
+    uint64_t endUs_;
+    int totalWeight_ = 0;
+    int epfd_ = -1;
+    bool stopped_ = false;
+    long inFlight_ = 0;
+    std::vector<Connection> conns_;
+    HmacSha256 hmac_;
+    uint32_t clientId_ = 0;
+    uint64_t lastNonce_ = 0;
+};
+
+uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t index = (size_t)(p * (double)(sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "Usage: %s [--host H] [--port P] [--connections N] [--threads N] [--duration S]\n"
+            "          [--requests N] [--timeout-ms N] [--mix op:w,...] [--power-channels 0,1] [--json]\n"
+            "          [--udp-key KEY]\n"
+            "  ops: index, info, status, power, longpress (default mix: index:1,info:1,status:8)\n"
+            "  --udp-key: use the UDP command protocol (ops: power, longpress; default mix: power:1)\n",
+            argv0);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    bool mixGiven = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--host" && hasValue) {
+            options.host = argv[++i];
+        } else if (arg == "--port" && hasValue) {
+            options.port = argv[++i];
+        } else if (arg == "--connections" && hasValue) {
+            options.connections = atoi(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = atoi(argv[++i]);
+        } else if (arg == "--duration" && hasValue) {
+            options.durationS = atof(argv[++i]);
+        } else if (arg == "--requests" && hasValue) {
+            options.maxRequests = atol(argv[++i]);
+        } else if (arg == "--timeout-ms" && hasValue) {
+            options.timeoutMs = atoi(argv[++i]);
+        } else if (arg == "--mix" && hasValue) {
+            if (!parseMix(argv[++i], options.weights)) {
+                fprintf(stderr, "Invalid --mix: %s\n", argv[i]);
+                return 1;
+            }
+            mixGiven = true;
+        } else if (arg == "--power-channels" && hasValue) {
+            options.powerChannels.clear();
+            std::string list = argv[++i];
+            for (size_t pos = 0; pos < list.size();) {
+                size_t comma = list.find(',', pos);
+                if (comma == std::string::npos) comma = list.size();
+                options.powerChannels.push_back(atoi(list.substr(pos, comma - pos).c_str()));
+                pos = comma + 1;
+            }
+            if (options.powerChannels.empty()) {
+                fprintf(stderr, "Invalid --power-channels: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (arg == "--udp-key" && hasValue) {
+            options.udpKey = argv[++i];
+        } else if (arg == "--json") {
+            options.json = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.udp()) {
+        if (!mixGiven) {
+            for (int op = 0; op < OpCount; op++) options.weights[op] = op == OpPower ? 1 : 0;
+        }
+        if (options.weights[OpIndex] || options.weights[OpInfo] || options.weights[OpStatus]) {
+            fprintf(stderr, "--udp-key supports only power and longpress in --mix\n");
+            return 1;
+        }
+        for (int channel : options.powerChannels) {
+            if (channel < 0 || channel >= 64) {
+                fprintf(stderr, "Invalid --power-channels for UDP: %d\n", channel);
+                return 1;
+            }
+        }
+    }
+    if (options.connections < 1) options.connections = 1;
+    if (options.threads <= 0) {
+        options.threads = std::min(options.connections, std::max(1, (int)std::thread::hardware_concurrency()));
+    }
+    options.threads = std::min(options.threads, options.connections);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = options.udp() ? SOCK_DGRAM : SOCK_STREAM;
+    addrinfo* addr = nullptr;
+    int rc = getaddrinfo(options.host.c_str(), options.port.c_str(), &hints, &addr);
+    if (rc != 0) {
+        fprintf(stderr, "Cannot resolve %s: %s\n", options.host.c_str(), gai_strerror(rc));
+        return 1;
+    }
+
+    std::atomic<long> remaining(options.maxRequests);
+    uint64_t startUs = nowUs();
+    uint64_t endUs = startUs + (uint64_t)(options.durationS * 1e6);
+
+    std::vector<Worker*> workers;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < options.threads; t++) {
+        int share = options.connections / options.threads + (t < options.connections % options.threads ? 1 : 0);
+        workers.push_back(new Worker(options, addr, share, 0x9e3779b9u * (unsigned)(t + 1), remaining, endUs));
+    }
+    for (Worker* w : workers) threads.emplace_back([w] { w->run(); });
+    for (std::thread& t : threads) t.join();
+    double elapsedS = (double)(nowUs() - startUs) / 1e6;
+    freeaddrinfo(addr);
+
+    // 集計
+    Stats total;
+    for (Worker* w : workers) {
+        for (int op = 0; op < OpCount; op++) {
+            total.latencyUs[op].insert(total.latencyUs[op].end(), w->stats.latencyUs[op].begin(),
+                                       w->stats.latencyUs[op].end());
+            total.responses[op] += w->stats.responses[op];
+            total.non2xx[op] += w->stats.non2xx[op];
+        }
+        total.status503 += w->stats.status503;
+        total.timeouts += w->stats.timeouts;
+        total.connectFailures += w->stats.connectFailures;
+        total.connectionErrors += w->stats.connectionErrors;
+        total.bytesIn += w->stats.bytesIn;
+        delete w;
+    }
+    std::vector<uint32_t> all;
+    long responses = 0;
+    long non2xx = 0;
+    for (int op = 0; op < OpCount; op++) {
+        std::sort(total.latencyUs[op].begin(), total.latencyUs[op].end());
+        all.insert(all.end(), total.latencyUs[op].begin(), total.latencyUs[op].end());
+        responses += total.responses[op];
+        non2xx += total.non2xx[op];
+    }
+    std::sort(all.begin(), all.end());
+    double rps = elapsedS > 0 ? (double)responses / elapsedS : 0;
+    double errorRate = responses > 0 ? (double)non2xx / (double)responses : 0;
+
+    if (options.json) {
+        static char buf[8192];
+        JsonWriter json(buf, sizeof(buf));
+        char rpsText[32], rateText[32], durText[32];
+        snprintf(rpsText, sizeof(rpsText), "%.1f", rps);
+        snprintf(rateText, sizeof(rateText), "%.6f", errorRate);
+        snprintf(durText, sizeof(durText), "%.3f", elapsedS);
+        json.beginObject()
+            .field("target", options.host.c_str(), (":" + options.port).c_str())
+            .field("protocol", options.udp() ? "udp" : "http")
+            .field("connections", options.connections)
+            .field("threads", options.threads)
+            .key("durationS").raw(durText)
+            .field("requests", responses)
+            .key("rps").raw(rpsText)
+            .field("p50Us", percentile(all, 0.50))
+            .field("p99Us", percentile(all, 0.99))
+            .field("p999Us", percentile(all, 0.999))
+            .field("maxUs", all.empty() ? 0u : all.back())
+            .field("non2xx", non2xx)
+            .key("errorRate").raw(rateText)
+            .field("status503", total.status503)
+            .field("timeouts", total.timeouts)
+            .field("connectFailures", total.connectFailures)
+            .field("connectionErrors", total.connectionErrors)
+            .field("bytesIn", total.bytesIn)
+            .key("ops").beginObject();
+        for (int op = 0; op < OpCount; op++) {
+            if (total.responses[op] == 0) continue;
+            json.key(OP_NAMES[op]).beginObject()
+                .field("requests", total.responses[op])
+                .field("non2xx", total.non2xx[op])
+                .field("p50Us", percentile(total.latencyUs[op], 0.50))
+                .field("p99Us", percentile(total.latencyUs[op], 0.99))
+                .field("p999Us", percentile(total.latencyUs[op], 0.999))
+                .endObject();
+        }
+        json.endObject().endObject();
+        printf("%s\n", json.c_str());
+    } else {
+        printf("target            %s:%s (%s)\n", options.host.c_str(), options.port.c_str(),
+               options.udp() ? "udp" : "http");
+        printf("connections       %d (%d threads)\n", options.connections, options.threads);
+        printf("duration          %.2f s\n", elapsedS);
+        printf("requests          %ld (%.1f req/s)\n", responses, rps);
+        printf("latency           p50 %u us  p99 %u us  p999 %u us  max %u us\n", percentile(all, 0.50),
+               percentile(all, 0.99), percentile(all, 0.999), all.empty() ? 0u : all.back());
+        printf("non-2xx           %ld (%.3f%%, 503: %ld)\n", non2xx, errorRate * 100, total.status503);
+        printf("timeouts          %ld\n", total.timeouts);
+        printf("connect failures  %ld\n", total.connectFailures);
+        printf("connection errors %ld\n", total.connectionErrors);
+        printf("\n%-10s %10s %8s %10s %10s %10s\n", "op", "requests", "non2xx", "p50(us)", "p99(us)", "p999(us)");
+        for (int op = 0; op < OpCount; op++) {
+            if (total.responses[op] == 0) continue;
+            printf("%-10s %10ld %8ld %10u %10u %10u\n", OP_NAMES[op], total.responses[op], total.non2xx[op],
+                   percentile(total.latencyUs[op], 0.50), percentile(total.latencyUs[op], 0.99),
+                   percentile(total.latencyUs[op], 0.999));
+        }
+    }
+    return total.connectFailures > 0 && responses == 0 ? 2 : 0;
+}
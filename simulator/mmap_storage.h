@@ -0,0 +1,65 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 実機のフラッシュ上のファイルの代わりに、mmap したファイルを使うストレージ
+// （AuditLog の Storage）。ファイルは指定サイズに揃え、新規作成時はゼロで埋まる。
+class MmapStorage {
+public:
+    MmapStorage() = default;
+
+    ~MmapStorage() {
+        if (data_) munmap(data_, size_);
+        if (fd_ >= 0) close(fd_);
+    }
+
+    MmapStorage(const MmapStorage&) = delete;
+    MmapStorage& operator=(const MmapStorage&) = delete;
+
+    bool open(const char* path, size_t size) {
+        fd_ = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (fstat(fd_, &st) < 0) return false;
+        if ((size_t)st.st_size != size && ftruncate(fd_, (off_t)size) < 0) return false;
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) return false;
+        data_ = (uint8_t*)p;
+        size_ = size;
+        return true;
+    }
+
+    bool read(size_t offset, void* data, size_t len) {
+        if (!data_ || offset + len > size_) return false;
+        memcpy(data, data_ + offset, len);
+        return true;
+    }
+
+    bool write(size_t offset, const void* data, size_t len) {
+        if (!data_ || offset + len > size_) return false;
+        memcpy(data_ + offset, data, len);
+        dirtyBegin_ = dirtyEnd_ > dirtyBegin_ && dirtyBegin_ < offset ? dirtyBegin_ : offset;
+        dirtyEnd_ = dirtyEnd_ > offset + len ? dirtyEnd_ : offset + len;
+        return true;
+    }
+
+    // 書いた範囲をファイルへ反映する（書き込みはセクタ境界なのでページ境界に揃っている）
+    void sync() {
+        if (!data_ || dirtyEnd_ <= dirtyBegin_) return;
+        msync(data_ + dirtyBegin_, dirtyEnd_ - dirtyBegin_, MS_ASYNC);
+        dirtyBegin_ = dirtyEnd_ = 0;
+    }
+
+private:
+    int fd_ = -1;
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    size_t dirtyBegin_ = 0;
+    size_t dirtyEnd_ = 0;
+};
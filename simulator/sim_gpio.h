@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+#include "gpio_mask.h"
+#include "json_writer.h"
+
+// ESP32のGPIO出力レジスタのモデル
+//
+// 実機の GPIO.out_w1ts / out_w1tc / out1_w1ts / out1_w1tc への書き込みを再現し、
+// 各書き込みを時刻付きで記録する。一括押しで複数ピンが同じ書き込みで変化することを
+// /api/sim/gpio から確認できる。
+class SimGpio {
+public:
+    static constexpr int LOG_SIZE = 32;
+
+    // level=true なら w1ts（セット）、false なら w1tc（クリア）。timeUs はシミュレータの時計
+    void write(const GpioBankMask& mask, bool level, uint64_t timeUs) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (level) {
+            out_ |= mask.low;
+            out1_ |= mask.high;
+        } else {
+            out_ &= ~mask.low;
+            out1_ &= ~mask.high;
+        }
+        Write& entry = log_[writes_ % LOG_SIZE];
+        entry.timeUs = timeUs;
+        entry.mask = mask;
+        entry.set = level;
+        writes_++;
+    }
+
+    bool pin(int gpio) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (gpio >= 0 && gpio < 32) return (out_ >> gpio) & 1u;
+        if (gpio >= 32 && gpio < 40) return (out1_ >> (gpio - 32)) & 1u;
+        return false;
+    }
+
+    // {"out":"0x...","out1":"0x...","writes":N,"log":[{"t":us,"reg":"w1ts","low":"0x...","high":"0x..."}]}
+    void writeJson(JsonWriter& json) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        char hex[16];
+        json.beginObject();
+        snprintf(hex, sizeof(hex), "0x%08x", (unsigned)out_);
+        json.field("out", hex);
+        snprintf(hex, sizeof(hex), "0x%08x", (unsigned)out1_);
+        json.field("out1", hex);
+        json.field("writes", writes_);
+        json.key("log").beginArray();
+        uint64_t first = writes_ > (uint64_t)LOG_SIZE ? writes_ - LOG_SIZE : 0;
+        for (uint64_t i = first; i < writes_; i++) {
+            const Write& entry = log_[i % LOG_SIZE];
+            json.beginObject()
+                .field("t", entry.timeUs)
+                .field("reg", entry.set ? "w1ts" : "w1tc");
+            snprintf(hex, sizeof(hex), "0x%08x", (unsigned)entry.mask.low);
+            json.field("low", hex);
+            snprintf(hex, sizeof(hex), "0x%08x", (unsigned)entry.mask.high);
+            json.field("high", hex);
+            json.endObject();
+        }
+        json.endArray().endObject();
+    }
+
+private:
+    struct Write {
+        uint64_t timeUs = 0;
+        GpioBankMask mask;
+        bool set = false;
+    };
+
+    mutable std::mutex mutex_;
+    uint32_t out_ = 0;
+    uint32_t out1_ = 0;
+    uint64_t writes_ = 0;
+    Write log_[LOG_SIZE];
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <random>
+
+#include "io_expander.h"
+#include "json_writer.h"
+
+// I2CバスとI/Oエキスパンダのモデル
+//
+// config.h の IO_EXPANDERS にあるエキスパンダをバスにつなぎ、ChannelDriver の書き込み（1回が START〜STOP の
+// 1トランザクション）をレジスタに反映する。トランザクションとバイトの数、バスの占有時間（SCL の周波数から計算）を数え、
+// 直近の書き込みを記録するので、一括押しがエキスパンダごとに1回の書き込みになることを /api/sim/i2c で確認できる。
+//   MCP23017: 先頭のバイトがレジスタのアドレスで、続くバイトは順にアドレスを進めて書く（IOCON.BANK=0、SEQOP=0）。
+//             出力のピンは IODIR が0のピンで、その値は OLAT
+//   PCF8575 : 2バイトがそのままポート（P00〜P07、P10〜P17）。LOW のピンが押している
+// アドレスにエキスパンダがなければ NACK。nackPercent で書き込みを確率的に失敗させられる（ChannelDriver の再送の確認用）。
+template <int E>
+class SimI2cBus {
+public:
+    static constexpr int LOG_SIZE = 32;
+    static constexpr int MAX_LOG_BYTES = 4;
+    static constexpr int MCP23017_REGISTERS = 0x16;
+
+    SimI2cBus(const IoExpander (&expanders)[E], uint32_t hz) : expanders_(expanders), hz_(hz) {
+        for (int i = 0; i < E; i++) {
+            // 電源投入時：MCP23017 は全ピン入力（IODIR=0xFF）、PCF8575 は全ピンHIGH
+            devices_[i].registers[MCP23017_IODIRA] = 0xFF;
+            devices_[i].registers[MCP23017_IODIRA + 1] = 0xFF;
+            devices_[i].port = 0xFFFF;
+        }
+    }
+
+    void setNackPercent(uint32_t percent) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        nackPercent_ = percent;
+    }
+
+    // address へ data を書く1トランザクション。ACK なら true。timeUs はシミュレータの時計
+    bool write(uint8_t address, const uint8_t* data, size_t len, uint64_t timeUs) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        transactions_++;
+        // START + アドレス + データ、各バイト9クロック（ACK を含む）と STOP
+        busTimeUs_ += ((len + 1) * 9 + 2) * 1000000ULL / hz_;
+        int index = find(address);
+        bool ack = index >= 0 && !(nackPercent_ > 0 && rng_() % 100 < nackPercent_);
+
+        Entry& entry = log_[logged_ % LOG_SIZE];
+        entry.timeUs = timeUs;
+        entry.address = address;
+        entry.len = (uint8_t)len;
+        entry.ack = ack;
+        for (size_t i = 0; i < len && i < (size_t)MAX_LOG_BYTES; i++) entry.data[i] = data[i];
+        logged_++;
+
+        if (!ack) {
+            nacks_++;
+            return false;
+        }
+        bytes_ += len;
+        Device& device = devices_[index];
+        device.transactions++;
+        if (expanders_[index].type == IoExpanderType::Mcp23017) {
+            if (len == 0) return true;
+            uint8_t reg = data[0];
+            for (size_t i = 1; i < len; i++) {
+                if (reg < MCP23017_REGISTERS) device.registers[reg] = data[i];
+                reg = (uint8_t)((reg + 1) % MCP23017_REGISTERS);
+            }
+        } else {
+            // 2バイトごとにポートへ反映する（余った1バイトは捨てる）
+            for (size_t i = 0; i + 1 < len; i += 2) device.port = (uint16_t)(data[i] | (data[i + 1] << 8));
+        }
+        return true;
+    }
+
+    // 押しているピン（PCF8575 は LOW のピン、MCP23017 は出力で HIGH のピン）
+    uint16_t pressed(int expander) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pressedLocked(expander);
+    }
+
+    uint64_t transactions() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return transactions_;
+    }
+
+    // {"hz":400000,"transactions":N,"bytes":N,"busTimeUs":N,"nacks":N,
+    //  "expanders":[{"index":0,"type":"mcp23017","address":"0x20","pressed":"0x0001","iodir":"0xfff0","olat":"0x0001","transactions":N}],
+    //  "log":[{"t":us,"address":"0x20","data":"14 01 00","ack":true}]}
+    // 呼び出し側がオブジェクトを開いて閉じる（ドライバの計数を同じオブジェクトに足せるように）
+    void writeFields(JsonWriter& json) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        char hex[16];
+        json.field("hz", hz_)
+            .field("transactions", transactions_)
+            .field("bytes", bytes_)
+            .field("busTimeUs", busTimeUs_)
+            .field("nacks", nacks_);
+        json.key("expanders").beginArray();
+        for (int i = 0; i < E; i++) {
+            if (expanders_[i].type == IoExpanderType::None) continue;
+            const Device& device = devices_[i];
+            json.beginObject().field("index", i).field("type", ioExpanderTypeName(expanders_[i].type));
+            snprintf(hex, sizeof(hex), "0x%02x", (unsigned)expanders_[i].address);
+            json.field("address", hex);
+            snprintf(hex, sizeof(hex), "0x%04x", (unsigned)pressedLocked(i));
+            json.field("pressed", hex);
+            if (expanders_[i].type == IoExpanderType::Mcp23017) {
+                snprintf(hex, sizeof(hex), "0x%04x", (unsigned)mcpPair(device, MCP23017_IODIRA));
+                json.field("iodir", hex);
+                snprintf(hex, sizeof(hex), "0x%04x", (unsigned)mcpPair(device, MCP23017_OLATA));
+                json.field("olat", hex);
+            } else {
+                snprintf(hex, sizeof(hex), "0x%04x", (unsigned)device.port);
+                json.field("port", hex);
+            }
+            json.field("transactions", device.transactions).endObject();
+        }
+        json.endArray();
+        json.key("log").beginArray();
+        uint64_t first = logged_ > (uint64_t)LOG_SIZE ? logged_ - LOG_SIZE : 0;
+        for (uint64_t i = first; i < logged_; i++) {
+            const Entry& entry = log_[i % LOG_SIZE];
+            char data[MAX_LOG_BYTES * 3 + 4] = "";
+            size_t pos = 0;
+            for (int b = 0; b < entry.len && b < MAX_LOG_BYTES; b++) {
+                pos += snprintf(data + pos, sizeof(data) - pos, b ? " %02x" : "%02x", (unsigned)entry.data[b]);
+            }
+            if (entry.len > MAX_LOG_BYTES) snprintf(data + pos, sizeof(data) - pos, " ..");
+            snprintf(hex, sizeof(hex), "0x%02x", (unsigned)entry.address);
+            json.beginObject()
+                .field("t", entry.timeUs)
+                .field("address", hex)
+                .field("data", data)
+                .field("ack", entry.ack)
+                .endObject();
+        }
+        json.endArray();
+    }
+
+private:
+    struct Device {
+        uint8_t registers[MCP23017_REGISTERS] = {};
+        uint16_t port = 0xFFFF;
+        uint64_t transactions = 0;
+    };
+
+    struct Entry {
+        uint64_t timeUs = 0;
+        uint8_t address = 0;
+        uint8_t len = 0;
+        uint8_t data[MAX_LOG_BYTES] = {};
+        bool ack = false;
+    };
+
+    int find(uint8_t address) const {
+        for (int i = 0; i < E; i++) {
+            if (expanders_[i].type != IoExpanderType::None && expanders_[i].address == address) return i;
+        }
+        return -1;
+    }
+
+    // A / B のレジスタの組（reg は A 側、BANK=0 では B が次のアドレス）
+    static uint16_t mcpPair(const Device& device, uint8_t reg) {
+        return (uint16_t)(device.registers[reg] | (device.registers[reg + 1] << 8));
+    }
+
+    uint16_t pressedLocked(int expander) const {
+        const Device& device = devices_[expander];
+        if (expanders_[expander].type == IoExpanderType::Mcp23017) {
+            return (uint16_t)(mcpPair(device, MCP23017_OLATA) & ~mcpPair(device, MCP23017_IODIRA));
+        }
+        if (expanders_[expander].type == IoExpanderType::Pcf8575) return (uint16_t)~device.port;
+        return 0;
+    }
+
+    const IoExpander (&expanders_)[E];
+    const uint32_t hz_;
+    mutable std::mutex mutex_;
+    Device devices_[E];
+    uint64_t transactions_ = 0;
+    uint64_t bytes_ = 0;
+    uint64_t busTimeUs_ = 0;
+    uint64_t nacks_ = 0;
+    uint32_t nackPercent_ = 0;
+    std::minstd_rand rng_;
+    Entry log_[LOG_SIZE];
+    uint64_t logged_ = 0;
+};
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// シミュレータの時計の進め方
+enum class ClockMode {
+    Real,    // 実時間
+    Scaled,  // 実時間の factor 倍で進む
+    Fast     // 仮想時間。実行待ちの処理がなくなるたびに次の期限まで即座に進める
+};
+
+// 実機の esp_timer に相当するタイマースレッド
+// schedule() した関数を期限順に専用スレッドで実行する。
+//
+// 期限は起動からの仮想時刻（マイクロ秒）で持ち、同じ期限は登録順に実行するので、
+// どの時計モードでも実行順は同じになる。Fast モードではタイマーから起こされた別スレッドの処理
+// （コマンドワーカーなど）を beginWork() / endWork() で囲むと、それが終わるまで時刻を進めない。
+class TimerService {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Callback = std::function<void()>;
+
+    TimerService() : origin_(Clock::now()), worker_([this] { run(); }) {}
+
+    ~TimerService() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        worker_.join();
+    }
+
+    TimerService(const TimerService&) = delete;
+    TimerService& operator=(const TimerService&) = delete;
+
+    // 起動直後（タイマー登録前）に呼ぶ
+    void setClock(ClockMode mode, double factor = 1.0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        mode_ = mode;
+        factor_ = mode == ClockMode::Scaled && factor > 0 ? factor : 1.0;
+        origin_ = Clock::now();
+        virtualUs_ = 0;
+    }
+
+    ClockMode mode() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return mode_;
+    }
+
+    double factor() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return factor_;
+    }
+
+    // 起動からの仮想時刻
+    uint64_t nowUs() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return nowUsLocked();
+    }
+
+    void schedule(uint32_t delayMs, Callback callback) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push(Entry{nowUsLocked() + (uint64_t)delayMs * 1000, nextSeq_++, std::move(callback)});
+        }
+        cv_.notify_all();
+    }
+
+    size_t pending() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queue_.size();
+    }
+
+    void beginWork() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        work_++;
+    }
+
+    void endWork() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            work_--;
+        }
+        cv_.notify_all();
+    }
+
+private:
+    struct Entry {
+        uint64_t deadlineUs;
+        uint64_t seq;  // 同一期限の実行順を登録順に固定する
+        Callback callback;
+
+        bool operator>(const Entry& other) const {
+            if (deadlineUs != other.deadlineUs) return deadlineUs > other.deadlineUs;
+            return seq > other.seq;
+        }
+    };
+
+    uint64_t nowUsLocked() const {
+        if (mode_ == ClockMode::Fast) return virtualUs_;
+        double realUs = (double)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - origin_).count();
+        return (uint64_t)(realUs * factor_);
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_) {
+            if (queue_.empty()) {
+                cv_.wait(lock);
+                continue;
+            }
+            uint64_t deadline = queue_.top().deadlineUs;
+            if (mode_ == ClockMode::Fast) {
+                // 起こした処理が終わって新しいタイマーが出揃ってから進める
+                if (work_ > 0) {
+                    cv_.wait(lock);
+                    continue;
+                }
+                if (deadline > virtualUs_) virtualUs_ = deadline;
+            } else {
+                uint64_t now = nowUsLocked();
+                if (now < deadline) {
+                    auto wait = std::chrono::microseconds((int64_t)((double)(deadline - now) / factor_) + 1);
+                    cv_.wait_for(lock, wait);
+                    continue;
+                }
+            }
+            Callback callback = std::move(const_cast<Entry&>(queue_.top()).callback);
+            queue_.pop();
+            lock.unlock();
+            callback();
+            lock.lock();
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue_;
+    uint64_t nextSeq_ = 0;
+    bool stopping_ = false;
+    ClockMode mode_ = ClockMode::Real;
+    double factor_ = 1.0;
+    Clock::time_point origin_;
+    uint64_t virtualUs_ = 0;
+    int work_ = 0;
+    std::thread worker_;
+};
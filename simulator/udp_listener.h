@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// UDPの受信（実機の AsyncUDP に相当）
+// listen() したポートごとに受信スレッドを1つ持ち、データグラムごとにハンドラを呼ぶ。
+// ハンドラが reply に書いて長さを返すと、同じソケットから送信元へ返信する（0なら返信しない）。
+class UdpListener {
+public:
+    static const size_t REPLY_CAPACITY = 512;
+
+    // remoteAddr は送信元のIPv4アドレス（a<<24|b<<16|c<<8|d）、remotePort はホストバイトオーダー
+    using Handler = std::function<size_t(const uint8_t* data, size_t len, uint32_t remoteAddr, uint16_t remotePort,
+                                         uint8_t* reply, size_t replyCapacity)>;
+
+    explicit UdpListener(Handler handler) : handler_(std::move(handler)) {}
+
+    UdpListener(const UdpListener&) = delete;
+    UdpListener& operator=(const UdpListener&) = delete;
+
+    // 失敗したら false（errno を参照）
+    bool listen(uint16_t port) {
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return false;
+        }
+        std::thread([this, fd] { receiveLoop(fd); }).detach();
+        return true;
+    }
+
+private:
+    void receiveLoop(int fd) {
+        uint8_t buf[1500];
+        uint8_t reply[REPLY_CAPACITY];
+        for (;;) {
+            struct sockaddr_in from;
+            socklen_t fromLen = sizeof(from);
+            ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr*)&from, &fromLen);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            size_t replyLen = handler_(buf, (size_t)n, ntohl(from.sin_addr.s_addr), ntohs(from.sin_port),
+                                       reply, sizeof(reply));
+            if (replyLen > 0) sendto(fd, reply, replyLen, 0, (struct sockaddr*)&from, fromLen);
+        }
+    }
+
+    Handler handler_;
+};
@@ -2,12 +2,38 @@
 #define WIFI_SSID "HERE IS YOUR SSID"
 #define WIFI_PASSWORD "HERE IS YOUR PASSWORD"
 
+// WiFi接続のタイムアウトと再試行（ミリ秒）
+// 前回つながったAPのBSSID・チャンネルとIPアドレスを保存しておき、起動時と再接続時はまずそれで接続する
+// （スキャンとDHCPを省く）。FAST 以内につながらなければ通常の接続に切り替え、それも CONNECT 以内に
+// つながらなければ BACKOFF_MIN から倍々（最大 BACKOFF_MAX）で待って最初からやり直す
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 3000
+#define WIFI_CONNECT_TIMEOUT_MS 15000
+#define WIFI_BACKOFF_MIN_MS 1000
+#define WIFI_BACKOFF_MAX_MS 30000
+
+// 高速接続のとき前回のIPアドレスを（DHCPを待たずに）そのまま使う
+// DHCPのリースを更新しないので、ルータでこのボードのMACアドレスにアドレスを固定（静的予約）しているときだけ 1 にする
+// （予約がないと、期限切れのアドレスが別の機器へ払い出されて衝突する）
+#define WIFI_REUSE_IP 0
+
 // Webサーバのポート
 #define WEB_SERVER_PORT 80
 
+// I/Oエキスパンダ（任意、README の「I/Oエキスパンダ」）
+// GPIOが足りないチャンネルは I2C の MCP23017 / PCF8575（各16ピン）に置ける。
+// IO_EXPANDERS に {種類, I2Cアドレス} を並べ、PHOTOCOUPLER_PINS に expanderPin(IO_EXPANDERS の添字, ピン 0〜15) と書く。
+// 使わないときは {IoExpanderType::None, 0} を1つだけ置く。I2C のピン（SDA / SCL）はチャンネルに使えない
+#include "io_expander.h"
+constexpr IoExpander IO_EXPANDERS[] = {
+    {IoExpanderType::None, 0},
+};
+#define IO_EXPANDER_SDA_PIN 21
+#define IO_EXPANDER_SCL_PIN 22
+#define IO_EXPANDER_I2C_HZ 400000
+
 // フォトカプラ制御用GPIOピンの設定
 // PC1, PC2, PC3... の順番で設定
-const int PHOTOCOUPLER_PINS[] = {
+constexpr int PHOTOCOUPLER_PINS[] = {
     32,  // PC1
     33,  // PC2
     25,  // PC3
@@ -52,13 +78,153 @@ const char* PC_NAMES[] = {
     "PC16",
     "PC17",
     "PC18",
-    "PC19",
-    "PC20",
-    "PC21"
+    "PC19"
+};
+
+// Wake-on-LAN で押すPCのMACアドレス（任意）
+// PHOTOCOUPLER_PINS と同じ順番・同じ数で設定し、使わないチャンネルは "" にする。
+// UDPポート7/9で受けたマジックパケットの宛先がこの表にあれば、そのPCの電源ボタンを押す。
+// コンパイル時にソートした表を作るので constexpr で書く。
+constexpr const char* PC_MAC_ADDRESSES[] = {
+    "",                   // PC1
+    "",                   // PC2
+    "",                   // PC3
+    "",                   // PC4
+    "",                   // PC5
+    "",                   // PC6
+    "",                   // PC7
+    "",                   // PC8
+    "",                   // PC9
+    "",                   // PC10
+    "",                   // PC11
+    "",                   // PC12
+    "",                   // PC13
+    "",                   // PC14
+    "",                   // PC15
+    "",                   // PC16
+    "",                   // PC17
+    "",                   // PC18
+    ""                    // PC19
 };
 
+// 電源状態検出用GPIOピンの設定（任意）
+// マザーボードの電源LEDヘッダーを2つ目のフォトカプラ経由で入力する。
+// PHOTOCOUPLER_PINS と同じ順番・同じ数で設定し、未接続のチャンネルは -1 にする。
+// 入力専用ピン（34, 35, 36, 39）が使える（内部プルアップがないので外付けのプルアップ抵抗が必要）。
+// -1 のチャンネルは押下ごとの反転で状態を推定する。
+const int POWER_SENSE_PINS[] = {
+    -1,  // PC1
+    -1,  // PC2
+    -1,  // PC3
+    -1,  // PC4
+    -1,  // PC5
+    -1,  // PC6
+    -1,  // PC7
+    -1,  // PC8
+    -1,  // PC9
+    -1,  // PC10
+    -1,  // PC11
+    -1,  // PC12
+    -1,  // PC13
+    -1,  // PC14
+    -1,  // PC15
+    -1,  // PC16
+    -1,  // PC17
+    -1,  // PC18
+    -1   // PC19
+};
+
+// 電源LED入力がLOWのときに電源ON（フォトカプラでプルアップ入力を引き下げる配線）
+#define POWER_SENSE_ACTIVE_LOW 1
+
+// 電源LED入力のサンプリング周期（ミリ秒）と、状態確定に必要な連続一致回数
+#define POWER_SENSE_INTERVAL_MS 10
+#define POWER_SENSE_DEBOUNCE_SAMPLES 5
+
 // パルス幅（ミリ秒） - 電源ボタンを押す時間
 #define POWER_PULSE_MS 1500
 
 // 長押し時間（ミリ秒） - 強制シャットダウン用
 #define POWER_LONG_PRESS_MS 5000
+
+// 一括操作（/api/power/batch）で同時に押すPCの上限（0なら上限なし）
+// 電源投入時の突入電流でPSUやPDUが落ちる場合に制限する
+#define MAX_CONCURRENT_PULSES 0
+
+// 電源操作コマンドのキュー長（2のべき乗）。満杯のときAPIは503を返す
+#define POWER_COMMAND_QUEUE_SIZE 16
+
+// 監査ログ（/api/audit）のレコード数（128の倍数、1件32バイト）と、
+// 溜まったレコードをフラッシュへ書くまでの最大待ち時間（ミリ秒）
+#define AUDIT_LOG_RECORDS 2048
+#define AUDIT_FLUSH_INTERVAL_MS 5000
+
+// トレース（/api/trace、Chrome Trace Event 形式）のリングに残すイベント数（2のべき乗、1件24バイト）と、
+// 起動時から記録するか（0なら POST /api/trace?enabled=1 で始める）
+#define TRACE_BUFFER_EVENTS 512
+#define TRACE_ENABLED_AT_BOOT 0
+
+// Wake-on-LAN を受けてから同じPCへの次のマジックパケットを無視する時間（ミリ秒）
+// WoLツールの再送で、電源を入れた直後にもう一度押して切ってしまわないようにする
+#define WOL_COOLDOWN_MS 10000
+
+// 認証付きUDP制御プロトコル（README の「UDP制御プロトコル」）
+// 鍵（HMAC-SHA256、送信側と同じ文字列）が空なら受信しない。
+// 時刻が合っているとき、送信時刻（nonce）がこの秒数以上ずれた要求は再送として拒否する
+#define UDP_COMMAND_PORT 7770
+#define UDP_COMMAND_KEY ""
+#define UDP_COMMAND_MAX_SKEW_S 30
+
+// 時刻合わせに使うNTPサーバ（監査ログの時刻、UDP制御の再送判定と予約運転に使う）
+#define NTP_SERVER "pool.ntp.org"
+
+// 予約運転（/api/schedules、README の「予約運転」）
+// 登録できる予約の数、予約の時刻を解釈するタイムゾーン（UTCからの分。夏時間は扱わない）と、
+// SNTPで時刻を合わせ直す間隔（ミリ秒）。同期の間は、同期ごとに測った水晶のずれで時刻を補正する
+#define SCHEDULE_MAX_ENTRIES 16
+#define SCHEDULE_UTC_OFFSET_MINUTES 540
+#define SNTP_SYNC_INTERVAL_MS 3600000
+
+// 電源投入プラン（POST /api/plan/<名前>、README の「電源投入プラン」）
+// ステップ: {チャンネル, 準備完了の判定, {{先行ステップのチャンネル, 先行が準備完了してから押すまでのミリ秒}, ...}}
+//   判定: "" ならパルス終了、"sense" なら電源LED入力がON、"<IPアドレス>:<ポート>" ならTCP接続できたとき
+// powerPlan(名前, ステップ, 同時に起動中にするステップ数の上限（0なら上限なし）, 準備完了を待つ上限ミリ秒)
+// 依存関係が許す限り並行して押す。電源LED入力でON、または押す前にTCP接続できたPCは押さない
+#include "power_plan.h"
+// プランを書くまでは NO_POWER_PLAN（例は config.h.example と README の「電源投入プラン」）
+constexpr PowerPlan POWER_PLANS[] = {
+    NO_POWER_PLAN,
+};
+
+// 目標状態（PUT /api/state/<チャンネル>、README の「目標状態」）
+// 電源LED入力のないチャンネルの電源状態を確かめるTCP接続先（"<IPアドレス>:<ポート>"、使わないチャンネルは ""）。
+// PHOTOCOUPLER_PINS と同じ順番・同じ数で設定する。電源LED入力もこの接続先もないチャンネルには目標を置けない
+// 実在しないアドレスを書くと電源が入っているPCもOFFと見なして押すので、確かめたアドレスだけを書く（例は README）
+#include "power_reconcile.h"
+constexpr const char* POWER_STATE_PROBES[] = {
+    "",  // proxmox001
+    "",  // proxmox002
+    "",  // proxmox003
+    "",  // proxmox004
+    "",  // proxmox005
+    "",  // proxmox006
+    "",  // proxmox007
+    "",  // PC08
+    "",  // PC09
+    "",  // PC10
+    "",  // PC11
+    "",  // PC12
+    "",  // PC13
+    "",  // PC14
+    "",  // PC15
+    "",  // PC16
+    "",  // PC17
+    "",  // PC18
+    ""   // PC19
+};
+
+// 目標と違うときに押す通常押しの回数（使い切ったら長押しに上げる）と、
+// 通常押しのあと電源が入る・切れるまで待つ時間（ミリ秒、起動・シャットダウンにかかる時間より長く）
+#define RECONCILE_MAX_PRESSES 2
+#define RECONCILE_ON_TIMEOUT_MS 120000
+#define RECONCILE_OFF_TIMEOUT_MS 90000
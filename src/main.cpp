@@ -1,188 +1,1440 @@
 #include <Arduino.h>
 #include <WiFi.h>
-#ifndef ASYNCWEBSERVER_REGEX
-#define ASYNCWEBSERVER_REGEX
-#endif
+#include <AsyncUDP.h>
 #include <ESPAsyncWebServer.h>
-#include <vector>
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <Wire.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include <mbedtls/md.h>
+#include <soc/gpio_struct.h>
+#include <sys/time.h>
+#include <time.h>
 #include "config.h"
+#include "audit_log.h"
+#include "channel_bitset.h"
+#include "gpio_mask.h"
+#include "io_expander.h"
+#include "json_writer.h"
+#include "metrics.h"
+#include "mpsc_ring.h"
+#include "power_api.h"
+#include "power_commands.h"
+#include "power_events.h"
+#include "power_plan.h"
+#include "power_reconcile.h"
+#include "power_schedule.h"
+#include "power_sense.h"
+#include "pulse_engine.h"
+#include "router.h"
+#include "trace.h"
+#include "udp_command.h"
 #include "web_ui.h"
+#include "wifi_connection.h"
+#include "wol.h"
 
 // Webサーバインスタンス
 AsyncWebServer server(WEB_SERVER_PORT);
 
-// 各PCの状態を保存（trueならON状態と仮定）
-bool pcStates[4] = {false, false, false, false};
+// 状態変化のプッシュ配信（Server-Sent Events）
+AsyncEventSource events("/api/events");
+
+static_assert(sizeof(POWER_SENSE_PINS) / sizeof(POWER_SENSE_PINS[0]) == NUM_PHOTOCOUPLERS,
+              "POWER_SENSE_PINS must have one entry per photocoupler (-1 if unused)");
+
+// 各PCの状態を保存（trueならON状態）
+// 電源LED入力があるチャンネルはサンプラが実測値を、ないチャンネルは押下ごとの反転で推定値を書く
+ChannelBitset<NUM_PHOTOCOUPLERS> pcStates;
+
+// 電源LED入力を持つチャンネル
+ChannelBitset<NUM_PHOTOCOUPLERS> sensedChannels;
+
+// 離す書き込みがエキスパンダに届かず、やり直しているチャンネル（/api/status の stuck と /api/metrics）
+ChannelBitset<NUM_PHOTOCOUPLERS> stuckOutputs;
+std::atomic<uint32_t> releaseRetries(0);
+
+// 最後の押下がピンに書けず、押せなかったチャンネル（/api/status の pressFailed、次に押せたら消す）
+ChannelBitset<NUM_PHOTOCOUPLERS> pressFailed;
+
+// パルス開始・終了イベントの受け渡し
+// AsyncTCPタスクとesp_timerタスクから投入し、loop()でSSEクライアントへ送る
+MpscRing<PowerEvent, 64> powerEventQueue;
+
+// /api/metrics の計測値（ハンドラとパルス状態機械からアトミックに加算する）
+struct DeviceClock {
+    static uint64_t nowUs() { return (uint64_t)esp_timer_get_time(); }
+    static uint32_t threadId() { return (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle(); }
+};
+HttpMetrics httpMetrics;
+PulseMetrics<NUM_PHOTOCOUPLERS> pulseMetrics;
+std::atomic<uint32_t> wifiConnects(0);
+
+typedef RouteTimer<DeviceClock> DeviceRouteTimer;
+
+// 要求と電源操作のトレース（/api/trace）。tid はFreeRTOSのタスクハンドル
+typedef TraceBuffer<DeviceClock, TRACE_BUFFER_EVENTS> DeviceTraceBuffer;
+DeviceTraceBuffer traceBuffer;
+
+void publishPowerEvent(int channel, PowerEventType type, PulseKind kind) {
+    PowerEvent event = makePowerEvent(channel, type, kind, pcStates.test(channel));
+    if (!powerEventQueue.tryPush(event)) {
+        Serial.println("Power event queue full, event dropped");
+    }
+}
+
+// 監査ログの保存先（LittleFS上の固定長ファイル。セクタ単位でしか書かない）
+class LittleFsAuditStorage {
+public:
+    bool begin(const char *path, size_t size) {
+        if (!LittleFS.begin(true)) return false;
+        if (fileSize(path) != size) {
+            // 新規作成（またはレコード数の変更）なのでゼロで埋めた空のログを作る
+            File created = LittleFS.open(path, "w");
+            if (!created) return false;
+            uint8_t zero[256] = {};
+            for (size_t n = 0; n < size; n += sizeof(zero)) created.write(zero, sizeof(zero));
+            created.close();
+        }
+        file_ = LittleFS.open(path, "r+");
+        return (bool)file_;
+    }
+
+    bool read(size_t offset, void *data, size_t len) {
+        if (!file_ || !file_.seek(offset)) return false;
+        return file_.read((uint8_t *)data, len) == len;
+    }
+
+    bool write(size_t offset, const void *data, size_t len) {
+        if (!file_ || !file_.seek(offset)) return false;
+        return file_.write((const uint8_t *)data, len) == len;
+    }
+
+    void sync() {
+        if (file_) file_.flush();
+    }
+
+private:
+    static size_t fileSize(const char *path) {
+        if (!LittleFS.exists(path)) return 0;
+        File f = LittleFS.open(path, "r");
+        size_t size = f ? f.size() : 0;
+        f.close();
+        return size;
+    }
+
+    File file_;
+};
+
+// 電源操作の監査ログ（/api/audit）
+// 記録はどのタスクからでもキューに積み、loop() がログへ移してフラッシュへ書く
+typedef AuditLog<LittleFsAuditStorage, AUDIT_LOG_RECORDS> DeviceAuditLog;
+LittleFsAuditStorage auditStorage;
+DeviceAuditLog auditLog(auditStorage, AUDIT_FLUSH_INTERVAL_MS);
+MpscRing<AuditRecord, 64> auditQueue;
+
+// SNTPで時刻が合うまでは0
+uint32_t currentUnixTime() {
+    time_t now = time(nullptr);
+    return now > 1600000000 ? (uint32_t)now : 0;
+}
+
+void recordAudit(AuditEvent event, AuditResult result, AuditSource source, int channel, PulseKind kind,
+                 uint32_t client, uint32_t arg, uint8_t maskWord = 0) {
+    AuditRecord record = makeAuditRecord(event, result, source, channel, kind, client, arg,
+                                         (uint32_t)(DeviceClock::nowUs() / 1000ULL), currentUnixTime(), maskWord);
+    if (!auditQueue.tryPush(record)) {
+        Serial.println("Audit queue full, record dropped");
+    }
+}
+
+// 一括押しはチャンネルマスクを32チャンネルずつのレコードに分けて残す（空のワードは書かない）
+void recordBatchAudit(AuditResult result, AuditSource source, uint32_t client,
+                      const ChannelMask<NUM_PHOTOCOUPLERS> &channels) {
+    for (int i = 0; i < ChannelMask<NUM_PHOTOCOUPLERS>::WORDS; i++) {
+        if (!channels.words[i]) continue;
+        recordAudit(AuditEvent::Batch, result, source, -1, PulseKind::Short, client, channels.words[i], (uint8_t)i);
+    }
+}
+
+void initAuditLog() {
+    if (!auditStorage.begin("/audit.bin", DeviceAuditLog::FILE_BYTES)) {
+        Serial.println("LittleFS mount failed, audit log is kept in RAM only");
+    }
+    auditLog.begin();
+    Serial.printf("Audit log ready (boot %u, next seq %lu)\n", (unsigned)auditLog.boot(),
+                  (unsigned long)auditLog.nextSeq());
+}
+
+// loop() から呼ぶ。フラッシュへの書き込みはここだけで行う
+void pumpAuditLog() {
+    AuditRecord record;
+    while (auditQueue.tryPop(record)) auditLog.append(record);
+    auditLog.flushIfDue(millis());
+}
+
+// チャンネルごとの出力先（本体のGPIOのビットとエキスパンダのピン、コンパイル時に計算）
+static_assert(channelOutputsValid(PHOTOCOUPLER_PINS, IO_EXPANDERS, IO_EXPANDER_SDA_PIN, IO_EXPANDER_SCL_PIN),
+              "PHOTOCOUPLER_PINS / IO_EXPANDERS: invalid or duplicate pin, unknown expander, or pin used by I2C");
+constexpr int NUM_IO_EXPANDERS = sizeof(IO_EXPANDERS) / sizeof(IO_EXPANDERS[0]);
+constexpr ChannelOutputMap<NUM_PHOTOCOUPLERS, NUM_IO_EXPANDERS> OUTPUT_MAP =
+    buildChannelOutputMap(PHOTOCOUPLER_PINS, IO_EXPANDERS);
+
+// 出力の実機バインディング（GPIOレジスタと Wire）
+struct DeviceChannelHw {
+    // バンクごとに1回のレジスタ書き込みでまとめて変更する
+    void gpioWrite(const GpioBankMask &mask, bool level) {
+        if (level) {
+            if (mask.low) GPIO.out_w1ts = mask.low;
+            if (mask.high) GPIO.out1_w1ts.val = mask.high;
+        } else {
+            if (mask.low) GPIO.out_w1tc = mask.low;
+            if (mask.high) GPIO.out1_w1tc.val = mask.high;
+        }
+    }
+    bool i2cWrite(uint8_t address, const uint8_t *data, size_t len) {
+        Wire.beginTransmission(address);
+        Wire.write(data, len);
+        return Wire.endTransmission() == 0;
+    }
+    // バスに書くのは起動時の begin() とコマンドワーカーだけ（esp_timer タスクは本体のGPIOしか触らない）
+    void lockBus() { busMutex.lock(); }
+    void unlockBus() { busMutex.unlock(); }
+    std::mutex busMutex;
+};
+
+DeviceChannelHw channelHw;
+ChannelDriver<NUM_PHOTOCOUPLERS, NUM_IO_EXPANDERS, DeviceChannelHw> channelDriver(channelHw, OUTPUT_MAP,
+                                                                                 IO_EXPANDERS);
+
+// パルス状態機械の実機バインディング（esp_timer が期限を知らせ、コマンドワーカーがピンを解放する）
+// 離す書き込みの失敗は releaseExpiredPulses() がやり直し、押す書き込みの失敗は onPulseFailed() で知らせる
+struct DevicePulsePlatform {
+    bool writePin(int channel, bool level) { return channelDriver.write(channel, level); }
+    // 複数チャンネルをGPIOのバンクごと・エキスパンダごとに1回の書き込みでまとめて変更する
+    bool writeMask(const ChannelMask<NUM_PHOTOCOUPLERS> &channels, bool level) {
+        return channelDriver.write(channels, level);
+    }
+    void armTimer(int channel, uint32_t durationMs);
+    void onPulseStart(int channel, PulseKind kind) {
+        pressFailed.set(channel, false);
+        pulseMetrics.started(channel, kind, DeviceClock::nowUs());
+        traceBuffer.record(TracePoint::Pulse, TracePhase::AsyncBegin, channel, (uint8_t)kind);
+        publishPowerEvent(channel, PowerEventType::PulseStart, kind);
+        recordAudit(AuditEvent::PulseStart, AuditResult::Started, AuditSource::Internal, channel, kind, 0,
+                    kind == PulseKind::Long ? POWER_LONG_PRESS_MS : POWER_PULSE_MS);
+    }
+    void onPulseComplete(int channel, PulseKind kind);
+    // 押せなかった（状態は変えない）
+    void onPulseFailed(int channel, PulseKind kind) {
+        pressFailed.set(channel, true);
+        traceBuffer.record(TracePoint::PulseFailed, TracePhase::Instant, channel, (uint8_t)kind);
+        publishPowerEvent(channel, PowerEventType::PulseFailed, kind);
+        recordAudit(AuditEvent::PulseStart, AuditResult::IoError, AuditSource::Internal, channel, kind, 0, 0);
+        Serial.printf("I/O expander write failed, %s power button not pressed\n", PC_NAMES[channel]);
+    }
+};
+
+DevicePulsePlatform pulsePlatform;
+PulseEngine<NUM_PHOTOCOUPLERS, DevicePulsePlatform> pulseEngine(pulsePlatform);
+
+// チャンネルごとのワンショットタイマー。期限が来たチャンネルは releaseDue に立て、ワーカーが離す
+esp_timer_handle_t pulseTimers[NUM_PHOTOCOUPLERS];
+ChannelBitset<NUM_PHOTOCOUPLERS> releaseDue;
+ChannelMask<NUM_PHOTOCOUPLERS> releaseRetrying;  // 離すのをやり直しているパルス（先頭チャンネル、ワーカーだけが触る）
+
+void DevicePulsePlatform::armTimer(int channel, uint32_t durationMs) {
+    esp_timer_start_once(pulseTimers[channel], (uint64_t)durationMs * 1000ULL);
+}
+
+void DevicePulsePlatform::onPulseComplete(int channel, PulseKind kind) {
+    pulseMetrics.completed(channel, DeviceClock::nowUs());
+    traceBuffer.record(TracePoint::Pulse, TracePhase::AsyncEnd, channel, (uint8_t)kind);
+    recordAudit(AuditEvent::PulseEnd, AuditResult::Completed, AuditSource::Internal, channel, kind, 0, 0);
+    if (sensedChannels.test(channel)) {
+        // 実測しているチャンネルはサンプラが状態を更新する
+        publishPowerEvent(channel, PowerEventType::PulseEnd, kind);
+        Serial.printf("%s power button released\n", PC_NAMES[channel]);
+    } else if (kind == PulseKind::Long) {
+        // 強制シャットダウンなので状態はOFF
+        pcStates.set(channel, false);
+        publishPowerEvent(channel, PowerEventType::PulseEnd, kind);
+        Serial.printf("%s power button long pressed (forced shutdown)\n", PC_NAMES[channel]);
+    } else {
+        // 状態を反転（簡易的な状態管理）
+        pcStates.flip(channel);
+        publishPowerEvent(channel, PowerEventType::PulseEnd, kind);
+        Serial.printf("%s power button pressed\n", PC_NAMES[channel]);
+    }
+}
+
+// 電源操作コマンドのキューと常駐ワーカー
+// HTTPハンドラはキューに積んでワーカーを起こすだけで、パルスの開始はワーカータスクが行う
+PowerCommandQueue<NUM_PHOTOCOUPLERS, POWER_COMMAND_QUEUE_SIZE> powerCommands;
+TaskHandle_t commandWorker = nullptr;
+
+// ワーカーを起こす（キュー投入時とパルス完了時）
+void wakeCommandWorker() {
+    if (commandWorker) xTaskNotifyGive(commandWorker);
+}
 
 // フォトカプラ初期化
 void initPhotocouplers() {
+    if (OUTPUT_MAP.usesExpanders()) {
+        Wire.begin(IO_EXPANDER_SDA_PIN, IO_EXPANDER_SCL_PIN, IO_EXPANDER_I2C_HZ);
+        if (!channelDriver.begin()) Serial.println("I/O expander not responding, will retry on first press");
+    }
     for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
-        pinMode(PHOTOCOUPLER_PINS[i], OUTPUT);
-        digitalWrite(PHOTOCOUPLER_PINS[i], LOW);
+        if (!isExpanderPin(PHOTOCOUPLER_PINS[i])) {
+            pinMode(PHOTOCOUPLER_PINS[i], OUTPUT);
+            digitalWrite(PHOTOCOUPLER_PINS[i], LOW);
+        }
+
+        esp_timer_create_args_t args = {};
+        args.callback = [](void *arg) {
+            int channel = (int)(intptr_t)arg;
+            // 本体のGPIOは時間どおりにここで離す。I2Cはバスを待つことがあるので、エキスパンダはワーカーが離す
+            channelDriver.writeNative(pulseEngine.pulseChannels(channel), false);
+            releaseDue.set(channel, true);
+            wakeCommandWorker();
+        };
+        args.arg = (void *)(intptr_t)i;
+        args.dispatch_method = ESP_TIMER_TASK;
+        args.name = "pulse";
+        esp_timer_create(&args, &pulseTimers[i]);
     }
     Serial.println("Photocouplers initialized");
 }
 
-// PC電源ボタンを押す（パルス信号を送る）
-void pressPowerButton(int pcIndex) {
-    if (pcIndex < 0 || pcIndex >= NUM_PHOTOCOUPLERS) {
-        Serial.println("Invalid PC index");
+// 電源LED入力のデバウンスとサンプリング用タイマー
+PowerSenseDebouncer<NUM_PHOTOCOUPLERS, POWER_SENSE_DEBOUNCE_SAMPLES> powerSenseDebouncer;
+esp_timer_handle_t powerSenseTimer;
+
+// 周期サンプリング（esp_timerタスクで実行）
+void samplePowerSense() {
+    for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
+        if (!sensedChannels.test(i)) continue;
+        bool on = digitalRead(POWER_SENSE_PINS[i]) == (POWER_SENSE_ACTIVE_LOW ? LOW : HIGH);
+        if (powerSenseDebouncer.sample(i, on)) {
+            pcStates.set(i, powerSenseDebouncer.stable(i));
+            publishPowerEvent(i, PowerEventType::State, PulseKind::Short);
+            Serial.printf("%s power state sensed: %s\n", PC_NAMES[i], on ? "ON" : "OFF");
+        }
+    }
+}
+
+// 電源LED入力の初期化（設定されたチャンネルがなければ何もしない）
+void initPowerSense() {
+    for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
+        if (POWER_SENSE_PINS[i] < 0) continue;
+        pinMode(POWER_SENSE_PINS[i], INPUT);
+        sensedChannels.set(i, true);
+    }
+    if (!sensedChannels.any()) return;
+
+    esp_timer_create_args_t args = {};
+    args.callback = [](void *) { samplePowerSense(); };
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "powerSense";
+    esp_timer_create(&args, &powerSenseTimer);
+    esp_timer_start_periodic(powerSenseTimer, (uint64_t)POWER_SENSE_INTERVAL_MS * 1000ULL);
+    Serial.println("Power sense inputs initialized");
+}
+
+// キューから取り出したコマンドでパルスを開始する（ワーカータスクで実行）
+PulseResult startPowerCommand(int pcIndex, PulseKind kind) {
+    uint32_t durationMs = kind == PulseKind::Long ? POWER_LONG_PRESS_MS : POWER_PULSE_MS;
+    PulseResult result = pulseEngine.begin(pcIndex, kind, durationMs);
+    traceCommandStart(traceBuffer, pcIndex, kind, result);
+    if (result == PulseResult::Pending) {
+        char pin[24];
+        formatOutputPin(pin, sizeof(pin), PHOTOCOUPLER_PINS[pcIndex]);
+        if (kind == PulseKind::Long) {
+            Serial.printf("Long pressing power button for %s (%s) - %dms\n", PC_NAMES[pcIndex], pin,
+                          POWER_LONG_PRESS_MS);
+        } else {
+            Serial.printf("Pressing power button for %s (%s)\n", PC_NAMES[pcIndex], pin);
+        }
+    }
+    return result;
+}
+
+// キューから取り出した一括押しを始める（ワーカータスクで実行、maxConcurrent 台ずつのウェーブに分ける）
+PulseBatchResult<NUM_PHOTOCOUPLERS> startBatchCommand(const ChannelMask<NUM_PHOTOCOUPLERS> &channels,
+                                                      int maxConcurrent) {
+    PulseBatchResult<NUM_PHOTOCOUPLERS> result =
+        pulseEngine.beginBatch(channels, PulseKind::Short, POWER_PULSE_MS, maxConcurrent);
+    channels.forEach([&](int channel) {
+        if (result.busy.test(channel)) return;
+        traceCommandStart(traceBuffer, channel, PulseKind::Short,
+                          result.failed.test(channel) ? PulseResult::IoError : PulseResult::Pending);
+    });
+    Serial.printf("Batch press: %d started, %d queued, %d busy, %d failed (%d waves)\n", result.started.count(),
+                  result.queued.count(), result.busy.count(), result.failed.count(), result.waves);
+    return result;
+}
+
+// 期限が来たパルスを離す（ワーカータスクで実行）。エキスパンダに書けなければチャンネルを空けずに
+// タイマーを張り直し、離せるまでやり直す。その間、書けなかったエキスパンダのチャンネルを stuckOutputs に載せる
+void releaseExpiredPulses() {
+    releaseDue.take().forEach([](int channel) {
+        ChannelMask<NUM_PHOTOCOUPLERS> channels = pulseEngine.pulseChannels(channel);
+        if (pulseEngine.release(channel)) {
+            if (releaseRetrying.test(channel)) Serial.printf("%s power button released after retry\n", PC_NAMES[channel]);
+            releaseRetrying.set(channel, false);
+            stuckOutputs.set(channels, false);
+            return;
+        }
+        ChannelMask<NUM_PHOTOCOUPLERS> failed = channelDriver.failed(channels);
+        if (!releaseRetrying.test(channel)) {
+            Serial.printf("I/O expander write failed, %s power button still pressed (retrying)\n",
+                          PC_NAMES[failed.any() ? failed.first() : channel]);
+        }
+        releaseRetrying.set(channel);
+        stuckOutputs.set(channels, false);
+        stuckOutputs.set(failed, true);
+        releaseRetries.fetch_add(1, std::memory_order_relaxed);
+        esp_timer_start_once(pulseTimers[channel], (uint64_t)IO_EXPANDER_RETRY_MS * 1000ULL);
+    });
+}
+
+// 常駐ワーカー：通知を待ってパルスを離し、キューを処理する。パルス実行中のチャンネルは完了通知で再試行する
+void commandWorkerTask(void *) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        releaseExpiredPulses();
+        TraceScope<DeviceTraceBuffer> span(traceBuffer, TracePoint::Drain);
+        powerCommands.drain(startPowerCommand, startBatchCommand);
+    }
+}
+
+void initCommandWorker() {
+    xTaskCreatePinnedToCore(commandWorkerTask, "powerCmd", 3072, nullptr, 2, &commandWorker, 1);
+}
+
+// PC電源ボタンを押す（キューに積むだけ、同じチャンネルの操作は順番に実行される）
+CommandResult pressPowerButton(int pcIndex) {
+    CommandResult result = powerCommands.submit(pcIndex, PulseKind::Short);
+    traceSubmit(traceBuffer, pcIndex, PulseKind::Short, result);
+    if (result == CommandResult::Queued) {
+        wakeCommandWorker();
+    } else if (result == CommandResult::Full) {
+        Serial.printf("Command queue full, press for %s rejected\n", PC_NAMES[pcIndex]);
+    }
+    return result;
+}
+
+// PC電源ボタンを長押し（強制シャットダウン用）
+// 通常押しと同じキューを通るので、同じピンでパルスが重なることはない
+CommandResult longPressPowerButtonAsync(int pcIndex) {
+    CommandResult result = powerCommands.submit(pcIndex, PulseKind::Long);
+    traceSubmit(traceBuffer, pcIndex, PulseKind::Long, result);
+    if (result == CommandResult::Queued) {
+        wakeCommandWorker();
+    } else if (result == CommandResult::Full) {
+        Serial.printf("Command queue full, long press for %s rejected\n", PC_NAMES[pcIndex]);
+    }
+    return result;
+}
+
+// 複数PCの電源ボタンを同時に押す（1件の要求としてキューに積む。チャンネルごとのまとめ・順番は通常押しと同じ）
+BatchSubmitResult<NUM_PHOTOCOUPLERS> pressPowerButtonBatch(const ChannelMask<NUM_PHOTOCOUPLERS> &channels,
+                                                           int maxConcurrent) {
+    BatchSubmitResult<NUM_PHOTOCOUPLERS> result = powerCommands.submitBatch(channels, maxConcurrent);
+    channels.forEach([&](int channel) {
+        traceSubmit(traceBuffer, channel, PulseKind::Short,
+                    result.queued.test(channel) ? CommandResult::Queued
+                    : result.coalesced.test(channel) ? CommandResult::Coalesced : result.result);
+    });
+    if (result.result == CommandResult::Queued) {
+        wakeCommandWorker();
+    } else if (result.result == CommandResult::Full) {
+        Serial.println("Command queue full, batch press rejected");
+    }
+    return result;
+}
+
+// Wake-on-LAN マジックパケットの受信（UDPポート7と9）
+static_assert(sizeof(PC_MAC_ADDRESSES) / sizeof(PC_MAC_ADDRESSES[0]) == NUM_PHOTOCOUPLERS,
+              "PC_MAC_ADDRESSES must have one entry per photocoupler (\"\" if unused)");
+static_assert(macTableValid(PC_MAC_ADDRESSES), "PC_MAC_ADDRESSES has a malformed or duplicate MAC address");
+constexpr MacChannelTable<NUM_PHOTOCOUPLERS> WOL_TABLE = buildMacChannelTable(PC_MAC_ADDRESSES);
+const uint16_t WOL_PORTS[] = {7, 9};
+AsyncUDP wolUdp[sizeof(WOL_PORTS) / sizeof(WOL_PORTS[0])];
+WolCooldown<NUM_PHOTOCOUPLERS> wolCooldown;
+
+uint32_t ipv4Address(const IPAddress &ip) {
+    return ((uint32_t)ip[0] << 24) | ((uint32_t)ip[1] << 16) | ((uint32_t)ip[2] << 8) | (uint32_t)ip[3];
+}
+
+// 受信したマジックパケットを /api/power と同じ経路で処理する（AsyncUDPのタスクで実行）
+void handleMagicPacket(const uint8_t *data, size_t len, uint32_t client) {
+    uint64_t mac;
+    if (!parseMagicPacket(data, len, mac)) return;
+    int pcIndex = WOL_TABLE.lookup(mac);
+    if (pcIndex < 0) return;  // 他のマシン宛て
+
+    // 電源LED入力でONと分かっていれば押さない（押すと切れてしまう）
+    if (sensedChannels.test(pcIndex) && pcStates.test(pcIndex)) {
+        Serial.printf("%s is already on, magic packet ignored\n", PC_NAMES[pcIndex]);
+        recordAudit(AuditEvent::Press, AuditResult::Skipped, AuditSource::Wol, pcIndex, PulseKind::Short, client, 0);
         return;
     }
-    
-    Serial.printf("Pressing power button for %s (GPIO %d)\n", 
-                  PC_NAMES[pcIndex], PHOTOCOUPLER_PINS[pcIndex]);
-    
-    digitalWrite(PHOTOCOUPLER_PINS[pcIndex], HIGH);
-    delay(POWER_PULSE_MS);
-    digitalWrite(PHOTOCOUPLER_PINS[pcIndex], LOW);
-    
-    // 状態を反転（簡易的な状態管理）
-    pcStates[pcIndex] = !pcStates[pcIndex];
-    
-    Serial.printf("%s power button pressed\n", PC_NAMES[pcIndex]);
+    if (!wolCooldown.tryAcquire(pcIndex, millis(), WOL_COOLDOWN_MS)) {
+        recordAudit(AuditEvent::Press, AuditResult::Skipped, AuditSource::Wol, pcIndex, PulseKind::Short, client, 0);
+        return;
+    }
+    CommandResult result = pressPowerButton(pcIndex);
+    recordAudit(AuditEvent::Press, auditResultOf(result), AuditSource::Wol, pcIndex, PulseKind::Short, client,
+                POWER_PULSE_MS);
+    Serial.printf("Magic packet for %s\n", PC_NAMES[pcIndex]);
 }
 
-// PC電源ボタンを長押し（強制シャットダウン用）を非同期で実行してWDTを回避
-void longPressPowerButtonAsync(int pcIndex) {
-    if (pcIndex < 0 || pcIndex >= NUM_PHOTOCOUPLERS) {
-        Serial.println("Invalid PC index");
+void initWakeOnLan() {
+    if (WOL_TABLE.count == 0) return;
+    for (size_t i = 0; i < sizeof(WOL_PORTS) / sizeof(WOL_PORTS[0]); i++) {
+        if (!wolUdp[i].listen(WOL_PORTS[i])) {
+            Serial.printf("Cannot listen for Wake-on-LAN on UDP port %u\n", WOL_PORTS[i]);
+            continue;
+        }
+        wolUdp[i].onPacket([](AsyncUDPPacket &packet) {
+            handleMagicPacket(packet.data(), packet.length(), ipv4Address(packet.remoteIP()));
+        });
+    }
+    Serial.printf("Wake-on-LAN listening for %d PCs\n", WOL_TABLE.count);
+}
+
+// 認証付きUDP制御プロトコル（UDP_COMMAND_PORT、鍵は UDP_COMMAND_KEY、押せるのはチャンネル0〜63）
+// 鍵を固定したHMAC-SHA256（mbedtlsがESP32のSHAアクセラレータで計算する）
+// 鍵の処理は begin() で1回だけ行い、パケットごとには reset から始める
+class MbedtlsHmacSha256 {
+public:
+    bool begin(const char *key) {
+        mbedtls_md_init(&ctx_);
+        if (mbedtls_md_setup(&ctx_, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) != 0) return false;
+        return mbedtls_md_hmac_starts(&ctx_, (const unsigned char *)key, strlen(key)) == 0;
+    }
+
+    void operator()(const void *data, size_t len, uint8_t tag[32]) {
+        mbedtls_md_hmac_reset(&ctx_);
+        mbedtls_md_hmac_update(&ctx_, (const unsigned char *)data, len);
+        mbedtls_md_hmac_finish(&ctx_, tag);
+    }
+
+private:
+    mbedtls_md_context_t ctx_;
+};
+
+AsyncUDP commandUdp;
+MbedtlsHmacSha256 commandHmac;
+UdpCommandServer<NUM_PHOTOCOUPLERS, 16> udpCommands(UDP_COMMAND_MAX_SKEW_S);
+
+// SNTPで時刻が合うまでは0（再送の判定は受信済みの表だけで行う）
+uint64_t currentUnixTimeUs() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec > 1600000000 ? (uint64_t)tv.tv_sec * 1000000ULL + (uint64_t)tv.tv_usec : 0;
+}
+
+// 受信した要求を /api/power・/api/longpress と同じキューに積み、ACKを返す（AsyncUDPのタスクで実行）
+void handleUdpCommand(AsyncUDPPacket &packet) {
+    uint32_t client = ipv4Address(packet.remoteIP());
+    auto submit = [client](int pcIndex, PulseKind kind) {
+        bool isLong = kind == PulseKind::Long;
+        CommandResult result = isLong ? longPressPowerButtonAsync(pcIndex) : pressPowerButton(pcIndex);
+        recordAudit(isLong ? AuditEvent::LongPress : AuditEvent::Press, auditResultOf(result), AuditSource::Udp,
+                    pcIndex, kind, client, isLong ? POWER_LONG_PRESS_MS : POWER_PULSE_MS);
+        return result;
+    };
+    uint8_t reply[UDP_COMMAND_ACK_BYTES];
+    size_t len = udpCommands.handle(packet.data(), packet.length(), currentUnixTimeUs(), commandHmac, submit,
+                                    [] { return powerCommands.depth(); }, reply, sizeof(reply));
+    if (len > 0) packet.write(reply, len);
+}
+
+void initUdpCommand() {
+    if (UDP_COMMAND_KEY[0] == '\0') return;
+    if (!commandHmac.begin(UDP_COMMAND_KEY) || !commandUdp.listen(UDP_COMMAND_PORT)) {
+        Serial.printf("Cannot start UDP command protocol on port %u\n", UDP_COMMAND_PORT);
         return;
     }
+    commandUdp.onPacket(handleUdpCommand);
+    Serial.printf("UDP command protocol listening on port %u\n", UDP_COMMAND_PORT);
+}
 
-    xTaskCreatePinnedToCore(
-        [](void *param) {
-            int idx = (int)(intptr_t)param;
-            Serial.printf("Long pressing power button for %s (GPIO %d) - %dms\n",
-                          PC_NAMES[idx], PHOTOCOUPLER_PINS[idx], POWER_LONG_PRESS_MS);
+// 電源投入プラン（/api/plan）
+// 専用タスクで回す。準備完了のTCP確認は接続を待つ（ブロックする）ので、ロックの外で行う
+static_assert(powerPlansValid(POWER_PLANS, NUM_PHOTOCOUPLERS),
+              "POWER_PLANS has an unknown or duplicate channel, a cycle, or a malformed readiness check");
+
+struct DevicePlanPlatform {
+    CommandResult press(int channel) {
+        CommandResult result = pressPowerButton(channel);
+        recordAudit(AuditEvent::Press, auditResultOf(result), AuditSource::Plan, channel, PulseKind::Short, 0,
+                    POWER_PULSE_MS);
+        return result;
+    }
 
-            digitalWrite(PHOTOCOUPLER_PINS[idx], HIGH);
-            vTaskDelay(pdMS_TO_TICKS(POWER_LONG_PRESS_MS));
-            digitalWrite(PHOTOCOUPLER_PINS[idx], LOW);
+    int powerState(int channel) { return sensedChannels.test(channel) ? (pcStates.test(channel) ? 1 : 0) : -1; }
+};
 
-            // 強制シャットダウンなので状態はOFF
-            pcStates[idx] = false;
-            Serial.printf("%s power button long pressed (forced shutdown)\n", PC_NAMES[idx]);
-            vTaskDelete(nullptr);
-        },
-        "longPressTask",
-        2048,                  // stack size
-        (void *)(intptr_t)pcIndex,
-        1,                     // priority
-        nullptr,
-        1                      // run on core 1 (same as WiFi/AsyncWebServer)
-    );
+static const uint32_t PLAN_POLL_MS = 100;
+static const int PLAN_PROBE_TIMEOUT_MS = 1000;
+
+DevicePlanPlatform planPlatform;
+PlanRunner<NUM_PHOTOCOUPLERS, DevicePlanPlatform> planRunner(planPlatform, POWER_PULSE_MS);
+std::mutex planMutex;
+TaskHandle_t planTaskHandle = nullptr;
+
+// 実行中は PLAN_POLL_MS ごとに回し、それ以外は /api/plan から起こされるまで寝る
+void planTask(void *) {
+    PlanProbe probes[PLAN_MAX_PROBES_PER_POLL];
+    for (;;) {
+        int count;
+        bool running;
+        {
+            std::lock_guard<std::mutex> lock(planMutex);
+            PlanState before = planRunner.state();
+            planRunner.poll(millis());
+            count = planRunner.dueProbes(millis(), probes, PLAN_MAX_PROBES_PER_POLL);
+            running = planRunner.running();
+            if (before == PlanState::Running && !running) {
+                Serial.printf("Plan %s %s\n", planRunner.plan()->name, planStateName(planRunner.state()));
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            WiFiClient client;
+            bool reachable = client.connect(probes[i].host, probes[i].port, PLAN_PROBE_TIMEOUT_MS);
+            client.stop();
+            std::lock_guard<std::mutex> lock(planMutex);
+            planRunner.probeResult(probes[i], reachable, millis());
+        }
+        ulTaskNotifyTake(pdTRUE, running || count > 0 ? pdMS_TO_TICKS(PLAN_POLL_MS) : portMAX_DELAY);
+    }
 }
 
-// Wi-Fi接続
-void connectWiFi() {
-    Serial.print("Connecting to WiFi");
-    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-    
-    int attempts = 0;
-    while (WiFi.status() != WL_CONNECTED && attempts < 30) {
-        delay(500);
-        Serial.print(".");
-        attempts++;
+void initPlanRunner() {
+    xTaskCreatePinnedToCore(planTask, "plan", 4096, nullptr, 1, &planTaskHandle, 1);
+}
+
+// 予約運転（/api/schedules）
+// 表はNVSに保存する。SNTPの同期ごとに時計を合わせ、専用タスクが次の予約の時刻まで寝る
+struct DeviceSchedulePlatform {
+    CommandResult press(int channel, PulseKind kind) {
+        bool isLong = kind == PulseKind::Long;
+        CommandResult result = isLong ? longPressPowerButtonAsync(channel) : pressPowerButton(channel);
+        recordAudit(isLong ? AuditEvent::LongPress : AuditEvent::Press, auditResultOf(result), AuditSource::Schedule,
+                    channel, kind, 0, isLong ? POWER_LONG_PRESS_MS : POWER_PULSE_MS);
+        return result;
     }
-    
-    if (WiFi.status() == WL_CONNECTED) {
-        Serial.println("\nWiFi connected!");
-        Serial.print("IP address: ");
-        Serial.println(WiFi.localIP());
-    } else {
-        Serial.println("\nWiFi connection failed!");
+
+    void skipped(int channel, PulseKind kind) {
+        recordAudit(kind == PulseKind::Long ? AuditEvent::LongPress : AuditEvent::Press, AuditResult::Skipped,
+                    AuditSource::Schedule, channel, kind, 0, 0);
+    }
+
+    int powerState(int channel) { return sensedChannels.test(channel) ? (pcStates.test(channel) ? 1 : 0) : -1; }
+};
+
+typedef ScheduleTable<NUM_PHOTOCOUPLERS, SCHEDULE_MAX_ENTRIES> DeviceScheduleTable;
+typedef ScheduleEntry<NUM_PHOTOCOUPLERS> DeviceScheduleEntry;
+
+class NvsScheduleStore {
+public:
+    bool load(DeviceScheduleTable &table) {
+        Preferences prefs;
+        if (!prefs.begin("schedule", true)) return false;
+        bool ok = prefs.getBytes("table", &table, sizeof(table)) == sizeof(table);
+        prefs.end();
+        return ok;
+    }
+
+    void save(const DeviceScheduleTable &table) {
+        Preferences prefs;
+        if (!prefs.begin("schedule", false)) return;
+        prefs.putBytes("table", &table, sizeof(table));
+        prefs.end();
+    }
+};
+
+// pdMS_TO_TICKS が桁あふれしないよう、これより長くは続けて寝ない
+static const uint32_t SCHEDULE_MAX_SLEEP_MS = 60000;
+
+typedef PowerScheduler<NUM_PHOTOCOUPLERS, SCHEDULE_MAX_ENTRIES, DeviceSchedulePlatform, NvsScheduleStore>
+    DeviceScheduler;
+DeviceSchedulePlatform schedulePlatform;
+NvsScheduleStore scheduleStore;
+DeviceScheduler scheduler(schedulePlatform, scheduleStore, SCHEDULE_UTC_OFFSET_MINUTES);
+std::mutex scheduleMutex;
+TaskHandle_t scheduleTaskHandle = nullptr;
+
+// 予約の変更と時刻の同期で起こされ、次の予約の時刻まで寝る
+void scheduleTask(void *) {
+    for (;;) {
+        uint32_t waitMs;
+        {
+            std::lock_guard<std::mutex> lock(scheduleMutex);
+            uint64_t now = DeviceClock::nowUs();
+            scheduler.poll(now);
+            waitMs = scheduler.msUntilNext(now);
+        }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs < SCHEDULE_MAX_SLEEP_MS ? waitMs : SCHEDULE_MAX_SLEEP_MS));
+    }
+}
+
+void wakeScheduleTask() {
+    if (scheduleTaskHandle) xTaskNotifyGive(scheduleTaskHandle);
+}
+
+// SNTPで時刻が合うたびに呼ばれる（lwIPのタスクで実行）
+void onTimeSync(struct timeval *tv) {
+    int32_t driftPpb;
+    {
+        std::lock_guard<std::mutex> lock(scheduleMutex);
+        scheduler.sync(DeviceClock::nowUs(), (uint64_t)tv->tv_sec * 1000000ULL + (uint64_t)tv->tv_usec);
+        driftPpb = scheduler.clock().driftPpb();
     }
+    wakeScheduleTask();
+    Serial.printf("Time synchronized (clock drift %ld ppb)\n", (long)driftPpb);
 }
 
-// HTMLページを返す（共通ビルダー）
-String getIndexHTML() {
-    std::vector<std::string> names;
+void initScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(scheduleMutex);
+        scheduler.begin();
+    }
+    // 同期の通知と間隔は configTime() より前に設定しておく
+    sntp_set_time_sync_notification_cb(onTimeSync);
+    sntp_set_sync_interval(SNTP_SYNC_INTERVAL_MS);
+    xTaskCreatePinnedToCore(scheduleTask, "schedule", 4096, nullptr, 1, &scheduleTaskHandle, 1);
+}
+
+// 目標状態（/api/state）
+// 専用タスクで回す。電源状態のTCP確認は接続を待つ（ブロックする）ので、ロックの外で行う
+static_assert(sizeof(POWER_STATE_PROBES) / sizeof(POWER_STATE_PROBES[0]) == NUM_PHOTOCOUPLERS,
+              "POWER_STATE_PROBES must have one entry per photocoupler (\"\" if unused)");
+static_assert(stateProbesValid(POWER_STATE_PROBES), "POWER_STATE_PROBES has a malformed \"<host>:<port>\"");
+
+struct DeviceReconcilePlatform {
+    CommandResult press(int channel, PulseKind kind) {
+        bool isLong = kind == PulseKind::Long;
+        CommandResult result = isLong ? longPressPowerButtonAsync(channel) : pressPowerButton(channel);
+        recordAudit(isLong ? AuditEvent::LongPress : AuditEvent::Press, auditResultOf(result), AuditSource::Reconcile,
+                    channel, kind, 0, isLong ? POWER_LONG_PRESS_MS : POWER_PULSE_MS);
+        return result;
+    }
+
+    int powerState(int channel) { return sensedChannels.test(channel) ? (pcStates.test(channel) ? 1 : 0) : -1; }
+};
+
+static const uint32_t RECONCILE_POLL_MS = 500;
+static const int RECONCILE_PROBE_TIMEOUT_MS = 1000;
+
+DeviceReconcilePlatform reconcilePlatform;
+PowerReconciler<NUM_PHOTOCOUPLERS, DeviceReconcilePlatform> reconciler(
+    reconcilePlatform, POWER_STATE_PROBES,
+    {RECONCILE_MAX_PRESSES, RECONCILE_ON_TIMEOUT_MS, RECONCILE_OFF_TIMEOUT_MS, POWER_LONG_PRESS_MS});
+std::mutex reconcileMutex;
+TaskHandle_t reconcileTaskHandle = nullptr;
+
+// 状態が変わったチャンネルをログに出す（reconcileMutex を持って呼ぶ）
+void logReconcileChanges(const ReconcileState (&before)[NUM_PHOTOCOUPLERS]) {
     for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
-        names.emplace_back(PC_NAMES[i]);
+        ReconcileState state = reconciler.state(i);
+        if (state == before[i]) continue;
+        Serial.printf("%s %s (desired %s)\n", PC_NAMES[i], reconcileStateName(state),
+                      desiredPowerName(reconciler.desired(i)));
     }
-    std::string html = buildWebUI(names, "ESP32", "実機", NUM_PHOTOCOUPLERS);
-    return String(html.c_str());
 }
 
-// Webサーバのルート設定
-void setupWebServer() {
-    // ルートページ
-    server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-        request->send(200, "text/html", getIndexHTML());
-    });
-    
-    // API: システム情報取得
-    server.on("/api/info", HTTP_GET, [](AsyncWebServerRequest *request) {
-        String json = "{";
-        json += "\"ip\":\"" + WiFi.localIP().toString() + "\",";
-        json += "\"numPCs\":" + String(NUM_PHOTOCOUPLERS) + ",";
-        json += "\"pcNames\":[";
-        for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
-            json += "\"" + String(PC_NAMES[i]) + "\"";
-            if (i < NUM_PHOTOCOUPLERS - 1) json += ",";
-        }
-        json += "]}";
-        request->send(200, "application/json", json);
-    });
-    
-    // API: PC状態取得
-    server.on("/api/status", HTTP_GET, [](AsyncWebServerRequest *request) {
-        String json = "{\"states\":[";
-        for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
-            json += pcStates[i] ? "true" : "false";
-            if (i < NUM_PHOTOCOUPLERS - 1) json += ",";
-        }
-        json += "]}";
-        request->send(200, "application/json", json);
-    });
-    
-    // API: 電源操作
-    server.on(R"(^/api/power/([0-9]+)$)", HTTP_POST, [](AsyncWebServerRequest *request) {
-        String pcIndexStr = request->pathArg(0);
-        int pcIndex = pcIndexStr.toInt();
-        
-        if (pcIndex >= 0 && pcIndex < NUM_PHOTOCOUPLERS) {
-            pressPowerButton(pcIndex);
-            
-            String json = "{";
-            json += "\"success\":true,";
-            json += "\"message\":\"" + String(PC_NAMES[pcIndex]) + " power button pressed\",";
-            json += "\"pcIndex\":" + String(pcIndex) + ",";
-            json += "\"newState\":" + String(pcStates[pcIndex] ? "true" : "false");
-            json += "}";
-            
-            request->send(200, "application/json", json);
+// 目標のあるチャンネルがある間は RECONCILE_POLL_MS ごとに回し、それ以外は /api/state から起こされるまで寝る
+void reconcileTask(void *) {
+    ReconcileProbe probes[RECONCILE_MAX_PROBES_PER_POLL];
+    static ReconcileState before[NUM_PHOTOCOUPLERS];  // タスクのスタックに置かない（チャンネル数で大きくなる）
+    for (;;) {
+        int count;
+        bool active;
+        {
+            std::lock_guard<std::mutex> lock(reconcileMutex);
+            for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) before[i] = reconciler.state(i);
+            reconciler.poll(millis());
+            count = reconciler.dueProbes(millis(), probes, RECONCILE_MAX_PROBES_PER_POLL);
+            active = reconciler.active();
+            logReconcileChanges(before);
+        }
+        for (int i = 0; i < count; i++) {
+            WiFiClient client;
+            bool reachable = client.connect(probes[i].host, probes[i].port, RECONCILE_PROBE_TIMEOUT_MS);
+            client.stop();
+            std::lock_guard<std::mutex> lock(reconcileMutex);
+            for (int j = 0; j < NUM_PHOTOCOUPLERS; j++) before[j] = reconciler.state(j);
+            reconciler.probeResult(probes[i], reachable, millis());
+            logReconcileChanges(before);
+        }
+        ulTaskNotifyTake(pdTRUE, active ? pdMS_TO_TICKS(RECONCILE_POLL_MS) : portMAX_DELAY);
+    }
+}
+
+void initReconciler() {
+    xTaskCreatePinnedToCore(reconcileTask, "reconcile", 4096, nullptr, 1, &reconcileTaskHandle, 1);
+}
+
+// Wi-Fi接続（shared/wifi_connection.h の状態機械を loop() から回す。setup() は待たない）
+class EspWifiDriver {
+public:
+    void begin(const WifiLease *lease) {
+        if (lease && WIFI_REUSE_IP) {
+            WiFi.config(toIp(lease->ip), toIp(lease->gateway), toIp(lease->subnet), toIp(lease->dns));
+        } else {
+            WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));  // DHCP
+        }
+        if (lease) {
+            WiFi.begin(WIFI_SSID, WIFI_PASSWORD, lease->channel, lease->bssid);
         } else {
-            String json = "{\"success\":false,\"message\":\"Invalid PC index\"}";
-            request->send(400, "application/json", json);
+            WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
         }
+    }
+
+    bool connected() { return WiFi.status() == WL_CONNECTED && (uint32_t)WiFi.localIP() != 0; }
+
+    bool readLease(WifiLease &lease) {
+        const uint8_t *bssid = WiFi.BSSID();
+        if (!bssid) return false;
+        memcpy(lease.bssid, bssid, sizeof(lease.bssid));
+        lease.channel = (uint8_t)WiFi.channel();
+        lease.ip = fromIp(WiFi.localIP());
+        lease.gateway = fromIp(WiFi.gatewayIP());
+        lease.subnet = fromIp(WiFi.subnetMask());
+        lease.dns = fromIp(WiFi.dnsIP());
+        return true;
+    }
+
+    void stop() { WiFi.disconnect(); }
+
+private:
+    static IPAddress toIp(uint32_t v) { return IPAddress(v >> 24, (v >> 16) & 0xFF, (v >> 8) & 0xFF, v & 0xFF); }
+    static uint32_t fromIp(const IPAddress &ip) {
+        return (uint32_t)ip[0] << 24 | (uint32_t)ip[1] << 16 | (uint32_t)ip[2] << 8 | (uint32_t)ip[3];
+    }
+};
+
+// 接続情報の保存先
+// ソフトウェアリセットやウォッチドッグでの再起動ではRTCメモリの写しを使い（NVSを読まない）、
+// 電源を切ったあとはNVSから読む。RTCメモリは電源投入時に不定値なので検査値で確かめる
+RTC_NOINIT_ATTR WifiLease rtcWifiLease;
+
+class NvsWifiLeaseStore {
+public:
+    bool load(WifiLease &lease) {
+        if (wifiLeaseValid(rtcWifiLease)) {
+            lease = rtcWifiLease;
+            return true;
+        }
+        Preferences prefs;
+        if (!prefs.begin("wifi", true)) return false;
+        bool ok = prefs.getBytes("lease", &lease, sizeof(lease)) == sizeof(lease);
+        prefs.end();
+        if (ok && wifiLeaseValid(lease)) rtcWifiLease = lease;
+        return ok;
+    }
+
+    void save(const WifiLease &lease) {
+        rtcWifiLease = lease;
+        Preferences prefs;
+        if (!prefs.begin("wifi", false)) return;
+        prefs.putBytes("lease", &lease, sizeof(lease));
+        prefs.end();
+    }
+};
+
+EspWifiDriver wifiDriver;
+NvsWifiLeaseStore wifiLeaseStore;
+WifiConnection<EspWifiDriver, NvsWifiLeaseStore> wifi(
+    wifiDriver, wifiLeaseStore,
+    {WIFI_FAST_CONNECT_TIMEOUT_MS, WIFI_CONNECT_TIMEOUT_MS, WIFI_BACKOFF_MIN_MS, WIFI_BACKOFF_MAX_MS});
+bool networkServicesStarted = false;
+
+void initWiFi() {
+    // IP取得の回数を数える（2回目以降は再接続）
+    WiFi.onEvent([](WiFiEvent_t, WiFiEventInfo_t) { wifiConnects.fetch_add(1, std::memory_order_relaxed); },
+                 ARDUINO_EVENT_WIFI_STA_GOT_IP);
+
+    // 接続情報は自前で保存し、再接続も状態機械が行う
+    WiFi.persistent(false);
+    WiFi.setAutoReconnect(false);
+    WiFi.mode(WIFI_STA);
+    wifi.begin(millis());
+    Serial.println("Connecting to WiFi...");
+}
+
+// JsonWriterで組み立てた本文を送る
+// 本文はESPAsyncWebServerが保持するため、ヒープ確保は送信時の1回だけになる
+void sendJson(AsyncWebServerRequest *request, int code, const JsonWriter &json) {
+    if (!json.ok()) {
+        request->send(500, "application/json", "{\"error\":\"Response too large\"}");
+        return;
+    }
+    request->send(code, "application/json", json.c_str());
+}
+
+// キューが満杯（503、少し待って再送してもらう）
+void sendQueueFull(AsyncWebServerRequest *request) {
+    AsyncWebServerResponse *response =
+        request->beginResponse(503, "application/json", "{\"success\":false,\"message\":\"Command queue full\"}");
+    response->addHeader("Retry-After", "1");
+    request->send(response);
+}
+
+// 電源操作の受付結果を返す（202 受付 / 503 キュー満杯 / 400 範囲外）
+void sendCommandResponse(AsyncWebServerRequest *request, CommandResult result, int pcIndex,
+                         const char *action, uint32_t durationMs) {
+    if (result == CommandResult::InvalidChannel) {
+        request->send(400, "application/json", "{\"success\":false,\"message\":\"Invalid PC index\"}");
+        return;
+    }
+    if (result == CommandResult::Full) {
+        sendQueueFull(request);
+        return;
+    }
+    char buf[256];
+    JsonWriter json(buf, sizeof(buf));
+    writeCommandAccepted(json, result, pcIndex, PC_NAMES[pcIndex], action, durationMs, powerCommands.depth());
+    sendJson(request, 202, json);
+}
+
+// 全PCの状態（/api/status の本文、SSE接続時のスナップショット）
+void writeStatusJson(JsonWriter &json) {
+    json.beginObject();
+    writeChannelStates(json, pcStates, sensedChannels);
+    json.key("stuck");
+    writeChannelList(json, stuckOutputs.mask());
+    json.key("pressFailed");
+    writeChannelList(json, pressFailed.mask());
+    {
+        std::lock_guard<std::mutex> lock(reconcileMutex);
+        reconciler.writeStatusFields(json);
+    }
+    json.endObject();
+}
+
+// キューに溜まった電源イベントをSSEクライアントへ送る
+void flushPowerEvents() {
+    PowerEvent event;
+    while (powerEventQueue.tryPop(event)) {
+        char buf[128];
+        JsonWriter json(buf, sizeof(buf));
+        writePowerEvent(json, event);
+        events.send(json.c_str(), "power", event.seq);
+    }
+}
+
+// スクレイプ時点のヒープ・WiFi・キューの状態
+SystemGauges readSystemGauges() {
+    SystemGauges gauges;
+    gauges.heapFree = ESP.getFreeHeap();
+    gauges.heapLargestBlock = ESP.getMaxAllocHeap();
+    gauges.heapMinFree = ESP.getMinFreeHeap();
+    gauges.wifiRssi = WiFi.RSSI();
+    uint32_t connects = wifiConnects.load(std::memory_order_relaxed);
+    gauges.wifiReconnects = connects > 0 ? connects - 1 : 0;
+    gauges.wifiBootToReadyMs = wifi.bootToReadyMs();
+    gauges.wifiLastReconnectMs = wifi.lastReconnectMs();
+    gauges.commandQueueDepth = (uint32_t)powerCommands.depth();
+    gauges.eventQueueDepth = (uint32_t)powerEventQueue.size();
+    gauges.stuckOutputs = (uint32_t)stuckOutputs.mask().count();
+    gauges.releaseRetries = releaseRetries.load(std::memory_order_relaxed);
+    gauges.uptimeSeconds = (uint32_t)(DeviceClock::nowUs() / 1000000ULL);
+    return gauges;
+}
+
+// 要求元のIPv4アドレス（監査ログ用）
+uint32_t clientAddress(AsyncWebServerRequest *request) {
+    return ipv4Address(request->client()->remoteIP());
+}
+
+// ---- APIハンドラ（ルート表から呼ばれる） ----
+
+// ルートページ
+// gzip済みのページをフラッシュから直接チャンク送信する（gzipを受け取れないクライアントには 406）
+void handleIndex(AsyncWebServerRequest *request, const RouteParams &) {
+    if (!request->hasHeader("Accept-Encoding") ||
+        !webUiAcceptsGzip(request->getHeader("Accept-Encoding")->value().c_str())) {
+        AsyncWebServerResponse *response = request->beginResponse(406, "text/plain", WEB_UI_GZIP_REQUIRED);
+        response->addHeader("Vary", "Accept-Encoding");
+        request->send(response);
+        return;
+    }
+    if (request->hasHeader("If-None-Match") &&
+        webUiEtagMatches(request->getHeader("If-None-Match")->value().c_str())) {
+        AsyncWebServerResponse *response = request->beginResponse(304);
+        response->addHeader("ETag", WEB_UI_ETAG);
+        response->addHeader("Vary", "Accept-Encoding");
+        request->send(response);
+        return;
+    }
+    AsyncWebServerResponse *response =
+        request->beginResponse_P(200, "text/html; charset=utf-8", WEB_UI_GZ, WEB_UI_GZ_LEN);
+    response->addHeader("Content-Encoding", "gzip");
+    response->addHeader("Vary", "Accept-Encoding");
+    response->addHeader("ETag", WEB_UI_ETAG);
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+}
+
+// API: システム情報取得
+void handleInfo(AsyncWebServerRequest *request, const RouteParams &) {
+    IPAddress ip = WiFi.localIP();
+    char ipStr[16];
+    snprintf(ipStr, sizeof(ipStr), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+
+    char buf[1024];
+    JsonWriter json(buf, sizeof(buf));
+    json.beginObject()
+        .field("ip", ipStr)
+        .field("platform", "ESP32")
+        .field("mode", "実機")
+        .field("numPCs", NUM_PHOTOCOUPLERS)
+        .key("pcNames").beginArray();
+    for (int i = 0; i < NUM_PHOTOCOUPLERS; i++) {
+        json.value(PC_NAMES[i]);
+    }
+    json.endArray().endObject();
+    sendJson(request, 200, json);
+}
+
+// API: PC状態取得
+void handleStatus(AsyncWebServerRequest *request, const RouteParams &) {
+    char buf[statusJsonCapacity<NUM_PHOTOCOUPLERS>()];
+    JsonWriter json(buf, sizeof(buf));
+    writeStatusJson(json);
+    sendJson(request, 200, json);
+}
+
+// API: 電源操作
+void handlePower(AsyncWebServerRequest *request, const RouteParams &params) {
+    int pcIndex = params[0];
+    CommandResult result = pressPowerButton(pcIndex);
+    recordAudit(AuditEvent::Press, auditResultOf(result), AuditSource::Http, pcIndex, PulseKind::Short,
+                clientAddress(request), POWER_PULSE_MS);
+    sendCommandResponse(request, result, pcIndex, " power button press queued", POWER_PULSE_MS);
+}
+
+// クエリまたはフォーム本文のパラメータ（なければ nullptr）
+AsyncWebParameter *findParam(AsyncWebServerRequest *request, const char *name) {
+    if (request->hasParam(name, true)) return request->getParam(name, true);
+    if (request->hasParam(name)) return request->getParam(name);
+    return nullptr;
+}
+
+// API: 一括電源操作（?channels=0,1,2 または ?mask=0x7、任意で ?max=同時押し上限）
+void handlePowerBatch(AsyncWebServerRequest *request, const RouteParams &) {
+    ChannelMask<NUM_PHOTOCOUPLERS> channels;
+    bool valid = false;
+    if (AsyncWebParameter *p = findParam(request, "channels")) {
+        valid = parseChannelList(p->value().c_str(), channels);
+    } else if (AsyncWebParameter *p = findParam(request, "mask")) {
+        valid = parseChannelBitmask(p->value().c_str(), channels);
+    }
+    if (!valid || !channels.any()) {
+        request->send(400, "application/json", "{\"success\":false,\"message\":\"Invalid channel list\"}");
+        return;
+    }
+
+    int maxConcurrent = MAX_CONCURRENT_PULSES;
+    if (AsyncWebParameter *p = findParam(request, "max")) {
+        int requested = p->value().toInt();
+        // 設定値より緩くはできない
+        if (requested > 0 && (maxConcurrent <= 0 || requested < maxConcurrent)) maxConcurrent = requested;
+    }
+
+    BatchSubmitResult<NUM_PHOTOCOUPLERS> result = pressPowerButtonBatch(channels, maxConcurrent);
+    recordBatchAudit(auditResultOf(result.result), AuditSource::Http, clientAddress(request), channels);
+    if (result.result == CommandResult::Full) {
+        sendQueueFull(request);
+        return;
+    }
+    char buf[512];
+    JsonWriter json(buf, sizeof(buf));
+    writeBatchAccepted(json, result, maxConcurrent, POWER_PULSE_MS, powerCommands.depth());
+    sendJson(request, 202, json);
+}
+
+// API: 電源長押し操作（強制シャットダウン）
+void handleLongPress(AsyncWebServerRequest *request, const RouteParams &params) {
+    int pcIndex = params[0];
+    CommandResult result = longPressPowerButtonAsync(pcIndex);
+    recordAudit(AuditEvent::LongPress, auditResultOf(result), AuditSource::Http, pcIndex, PulseKind::Long,
+                clientAddress(request), POWER_LONG_PRESS_MS);
+    sendCommandResponse(request, result, pcIndex, " power button long press queued (forced shutdown)",
+                        POWER_LONG_PRESS_MS);
+}
+
+// API: Prometheus形式のメトリクス（固定長の行バッファからチャンク送信する）
+void handleMetrics(AsyncWebServerRequest *request, const RouteParams &) {
+    MetricsRenderer<NUM_PHOTOCOUPLERS> renderer(httpMetrics, pulseMetrics, readSystemGauges(), PC_NAMES);
+    AsyncWebServerResponse *response = request->beginChunkedResponse(
+        "text/plain; version=0.0.4",
+        [renderer](uint8_t *buffer, size_t maxLen, size_t) mutable -> size_t {
+            return renderer.render((char *)buffer, maxLen);
+        });
+    request->send(response);
+}
+
+// API: 監査ログ（?since=<seq>&limit=<件数>）。数件ずつファイルから読んでチャンク送信する
+void handleAudit(AsyncWebServerRequest *request, const RouteParams &) {
+    uint32_t since = 0;
+    uint32_t limit = 0;
+    if (AsyncWebParameter *p = findParam(request, "since")) since = strtoul(p->value().c_str(), nullptr, 10);
+    if (AsyncWebParameter *p = findParam(request, "limit")) limit = strtoul(p->value().c_str(), nullptr, 10);
+    AuditRenderer<DeviceAuditLog> renderer(auditLog, since, limit);
+    AsyncWebServerResponse *response = request->beginChunkedResponse(
+        "application/json",
+        [renderer](uint8_t *buffer, size_t maxLen, size_t) mutable -> size_t {
+            return renderer.render((char *)buffer, maxLen);
+        });
+    request->send(response);
+}
+
+// API: トレースの書き出し（Chrome Trace Event 形式。Perfetto の Open trace file で開ける）
+// 要求の解析と応答の送信はESPAsyncWebServerの中なので、実機で記録するのはハンドラから先だけ
+void handleTrace(AsyncWebServerRequest *request, const RouteParams &) {
+    TraceRenderer<DeviceTraceBuffer> renderer(traceBuffer, PC_NAMES, NUM_PHOTOCOUPLERS);
+    AsyncWebServerResponse *response = request->beginChunkedResponse(
+        "application/json",
+        [renderer](uint8_t *buffer, size_t maxLen, size_t) mutable -> size_t {
+            return renderer.render((char *)buffer, maxLen);
+        });
+    request->send(response);
+}
+
+// API: トレースの開始・停止（?enabled=1|0）と消去（?clear=1）
+void handleTraceControl(AsyncWebServerRequest *request, const RouteParams &) {
+    if (AsyncWebParameter *p = findParam(request, "enabled")) traceBuffer.setEnabled(p->value() == "1");
+    if (AsyncWebParameter *p = findParam(request, "clear")) {
+        if (p->value() == "1") traceBuffer.clear();
+    }
+    char buf[128];
+    JsonWriter json(buf, sizeof(buf));
+    writeTraceState(json, traceBuffer);
+    sendJson(request, 200, json);
+}
+
+// API: 電源投入プランの一覧と、実行中のプラン
+void handlePlans(AsyncWebServerRequest *request, const RouteParams &) {
+    char buf[1024];
+    JsonWriter json(buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(planMutex);
+    json.beginObject().key("plans").beginArray();
+    for (const PowerPlan &plan : POWER_PLANS) {
+        if (!plan.name) continue;
+        json.beginObject()
+            .field("name", plan.name)
+            .field("steps", plan.stepCount)
+            .field("maxConcurrent", plan.maxConcurrent)
+            .field("readyTimeoutMs", plan.readyTimeoutMs)
+            .endObject();
+    }
+    json.endArray().key("running");
+    if (planRunner.running()) {
+        json.value(planRunner.plan()->name);
+    } else {
+        json.raw("null");
+    }
+    json.endObject();
+    sendJson(request, 200, json);
+}
+
+const PowerPlan *requestedPlan(AsyncWebServerRequest *request, const RouteParams &params) {
+    const PowerPlan *plan = findPowerPlan(POWER_PLANS, request->url().c_str() + params[0], params.lengths[0]);
+    if (!plan) request->send(404, "application/json", "{\"error\":\"Unknown plan\"}");
+    return plan;
+}
+
+// API: プランの進捗（最後に実行したプランでなければ idle）
+void handlePlanStatus(AsyncWebServerRequest *request, const RouteParams &params) {
+    const PowerPlan *plan = requestedPlan(request, params);
+    if (!plan) return;
+    char buf[4096];
+    JsonWriter json(buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(planMutex);
+    if (planRunner.plan() == plan) {
+        planRunner.writeJson(json, millis(), PC_NAMES);
+    } else {
+        json.beginObject().field("plan", plan->name).field("state", "idle").endObject();
+    }
+    sendJson(request, 200, json);
+}
+
+// API: プランの開始（202 開始 / 409 別のプランを実行中か、"sense" のステップに電源LED入力がない）
+void handlePlanStart(AsyncWebServerRequest *request, const RouteParams &params) {
+    const PowerPlan *plan = requestedPlan(request, params);
+    if (!plan) return;
+    char buf[4096];
+    JsonWriter json(buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(planMutex);
+    int badChannel = -1;
+    switch (planRunner.start(*plan, millis(), badChannel)) {
+        case PlanStartResult::Busy:
+            json.beginObject().field("error", "Another plan is running").field("running", planRunner.plan()->name).endObject();
+            sendJson(request, 409, json);
+            return;
+        case PlanStartResult::NoSense:
+            json.beginObject().field("error", "No power sense input for a \"sense\" step").field("channel", badChannel).endObject();
+            sendJson(request, 409, json);
+            return;
+        case PlanStartResult::Started:
+            break;
+    }
+    Serial.printf("Plan %s started\n", plan->name);
+    xTaskNotifyGive(planTaskHandle);
+    planRunner.writeJson(json, millis(), PC_NAMES);
+    sendJson(request, 202, json);
+}
+
+// API: プランの中止（押したPCはそのまま、まだ押していないステップを押さない）
+void handlePlanCancel(AsyncWebServerRequest *request, const RouteParams &params) {
+    const PowerPlan *plan = requestedPlan(request, params);
+    if (!plan) return;
+    char buf[4096];
+    JsonWriter json(buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(planMutex);
+    if (planRunner.plan() != plan || !planRunner.cancel(millis())) {
+        request->send(409, "application/json", "{\"error\":\"Plan is not running\"}");
+        return;
+    }
+    Serial.printf("Plan %s cancelled\n", plan->name);
+    planRunner.writeJson(json, millis(), PC_NAMES);
+    sendJson(request, 200, json);
+}
+
+// API: 予約の一覧と時計の状態
+void handleSchedules(AsyncWebServerRequest *request, const RouteParams &) {
+    char buf[4096];
+    JsonWriter json(buf, sizeof(buf));
+    std::lock_guard<std::mutex> lock(scheduleMutex);
+    scheduler.writeJson(json, DeviceClock::nowUs());
+    sendJson(request, 200, json);
+}
+
+// クエリまたはフォーム本文の値で予約を書き換える（不正なら400を返して false）
+bool applyScheduleRequest(AsyncWebServerRequest *request, DeviceScheduleEntry &entry) {
+    const char *error = applyScheduleParams(entry, [request](const char *name) -> const char * {
+        AsyncWebParameter *p = findParam(request, name);
+        return p ? p->value().c_str() : nullptr;
     });
+    if (!error) return true;
+    char buf[160];
+    JsonWriter json(buf, sizeof(buf));
+    json.beginObject().field("error", error).endObject();
+    sendJson(request, 400, json);
+    return false;
+}
+
+void sendScheduleEntry(AsyncWebServerRequest *request, int code, int id) {
+    char buf[512];
+    JsonWriter json(buf, sizeof(buf));
+    scheduler.writeEntryJson(json, id);
+    sendJson(request, code, json);
+}
+
+// API: 予約の追加（201 追加 / 400 不正な値 / 409 満杯）
+void handleScheduleCreate(AsyncWebServerRequest *request, const RouteParams &) {
+    DeviceScheduleEntry entry = newScheduleEntry<NUM_PHOTOCOUPLERS>();
+    if (!applyScheduleRequest(request, entry)) return;
+    std::lock_guard<std::mutex> lock(scheduleMutex);
+    int id = scheduler.add(entry, DeviceClock::nowUs());
+    if (id < 0) {
+        request->send(409, "application/json", "{\"error\":\"Schedule table full\"}");
+        return;
+    }
+    wakeScheduleTask();
+    sendScheduleEntry(request, 201, id);
+}
+
+void handleScheduleGet(AsyncWebServerRequest *request, const RouteParams &params) {
+    std::lock_guard<std::mutex> lock(scheduleMutex);
+    if (!scheduler.exists(params[0])) {
+        request->send(404, "application/json", "{\"error\":\"Unknown schedule\"}");
+        return;
+    }
+    sendScheduleEntry(request, 200, params[0]);
+}
+
+// API: 予約の変更（渡した項目だけ変わる）
+void handleScheduleUpdate(AsyncWebServerRequest *request, const RouteParams &params) {
+    std::lock_guard<std::mutex> lock(scheduleMutex);
+    if (!scheduler.exists(params[0])) {
+        request->send(404, "application/json", "{\"error\":\"Unknown schedule\"}");
+        return;
+    }
+    DeviceScheduleEntry entry = scheduler.entry(params[0]);
+    if (!applyScheduleRequest(request, entry)) return;
+    scheduler.update(params[0], entry, DeviceClock::nowUs());
+    wakeScheduleTask();
+    sendScheduleEntry(request, 200, params[0]);
+}
+
+void handleScheduleDelete(AsyncWebServerRequest *request, const RouteParams &params) {
+    std::lock_guard<std::mutex> lock(scheduleMutex);
+    if (!scheduler.remove(params[0])) {
+        request->send(404, "application/json", "{\"error\":\"Unknown schedule\"}");
+        return;
+    }
+    char buf[64];
+    JsonWriter json(buf, sizeof(buf));
+    json.beginObject().field("deleted", params[0]).endObject();
+    sendJson(request, 200, json);
+}
+
+void sendStateJson(AsyncWebServerRequest *request, int code, int pcIndex) {
+    char buf[320];
+    JsonWriter json(buf, sizeof(buf));
+    {
+        std::lock_guard<std::mutex> lock(reconcileMutex);
+        reconciler.writeChannelJson(json, pcIndex, millis(), PC_NAMES[pcIndex]);
+    }
+    sendJson(request, code, json);
+}
+
+bool checkStateChannel(AsyncWebServerRequest *request, int pcIndex) {
+    if (pcIndex >= 0 && pcIndex < NUM_PHOTOCOUPLERS) return true;
+    request->send(400, "application/json", "{\"success\":false,\"message\":\"Invalid PC index\"}");
+    return false;
+}
+
+void handleStateGet(AsyncWebServerRequest *request, const RouteParams &params) {
+    if (!checkStateChannel(request, params[0])) return;
+    sendStateJson(request, 200, params[0]);
+}
+
+// API: 目標状態の設定（state=on|off。200 既に合っている / 202 合わせにいく / 400 不正な値 / 409 観測できない）
+// 同じ目標を何度送っても、合っていれば押さない
+void handleStatePut(AsyncWebServerRequest *request, const RouteParams &params) {
+    int pcIndex = params[0];
+    if (!checkStateChannel(request, pcIndex)) return;
+    AsyncWebParameter *param = findParam(request, "state");
+    DesiredPower desired;
+    if (!param || !parseDesiredPower(param->value().c_str(), desired)) {
+        request->send(400, "application/json", "{\"error\":\"state must be on or off\"}");
+        return;
+    }
+    ReconcileSetResult result;
+    ReconcileState state;
+    {
+        std::lock_guard<std::mutex> lock(reconcileMutex);
+        result = reconciler.set(pcIndex, desired, millis());
+        state = reconciler.state(pcIndex);
+    }
+    if (result == ReconcileSetResult::NoObservation) {
+        request->send(409, "application/json", "{\"error\":\"No power sense input or state probe for this PC\"}");
+        return;
+    }
+    xTaskNotifyGive(reconcileTaskHandle);
+    sendStateJson(request, state == ReconcileState::Converged ? 200 : 202, pcIndex);
+}
+
+// API: 目標を外す（以後このPCは押さない）
+void handleStateDelete(AsyncWebServerRequest *request, const RouteParams &params) {
+    if (!checkStateChannel(request, params[0])) return;
+    {
+        std::lock_guard<std::mutex> lock(reconcileMutex);
+        reconciler.set(params[0], DesiredPower::None, millis());
+    }
+    sendStateJson(request, 200, params[0]);
+}
+
+// ルート表（先頭から照合する。リテラルのルートはパラメータ付きより前に置く）
+typedef void (*DeviceRouteHandler)(AsyncWebServerRequest *request, const RouteParams &params);
+
+constexpr RouteEntry<DeviceRouteHandler> API_ROUTES[] = {
+    {HttpMethod::Get,  "/",                  Route::Index,      handleIndex},
+    {HttpMethod::Get,  "/api/info",          Route::Info,       handleInfo},
+    {HttpMethod::Get,  "/api/status",        Route::Status,     handleStatus},
+    {HttpMethod::Get,  "/api/metrics",       Route::Metrics,    handleMetrics},
+    {HttpMethod::Get,  "/api/audit",         Route::Audit,      handleAudit},
+    {HttpMethod::Get,  "/api/trace",         Route::Trace,      handleTrace},
+    {HttpMethod::Post, "/api/trace",         Route::Trace,      handleTraceControl},
+    {HttpMethod::Get,  "/api/plans",         Route::Plan,       handlePlans},
+    {HttpMethod::Get,  "/api/plan/{s}",      Route::Plan,       handlePlanStatus},
+    {HttpMethod::Post, "/api/plan/{s}",      Route::Plan,       handlePlanStart},
+    {HttpMethod::Delete, "/api/plan/{s}",    Route::Plan,       handlePlanCancel},
+    {HttpMethod::Get,  "/api/schedules",     Route::Schedule,   handleSchedules},
+    {HttpMethod::Post, "/api/schedules",     Route::Schedule,   handleScheduleCreate},
+    {HttpMethod::Get,  "/api/schedules/{i}", Route::Schedule,   handleScheduleGet},
+    {HttpMethod::Put,  "/api/schedules/{i}", Route::Schedule,   handleScheduleUpdate},
+    {HttpMethod::Delete, "/api/schedules/{i}", Route::Schedule, handleScheduleDelete},
+    {HttpMethod::Get,  "/api/state/{i}",     Route::State,      handleStateGet},
+    {HttpMethod::Put,  "/api/state/{i}",     Route::State,      handleStatePut},
+    {HttpMethod::Delete, "/api/state/{i}",   Route::State,      handleStateDelete},
+    {HttpMethod::Post, "/api/power/batch",   Route::PowerBatch, handlePowerBatch},
+    {HttpMethod::Post, "/api/power/{i}",     Route::Power,      handlePower},
+    {HttpMethod::Post, "/api/longpress/{i}", Route::LongPress,  handleLongPress},
+};
+static_assert(routeTableValid(API_ROUTES), "API_ROUTES has a malformed pattern");
+
+// ルート表で振り分けるハンドラ（std::regex を使わない）
+class ApiRouter : public AsyncWebHandler {
+public:
+    bool canHandle(AsyncWebServerRequest *request) override {
+        RouteParams params;
+        if (!lookup(request, params)) return false;
+        // 既定ではヘッダーが破棄されるので、ETagの照合に使うものを残す
+        request->addInterestingHeader("If-None-Match");
+        return true;
+    }
+
+    void handleRequest(AsyncWebServerRequest *request) override {
+        RouteParams params;
+        const RouteEntry<DeviceRouteHandler> *route = lookup(request, params);
+        if (!route) return;
+        DeviceRouteTimer timer(httpMetrics, route->metric);
+        TraceScope<DeviceTraceBuffer> span(traceBuffer, TracePoint::HttpHandler, (uint32_t)route->metric);
+        route->handler(request, params);
+    }
+
+    // フォーム本文のパラメータを使うので本文も解析させる
+    bool isRequestHandlerTrivial() override { return false; }
+
+private:
+    static HttpMethod methodOf(AsyncWebServerRequest *request) {
+        switch (request->method()) {
+            case HTTP_GET:    return HttpMethod::Get;
+            case HTTP_POST:   return HttpMethod::Post;
+            case HTTP_PUT:    return HttpMethod::Put;
+            case HTTP_DELETE: return HttpMethod::Delete;
+            default:          return HttpMethod::Other;
+        }
+    }
+
+    static const RouteEntry<DeviceRouteHandler> *lookup(AsyncWebServerRequest *request, RouteParams &params) {
+        const String &url = request->url();
+        return matchRoute(API_ROUTES, methodOf(request), url.c_str(), url.length(), params);
+    }
+};
+
+ApiRouter apiRouter;
+
+// Webサーバのルート設定
+void setupWebServer() {
+    server.addHandler(&apiRouter);
     
-    // API: 電源長押し操作（強制シャットダウン）
-    server.on(R"(^/api/longpress/([0-9]+)$)", HTTP_POST, [](AsyncWebServerRequest *request) {
-        String pcIndexStr = request->pathArg(0);
-        int pcIndex = pcIndexStr.toInt();
-        
-        if (pcIndex >= 0 && pcIndex < NUM_PHOTOCOUPLERS) {
-            longPressPowerButtonAsync(pcIndex);
-            
-            String json = "{";
-            json += "\"success\":true,";
-            json += "\"message\":\"" + String(PC_NAMES[pcIndex]) + " power button long press queued (forced shutdown)\",";
-            json += "\"pcIndex\":" + String(pcIndex) + ",";
-            json += "\"duration\":" + String(POWER_LONG_PRESS_MS);
-            json += "}";
-            
-            request->send(200, "application/json", json);
-        } else {
-            String json = "{\"success\":false,\"message\":\"Invalid PC index\"}";
-            request->send(400, "application/json", json);
+    // API: 状態変化のプッシュ配信（接続時に現在の状態を送る）
+    events.onConnect([](AsyncEventSourceClient *client) {
+        DeviceRouteTimer timer(httpMetrics, Route::Events);
+        char buf[statusJsonCapacity<NUM_PHOTOCOUPLERS>()];
+        JsonWriter json(buf, sizeof(buf));
+        writeStatusJson(json);
+        if (!json.ok()) {
+            Serial.println("Status snapshot too large, not sent");
+            return;
         }
+        client->send(json.c_str(), "status", nextPowerEventSeq());
     });
+    server.addHandler(&events);
     
     // 404エラー
     server.onNotFound([](AsyncWebServerRequest *request) {
+        DeviceRouteTimer timer(httpMetrics, Route::NotFound);
         request->send(404, "application/json", "{\"error\":\"Not found\"}");
     });
     
@@ -190,30 +1442,62 @@ void setupWebServer() {
     Serial.println("Web server started");
 }
 
+// 最初につながったときに、ネットワークを使う機能を起動する
+void startNetworkServices() {
+    setupWebServer();
+    initWakeOnLan();
+    initUdpCommand();
+    configTime(0, 0, NTP_SERVER);
+    networkServicesStarted = true;
+    Serial.println("\nSystem ready!");
+    Serial.print("Access: http://");
+    Serial.println(WiFi.localIP());
+}
+
+// loop() から呼ぶ
+void pollWiFi() {
+    switch (wifi.poll(millis())) {
+        case WifiEvent::Ready:
+            Serial.printf("WiFi connected in %lu ms, IP ",
+                          (unsigned long)(networkServicesStarted ? wifi.lastReconnectMs() : wifi.bootToReadyMs()));
+            Serial.println(WiFi.localIP());
+            if (!networkServicesStarted) startNetworkServices();
+            break;
+        case WifiEvent::Lost:
+            Serial.println("WiFi connection lost, reconnecting");
+            break;
+        case WifiEvent::None:
+            break;
+    }
+}
+
 void setup() {
     Serial.begin(115200);
-    delay(1000);
     
     Serial.println("\n=================================");
     Serial.println("PC Power Control with ESP32");
     Serial.println("=================================\n");
     
+    // 監査ログ（パルスの記録より先に開く）
+    initAuditLog();
+    traceBuffer.setEnabled(TRACE_ENABLED_AT_BOOT);
+
     // フォトカプラ初期化
     initPhotocouplers();
+    initPowerSense();
+    initCommandWorker();
+    initPlanRunner();
+    initScheduler();
+    initReconciler();
     
-    // Wi-Fi接続
-    connectWiFi();
-    
-    // Webサーバ起動
-    if (WiFi.status() == WL_CONNECTED) {
-        setupWebServer();
-        Serial.println("\nSystem ready!");
-        Serial.print("Access: http://");
-        Serial.println(WiFi.localIP());
-    }
+    // Wi-Fi接続（つながったら pollWiFi() がWebサーバ等を起動する）
+    initWiFi();
 }
 
 void loop() {
-    // メインループは空（AsyncWebServerが非同期で動作）
-    delay(100);
+    // HTTPはAsyncWebServerが非同期で処理する。ここではWiFiの再接続、SSEイベントの送出と監査ログの書き込みを行う
+    pollWiFi();
+    flushPowerEvents();
+    pumpAuditLog();
+    delay(10);
 }
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# Web UI (shared/web/index.html) をgzip圧縮してCヘッダーに埋め込む
+#
+# PlatformIOのビルド前スクリプト（extra_scripts = pre:tools/embed_web_ui.py）として、
+# またはシミュレータのビルド前に単体で実行する：
+#   python3 tools/embed_web_ui.py
+#
+# 出力: shared/web_ui_gz.h
+#   WEB_UI_GZ[]   gzip済みページ（実機ではPROGMEMに配置）
+#   WEB_UI_GZ_LEN バイト数
+#   WEB_UI_ETAG   圧縮後データのSHA-256から作る強いETag
+
+import gzip
+import hashlib
+import os
+
+try:
+    Import("env")  # noqa: F821  PlatformIOから実行された場合
+    ROOT = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+SOURCE = os.path.join(ROOT, "shared", "web", "index.html")
+OUTPUT = os.path.join(ROOT, "shared", "web_ui_gz.h")
+
+
+def render(data):
+    # mtime=0 で毎回同じバイト列にする（ETagとビルドの再現性のため）
+    blob = gzip.compress(data, compresslevel=9, mtime=0)
+    etag = hashlib.sha256(blob).hexdigest()[:16]
+
+    lines = [
+        "#pragma once",
+        "",
+        "// このファイルは tools/embed_web_ui.py が生成する。直接編集しないこと。",
+        "// 元データ: shared/web/index.html (%d bytes -> gzip %d bytes)" % (len(data), len(blob)),
+        "",
+        "#include <stddef.h>",
+        "#include <stdint.h>",
+        "",
+        "#ifndef PROGMEM",
+        "#define PROGMEM",
+        "#endif",
+        "",
+        "#define WEB_UI_ETAG \"\\\"%s\\\"\"" % etag,
+        "",
+        "static const size_t WEB_UI_GZ_LEN = %d;" % len(blob),
+        "",
+        "static const uint8_t WEB_UI_GZ[] PROGMEM = {",
+    ]
+    for i in range(0, len(blob), 16):
+        chunk = blob[i:i + 16]
+        lines.append("    " + ", ".join("0x%02x" % b for b in chunk) + ",")
+    lines.append("};")
+    lines.append("")
+    return "\n".join(lines)
+
+
+def main():
+    with open(SOURCE, "rb") as f:
+        header = render(f.read())
+
+    # 内容が変わらない場合は書き換えず、不要な再ビルドを避ける
+    if os.path.exists(OUTPUT):
+        with open(OUTPUT, "r", encoding="utf-8") as f:
+            if f.read() == header:
+                return
+    with open(OUTPUT, "w", encoding="utf-8") as f:
+        f.write(header)
+    print("Generated %s" % os.path.relpath(OUTPUT, ROOT))
+
+
+main()
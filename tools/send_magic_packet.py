@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+"""Wake-on-LAN マジックパケットを送る（実機・シミュレータの動作確認用）
+
+使い方:
+  python3 tools/send_magic_packet.py 02:00:00:00:00:01
+  python3 tools/send_magic_packet.py 02:00:00:00:00:01 --host 127.0.0.1 --port 40009 --count 3
+"""
+import argparse
+import socket
+import sys
+import time
+
+
+def magic_packet(mac):
+    digits = mac.replace(":", "").replace("-", "")
+    if len(digits) != 12:
+        raise ValueError("invalid MAC address: " + mac)
+    target = bytes.fromhex(digits)
+    return b"\xff" * 6 + target * 16
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Send Wake-on-LAN magic packets")
+    parser.add_argument("mac", help="target MAC address (aa:bb:cc:dd:ee:ff)")
+    parser.add_argument("--host", default="255.255.255.255", help="destination address (default: broadcast)")
+    parser.add_argument("--port", type=int, default=9, help="destination UDP port (default: 9)")
+    parser.add_argument("--count", type=int, default=1, help="number of packets, like WoL tools that retry")
+    parser.add_argument("--interval", type=float, default=0.1, help="seconds between packets")
+    args = parser.parse_args()
+
+    try:
+        packet = magic_packet(args.mac)
+    except ValueError as e:
+        print(e, file=sys.stderr)
+        return 1
+
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as sock:
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_BROADCAST, 1)
+        for i in range(args.count):
+            if i > 0:
+                time.sleep(args.interval)
+            sock.sendto(packet, (args.host, args.port))
+    print("sent %d magic packet(s) for %s to %s:%d" % (args.count, args.mac, args.host, args.port))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""認証付きUDP制御プロトコルで電源ボタンを押す（shared/udp_command.h と同じ形式）
+
+使い方:
+  python3 tools/send_udp_command.py --key secret 0 2
+  python3 tools/send_udp_command.py --key secret --host 127.0.0.1 --port 7770 --long 1
+
+ACKが届かなければ同じ要求（同じ nonce）を再送する。処理済みなら "replay" が返る。
+"""
+import argparse
+import hashlib
+import hmac
+import os
+import socket
+import struct
+import sys
+import time
+
+VERSION = 1
+STATUS_NAMES = {0: "ok", 1: "partial", 2: "replay", 3: "bad_request"}
+
+
+def build_request(key, action, client_id, nonce, channels):
+    body = b"PC" + struct.pack("<BBIQQ", VERSION, action, client_id, nonce, channels)
+    return body + hmac.new(key, body, hashlib.sha256).digest()
+
+
+def parse_ack(key, data):
+    if len(data) != 52 or data[:2] != b"PC":
+        return None
+    tag = hmac.new(key, data[:36], hashlib.sha256).digest()[:16]
+    if not hmac.compare_digest(tag, data[36:]):
+        return None
+    _, _, client_id, nonce, status, depth, _, accepted, rejected = struct.unpack("<BBIQBBHQQ", data[2:36])
+    return {"nonce": nonce, "status": status, "depth": depth, "accepted": accepted, "rejected": rejected}
+
+
+def channel_list(mask):
+    return [i for i in range(64) if mask >> i & 1]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Press power buttons over the authenticated UDP protocol")
+    parser.add_argument("channels", type=int, nargs="+", help="channel numbers (0-63)")
+    parser.add_argument("--key", required=True, help="shared key (UDP_COMMAND_KEY)")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=7770)
+    parser.add_argument("--long", action="store_true", help="long press (forced shutdown)")
+    parser.add_argument("--client-id", type=int, default=None, help="default: derived from the process id")
+    parser.add_argument("--retries", type=int, default=3)
+    parser.add_argument("--timeout", type=float, default=0.5, help="seconds to wait for each ack")
+    args = parser.parse_args()
+
+    if any(ch < 0 or ch >= 64 for ch in args.channels):
+        print("channels must be 0-63", file=sys.stderr)
+        return 1
+    key = args.key.encode()
+    client_id = args.client_id if args.client_id is not None else (os.getpid() * 2654435761) & 0xFFFFFFFF
+    nonce = time.time_ns() // 1000
+    mask = 0
+    for ch in args.channels:
+        mask |= 1 << ch
+    packet = build_request(key, 2 if args.long else 1, client_id, nonce, mask)
+
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as sock:
+        sock.settimeout(args.timeout)
+        for attempt in range(args.retries + 1):
+            start = time.perf_counter()
+            sock.sendto(packet, (args.host, args.port))
+            try:
+                while True:
+                    data, _ = sock.recvfrom(512)
+                    ack = parse_ack(key, data)
+                    if ack and ack["nonce"] == nonce:
+                        break
+            except socket.timeout:
+                continue
+            rtt_us = (time.perf_counter() - start) * 1e6
+            print("%s in %.0f us (attempt %d): accepted %s, rejected %s, queue depth %d" % (
+                STATUS_NAMES.get(ack["status"], ack["status"]), rtt_us, attempt + 1,
+                channel_list(ack["accepted"]), channel_list(ack["rejected"]), ack["depth"]))
+            return 0 if ack["status"] in (0, 2) else 1
+    print("no ack from %s:%d (wrong key or port?)" % (args.host, args.port), file=sys.stderr)
+    return 2
+
+
+if __name__ == "__main__":
+    sys.exit(main())